@@ -0,0 +1,38 @@
+/*
+ * Copyright (C) 2018 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <iostream>
+
+#include <vhal_v2_0/JsonFakeValueGenerator.h>
+
+using namespace android::hardware::automotive::vehicle::V2_0;
+
+// Pre-compiles JSON fake value trace into the binary format replayed by JsonFakeValueGenerator.
+int main(int argc, char* argv[]) {
+    if (argc != 3) {
+        std::cerr << "Usage: " << argv[0] << " <trace.json> <output.trace>" << std::endl;
+        return 1;
+    }
+
+    int events = impl::JsonFakeValueGenerator::compileTrace(argv[1], argv[2]);
+    if (events < 0) {
+        std::cerr << "Failed to compile " << argv[1] << std::endl;
+        return 1;
+    }
+
+    std::cout << "Compiled " << events << " events into " << argv[2] << std::endl;
+    return 0;
+}
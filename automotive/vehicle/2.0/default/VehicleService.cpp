@@ -27,9 +27,12 @@ using namespace android;
 using namespace android::hardware;
 using namespace android::hardware::automotive::vehicle::V2_0;
 
+// Last known property values, restored on start over the defaults.
+static constexpr char kPropertyStoreSnapshotPath[] = "/data/vendor/vehicle/property_store.snapshot";
+
 int main(int /* argc */, char* /* argv */ []) {
     auto store = std::make_unique<VehiclePropertyStore>();
-    auto hal = std::make_unique<impl::EmulatedVehicleHal>(store.get());
+    auto hal = std::make_unique<impl::EmulatedVehicleHal>(store.get(), kPropertyStoreSnapshotPath);
     auto emulator = std::make_unique<impl::VehicleEmulator>(hal.get());
     auto service = std::make_unique<VehicleHalManager>(hal.get());
 
@@ -22,6 +22,9 @@
 #include <thread>
 #include <condition_variable>
 #include <iostream>
+#include <memory>
+#include <unordered_map>
+#include <vector>
 
 namespace android {
 
@@ -37,16 +40,20 @@ public:
 
     std::vector<T> flush() {
         std::vector<T> items;
+        flush(&items);
+        return items;
+    }
 
+    /* Moves all queued items to the end of provided vector, so callers can reuse its storage. */
+    void flush(std::vector<T>* items) {
         MuxGuard g(mLock);
         if (mQueue.empty() || !mIsActive) {
-            return items;
+            return;
         }
         while (!mQueue.empty()) {
-            items.push_back(std::move(mQueue.front()));
+            items->push_back(std::move(mQueue.front()));
             mQueue.pop();
         }
-        return items;
     }
 
     void push(T&& item) {
@@ -84,7 +91,249 @@ private:
     std::queue<T> mQueue;
 };
 
+struct QueueStats {
+    size_t depth;       // Number of items currently in the queue (approximate).
+    size_t maxDepth;    // Highest observed depth.
+    uint64_t pushed;    // Items accepted by push().
+    uint64_t dropped;   // Items discarded because the queue was full.
+    uint64_t coalesced; // Items discarded by flush() because a newer item had the same key.
+};
+
+/**
+ * Bounded multi-producer multi-consumer queue backed by a lock-free ring buffer.
+ *
+ * Producers never take a lock, unless a consumer is blocked in waitForItems() and needs to be
+ * woken up. When the ring is full the oldest item is discarded to make room for the new one.
+ *
+ * With OverflowPolicy::COALESCE_BY_KEY, flush() additionally keeps only the newest item for every
+ * key returned by the key function, preserving relative order of the remaining items. Coalescing
+ * uses internal state, thus flush() must not be called concurrently from several threads in this
+ * mode.
+ */
 template<typename T>
+class RingConcurrentQueue {
+public:
+    enum class OverflowPolicy {
+        DROP_OLDEST = 0,
+        COALESCE_BY_KEY = 1,
+    };
+
+    using KeyFunc = std::function<int64_t(const T& item)>;
+
+    /* Capacity is rounded up to the next power of two. */
+    RingConcurrentQueue(size_t capacity,
+                        OverflowPolicy policy = OverflowPolicy::DROP_OLDEST,
+                        const KeyFunc& keyFunc = nullptr)
+        : mCapacity(roundUpToPowerOfTwo(capacity)),
+          mMask(mCapacity - 1),
+          mCells(new Cell[mCapacity]),
+          mPolicy(keyFunc != nullptr ? policy : OverflowPolicy::DROP_OLDEST),
+          mKeyFunc(keyFunc) {
+        for (size_t i = 0; i < mCapacity; i++) {
+            mCells[i].sequence.store(i, std::memory_order_relaxed);
+        }
+    }
+
+    RingConcurrentQueue(const RingConcurrentQueue &) = delete;
+    RingConcurrentQueue &operator=(const RingConcurrentQueue &) = delete;
+
+    void waitForItems() {
+        std::unique_lock<std::mutex> g(mLock);
+        mWaiters.fetch_add(1);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        while (isEmpty() && mIsActive) {
+            mCond.wait(g);
+        }
+        mWaiters.fetch_sub(1);
+    }
+
+    std::vector<T> flush() {
+        std::vector<T> items;
+        flush(&items);
+        return items;
+    }
+
+    /* Moves all queued items to the end of provided vector, so callers can reuse its storage. */
+    void flush(std::vector<T>* items) {
+        if (!mIsActive) {
+            return;
+        }
+        size_t first = items->size();
+        T item;
+        while (tryPop(&item)) {
+            items->push_back(std::move(item));
+        }
+        if (mPolicy == OverflowPolicy::COALESCE_BY_KEY && items->size() - first > 1) {
+            coalesce(items, first);
+        }
+    }
+
+    void push(T&& item) {
+        if (!mIsActive) {
+            return;
+        }
+        while (!tryPush(std::move(item))) {
+            // Full, discard the oldest item to make room. tryPush doesn't touch the item on
+            // failure, so it is safe to retry.
+            T dropped;
+            if (tryPop(&dropped)) {
+                mDropped.fetch_add(1, std::memory_order_relaxed);
+            }
+        }
+        mPushed.fetch_add(1, std::memory_order_relaxed);
+        updateMaxDepth();
+
+        // Pairs with the fence in waitForItems: either the consumer sees the new item or we see
+        // the waiter. Notify under the lock so the wake-up can't be lost.
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (mWaiters.load() > 0) {
+            std::lock_guard<std::mutex> g(mLock);
+            mCond.notify_one();
+        }
+    }
+
+    /* Deactivates the queue, thus no one can push items to it, also
+     * notifies all waiting thread.
+     */
+    void deactivate() {
+        {
+            std::lock_guard<std::mutex> g(mLock);
+            mIsActive = false;
+        }
+        mCond.notify_all();  // To unblock all waiting consumers.
+    }
+
+    QueueStats getStats() const {
+        return QueueStats {
+            .depth = getDepth(),
+            .maxDepth = mMaxDepth.load(std::memory_order_relaxed),
+            .pushed = mPushed.load(std::memory_order_relaxed),
+            .dropped = mDropped.load(std::memory_order_relaxed),
+            .coalesced = mCoalesced.load(std::memory_order_relaxed),
+        };
+    }
+
+    size_t capacity() const { return mCapacity; }
+
+private:
+    // Each cell carries a sequence number that tells whether it is ready for the producer or for
+    // the consumer at a given position, see D. Vyukov's bounded MPMC queue.
+    struct Cell {
+        std::atomic<size_t> sequence;
+        T item;
+    };
+
+    static size_t roundUpToPowerOfTwo(size_t n) {
+        size_t result = 2;
+        while (result < n) result <<= 1;
+        return result;
+    }
+
+    bool isEmpty() const {
+        return getDepth() == 0;
+    }
+
+    size_t getDepth() const {
+        size_t tail = mDequeuePos.load(std::memory_order_acquire);
+        size_t head = mEnqueuePos.load(std::memory_order_acquire);
+        return head > tail ? head - tail : 0;
+    }
+
+    bool tryPush(T&& item) {
+        Cell* cell;
+        size_t pos = mEnqueuePos.load(std::memory_order_relaxed);
+        for (;;) {
+            cell = &mCells[pos & mMask];
+            size_t seq = cell->sequence.load(std::memory_order_acquire);
+            intptr_t diff = static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos);
+            if (diff == 0) {
+                if (mEnqueuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    break;
+                }
+            } else if (diff < 0) {
+                return false;  // Full.
+            } else {
+                pos = mEnqueuePos.load(std::memory_order_relaxed);
+            }
+        }
+        cell->item = std::move(item);
+        cell->sequence.store(pos + 1, std::memory_order_release);
+        return true;
+    }
+
+    bool tryPop(T* item) {
+        Cell* cell;
+        size_t pos = mDequeuePos.load(std::memory_order_relaxed);
+        for (;;) {
+            cell = &mCells[pos & mMask];
+            size_t seq = cell->sequence.load(std::memory_order_acquire);
+            intptr_t diff = static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos + 1);
+            if (diff == 0) {
+                if (mDequeuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    break;
+                }
+            } else if (diff < 0) {
+                return false;  // Empty.
+            } else {
+                pos = mDequeuePos.load(std::memory_order_relaxed);
+            }
+        }
+        *item = std::move(cell->item);
+        cell->sequence.store(pos + mMask + 1, std::memory_order_release);
+        return true;
+    }
+
+    void updateMaxDepth() {
+        size_t depth = getDepth();
+        size_t maxDepth = mMaxDepth.load(std::memory_order_relaxed);
+        while (depth > maxDepth
+               && !mMaxDepth.compare_exchange_weak(maxDepth, depth, std::memory_order_relaxed)) {}
+    }
+
+    /* Keeps only the newest item per key in items[first..end). */
+    void coalesce(std::vector<T>* items, size_t first) {
+        mLastIndexForKey.clear();
+        for (size_t i = first; i < items->size(); i++) {
+            mLastIndexForKey[mKeyFunc((*items)[i])] = i;
+        }
+        size_t out = first;
+        for (size_t i = first; i < items->size(); i++) {
+            if (mLastIndexForKey[mKeyFunc((*items)[i])] == i) {
+                if (out != i) {
+                    (*items)[out] = std::move((*items)[i]);
+                }
+                out++;
+            }
+        }
+        mCoalesced.fetch_add(items->size() - out, std::memory_order_relaxed);
+        items->resize(out);
+    }
+
+private:
+    const size_t mCapacity;
+    const size_t mMask;
+    const std::unique_ptr<Cell[]> mCells;
+    const OverflowPolicy mPolicy;
+    const KeyFunc mKeyFunc;
+
+    // Producer and consumer positions are on separate cache lines to avoid false sharing.
+    alignas(64) std::atomic<size_t> mEnqueuePos { 0 };
+    alignas(64) std::atomic<size_t> mDequeuePos { 0 };
+
+    std::atomic<bool> mIsActive { true };
+    std::atomic<int> mWaiters { 0 };
+    std::mutex mLock;  // Only used to block consumers waiting for items.
+    std::condition_variable mCond;
+
+    std::atomic<size_t> mMaxDepth { 0 };
+    std::atomic<uint64_t> mPushed { 0 };
+    std::atomic<uint64_t> mDropped { 0 };
+    std::atomic<uint64_t> mCoalesced { 0 };
+
+    std::unordered_map<int64_t, size_t> mLastIndexForKey;  // Only used by flush().
+};
+
+template<typename T, typename Queue = ConcurrentQueue<T>>
 class BatchingConsumer {
 private:
     enum class State {
@@ -102,14 +351,14 @@ public:
 
     using OnBatchReceivedFunc = std::function<void(const std::vector<T>& vec)>;
 
-    void run(ConcurrentQueue<T>* queue,
+    void run(Queue* queue,
              std::chrono::nanoseconds batchInterval,
              const OnBatchReceivedFunc& func) {
         mQueue = queue;
         mBatchInterval = batchInterval;
 
         mWorkerThread = std::thread(
-            &BatchingConsumer<T>::runInternal, this, func);
+            &BatchingConsumer<T, Queue>::runInternal, this, func);
     }
 
     void requestStop() {
@@ -132,11 +381,13 @@ private:
                 std::this_thread::sleep_for(mBatchInterval);
                 if (State::STOP_REQUESTED == mState) break;
 
-                std::vector<T> items = mQueue->flush();
+                // Reuse the same vector for every batch to avoid reallocating its storage.
+                mQueue->flush(&mItems);
 
-                if (items.size() > 0) {
-                    onBatchReceived(items);
+                if (mItems.size() > 0) {
+                    onBatchReceived(mItems);
                 }
+                mItems.clear();
             }
         }
 
@@ -148,7 +399,8 @@ private:
 
     std::atomic<State> mState;
     std::chrono::nanoseconds mBatchInterval;
-    ConcurrentQueue<T>* mQueue;
+    Queue* mQueue;
+    std::vector<T> mItems;  // Only accessed from mWorkerThread.
 };
 
 }  // namespace android
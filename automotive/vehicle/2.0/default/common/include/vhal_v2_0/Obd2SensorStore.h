@@ -17,6 +17,9 @@
 #ifndef android_hardware_automotive_vehicle_V2_0_Obd2SensorStore_H_
 #define android_hardware_automotive_vehicle_V2_0_Obd2SensorStore_H_
 
+#include <sys/types.h>
+
+#include <string>
 #include <vector>
 
 #include <android/hardware/automotive/vehicle/2.0/types.h>
@@ -31,10 +34,26 @@ namespace V2_0 {
 // It allows storing sensor values, setting appropriate bitmasks as needed,
 // and returning appropriately laid out storage of sensor values suitable
 // for being returned via a VehicleHal implementation.
+//
+// Frames are double-buffered: setters update sensor values and mark changed
+// sensors as dirty, while readers get the frame as of the last publishFrame().
+// Publishing re-encodes only the dirty sensors into the frame, so a frame that
+// is read much more often than it changes costs a plain copy. The frame keeps
+// the timestamp of its last change, not of the read.
+//
+// The store also keeps a bounded ring of freeze frames captured from the
+// published frame. Once the ring is full, capturing a new freeze frame drops
+// the oldest one. Removing a freeze frame compacts the ring. Slots are reused,
+// so neither capturing nor removing allocates memory.
+//
+// This class is not thread-safe.
 class Obd2SensorStore {
    public:
+    static constexpr size_t kDefaultMaxFreezeFrames = 16;
+
     // Creates a sensor storage with a given number of vendor-specific sensors.
-    Obd2SensorStore(size_t numVendorIntegerSensors, size_t numVendorFloatSensors);
+    Obd2SensorStore(size_t numVendorIntegerSensors, size_t numVendorFloatSensors,
+                    size_t maxFreezeFrames = kDefaultMaxFreezeFrames);
 
     // Stores an integer-valued sensor.
     StatusCode setIntegerSensor(DiagnosticIntegerSensorIndex index, int32_t value);
@@ -46,33 +65,98 @@ class Obd2SensorStore {
     // Stores a float-valued sensor.
     StatusCode setFloatSensor(size_t index, float value);
 
-    // Returns a vector that contains all integer sensors stored.
+    // Replaces the frame with the given one: only sensors marked as present in
+    // its bitmask are present afterwards. The frame's timestamp is kept, or
+    // the current time is used if it has none.
+    StatusCode setSensors(const VehiclePropValue& frame);
+
+    // Re-encodes sensors that have changed since the last call into the frame.
+    // Returns number of re-encoded sensors.
+    size_t publishFrame();
+
+    // Returns a vector that contains all integer sensors of the published frame.
     const std::vector<int32_t>& getIntegerSensors() const;
-    // Returns a vector that contains all float sensors stored.
+    // Returns a vector that contains all float sensors of the published frame.
     const std::vector<float>& getFloatSensors() const;
-    // Returns a vector that contains a bitmask for all stored sensors.
+    // Returns a vector that contains a bitmask for all sensors of the published frame.
     const std::vector<uint8_t>& getSensorsBitmask() const;
 
-    // Given a stringValue, fill in a VehiclePropValue
-    void fillPropValue(const std::string& dtc, VehiclePropValue* propValue) const;
+    // Publishes pending changes and fills in a VehiclePropValue with the frame.
+    void fillPropValue(const std::string& dtc, VehiclePropValue* propValue);
+
+    // Publishes pending changes and stores the frame as a freeze frame with the
+    // given DTC. Returns timestamp of the freeze frame which identifies it.
+    int64_t captureFreezeFrame(const std::string& dtc);
+    // Stores the given frame as a freeze frame, e.g. one injected by the emulator. The frame's
+    // timestamp identifies it, so a freeze frame with the same timestamp is replaced. Frames
+    // without a timestamp are stamped like captured ones.
+    StatusCode addFreezeFrame(const VehiclePropValue& frame);
+    // Fills in a VehiclePropValue with the freeze frame with given timestamp.
+    StatusCode fillFreezeFrame(int64_t timestamp, VehiclePropValue* propValue) const;
+    // Returns timestamps of stored freeze frames, from the oldest to the newest.
+    std::vector<int64_t> getFreezeFrameTimestamps() const;
+    // Removes the freeze frame with given timestamp.
+    StatusCode removeFreezeFrame(int64_t timestamp);
+    void clearFreezeFrames();
 
    private:
-    class BitmaskInVector {
+    // Bitset packed into 64-bit words, so that set bits can be visited
+    // a word at a time.
+    class PackedBitset {
        public:
-        BitmaskInVector(size_t numBits = 0);
+        PackedBitset(size_t numBits = 0);
         void resize(size_t numBits);
         bool get(size_t index) const;
         void set(size_t index, bool value);
+        void clear();
 
-        const std::vector<uint8_t>& getBitmask() const;
+        // Calls fn(index) for every set bit, in increasing order.
+        template <typename Fn>
+        void forEachSet(Fn fn) const;
 
        private:
-        std::vector<uint8_t> mStorage;
+        std::vector<uint64_t> mWords;
     };
 
+    struct Frame {
+        int64_t timestamp = 0;
+        std::string dtc;
+        std::vector<int32_t> integerSensors;
+        std::vector<float> floatSensors;
+        std::vector<uint8_t> bitmask;
+    };
+
+    void fillPropValue(const Frame& frame, VehiclePropValue* propValue) const;
+    // Returns a unique timestamp for a new freeze frame.
+    int64_t nextFreezeFrameTimestamp();
+    // Makes room for a new freeze frame and returns n of its slot.
+    size_t appendFreezeFrame();
+    // Returns the slot with the n-th oldest freeze frame.
+    Frame& freezeFrameAt(size_t n);
+    const Frame& freezeFrameAt(size_t n) const;
+    // Returns n such that freezeFrameAt(n) has given timestamp or -1 if there is none.
+    ssize_t findFreezeFrame(int64_t timestamp) const;
+
+    // Back buffer: latest sensor values and sensors changed since the last publish.
     std::vector<int32_t> mIntegerSensors;
     std::vector<float> mFloatSensors;
-    BitmaskInVector mSensorsBitmask;
+    PackedBitset mSensorsPresent;
+    PackedBitset mDirtySensors;
+    int64_t mTimestamp = 0;
+    bool mDirty = false;
+    // All sensors were removed since the last publish, the frame must be cleared
+    // before the dirty sensors are re-encoded.
+    bool mReset = false;
+
+    // Front buffer: the published frame.
+    Frame mFrame;
+
+    // Freeze frame slots, mNumFreezeFrames of them starting at mFirstFreezeFrame
+    // hold freeze frames from the oldest to the newest, the rest are free.
+    std::vector<Frame> mFreezeFrames;
+    size_t mFirstFreezeFrame = 0;
+    size_t mNumFreezeFrames = 0;
+    int64_t mLastFreezeFrameTimestamp = 0;
 };
 
 }  // namespace V2_0
@@ -17,8 +17,10 @@
 #ifndef android_hardware_automotive_vehicle_V2_0_RecurrentTimer_H_
 #define android_hardware_automotive_vehicle_V2_0_RecurrentTimer_H_
 
+#include <algorithm>
 #include <atomic>
 #include <chrono>
+#include <cstdint>
 #include <condition_variable>
 #include <functional>
 #include <list>
@@ -31,6 +33,11 @@
 /**
  * This class allows to specify multiple time intervals to receive
  * notifications. A single thread is used internally.
+ *
+ * Events are kept in a hierarchical timing wheel with kWheelLevels levels of kWheelSlots slots,
+ * the first level has a slot per tick (resolution provided in the constructor, 1ms by default).
+ * Registering and unregistering an event is O(1), a wake-up only touches the slots that are due.
+ * All events falling into the same tick are reported in a single action call.
  */
 class RecurrentTimer {
 private:
@@ -40,7 +47,16 @@ private:
 public:
     using Action = std::function<void(const std::vector<int32_t>& cookies)>;
 
-    RecurrentTimer(const Action& action) : mAction(action) {
+    struct Stats {
+        uint64_t wakeups;      // Number of times the timer thread woke up.
+        uint64_t firedEvents;  // Number of events reported to the action.
+        Nanos maxLateness;     // Largest delay between event's deadline and its firing.
+        Nanos totalLateness;   // Sum of delays, divide by firedEvents to get the average.
+    };
+
+    RecurrentTimer(const Action& action, Nanos resolution = std::chrono::milliseconds(1))
+            : mResolution(resolution), mEpoch(alignToResolution(Clock::now(), resolution)),
+              mAction(action) {
         mTimerThread = std::thread(&RecurrentTimer::loop, this, action);
     }
 
@@ -61,7 +77,15 @@ public:
 
         {
             std::lock_guard<std::mutex> g(mLock);
-            mCookieToEventsMap[cookie] = { interval, cookie, absoluteTime };
+            RecurrentEvent& event = mCookieToEventsMap[cookie];
+            if (event.isScheduled()) {
+                unscheduleLocked(&event);
+            }
+            event.interval = interval;
+            event.cookie = cookie;
+            event.absoluteTime = absoluteTime;
+            event.registeredTime = now;
+            scheduleLocked(&event);
         }
         mCond.notify_one();
     }
@@ -69,18 +93,42 @@ public:
     void unregisterRecurrentEvent(int32_t cookie) {
         {
             std::lock_guard<std::mutex> g(mLock);
-            mCookieToEventsMap.erase(cookie);
+            auto it = mCookieToEventsMap.find(cookie);
+            if (it == mCookieToEventsMap.end()) return;
+            unscheduleLocked(&it->second);
+            mCookieToEventsMap.erase(it);
         }
         mCond.notify_one();
     }
 
+    Stats getStats() const {
+        std::lock_guard<std::mutex> g(mLock);
+        return mStats;
+    }
 
 private:
+    static constexpr int kWheelLevels = 4;
+    static constexpr int kSlotBits = 6;
+    static constexpr int kWheelSlots = 1 << kSlotBits;  // Must match bitmap width.
+    static constexpr uint64_t kSlotMask = kWheelSlots - 1;
+    // Extra level with a single slot for events that are already due, e.g. when the timer thread
+    // woke up late and an event needs to catch up. They fire on the next loop iteration.
+    static constexpr int kOverdueLevel = kWheelLevels;
 
     struct RecurrentEvent {
         Nanos interval;
         int32_t cookie;
         TimePoint absoluteTime;  // Absolute time of the next event.
+        TimePoint registeredTime;  // Aligned first event may be in the past, it's not late.
+
+        // Position in the timing wheel, events in a slot form an intrusive doubly-linked list.
+        uint64_t tick = 0;
+        int level = -1;
+        int slot = 0;
+        RecurrentEvent* prev = nullptr;
+        RecurrentEvent* next = nullptr;
+
+        bool isScheduled() const { return level >= 0; }
 
         void updateNextEventTime(TimePoint now) {
             // We want to move time to next event by adding some number of intervals (usually 1)
@@ -91,6 +139,175 @@ private:
         }
     };
 
+    struct WheelLevel {
+        RecurrentEvent* slots[kWheelSlots] = {};
+        uint64_t occupied = 0;  // Bit i is set if slots[i] is not empty.
+    };
+
+    // Ticks are aligned the same way as event times, so events on a multiple of the resolution
+    // fire exactly on their tick.
+    static TimePoint alignToResolution(TimePoint time, Nanos resolution) {
+        return time - Nanos(time.time_since_epoch().count() % resolution.count());
+    }
+
+    static int shiftForLevel(int level) {
+        return level * kSlotBits;
+    }
+
+    // First tick at or after given time point, events never fire earlier than requested.
+    uint64_t toTickCeil(TimePoint time) const {
+        if (time <= mEpoch) return 0;
+        return ((time - mEpoch).count() + mResolution.count() - 1) / mResolution.count();
+    }
+
+    uint64_t toTickFloor(TimePoint time) const {
+        if (time <= mEpoch) return 0;
+        return (time - mEpoch).count() / mResolution.count();
+    }
+
+    TimePoint toTimePoint(uint64_t tick) const {
+        return mEpoch + Nanos(static_cast<Nanos::rep>(tick) * mResolution.count());
+    }
+
+    void scheduleLocked(RecurrentEvent* event) {
+        event->tick = toTickCeil(event->absoluteTime);
+        if (event->tick <= mCurrentTick) {
+            linkLocked(event, kOverdueLevel, 0);
+        } else {
+            insertLocked(event);
+        }
+    }
+
+    void insertLocked(RecurrentEvent* event) {
+        uint64_t delta = event->tick - mCurrentTick;
+        // Events that don't fit into the wheel are parked in the farthest slot and placed again
+        // once that slot is cascaded.
+        uint64_t tick = std::min<uint64_t>(event->tick,
+                                 mCurrentTick + (1ULL << shiftForLevel(kWheelLevels)) - 1);
+        int level = 0;
+        while (level < kWheelLevels - 1 && delta >= (1ULL << shiftForLevel(level + 1))) {
+            level++;
+        }
+        linkLocked(event, level, (tick >> shiftForLevel(level)) & kSlotMask);
+    }
+
+    void linkLocked(RecurrentEvent* event, int level, int slot) {
+        WheelLevel& wheel = mWheel[level];
+        event->level = level;
+        event->slot = slot;
+        event->prev = nullptr;
+        event->next = wheel.slots[slot];
+        if (event->next != nullptr) {
+            event->next->prev = event;
+        }
+        wheel.slots[slot] = event;
+        wheel.occupied |= 1ULL << slot;
+    }
+
+    void unscheduleLocked(RecurrentEvent* event) {
+        if (!event->isScheduled()) return;
+        WheelLevel& wheel = mWheel[event->level];
+        int slot = event->slot;
+        if (event->prev != nullptr) {
+            event->prev->next = event->next;
+        } else {
+            wheel.slots[slot] = event->next;
+            if (wheel.slots[slot] == nullptr) {
+                wheel.occupied &= ~(1ULL << slot);
+            }
+        }
+        if (event->next != nullptr) {
+            event->next->prev = event->prev;
+        }
+        event->level = -1;
+        event->prev = event->next = nullptr;
+    }
+
+    /* Detaches all events from a slot and returns them as a list linked through next. */
+    RecurrentEvent* takeSlotLocked(int level, int slot) {
+        WheelLevel& wheel = mWheel[level];
+        RecurrentEvent* head = wheel.slots[slot];
+        wheel.slots[slot] = nullptr;
+        wheel.occupied &= ~(1ULL << slot);
+        for (RecurrentEvent* e = head; e != nullptr; e = e->next) {
+            e->level = -1;
+        }
+        return head;
+    }
+
+    /* Moves events of higher levels whose block starts at given tick down to lower levels. Higher
+     * levels go first, so events they move into the current block of a lower level are cascaded
+     * further in the same pass. */
+    void cascadeLocked(uint64_t tick) {
+        for (int level = kWheelLevels - 1; level > 0; level--) {
+            if ((tick & ((1ULL << shiftForLevel(level)) - 1)) != 0) continue;
+            RecurrentEvent* e = takeSlotLocked(level, (tick >> shiftForLevel(level)) & kSlotMask);
+            while (e != nullptr) {
+                RecurrentEvent* next = e->next;
+                insertLocked(e);
+                e = next;
+            }
+        }
+    }
+
+    /* Processes all ticks up to targetTick and appends due events to mDueEvents. */
+    void advanceLocked(uint64_t targetTick) {
+        while (mCurrentTick < targetTick) {
+            uint64_t tick = mCurrentTick + 1;
+            if ((tick & kSlotMask) != 0) {
+                // Jump straight to the next occupied slot of the first level, or to the end of the
+                // current block where the next cascade happens.
+                uint64_t blockEnd = std::min(tick | kSlotMask, targetTick);
+                uint64_t pending = mWheel[0].occupied >> (tick & kSlotMask);
+                if (pending == 0) {
+                    mCurrentTick = blockEnd;
+                    continue;
+                }
+                tick += __builtin_ctzll(pending);
+                if (tick > blockEnd) {
+                    mCurrentTick = blockEnd;
+                    continue;
+                }
+                mCurrentTick = tick;
+            } else {
+                // Move the current tick first, so cascaded events are placed relative to it.
+                mCurrentTick = tick;
+                cascadeLocked(tick);
+            }
+            appendDueLocked(takeSlotLocked(0, tick & kSlotMask));
+        }
+    }
+
+    void appendDueLocked(RecurrentEvent* e) {
+        while (e != nullptr) {
+            RecurrentEvent* next = e->next;
+            e->prev = e->next = nullptr;
+            mDueEvents.push_back(e);
+            e = next;
+        }
+    }
+
+    /* Returns the earliest tick at which an event is due, or UINT64_MAX if there are no events.
+     * Cascades on the way are done by advanceLocked, so they don't need separate wake-ups. */
+    uint64_t nextWakeupTickLocked() const {
+        if (mWheel[kOverdueLevel].occupied != 0) {
+            return mCurrentTick;  // In the past, so no waiting.
+        }
+        uint64_t result = UINT64_MAX;
+        for (int level = 0; level < kWheelLevels; level++) {
+            uint64_t occupied = mWheel[level].occupied;
+            if (occupied == 0) continue;
+            // The first occupied slot after the current one holds the earliest events of a level.
+            int start = ((mCurrentTick >> shiftForLevel(level)) + 1) & kSlotMask;
+            uint64_t rotated = (occupied >> start) | (start == 0 ? 0 : occupied << (64 - start));
+            int slot = (start + __builtin_ctzll(rotated)) & kSlotMask;
+            for (const RecurrentEvent* e = mWheel[level].slots[slot]; e != nullptr; e = e->next) {
+                result = std::min(result, e->tick);
+            }
+        }
+        return result;
+    }
+
     void loop(const Action& action) {
         static constexpr auto kInvalidTime = TimePoint(Nanos::max());
 
@@ -103,17 +320,25 @@ private:
 
             {
                 std::unique_lock<std::mutex> g(mLock);
+                mStats.wakeups++;
 
-                for (auto&& it : mCookieToEventsMap) {
-                    RecurrentEvent& event = it.second;
-                    if (event.absoluteTime <= now) {
-                        event.updateNextEventTime(now);
-                        cookies.push_back(event.cookie);
-                    }
+                appendDueLocked(takeSlotLocked(kOverdueLevel, 0));
+                advanceLocked(toTickFloor(now));
+                for (RecurrentEvent* event : mDueEvents) {
+                    Nanos lateness = now - std::max(event->absoluteTime, event->registeredTime);
+                    mStats.firedEvents++;
+                    mStats.totalLateness += lateness;
+                    mStats.maxLateness = std::max(mStats.maxLateness, lateness);
+
+                    cookies.push_back(event->cookie);
+                    event->updateNextEventTime(now);
+                    scheduleLocked(event);
+                }
+                mDueEvents.clear();
 
-                    if (nextEventTime > event.absoluteTime) {
-                        nextEventTime = event.absoluteTime;
-                    }
+                uint64_t nextTick = nextWakeupTickLocked();
+                if (nextTick != UINT64_MAX) {
+                    nextEventTime = toTimePoint(nextTick);
                 }
             }
 
@@ -122,14 +347,19 @@ private:
             }
 
             std::unique_lock<std::mutex> g(mLock);
+            if (mStopRequested) break;
+            // Registering an event may schedule it before nextEventTime, it will notify us then.
             mCond.wait_until(g, nextEventTime);  // nextEventTime can be nanoseconds::max()
         }
     }
 
     void stop() {
-        mStopRequested = true;
         {
             std::lock_guard<std::mutex> g(mLock);
+            mStopRequested = true;
+            for (auto&& it : mCookieToEventsMap) {
+                unscheduleLocked(&it.second);
+            }
             mCookieToEventsMap.clear();
         }
         mCond.notify_one();
@@ -138,12 +368,21 @@ private:
         }
     }
 private:
+    const Nanos mResolution;
+    const TimePoint mEpoch;  // Tick 0.
+
     mutable std::mutex mLock;
     std::thread mTimerThread;
     std::condition_variable mCond;
     std::atomic_bool mStopRequested { false };
     Action mAction;
+    // Node-based map, so events don't move while they are linked into the wheel.
     std::unordered_map<int32_t, RecurrentEvent> mCookieToEventsMap;
+
+    WheelLevel mWheel[kWheelLevels + 1];  // Including kOverdueLevel.
+    uint64_t mCurrentTick = 0;  // All slots up to and including this tick have been processed.
+    std::vector<RecurrentEvent*> mDueEvents;
+    Stats mStats {};
 };
 
 
@@ -52,10 +52,36 @@ public:
     bool isSubscribed(int32_t propId, SubscribeFlags flags);
     std::vector<int32_t> getSubscribedProperties() const;
 
+    /**
+     * Decides whether given event should be delivered to this client. Events of properties
+     * subscribed with non-zero sample rate are coalesced and decimated: only the newest event per
+     * (property, area) within a batch is considered and it is delivered only if at least one
+     * sample period elapsed since the previous event delivered for the same (property, area).
+     *
+     * An event with a timestamp not newer than the last delivered one is always delivered, as its
+     * source clock did not advance and it cannot be told apart from a stale sample.
+     *
+     * Events within a batch must be passed from the newest to the oldest, batchId must be
+     * different for every batch.
+     */
+    bool acceptEvent(const VehiclePropValue& value, uint64_t batchId);
+
+    /**
+     * Forgets the events delivered for given property, so that the next event is delivered
+     * regardless of the sample rate. Called whenever the subscription to the property changes.
+     */
+    void clearEventWindows(int32_t propId);
+
 private:
+    struct EventWindow {
+        uint64_t lastBatchId;
+        int64_t lastDeliveredTimestamp;
+    };
+
     const sp<IVehicleCallback> mCallback;
 
     std::map<int32_t, SubscribeOptions> mSubscriptions;
+    std::map<std::pair<int32_t /* prop */, int32_t /* area */>, EventWindow> mEventWindows;
 };
 
 class HalClientVector : private SortedVector<sp<HalClient>> , public RefBase {
@@ -109,10 +135,14 @@ public:
     /**
      * Returns a list of IVehicleCallback -> list of VehiclePropValue ready for
      * dispatching to its clients.
+     *
+     * Clients subscribed to a property with non-zero sample rate receive at most
+     * one value per (property, area) in a batch and no more often than their
+     * sample rate, see HalClient::acceptEvent.
      */
     std::list<HalClientValues> distributeValuesToClients(
             const std::vector<recyclable_ptr<VehiclePropValue>>& propValues,
-            SubscribeFlags flags) const;
+            SubscribeFlags flags);
 
     std::list<sp<HalClient>> getSubscribedClients(int32_t propId, SubscribeFlags flags) const;
     /**
@@ -166,6 +196,8 @@ private:
 
     OnPropertyUnsubscribed mOnPropertyUnsubscribed;
     sp<DeathRecipient> mCallbackDeathRecipient;
+
+    uint64_t mLastBatchId = 0;
 };
 
 
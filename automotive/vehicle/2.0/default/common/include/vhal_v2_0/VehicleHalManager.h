@@ -109,8 +109,13 @@ private:
 
     hidl_vec<VehiclePropValue> mHidlVecOfVehiclePropValuePool;
 
-    ConcurrentQueue<VehiclePropValuePtr> mEventQueue;
-    BatchingConsumer<VehiclePropValuePtr> mBatchingConsumer;
+    // Events that do not fit into the queue before the next batch is dispatched are dropped,
+    // starting from the oldest.
+    static constexpr size_t kHalEventQueueCapacity = 4096;
+
+    RingConcurrentQueue<VehiclePropValuePtr> mEventQueue { kHalEventQueueCapacity };
+    BatchingConsumer<VehiclePropValuePtr, RingConcurrentQueue<VehiclePropValuePtr>>
+            mBatchingConsumer;
     VehiclePropValuePool mValueObjectPool;
 };
 
@@ -18,9 +18,12 @@
 #ifndef android_hardware_automotive_vehicle_V2_0_VehicleObjectPool_H_
 #define android_hardware_automotive_vehicle_V2_0_VehicleObjectPool_H_
 
-#include <deque>
-#include <map>
+#include <algorithm>
+#include <atomic>
+#include <functional>
+#include <memory>
 #include <mutex>
+#include <vector>
 
 #include <android/hardware/automotive/vehicle/2.0/types.h>
 
@@ -35,7 +38,8 @@ namespace V2_0 {
 struct PoolStats {
     std::atomic<uint32_t> Obtained {0};
     std::atomic<uint32_t> Created {0};
-    std::atomic<uint32_t> Recycled {0};
+    std::atomic<uint32_t> Recycled {0};   // Objects returned to the pool.
+    std::atomic<uint32_t> Discarded {0};  // Returned objects that could not be recycled.
 
     static PoolStats* instance() {
         static PoolStats inst;
@@ -66,6 +70,36 @@ private:
 template <typename T>
 using recyclable_ptr = typename std::unique_ptr<T, Deleter<T>>;
 
+/**
+ * Per-pool counters, see ObjectPool::getStats().
+ */
+struct ObjectPoolStats {
+    uint64_t obtained = 0;
+    uint64_t created = 0;          // Obtained objects that had to be created.
+    uint64_t threadCacheHits = 0;  // Obtained objects that came from the calling thread's cache.
+    uint64_t freeListHits = 0;     // Obtained objects that came from the shared free list.
+    uint64_t recycled = 0;         // Returned objects that were kept for reuse.
+    uint64_t discarded = 0;        // Returned objects that were deleted.
+
+    uint64_t outstanding() const {
+        return obtained - recycled - discarded;
+    }
+
+    double hitRate() const {
+        return obtained == 0 ? 0 : static_cast<double>(obtained - created) / obtained;
+    }
+
+    ObjectPoolStats& operator+=(const ObjectPoolStats& other) {
+        obtained += other.obtained;
+        created += other.created;
+        threadCacheHits += other.threadCacheHits;
+        freeListHits += other.freeListHits;
+        recycled += other.recycled;
+        discarded += other.discarded;
+        return *this;
+    }
+};
+
 /**
  * Generic abstract object pool class. Users of this class must implement
  * #createObject method.
@@ -74,25 +108,54 @@ using recyclable_ptr = typename std::unique_ptr<T, Deleter<T>>;
  * multiple threads is OK, also client can obtain an object in one thread and
  * then move ownership to another thread.
  *
+ * Free objects are kept in magazines - small fixed-size arrays. Every thread
+ * that uses the pool owns up to two magazines and serves #obtain(...) and
+ * recycling from them without any synchronization. Only when both of them are
+ * empty (or full) the thread exchanges a magazine with the global free list,
+ * which is a lock-free stack of full magazines. Objects obtained in one thread
+ * and recycled in another simply migrate between threads through the free list.
+ *
+ * Caches of exited threads are adopted by threads that start using the pool
+ * later, so objects are not lost.
  */
 template<typename T>
 class ObjectPool {
 public:
-    ObjectPool() = default;
-    virtual ~ObjectPool() = default;
+    ObjectPool() : mId(nextPoolId()),
+                   mDeleter(std::bind(&ObjectPool::recycle, this, std::placeholders::_1)) {}
+
+    virtual ~ObjectPool() {
+        clear();
+    }
 
     virtual recyclable_ptr<T> obtain() {
-        std::lock_guard<std::mutex> g(mLock);
         INC_METRIC_IF_DEBUG(Obtained)
-        if (mObjects.empty()) {
+        ThreadCache* cache = getThreadCache();
+        T* o = cache != nullptr ? takeFromCache(cache) : nullptr;
+        if (o == nullptr) {
             INC_METRIC_IF_DEBUG(Created)
-            return wrap(createObject());
+            if (cache != nullptr) {
+                increment(&cache->stats.created);
+            } else {
+                mUncachedStats.obtained++;
+                mUncachedStats.created++;
+            }
+            o = createObject();
         }
+        return wrap(o);
+    }
 
-        auto o = wrap(mObjects.front().release());
-        mObjects.pop_front();
+    ObjectPoolStats getStats() const {
+        ObjectPoolStats result;
+        result.obtained = mUncachedStats.obtained;
+        result.created = mUncachedStats.created;
+        result.discarded = mUncachedStats.discarded;
 
-        return o;
+        std::lock_guard<std::mutex> g(mCachesLock);
+        for (const auto& cache : mCaches) {
+            result += cache->stats.snapshot();
+        }
+        return result;
     }
 
     ObjectPool& operator =(const ObjectPool &) = delete;
@@ -101,30 +164,304 @@ public:
 protected:
     virtual T* createObject() = 0;
 
+    virtual void destroyObject(T* o) {
+        delete o;
+    }
+
     virtual void recycle(T* o) {
         INC_METRIC_IF_DEBUG(Recycled)
-        std::lock_guard<std::mutex> g(mLock);
-        mObjects.push_back(std::unique_ptr<T> { o } );
+        ThreadCache* cache = getThreadCache();
+        if (cache == nullptr || !putToCache(cache, o)) {
+            discard(o);
+        }
+    }
+
+    /* Deletes object that was returned to the pool, but cannot be reused. */
+    void discard(T* o) {
+        INC_METRIC_IF_DEBUG(Discarded)
+        ThreadCache* cache = getThreadCache();
+        if (cache != nullptr) {
+            increment(&cache->stats.discarded);
+        } else {
+            mUncachedStats.discarded++;
+        }
+        destroyObject(o);
+    }
+
+    /* Deletes all free objects. Subclasses that override #destroyObject must call it from their
+     * destructor, the pool must not be used by other threads at this point. */
+    void clear() {
+        {
+            std::lock_guard<std::mutex> g(mCachesLock);
+            for (auto& cache : mCaches) {
+                cache->detached.store(true, std::memory_order_release);
+            }
+            mCaches.clear();
+        }
+
+        std::lock_guard<std::mutex> g(mMagazinesLock);
+        for (uint32_t i = 0; i < mMagazineCount; i++) {
+            Magazine* m = magazineAt(i);
+            for (uint32_t j = 0; j < m->count; j++) {
+                destroyObject(m->objects[j]);
+            }
+            m->count = 0;
+        }
+        for (uint32_t i = 0; i < kMaxMagazineChunks; i++) {
+            delete[] mMagazineChunks[i].exchange(nullptr);
+        }
+        mMagazineCount = 0;
+        mFullMagazines.reset();
+        mEmptyMagazines.reset();
     }
 
 private:
-    const Deleter<T>& getDeleter() {
-        if (!mDeleter.get()) {
-            Deleter<T> *d = new Deleter<T>(std::bind(
-                &ObjectPool::recycle, this, std::placeholders::_1));
-            mDeleter.reset(d);
+    static constexpr uint32_t kMagazineSize = 16;
+    static constexpr uint32_t kMagazinesPerChunk = 64;
+    static constexpr uint32_t kMaxMagazineChunks = 256;
+    static constexpr uint32_t kNoMagazine = UINT32_MAX;
+
+    struct Magazine {
+        uint32_t index;
+        std::atomic<uint32_t> next { kNoMagazine };
+        uint32_t count = 0;
+        T* objects[kMagazineSize];
+    };
+
+    /* Treiber stack of magazines. Magazines are addressed by their index and the head carries a
+     * tag that is incremented on every change to avoid ABA problem. Magazines are never freed
+     * while the pool is alive, so it is safe to read a magazine that was concurrently popped. */
+    class MagazineStack {
+    public:
+        explicit MagazineStack(const ObjectPool* pool) : mPool(pool) {}
+
+        void push(Magazine* m) {
+            uint64_t head = mHead.load(std::memory_order_relaxed);
+            do {
+                m->next.store(indexOf(head), std::memory_order_relaxed);
+            } while (!mHead.compare_exchange_weak(head, pack(m->index, tagOf(head) + 1),
+                                                  std::memory_order_release,
+                                                  std::memory_order_relaxed));
+        }
+
+        Magazine* pop() {
+            uint64_t head = mHead.load(std::memory_order_acquire);
+            while (indexOf(head) != kNoMagazine) {
+                Magazine* m = mPool->magazineAt(indexOf(head));
+                uint64_t next = pack(m->next.load(std::memory_order_relaxed), tagOf(head) + 1);
+                if (mHead.compare_exchange_weak(head, next, std::memory_order_acquire,
+                                                std::memory_order_acquire)) {
+                    return m;
+                }
+            }
+            return nullptr;
+        }
+
+        void reset() {
+            mHead.store(pack(kNoMagazine, 0));
         }
-        return *mDeleter.get();
+
+    private:
+        static uint64_t pack(uint32_t index, uint32_t tag) {
+            return (static_cast<uint64_t>(tag) << 32) | index;
+        }
+        static uint32_t indexOf(uint64_t head) { return static_cast<uint32_t>(head); }
+        static uint32_t tagOf(uint64_t head) { return static_cast<uint32_t>(head >> 32); }
+
+        const ObjectPool* mPool;
+        std::atomic<uint64_t> mHead { pack(kNoMagazine, 0) };
+    };
+
+    /* Counters are written only by the thread that owns the cache, but can be read by any. */
+    struct CacheStats {
+        std::atomic<uint64_t> obtained { 0 };
+        std::atomic<uint64_t> created { 0 };
+        std::atomic<uint64_t> threadCacheHits { 0 };
+        std::atomic<uint64_t> freeListHits { 0 };
+        std::atomic<uint64_t> recycled { 0 };
+        std::atomic<uint64_t> discarded { 0 };
+
+        ObjectPoolStats snapshot() const {
+            ObjectPoolStats s;
+            s.obtained = obtained.load(std::memory_order_relaxed);
+            s.created = created.load(std::memory_order_relaxed);
+            s.threadCacheHits = threadCacheHits.load(std::memory_order_relaxed);
+            s.freeListHits = freeListHits.load(std::memory_order_relaxed);
+            s.recycled = recycled.load(std::memory_order_relaxed);
+            s.discarded = discarded.load(std::memory_order_relaxed);
+            return s;
+        }
+    };
+
+    struct ThreadCache {
+        Magazine* loaded = nullptr;
+        Magazine* previous = nullptr;
+        CacheStats stats;
+        std::atomic<bool> orphaned { false };  // Owning thread has exited.
+        std::atomic<bool> detached { false };  // Pool has been destroyed.
+    };
+
+    struct ThreadCacheRef {
+        uint64_t poolId;
+        std::shared_ptr<ThreadCache> cache;
+    };
+
+    /* All caches of the calling thread, one for every pool of type T it has used. */
+    struct ThreadCaches {
+        std::vector<ThreadCacheRef> refs;
+
+        ~ThreadCaches() {
+            for (auto& ref : refs) {
+                ref.cache->orphaned.store(true, std::memory_order_release);
+            }
+            exiting() = true;
+        }
+
+        // Objects can be recycled from destructors of other thread_local variables.
+        static bool& exiting() {
+            static thread_local bool sExiting = false;
+            return sExiting;
+        }
+    };
+
+    static uint64_t nextPoolId() {
+        static std::atomic<uint64_t> sNextId { 0 };
+        return ++sNextId;
+    }
+
+    static void increment(std::atomic<uint64_t>* counter) {
+        counter->store(counter->load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    }
+
+    ThreadCache* getThreadCache() {
+        if (ThreadCaches::exiting()) {
+            return nullptr;
+        }
+        static thread_local ThreadCaches tCaches;
+        for (const auto& ref : tCaches.refs) {
+            if (ref.poolId == mId) {
+                return ref.cache.get();
+            }
+        }
+
+        auto& refs = tCaches.refs;
+        refs.erase(std::remove_if(refs.begin(), refs.end(), [](const ThreadCacheRef& ref) {
+                       return ref.cache->detached.load(std::memory_order_acquire);
+                   }), refs.end());
+        refs.push_back({ mId, registerThread() });
+        return refs.back().cache.get();
+    }
+
+    std::shared_ptr<ThreadCache> registerThread() {
+        std::lock_guard<std::mutex> g(mCachesLock);
+        for (const auto& cache : mCaches) {
+            bool orphaned = true;
+            if (cache->orphaned.compare_exchange_strong(orphaned, false,
+                                                        std::memory_order_acq_rel)) {
+                return cache;
+            }
+        }
+        mCaches.push_back(std::make_shared<ThreadCache>());
+        return mCaches.back();
+    }
+
+    T* takeFromCache(ThreadCache* cache) {
+        increment(&cache->stats.obtained);
+        if (cache->loaded == nullptr || cache->loaded->count == 0) {
+            if (cache->previous != nullptr && cache->previous->count > 0) {
+                std::swap(cache->loaded, cache->previous);
+            } else {
+                Magazine* full = mFullMagazines.pop();
+                if (full == nullptr) {
+                    return nullptr;
+                }
+                if (cache->previous != nullptr) {
+                    mEmptyMagazines.push(cache->previous);
+                }
+                cache->previous = cache->loaded;
+                cache->loaded = full;
+                increment(&cache->stats.freeListHits);
+                return cache->loaded->objects[--cache->loaded->count];
+            }
+        }
+        increment(&cache->stats.threadCacheHits);
+        return cache->loaded->objects[--cache->loaded->count];
+    }
+
+    bool putToCache(ThreadCache* cache, T* o) {
+        if (cache->loaded == nullptr || cache->loaded->count == kMagazineSize) {
+            if (cache->previous != nullptr && cache->previous->count < kMagazineSize) {
+                std::swap(cache->loaded, cache->previous);
+            } else {
+                Magazine* empty = allocateMagazine();
+                if (empty == nullptr) {
+                    return false;
+                }
+                if (cache->previous != nullptr) {
+                    mFullMagazines.push(cache->previous);
+                }
+                cache->previous = cache->loaded;
+                cache->loaded = empty;
+            }
+        }
+        cache->loaded->objects[cache->loaded->count++] = o;
+        increment(&cache->stats.recycled);
+        return true;
+    }
+
+    Magazine* allocateMagazine() {
+        Magazine* m = mEmptyMagazines.pop();
+        if (m != nullptr) {
+            return m;
+        }
+
+        std::lock_guard<std::mutex> g(mMagazinesLock);
+        uint32_t index = mMagazineCount;
+        uint32_t chunk = index / kMagazinesPerChunk;
+        if (chunk >= kMaxMagazineChunks) {
+            return nullptr;
+        }
+        if (index % kMagazinesPerChunk == 0) {
+            Magazine* magazines = new Magazine[kMagazinesPerChunk];
+            for (uint32_t i = 0; i < kMagazinesPerChunk; i++) {
+                magazines[i].index = index + i;
+            }
+            mMagazineChunks[chunk].store(magazines, std::memory_order_release);
+        }
+        mMagazineCount++;
+        return magazineAt(index);
+    }
+
+    Magazine* magazineAt(uint32_t index) const {
+        Magazine* chunk = mMagazineChunks[index / kMagazinesPerChunk]
+                .load(std::memory_order_acquire);
+        return &chunk[index % kMagazinesPerChunk];
     }
 
     recyclable_ptr<T> wrap(T* raw) {
-        return recyclable_ptr<T> { raw, getDeleter() };
+        return recyclable_ptr<T> { raw, mDeleter };
     }
 
 private:
-    mutable std::mutex mLock;
-    std::deque<std::unique_ptr<T>> mObjects;
-    std::unique_ptr<Deleter<T>> mDeleter;
+    const uint64_t mId;  // Unique for the lifetime of the process.
+    const Deleter<T> mDeleter;
+
+    MagazineStack mFullMagazines { this };
+    MagazineStack mEmptyMagazines { this };
+
+    std::mutex mMagazinesLock;
+    uint32_t mMagazineCount = 0;  // Guarded by mMagazinesLock.
+    std::atomic<Magazine*> mMagazineChunks[kMaxMagazineChunks] {};
+
+    mutable std::mutex mCachesLock;
+    std::vector<std::shared_ptr<ThreadCache>> mCaches;
+
+    // For objects that were obtained or returned by exiting threads.
+    struct {
+        std::atomic<uint64_t> obtained { 0 };
+        std::atomic<uint64_t> created { 0 };
+        std::atomic<uint64_t> discarded { 0 };
+    } mUncachedStats;
 };
 
 /**
@@ -144,6 +481,11 @@ private:
  * synchornization penalty for these objects since we do not store them in the
  * pool.
  *
+ * Recyclable vector values are pooled by size class: the payload buffer is
+ * allocated with capacity rounded up to the power of two and shared by all
+ * vector sizes of that class, e.g. INT32_VEC values of size 3 and 4 come from
+ * the same pool.
+ *
  * This class is thread-safe. Users can obtain an object in one thread and pass
  * it to another.
  *
@@ -173,8 +515,8 @@ public:
      * returning back to the object pool.
      *
      */
-    VehiclePropValuePool(size_t maxRecyclableVectorSize = 4) :
-        mMaxRecyclableVectorSize(maxRecyclableVectorSize) {};
+    VehiclePropValuePool(size_t maxRecyclableVectorSize = 4);
+    ~VehiclePropValuePool();
 
     RecyclableType obtain(VehiclePropertyType type);
 
@@ -187,6 +529,9 @@ public:
     RecyclableType obtainString(const char* cstr);
     RecyclableType obtainComplex();
 
+    /* Returns counters summed up over pools of all value types and sizes. */
+    ObjectPoolStats getStats() const;
+
     VehiclePropValuePool(VehiclePropValuePool& ) = delete;
     VehiclePropValuePool& operator=(VehiclePropValuePool&) = delete;
 private:
@@ -200,29 +545,47 @@ private:
     RecyclableType obtainRecylable(VehiclePropertyType type,
                                    size_t vecSize);
 
+    /* Pool of values of one type, vector payload is allocated with given capacity. */
     class InternalPool: public ObjectPool<VehiclePropValue> {
     public:
-        InternalPool(VehiclePropertyType type, size_t vectorSize)
-            : mPropType(type), mVectorSize(vectorSize) {}
+        InternalPool(VehiclePropertyType type, size_t capacity)
+            : mPropType(type), mCapacity(capacity) {}
 
-        RecyclableType obtain() {
-            return ObjectPool<VehiclePropValue>::obtain();
+        ~InternalPool() override {
+            clear();
         }
+
+        RecyclableType obtain(size_t vecSize);
     protected:
         VehiclePropValue* createObject() override;
+        void destroyObject(VehiclePropValue* o) override;
         void recycle(VehiclePropValue* o) override;
     private:
-        bool check(VehiclePropValue::RawValue* v);
+        // Vectors of the pooled value don't own their payload, so if a user of the value replaces
+        // or resizes a vector, our buffer stays intact and we can detect it by the address.
+        struct PooledValue : public VehiclePropValue {
+            std::unique_ptr<uint8_t[]> payload;
+        };
+
+        bool check(const PooledValue& o) const;
+        void setPayloadSize(PooledValue* o, size_t size) const;
+
+        /* Calls f with pointer to the vector that holds values of mPropType. */
+        template <typename RawValueT, typename F>
+        void forPayload(RawValueT* v, F f) const;
 
         template <typename VecType>
-        bool check(hidl_vec<VecType>* vec, bool expected) {
-            return vec->size() == (expected ? mVectorSize : 0);
+        bool check(const hidl_vec<VecType>& vec, bool expected) const {
+            return expected || vec.size() == 0;
         }
     private:
         VehiclePropertyType mPropType;
-        size_t mVectorSize;
+        size_t mCapacity;
     };
 
+    static int getTypeIndex(VehiclePropertyType type);
+    static size_t getSizeClass(size_t vecSize);
+
 private:
     const Deleter<VehiclePropValue> mDisposableDeleter {
         [] (VehiclePropValue* v) {
@@ -231,9 +594,12 @@ private:
     };
 
 private:
-    mutable std::mutex mLock;
+    static constexpr int kRecyclableTypeCount = 8;
+
     const size_t mMaxRecyclableVectorSize;
-    std::map<int32_t, std::unique_ptr<InternalPool>> mValueTypePools;
+    const size_t mSizeClassCount;
+    // Indexed by type index and size class, pools are created lazily.
+    std::unique_ptr<std::atomic<InternalPool*>[]> mValueTypePools;
 };
 
 }  // namespace V2_0
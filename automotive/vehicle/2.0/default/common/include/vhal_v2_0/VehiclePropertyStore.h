@@ -17,10 +17,13 @@
 #ifndef android_hardware_automotive_vehicle_V2_0_impl_PropertyDb_H_
 #define android_hardware_automotive_vehicle_V2_0_impl_PropertyDb_H_
 
+#include <atomic>
 #include <cstdint>
-#include <unordered_map>
+#include <functional>
+#include <map>
 #include <memory>
 #include <mutex>
+#include <vector>
 
 #include <android/hardware/automotive/vehicle/2.0/IVehicle.h>
 
@@ -34,10 +37,15 @@ namespace V2_0 {
  * Encapsulates work related to storing and accessing configuration, storing and modifying
  * vehicle property values.
  *
- * VehiclePropertyValues stored in a sorted map thus it makes easier to get range of values, e.g.
- * to get value for all areas for particular property.
+ * Values are sharded per property: every registered property owns a slot with its config and a
+ * sorted map of (area, token) records, thus it is easy to get range of values, e.g. to get value
+ * for all areas for particular property.
  *
- * This class is thread-safe, however it uses blocking synchronization across all methods.
+ * This class is thread-safe. Reads never block: properties are looked up in a flat lock-free slot
+ * table, per-property record maps and the values themselves are immutable snapshots published
+ * through atomic shared_ptr swaps (RCU style). Writers of the same property are serialized by a
+ * per-property lock, writers of different properties do not contend. Properties are expected to
+ * be registered during initialization.
  */
 class VehiclePropertyStore {
 public:
@@ -51,7 +59,6 @@ private:
     };
 
     struct RecordId {
-        int32_t prop;
         int32_t area;
         int64_t token;
 
@@ -59,10 +66,43 @@ private:
         bool operator<(const RecordId& other) const;
     };
 
-    using PropertyMap = std::map<RecordId, VehiclePropValue>;
-    using PropertyMapRange = std::pair<PropertyMap::const_iterator, PropertyMap::const_iterator>;
+    using ValuePtr = std::shared_ptr<const VehiclePropValue>;
+
+    /* Holds the latest value for a single (area, token); value is accessed with std::atomic_load
+     * and std::atomic_store only. */
+    struct Record {
+        ValuePtr value;
+    };
+
+    using RecordMap = std::map<RecordId, std::shared_ptr<Record>>;
+
+    struct PropertyShard {
+        PropertyShard(const VehiclePropConfig& config, TokenFunction tokenFunc)
+            : recordConfig { config, tokenFunc },
+              records(std::make_shared<const RecordMap>()) {}
+
+        const RecordConfig recordConfig;
+        std::mutex writeLock;  // Serializes writers of this property only.
+        std::shared_ptr<const RecordMap> records;  // Replaced as a whole under writeLock.
+    };
+
+    /* Flat open-addressing table of propId -> shard, probed without locks. Tables are only
+     * replaced by a larger one when they become half full; replaced tables are kept alive since
+     * readers may still probe them. */
+    struct ShardTable {
+        explicit ShardTable(size_t capacity);
+
+        PropertyShard* find(int32_t propId) const;
+        void insert(PropertyShard* shard);
+
+        const size_t capacity;  // Always a power of two.
+        size_t size = 0;
+        std::unique_ptr<std::atomic<PropertyShard*>[]> slots;
+    };
 
 public:
+    VehiclePropertyStore();
+
     void registerProperty(const VehiclePropConfig& config, TokenFunction tokenFunc = nullptr);
 
     /* Stores provided value. Returns true if value was written returns false if config for
@@ -72,6 +112,8 @@ public:
     void removeValue(const VehiclePropValue& propValue);
     void removeValuesForProperty(int32_t propId);
 
+    /* Values are ordered by property id, then by area and token, like configs returned by
+     * getAllConfigs(). */
     std::vector<VehiclePropValue> readAllValues() const;
     std::vector<VehiclePropValue> readValuesForProperty(int32_t propId) const;
     std::unique_ptr<VehiclePropValue> readValueOrNull(const VehiclePropValue& request) const;
@@ -83,16 +125,24 @@ public:
     const VehiclePropConfig* getConfigOrDie(int32_t propId) const;
 
 private:
-    RecordId getRecordIdLocked(const VehiclePropValue& valuePrototype) const;
-    const VehiclePropValue* getValueOrNullLocked(const RecordId& recId) const;
-    PropertyMapRange findRangeLocked(int32_t propId) const;
+    /* Shards are never removed once registered, so returned pointer stays valid for the lifetime
+     * of the store. Lock-free. */
+    PropertyShard* getShardOrNull(int32_t propId) const {
+        return mShardTable.load(std::memory_order_acquire)->find(propId);
+    }
+    static RecordId getRecordId(const PropertyShard& shard, const VehiclePropValue& valuePrototype);
+    static ValuePtr getValueOrNull(const PropertyShard& shard, const RecordId& recId);
+    static void appendValues(const PropertyShard& shard, std::vector<VehiclePropValue>* values);
+    /* Registered shards sorted by property id, so that bulk reads do not depend on the layout of
+     * the shard table. Lock-free. */
+    std::vector<const PropertyShard*> getShardsInPropertyOrder() const;
 
 private:
     using MuxGuard = std::lock_guard<std::mutex>;
-    mutable std::mutex mLock;
-    std::unordered_map<int32_t /* VehicleProperty */, RecordConfig> mConfigs;
-
-    PropertyMap mPropertyValues;  // Sorted map of RecordId : VehiclePropValue.
+    std::mutex mRegisterLock;  // Guards everything below except reads of mShardTable.
+    std::vector<std::unique_ptr<PropertyShard>> mShards;  // In registration order.
+    std::vector<std::unique_ptr<ShardTable>> mShardTables;  // Current table is the last one.
+    std::atomic<ShardTable*> mShardTable;
 };
 
 }  // namespace V2_0
@@ -0,0 +1,74 @@
+/*
+ * Copyright (C) 2018 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef android_hardware_automotive_vehicle_V2_0_VehiclePropertyStoreSnapshot_H_
+#define android_hardware_automotive_vehicle_V2_0_VehiclePropertyStoreSnapshot_H_
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "VehiclePropertyStore.h"
+
+namespace android {
+namespace hardware {
+namespace automotive {
+namespace vehicle {
+namespace V2_0 {
+
+/**
+ * Compact binary snapshot of VehiclePropertyStore: all registered configs and the latest values.
+ * It is used to persist values across HAL restarts and to restore them with a single mmap on
+ * top of the default values.
+ *
+ * Layout: fixed size header followed by config records and then value records. Every record is
+ * prefixed with its size and all fields are 4-byte aligned, integers are stored in native byte
+ * order since snapshots never leave the device. The header carries a checksum of the payload, so
+ * truncated or corrupted files are rejected as a whole.
+ */
+class VehiclePropertyStoreSnapshot {
+public:
+    static constexpr uint32_t kMagic = 0x53534856;  // "VHSS"
+    static constexpr uint32_t kVersion = 1;
+
+    static std::vector<uint8_t> serialize(const VehiclePropertyStore& store);
+
+    /**
+     * Loads values from the snapshot into the store, on top of the values it already holds. Only
+     * values of properties registered in the store with the same config as in the snapshot are
+     * restored, values of properties that are no longer registered or whose config has changed
+     * are considered stale and skipped. Configs are never registered from the snapshot.
+     *
+     * Returns number of restored values or -1 if the snapshot is not valid (unknown version,
+     * checksum mismatch or broken layout), in which case the store is left untouched.
+     */
+    static int deserialize(const uint8_t* data, size_t size, VehiclePropertyStore* store);
+
+    /* Writes snapshot of the store to the file atomically: through a temporary file which is then
+     * renamed over the given path. */
+    static bool save(const VehiclePropertyStore& store, const std::string& path);
+
+    /* Maps the file and deserializes it into the store, see deserialize(...). */
+    static int restore(const std::string& path, VehiclePropertyStore* store);
+};
+
+}  // namespace V2_0
+}  // namespace vehicle
+}  // namespace automotive
+}  // namespace hardware
+}  // namespace android
+
+#endif  // android_hardware_automotive_vehicle_V2_0_VehiclePropertyStoreSnapshot_H_
@@ -16,6 +16,8 @@
 
 #include "Obd2SensorStore.h"
 
+#include <algorithm>
+
 #include <utils/SystemClock.h>
 #include "VehicleUtils.h"
 
@@ -25,41 +27,60 @@ namespace automotive {
 namespace vehicle {
 namespace V2_0 {
 
-Obd2SensorStore::BitmaskInVector::BitmaskInVector(size_t numBits) {
+Obd2SensorStore::PackedBitset::PackedBitset(size_t numBits) {
     resize(numBits);
 }
 
-void Obd2SensorStore::BitmaskInVector::resize(size_t numBits) {
-    mStorage = std::vector<uint8_t>((numBits + 7) / 8, 0);
+void Obd2SensorStore::PackedBitset::resize(size_t numBits) {
+    mWords = std::vector<uint64_t>((numBits + 63) / 64, 0);
+}
+
+void Obd2SensorStore::PackedBitset::set(size_t index, bool value) {
+    const uint64_t mask = uint64_t(1) << (index % 64);
+    if (value) {
+        mWords[index / 64] |= mask;
+    } else {
+        mWords[index / 64] &= ~mask;
+    }
 }
 
-void Obd2SensorStore::BitmaskInVector::set(size_t index, bool value) {
-    const size_t byteIndex = index / 8;
-    const size_t bitIndex = index % 8;
-    const uint8_t byte = mStorage[byteIndex];
-    uint8_t newValue = value ? (byte | (1 << bitIndex)) : (byte & ~(1 << bitIndex));
-    mStorage[byteIndex] = newValue;
+bool Obd2SensorStore::PackedBitset::get(size_t index) const {
+    return (mWords[index / 64] & (uint64_t(1) << (index % 64))) != 0;
 }
 
-bool Obd2SensorStore::BitmaskInVector::get(size_t index) const {
-    const size_t byteIndex = index / 8;
-    const size_t bitIndex = index % 8;
-    const uint8_t byte = mStorage[byteIndex];
-    return (byte & (1 << bitIndex)) != 0;
+void Obd2SensorStore::PackedBitset::clear() {
+    std::fill(mWords.begin(), mWords.end(), 0);
 }
 
-const std::vector<uint8_t>& Obd2SensorStore::BitmaskInVector::getBitmask() const {
-    return mStorage;
+template <typename Fn>
+void Obd2SensorStore::PackedBitset::forEachSet(Fn fn) const {
+    for (size_t i = 0; i < mWords.size(); i++) {
+        for (uint64_t word = mWords[i]; word != 0; word &= word - 1) {
+            fn(i * 64 + __builtin_ctzll(word));
+        }
+    }
 }
 
-Obd2SensorStore::Obd2SensorStore(size_t numVendorIntegerSensors, size_t numVendorFloatSensors) {
+Obd2SensorStore::Obd2SensorStore(size_t numVendorIntegerSensors, size_t numVendorFloatSensors,
+                                 size_t maxFreezeFrames) {
     // because the last index is valid *inclusive*
     const size_t numSystemIntegerSensors =
         toInt(DiagnosticIntegerSensorIndex::LAST_SYSTEM_INDEX) + 1;
     const size_t numSystemFloatSensors = toInt(DiagnosticFloatSensorIndex::LAST_SYSTEM_INDEX) + 1;
     mIntegerSensors = std::vector<int32_t>(numSystemIntegerSensors + numVendorIntegerSensors, 0);
     mFloatSensors = std::vector<float>(numSystemFloatSensors + numVendorFloatSensors, 0);
-    mSensorsBitmask.resize(mIntegerSensors.size() + mFloatSensors.size());
+    const size_t numSensors = mIntegerSensors.size() + mFloatSensors.size();
+    mSensorsPresent.resize(numSensors);
+    mDirtySensors.resize(numSensors);
+
+    mTimestamp = elapsedRealtimeNano();
+    mFrame.timestamp = mTimestamp;
+    mFrame.integerSensors = mIntegerSensors;
+    mFrame.floatSensors = mFloatSensors;
+    mFrame.bitmask = std::vector<uint8_t>((numSensors + 7) / 8, 0);
+
+    // Freeze frames are allocated upfront, so the ring never grows.
+    mFreezeFrames = std::vector<Frame>(std::max<size_t>(maxFreezeFrames, 1), mFrame);
 }
 
 StatusCode Obd2SensorStore::setIntegerSensor(DiagnosticIntegerSensorIndex index, int32_t value) {
@@ -70,35 +91,232 @@ StatusCode Obd2SensorStore::setFloatSensor(DiagnosticFloatSensorIndex index, flo
 }
 
 StatusCode Obd2SensorStore::setIntegerSensor(size_t index, int32_t value) {
-    mIntegerSensors[index] = value;
-    mSensorsBitmask.set(index, true);
+    if (index >= mIntegerSensors.size()) {
+        return StatusCode::INVALID_ARG;
+    }
+    if (mIntegerSensors[index] != value || !mSensorsPresent.get(index)) {
+        mIntegerSensors[index] = value;
+        mSensorsPresent.set(index, true);
+        mDirtySensors.set(index, true);
+        mTimestamp = elapsedRealtimeNano();
+        mDirty = true;
+    }
     return StatusCode::OK;
 }
 
 StatusCode Obd2SensorStore::setFloatSensor(size_t index, float value) {
-    mFloatSensors[index] = value;
-    mSensorsBitmask.set(index + mIntegerSensors.size(), true);
+    if (index >= mFloatSensors.size()) {
+        return StatusCode::INVALID_ARG;
+    }
+    const size_t bitIndex = index + mIntegerSensors.size();
+    if (mFloatSensors[index] != value || !mSensorsPresent.get(bitIndex)) {
+        mFloatSensors[index] = value;
+        mSensorsPresent.set(bitIndex, true);
+        mDirtySensors.set(bitIndex, true);
+        mTimestamp = elapsedRealtimeNano();
+        mDirty = true;
+    }
     return StatusCode::OK;
 }
 
+StatusCode Obd2SensorStore::setSensors(const VehiclePropValue& frame) {
+    const auto& integers = frame.value.int32Values;
+    const auto& floats = frame.value.floatValues;
+    const auto& bitmask = frame.value.bytes;
+    if (integers.size() != mIntegerSensors.size() || floats.size() != mFloatSensors.size()
+            || bitmask.size() != mFrame.bitmask.size()) {
+        return StatusCode::INVALID_ARG;
+    }
+
+    // Sensors that are not present in the new frame must not be carried over from the old one.
+    std::fill(mIntegerSensors.begin(), mIntegerSensors.end(), 0);
+    std::fill(mFloatSensors.begin(), mFloatSensors.end(), 0);
+    mSensorsPresent.clear();
+    mDirtySensors.clear();
+    mReset = true;
+    mDirty = true;
+
+    for (size_t i = 0; i < bitmask.size(); i++) {
+        for (unsigned byte = bitmask[i]; byte != 0; byte &= byte - 1) {
+            const size_t index = i * 8 + __builtin_ctz(byte);
+            if (index < integers.size()) {
+                setIntegerSensor(index, integers[index]);
+            } else {
+                setFloatSensor(index - integers.size(), floats[index - integers.size()]);
+            }
+        }
+    }
+    mTimestamp = frame.timestamp != 0 ? frame.timestamp : elapsedRealtimeNano();
+    return StatusCode::OK;
+}
+
+size_t Obd2SensorStore::publishFrame() {
+    if (!mDirty) {
+        return 0;
+    }
+
+    if (mReset) {
+        std::fill(mFrame.integerSensors.begin(), mFrame.integerSensors.end(), 0);
+        std::fill(mFrame.floatSensors.begin(), mFrame.floatSensors.end(), 0);
+        std::fill(mFrame.bitmask.begin(), mFrame.bitmask.end(), 0);
+        mReset = false;
+    }
+
+    size_t numChanged = 0;
+    const size_t numIntegerSensors = mIntegerSensors.size();
+    mDirtySensors.forEachSet([this, numIntegerSensors, &numChanged](size_t index) {
+        if (index < numIntegerSensors) {
+            mFrame.integerSensors[index] = mIntegerSensors[index];
+        } else {
+            mFrame.floatSensors[index - numIntegerSensors] =
+                mFloatSensors[index - numIntegerSensors];
+        }
+        mFrame.bitmask[index / 8] |= 1 << (index % 8);
+        numChanged++;
+    });
+    mDirtySensors.clear();
+    mFrame.timestamp = mTimestamp;
+    mDirty = false;
+    return numChanged;
+}
+
 const std::vector<int32_t>& Obd2SensorStore::getIntegerSensors() const {
-    return mIntegerSensors;
+    return mFrame.integerSensors;
 }
 
 const std::vector<float>& Obd2SensorStore::getFloatSensors() const {
-    return mFloatSensors;
+    return mFrame.floatSensors;
 }
 
 const std::vector<uint8_t>& Obd2SensorStore::getSensorsBitmask() const {
-    return mSensorsBitmask.getBitmask();
+    return mFrame.bitmask;
+}
+
+void Obd2SensorStore::fillPropValue(const std::string& dtc, VehiclePropValue* propValue) {
+    publishFrame();
+    mFrame.dtc = dtc;
+    fillPropValue(mFrame, propValue);
+}
+
+void Obd2SensorStore::fillPropValue(const Frame& frame, VehiclePropValue* propValue) const {
+    propValue->timestamp = frame.timestamp;
+    propValue->value.int32Values = frame.integerSensors;
+    propValue->value.floatValues = frame.floatSensors;
+    propValue->value.bytes = frame.bitmask;
+    propValue->value.stringValue = frame.dtc;
+}
+
+int64_t Obd2SensorStore::captureFreezeFrame(const std::string& dtc) {
+    publishFrame();
+
+    int64_t timestamp = nextFreezeFrameTimestamp();
+    // Same sized vectors, so assignment reuses memory of the slot.
+    Frame& slot = freezeFrameAt(appendFreezeFrame());
+    slot.timestamp = timestamp;
+    slot.dtc = dtc;
+    slot.integerSensors = mFrame.integerSensors;
+    slot.floatSensors = mFrame.floatSensors;
+    slot.bitmask = mFrame.bitmask;
+    return timestamp;
+}
+
+StatusCode Obd2SensorStore::addFreezeFrame(const VehiclePropValue& frame) {
+    const auto& integers = frame.value.int32Values;
+    const auto& floats = frame.value.floatValues;
+    const auto& bitmask = frame.value.bytes;
+    if (integers.size() != mFrame.integerSensors.size()
+            || floats.size() != mFrame.floatSensors.size()
+            || bitmask.size() != mFrame.bitmask.size()) {
+        return StatusCode::INVALID_ARG;
+    }
+
+    int64_t timestamp = frame.timestamp;
+    ssize_t n = timestamp != 0 ? findFreezeFrame(timestamp) : -1;
+    if (n < 0) {
+        if (timestamp == 0) {
+            timestamp = nextFreezeFrameTimestamp();
+        }
+        n = appendFreezeFrame();
+    }
+    // Captured freeze frames must not reuse the timestamp of this one.
+    mLastFreezeFrameTimestamp = std::max(mLastFreezeFrameTimestamp, timestamp);
+
+    Frame& slot = freezeFrameAt(n);
+    slot.timestamp = timestamp;
+    slot.dtc = frame.value.stringValue;
+    std::copy(integers.data(), integers.data() + integers.size(), slot.integerSensors.begin());
+    std::copy(floats.data(), floats.data() + floats.size(), slot.floatSensors.begin());
+    std::copy(bitmask.data(), bitmask.data() + bitmask.size(), slot.bitmask.begin());
+    return StatusCode::OK;
+}
+
+int64_t Obd2SensorStore::nextFreezeFrameTimestamp() {
+    // Timestamps identify freeze frames, so they must be unique.
+    mLastFreezeFrameTimestamp = std::max(elapsedRealtimeNano(), mLastFreezeFrameTimestamp + 1);
+    return mLastFreezeFrameTimestamp;
+}
+
+size_t Obd2SensorStore::appendFreezeFrame() {
+    // Once the ring is full, the oldest freeze frame is overwritten.
+    if (mNumFreezeFrames == mFreezeFrames.size()) {
+        mFirstFreezeFrame = (mFirstFreezeFrame + 1) % mFreezeFrames.size();
+        mNumFreezeFrames--;
+    }
+    return mNumFreezeFrames++;
+}
+
+Obd2SensorStore::Frame& Obd2SensorStore::freezeFrameAt(size_t n) {
+    return mFreezeFrames[(mFirstFreezeFrame + n) % mFreezeFrames.size()];
+}
+
+const Obd2SensorStore::Frame& Obd2SensorStore::freezeFrameAt(size_t n) const {
+    return mFreezeFrames[(mFirstFreezeFrame + n) % mFreezeFrames.size()];
+}
+
+ssize_t Obd2SensorStore::findFreezeFrame(int64_t timestamp) const {
+    for (size_t n = 0; n < mNumFreezeFrames; n++) {
+        if (freezeFrameAt(n).timestamp == timestamp) {
+            return n;
+        }
+    }
+    return -1;
+}
+
+StatusCode Obd2SensorStore::fillFreezeFrame(int64_t timestamp, VehiclePropValue* propValue) const {
+    ssize_t n = findFreezeFrame(timestamp);
+    if (n < 0) {
+        return StatusCode::INVALID_ARG;
+    }
+    fillPropValue(freezeFrameAt(n), propValue);
+    return StatusCode::OK;
+}
+
+std::vector<int64_t> Obd2SensorStore::getFreezeFrameTimestamps() const {
+    std::vector<int64_t> timestamps;
+    timestamps.reserve(mNumFreezeFrames);
+    for (size_t n = 0; n < mNumFreezeFrames; n++) {
+        timestamps.push_back(freezeFrameAt(n).timestamp);
+    }
+    return timestamps;
+}
+
+StatusCode Obd2SensorStore::removeFreezeFrame(int64_t timestamp) {
+    ssize_t n = findFreezeFrame(timestamp);
+    if (n < 0) {
+        return StatusCode::INVALID_ARG;
+    }
+    // Move newer freeze frames down to close the gap, swapping keeps memory of the slots. The
+    // removed frame ends up in the first free slot.
+    for (size_t i = n; i + 1 < mNumFreezeFrames; i++) {
+        std::swap(freezeFrameAt(i), freezeFrameAt(i + 1));
+    }
+    mNumFreezeFrames--;
+    return StatusCode::OK;
 }
 
-void Obd2SensorStore::fillPropValue(const std::string& dtc, VehiclePropValue* propValue) const {
-    propValue->timestamp = elapsedRealtimeNano();
-    propValue->value.int32Values = getIntegerSensors();
-    propValue->value.floatValues = getFloatSensors();
-    propValue->value.bytes = getSensorsBitmask();
-    propValue->value.stringValue = dtc;
+void Obd2SensorStore::clearFreezeFrames() {
+    mFirstFreezeFrame = 0;
+    mNumFreezeFrames = 0;
 }
 
 }  // namespace V2_0
@@ -20,6 +20,7 @@
 
 #include <cmath>
 #include <inttypes.h>
+#include <limits>
 
 #include <android/log.h>
 
@@ -50,6 +51,7 @@ bool mergeSubscribeOptions(const SubscribeOptions &oldOpts,
 void HalClient::addOrUpdateSubscription(const SubscribeOptions &opts)  {
     ALOGI("%s opts.propId: 0x%x", __func__, opts.propId);
 
+    clearEventWindows(opts.propId);
     auto it = mSubscriptions.find(opts.propId);
     if (it == mSubscriptions.end()) {
         mSubscriptions.emplace(opts.propId, opts);
@@ -74,6 +76,44 @@ bool HalClient::isSubscribed(int32_t propId,
     return res;
 }
 
+bool HalClient::acceptEvent(const VehiclePropValue& value, uint64_t batchId) {
+    auto it = mSubscriptions.find(value.prop);
+    if (it == mSubscriptions.end() || it->second.sampleRate <= 0) {
+        return true;  // On-change property, every event matters.
+    }
+
+    auto windowIt = mEventWindows.find({ value.prop, value.areaId });
+    if (windowIt == mEventWindows.end()) {
+        mEventWindows.insert({ { value.prop, value.areaId },
+                               EventWindow { batchId, value.timestamp } });
+        return true;
+    }
+
+    EventWindow& window = windowIt->second;
+    if (window.lastBatchId == batchId) {
+        return false;  // Newer value for the same property and area is already in this batch.
+    }
+    window.lastBatchId = batchId;
+
+    // Allow some jitter, otherwise a source producing at exactly the requested rate would
+    // occasionally get every other sample dropped.
+    constexpr float kSamplePeriodTolerance = 0.9f;
+    auto minInterval = static_cast<int64_t>(kSamplePeriodTolerance * 1e9f / it->second.sampleRate);
+    if (value.timestamp > window.lastDeliveredTimestamp
+            && value.timestamp - window.lastDeliveredTimestamp < minInterval) {
+        return false;
+    }
+    // Also deliver if timestamp did not advance, e.g. value was injected with its own clock.
+    window.lastDeliveredTimestamp = value.timestamp;
+    return true;
+}
+
+void HalClient::clearEventWindows(int32_t propId) {
+    mEventWindows.erase(
+        mEventWindows.lower_bound({ propId, std::numeric_limits<int32_t>::min() }),
+        mEventWindows.upper_bound({ propId, std::numeric_limits<int32_t>::max() }));
+}
+
 std::vector<int32_t> HalClient::getSubscribedProperties() const {
     std::vector<int32_t> props;
     for (const auto& subscription : mSubscriptions) {
@@ -119,16 +159,20 @@ StatusCode SubscriptionManager::addOrUpdateSubscription(
 
 std::list<HalClientValues> SubscriptionManager::distributeValuesToClients(
         const std::vector<recyclable_ptr<VehiclePropValue>>& propValues,
-        SubscribeFlags flags) const {
+        SubscribeFlags flags) {
     std::map<sp<HalClient>, std::list<VehiclePropValue*>> clientValuesMap;
 
     {
         MuxGuard g(mLock);
-        for (const auto& propValue: propValues) {
-            VehiclePropValue* v = propValue.get();
+        uint64_t batchId = ++mLastBatchId;
+        // Walk from the newest value, so clients can drop older values of the same property.
+        for (auto it = propValues.rbegin(); it != propValues.rend(); ++it) {
+            VehiclePropValue* v = it->get();
             auto clients = getSubscribedClientsLocked(v->prop, flags);
             for (const auto& client : clients) {
-                clientValuesMap[client].push_back(v);
+                if (client->acceptEvent(*v, batchId)) {
+                    clientValuesMap[client].push_front(v);
+                }
             }
         }
     }
@@ -238,6 +282,7 @@ void SubscriptionManager::unsubscribe(ClientId clientId,
         ALOGW("Unable to unsubscribe: no callback found, propId: 0x%x", propId);
     } else {
         auto client = clientIter->second;
+        client->clearEventWindows(propId);
 
         if (propertyClients != nullptr) {
             propertyClients->remove(client);
@@ -20,6 +20,7 @@
 
 #include <cmath>
 #include <fstream>
+#include <sstream>
 
 #include <android/log.h>
 #include <android/hardware/automotive/vehicle/2.0/BpHwVehicleCallback.h>
@@ -168,7 +169,23 @@ Return<StatusCode> VehicleHalManager::unsubscribe(const sp<IVehicleCallback>& ca
 }
 
 Return<void> VehicleHalManager::debugDump(IVehicle::debugDump_cb _hidl_cb) {
-    _hidl_cb("");
+    QueueStats stats = mEventQueue.getStats();
+    std::stringstream ss;
+    ss << "HAL event queue: capacity=" << mEventQueue.capacity()
+       << " depth=" << stats.depth
+       << " maxDepth=" << stats.maxDepth
+       << " pushed=" << stats.pushed
+       << " dropped=" << stats.dropped
+       << " coalesced=" << stats.coalesced << "\n";
+
+    ObjectPoolStats poolStats = mValueObjectPool.getStats();
+    ss << "Value pool: obtained=" << poolStats.obtained
+       << " created=" << poolStats.created
+       << " threadCacheHits=" << poolStats.threadCacheHits
+       << " freeListHits=" << poolStats.freeListHits
+       << " hitRate=" << poolStats.hitRate()
+       << " outstanding=" << poolStats.outstanding() << "\n";
+    _hidl_cb(ss.str());
     return Void();
 }
 
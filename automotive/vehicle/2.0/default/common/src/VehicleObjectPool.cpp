@@ -18,6 +18,8 @@
 
 #include "VehicleObjectPool.h"
 
+#include <algorithm>
+
 #include <log/log.h>
 
 #include "VehicleUtils.h"
@@ -28,6 +30,36 @@ namespace automotive {
 namespace vehicle {
 namespace V2_0 {
 
+namespace {
+
+// Copies |src| into the elements of |dest| if they have the same size, so that a pooled payload
+// is kept rather than replaced by a newly allocated one.
+template <typename T>
+void copyHidlVecInPlace(hidl_vec<T>* dest, const hidl_vec<T>& src) {
+    if (dest->size() == src.size()) {
+        std::copy(src.data(), src.data() + src.size(), dest->data());
+    } else {
+        *dest = src;
+    }
+}
+
+}  // namespace
+
+VehiclePropValuePool::VehiclePropValuePool(size_t maxRecyclableVectorSize) :
+    mMaxRecyclableVectorSize(maxRecyclableVectorSize),
+    mSizeClassCount(getSizeClass(maxRecyclableVectorSize) + 1),
+    mValueTypePools(new std::atomic<InternalPool*>[kRecyclableTypeCount * mSizeClassCount]) {
+    for (size_t i = 0; i < kRecyclableTypeCount * mSizeClassCount; i++) {
+        mValueTypePools[i] = nullptr;
+    }
+}
+
+VehiclePropValuePool::~VehiclePropValuePool() {
+    for (size_t i = 0; i < kRecyclableTypeCount * mSizeClassCount; i++) {
+        delete mValueTypePools[i].load();
+    }
+}
+
 VehiclePropValuePool::RecyclableType VehiclePropValuePool::obtain(
         VehiclePropertyType type, size_t vecSize) {
     return isDisposable(type, vecSize)
@@ -42,14 +74,19 @@ VehiclePropValuePool::RecyclableType VehiclePropValuePool::obtain(
         return RecyclableType();
     }
     VehiclePropertyType type = getPropType(src.prop);
-    size_t vecSize = getVehicleRawValueVectorSize(src.value, type);;
+    size_t vecSize = getVehicleRawValueVectorSize(src.value, type);
     auto dest = obtain(type, vecSize);
 
     dest->prop = src.prop;
     dest->areaId = src.areaId;
     dest->status = src.status;
     dest->timestamp = src.timestamp;
-    copyVehicleRawValue(&dest->value, src.value);
+    // The payload of a recyclable value has already been sized to vecSize.
+    copyHidlVecInPlace(&dest->value.int32Values, src.value.int32Values);
+    copyHidlVecInPlace(&dest->value.floatValues, src.value.floatValues);
+    copyHidlVecInPlace(&dest->value.int64Values, src.value.int64Values);
+    copyHidlVecInPlace(&dest->value.bytes, src.value.bytes);
+    dest->value.stringValue = src.value.stringValue;
 
     return dest;
 }
@@ -88,18 +125,52 @@ VehiclePropValuePool::RecyclableType VehiclePropValuePool::obtainComplex() {
 
 VehiclePropValuePool::RecyclableType VehiclePropValuePool::obtainRecylable(
         VehiclePropertyType type, size_t vecSize) {
-    // VehiclePropertyType is not overlapping with vectorSize.
-    int32_t key = static_cast<int32_t>(type)
-                  | static_cast<int32_t>(vecSize);
+    size_t sizeClass = getSizeClass(vecSize);
+    std::atomic<InternalPool*>& slot =
+            mValueTypePools[getTypeIndex(type) * mSizeClassCount + sizeClass];
 
-    std::lock_guard<std::mutex> g(mLock);
-    auto it = mValueTypePools.find(key);
+    InternalPool* pool = slot.load(std::memory_order_acquire);
+    if (pool == nullptr) {
+        auto newPool = std::make_unique<InternalPool>(type, size_t(1) << sizeClass);
+        if (slot.compare_exchange_strong(pool, newPool.get(), std::memory_order_acq_rel)) {
+            pool = newPool.release();
+        }  // Otherwise another thread has won and pool points to its instance.
+    }
+    return pool->obtain(vecSize);
+}
 
-    if (it == mValueTypePools.end()) {
-        auto newPool(std::make_unique<InternalPool>(type, vecSize));
-        it = mValueTypePools.emplace(key, std::move(newPool)).first;
+ObjectPoolStats VehiclePropValuePool::getStats() const {
+    ObjectPoolStats stats;
+    for (size_t i = 0; i < kRecyclableTypeCount * mSizeClassCount; i++) {
+        InternalPool* pool = mValueTypePools[i].load(std::memory_order_acquire);
+        if (pool != nullptr) {
+            stats += pool->getStats();
+        }
     }
-    return it->second->obtain();
+    return stats;
+}
+
+int VehiclePropValuePool::getTypeIndex(VehiclePropertyType type) {
+    switch (type) {
+        case VehiclePropertyType::BOOLEAN: return 0;
+        case VehiclePropertyType::INT32: return 1;
+        case VehiclePropertyType::INT32_VEC: return 2;
+        case VehiclePropertyType::INT64: return 3;
+        case VehiclePropertyType::INT64_VEC: return 4;
+        case VehiclePropertyType::FLOAT: return 5;
+        case VehiclePropertyType::FLOAT_VEC: return 6;
+        case VehiclePropertyType::BYTES: return 7;
+        default:
+            LOG_ALWAYS_FATAL("Unexpected recyclable type: 0x%x", toInt(type));
+    }
+}
+
+size_t VehiclePropValuePool::getSizeClass(size_t vecSize) {
+    size_t sizeClass = 0;
+    while ((size_t(1) << sizeClass) < vecSize) {
+        sizeClass++;
+    }
+    return sizeClass;
 }
 
 VehiclePropValuePool::RecyclableType VehiclePropValuePool::obtainBoolean(
@@ -121,36 +192,90 @@ VehiclePropValuePool::RecyclableType VehiclePropValuePool::obtain(
 }
 
 
+template <typename RawValueT, typename F>
+void VehiclePropValuePool::InternalPool::forPayload(RawValueT* v, F f) const {
+    switch (mPropType) {
+        case VehiclePropertyType::INT32:      // fall through
+        case VehiclePropertyType::INT32_VEC:  // fall through
+        case VehiclePropertyType::BOOLEAN:
+            f(&v->int32Values);
+            break;
+        case VehiclePropertyType::FLOAT:      // fall through
+        case VehiclePropertyType::FLOAT_VEC:
+            f(&v->floatValues);
+            break;
+        case VehiclePropertyType::INT64:      // fall through
+        case VehiclePropertyType::INT64_VEC:
+            f(&v->int64Values);
+            break;
+        case VehiclePropertyType::BYTES:
+            f(&v->bytes);
+            break;
+        default:
+            break;
+    }
+}
+
+VehiclePropValuePool::RecyclableType VehiclePropValuePool::InternalPool::obtain(
+        size_t vecSize) {
+    auto o = ObjectPool<VehiclePropValue>::obtain();
+    setPayloadSize(static_cast<PooledValue*>(o.get()), vecSize);
+    return o;
+}
+
 void VehiclePropValuePool::InternalPool::recycle(VehiclePropValue* o) {
     if (o == nullptr) {
         ALOGE("Attempt to recycle nullptr");
         return;
     }
 
-    if (!check(&o->value)) {
+    if (!check(*static_cast<PooledValue*>(o))) {
         ALOGE("Discarding value for prop 0x%x because it contains "
                   "data that is not consistent with this pool. "
-                  "Expected type: %d, vector size: %zu",
-              o->prop, mPropType, mVectorSize);
-        delete o;
+                  "Expected type: %d, capacity: %zu",
+              o->prop, mPropType, mCapacity);
+        INC_METRIC_IF_DEBUG(Recycled)
+        discard(o);
     } else {
         ObjectPool<VehiclePropValue>::recycle(o);
     }
 }
 
-bool VehiclePropValuePool::InternalPool::check(VehiclePropValue::RawValue* v) {
-    return check(&v->int32Values, (VehiclePropertyType::INT32 == mPropType ||
-                                   VehiclePropertyType::INT32_VEC == mPropType ||
-                                   VehiclePropertyType::BOOLEAN == mPropType)) &&
-           check(&v->floatValues, (VehiclePropertyType::FLOAT == mPropType ||
-                                   VehiclePropertyType::FLOAT_VEC == mPropType)) &&
-           check(&v->int64Values, (VehiclePropertyType::INT64 == mPropType ||
-                                   VehiclePropertyType::INT64_VEC == mPropType)) &&
-           check(&v->bytes, VehiclePropertyType::BYTES == mPropType) && v->stringValue.size() == 0;
+bool VehiclePropValuePool::InternalPool::check(const PooledValue& o) const {
+    const VehiclePropValue::RawValue& v = o.value;
+    const void* payload = nullptr;
+    forPayload(&v, [&payload](const auto* vec) { payload = vec->data(); });
+
+    return check(v.int32Values, (VehiclePropertyType::INT32 == mPropType ||
+                                 VehiclePropertyType::INT32_VEC == mPropType ||
+                                 VehiclePropertyType::BOOLEAN == mPropType)) &&
+           check(v.floatValues, (VehiclePropertyType::FLOAT == mPropType ||
+                                 VehiclePropertyType::FLOAT_VEC == mPropType)) &&
+           check(v.int64Values, (VehiclePropertyType::INT64 == mPropType ||
+                                 VehiclePropertyType::INT64_VEC == mPropType)) &&
+           check(v.bytes, VehiclePropertyType::BYTES == mPropType) && v.stringValue.size() == 0 &&
+           payload == o.payload.get();
+}
+
+void VehiclePropValuePool::InternalPool::setPayloadSize(PooledValue* o, size_t size) const {
+    uint8_t* payload = o->payload.get();
+    forPayload(&o->value, [payload, size](auto* vec) {
+        using VecType = typename std::remove_reference<decltype((*vec)[0])>::type;
+        vec->setToExternal(reinterpret_cast<VecType*>(payload), size, false /* shouldOwn */);
+    });
 }
 
 VehiclePropValue* VehiclePropValuePool::InternalPool::createObject() {
-    return createVehiclePropValue(mPropType, mVectorSize).release();
+    PooledValue* o = new PooledValue;
+    size_t elementSize = 0;
+    forPayload(&o->value, [&elementSize](auto* vec) { elementSize = sizeof((*vec)[0]); });
+    o->payload.reset(new uint8_t[mCapacity * elementSize]());
+    setPayloadSize(o, mCapacity);
+    return o;
+}
+
+void VehiclePropValuePool::InternalPool::destroyObject(VehiclePropValue* o) {
+    delete static_cast<PooledValue*>(o);
 }
 
 }  // namespace V2_0
@@ -14,6 +14,8 @@
  * limitations under the License.
  */
 #define LOG_TAG "VehiclePropertyStore"
+#include <algorithm>
+
 #include <log/log.h>
 
 #include <common/include/vhal_v2_0/VehicleUtils.h>
@@ -26,107 +28,179 @@ namespace vehicle {
 namespace V2_0 {
 
 bool VehiclePropertyStore::RecordId::operator==(const VehiclePropertyStore::RecordId& other) const {
-    return prop == other.prop && area == other.area && token == other.token;
+    return area == other.area && token == other.token;
 }
 
 bool VehiclePropertyStore::RecordId::operator<(const VehiclePropertyStore::RecordId& other) const  {
-    return prop < other.prop
-           || (prop == other.prop && area < other.area)
-           || (prop == other.prop && area == other.area && token < other.token);
+    return area < other.area || (area == other.area && token < other.token);
+}
+
+namespace {
+
+constexpr size_t kInitialShardTableCapacity = 64;
+
+size_t hashPropId(int32_t propId) {
+    // Property ids differ mostly in the low bits, but group/area/type bits are also significant.
+    uint32_t h = static_cast<uint32_t>(propId);
+    h ^= h >> 16;
+    h *= 0x45d9f3b;
+    h ^= h >> 16;
+    return h;
+}
+
+}  // namespace
+
+VehiclePropertyStore::ShardTable::ShardTable(size_t capacity)
+        : capacity(capacity), slots(new std::atomic<PropertyShard*>[capacity]) {
+    for (size_t i = 0; i < capacity; i++) {
+        slots[i].store(nullptr, std::memory_order_relaxed);
+    }
+}
+
+VehiclePropertyStore::PropertyShard* VehiclePropertyStore::ShardTable::find(int32_t propId) const {
+    for (size_t i = hashPropId(propId) & (capacity - 1);; i = (i + 1) & (capacity - 1)) {
+        PropertyShard* shard = slots[i].load(std::memory_order_acquire);
+        if (shard == nullptr || shard->recordConfig.propConfig.prop == propId) {
+            return shard;
+        }
+    }
+}
+
+void VehiclePropertyStore::ShardTable::insert(PropertyShard* shard) {
+    size_t i = hashPropId(shard->recordConfig.propConfig.prop) & (capacity - 1);
+    while (slots[i].load(std::memory_order_relaxed) != nullptr) {
+        i = (i + 1) & (capacity - 1);
+    }
+    slots[i].store(shard, std::memory_order_release);
+    size++;
+}
+
+VehiclePropertyStore::VehiclePropertyStore() {
+    mShardTables.push_back(std::make_unique<ShardTable>(kInitialShardTableCapacity));
+    mShardTable.store(mShardTables.back().get(), std::memory_order_release);
 }
 
 void VehiclePropertyStore::registerProperty(const VehiclePropConfig& config,
                                             VehiclePropertyStore::TokenFunction tokenFunc) {
-    MuxGuard g(mLock);
-    mConfigs.insert({ config.prop, RecordConfig { config, tokenFunc } });
+    MuxGuard g(mRegisterLock);
+    ShardTable* table = mShardTables.back().get();
+    if (table->find(config.prop) != nullptr) return;
+
+    mShards.push_back(std::make_unique<PropertyShard>(config, tokenFunc));
+
+    // Keep load factor under 1/2 so probe sequences stay short.
+    if ((table->size + 1) * 2 > table->capacity) {
+        auto newTable = std::make_unique<ShardTable>(table->capacity * 2);
+        for (auto&& shard : mShards) {
+            newTable->insert(shard.get());
+        }
+        mShardTables.push_back(std::move(newTable));
+        mShardTable.store(mShardTables.back().get(), std::memory_order_release);
+    } else {
+        table->insert(mShards.back().get());
+    }
 }
 
 bool VehiclePropertyStore::writeValue(const VehiclePropValue& propValue,
                                         bool updateStatus) {
-    MuxGuard g(mLock);
-    if (!mConfigs.count(propValue.prop)) return false;
+    PropertyShard* shard = getShardOrNull(propValue.prop);
+    if (shard == nullptr) return false;
+
+    RecordId recId = getRecordId(*shard, propValue);
+    auto newValue = std::make_shared<VehiclePropValue>(propValue);
 
-    RecordId recId = getRecordIdLocked(propValue);
-    VehiclePropValue* valueToUpdate = const_cast<VehiclePropValue*>(getValueOrNullLocked(recId));
-    if (valueToUpdate == nullptr) {
-        mPropertyValues.insert({ recId, propValue });
+    MuxGuard g(shard->writeLock);
+    // Records map is only replaced under writeLock, no need for atomic_load here.
+    auto it = shard->records->find(recId);
+    if (it == shard->records->end()) {
+        auto newRecords = std::make_shared<RecordMap>(*shard->records);
+        newRecords->insert({ recId, std::make_shared<Record>(Record { std::move(newValue) }) });
+        std::atomic_store(&shard->records, std::shared_ptr<const RecordMap>(std::move(newRecords)));
     } else {
-        valueToUpdate->timestamp = propValue.timestamp;
-        valueToUpdate->value = propValue.value;
-        if (updateStatus) {
-            valueToUpdate->status = propValue.status;
+        // Only timestamp, value and optionally status are updated for existing records.
+        auto oldValue = std::atomic_load(&it->second->value);
+        newValue->prop = oldValue->prop;
+        newValue->areaId = oldValue->areaId;
+        if (!updateStatus) {
+            newValue->status = oldValue->status;
         }
+        std::atomic_store(&it->second->value, ValuePtr(std::move(newValue)));
     }
     return true;
 }
 
 void VehiclePropertyStore::removeValue(const VehiclePropValue& propValue) {
-    MuxGuard g(mLock);
-    RecordId recId = getRecordIdLocked(propValue);
-    auto it = mPropertyValues.find(recId);
-    if (it != mPropertyValues.end()) {
-        mPropertyValues.erase(it);
-    }
+    PropertyShard* shard = getShardOrNull(propValue.prop);
+    if (shard == nullptr) return;
+
+    RecordId recId = getRecordId(*shard, propValue);
+    MuxGuard g(shard->writeLock);
+    if (!shard->records->count(recId)) return;
+
+    auto newRecords = std::make_shared<RecordMap>(*shard->records);
+    newRecords->erase(recId);
+    std::atomic_store(&shard->records, std::shared_ptr<const RecordMap>(std::move(newRecords)));
 }
 
 void VehiclePropertyStore::removeValuesForProperty(int32_t propId) {
-    MuxGuard g(mLock);
-    auto range = findRangeLocked(propId);
-    mPropertyValues.erase(range.first, range.second);
+    PropertyShard* shard = getShardOrNull(propId);
+    if (shard == nullptr) return;
+
+    MuxGuard g(shard->writeLock);
+    std::atomic_store(&shard->records, std::make_shared<const RecordMap>());
 }
 
 std::vector<VehiclePropValue> VehiclePropertyStore::readAllValues() const {
-    MuxGuard g(mLock);
+    std::vector<const PropertyShard*> shards = getShardsInPropertyOrder();
     std::vector<VehiclePropValue> allValues;
-    allValues.reserve(mPropertyValues.size());
-    for (auto&& it : mPropertyValues) {
-        allValues.push_back(it.second);
+    allValues.reserve(shards.size());
+    for (const PropertyShard* shard : shards) {
+        appendValues(*shard, &allValues);
     }
     return allValues;
 }
 
 std::vector<VehiclePropValue> VehiclePropertyStore::readValuesForProperty(int32_t propId) const {
     std::vector<VehiclePropValue> values;
-    MuxGuard g(mLock);
-    auto range = findRangeLocked(propId);
-    for (auto it = range.first; it != range.second; ++it) {
-        values.push_back(it->second);
+    PropertyShard* shard = getShardOrNull(propId);
+    if (shard != nullptr) {
+        appendValues(*shard, &values);
     }
-
     return values;
 }
 
 std::unique_ptr<VehiclePropValue> VehiclePropertyStore::readValueOrNull(
         const VehiclePropValue& request) const {
-    MuxGuard g(mLock);
-    RecordId recId = getRecordIdLocked(request);
-    const VehiclePropValue* internalValue = getValueOrNullLocked(recId);
+    PropertyShard* shard = getShardOrNull(request.prop);
+    if (shard == nullptr) return nullptr;
+
+    ValuePtr internalValue = getValueOrNull(*shard, getRecordId(*shard, request));
     return internalValue ? std::make_unique<VehiclePropValue>(*internalValue) : nullptr;
 }
 
 std::unique_ptr<VehiclePropValue> VehiclePropertyStore::readValueOrNull(
         int32_t prop, int32_t area, int64_t token) const {
-    RecordId recId = {prop, isGlobalProp(prop) ? 0 : area, token };
-    MuxGuard g(mLock);
-    const VehiclePropValue* internalValue = getValueOrNullLocked(recId);
+    PropertyShard* shard = getShardOrNull(prop);
+    if (shard == nullptr) return nullptr;
+
+    RecordId recId = { isGlobalProp(prop) ? 0 : area, token };
+    ValuePtr internalValue = getValueOrNull(*shard, recId);
     return internalValue ? std::make_unique<VehiclePropValue>(*internalValue) : nullptr;
 }
 
-
 std::vector<VehiclePropConfig> VehiclePropertyStore::getAllConfigs() const {
-    MuxGuard g(mLock);
+    std::vector<const PropertyShard*> shards = getShardsInPropertyOrder();
     std::vector<VehiclePropConfig> configs;
-    configs.reserve(mConfigs.size());
-    for (auto&& recordConfigIt: mConfigs) {
-        configs.push_back(recordConfigIt.second.propConfig);
+    configs.reserve(shards.size());
+    for (const PropertyShard* shard : shards) {
+        configs.push_back(shard->recordConfig.propConfig);
     }
     return configs;
 }
 
 const VehiclePropConfig* VehiclePropertyStore::getConfigOrNull(int32_t propId) const {
-    MuxGuard g(mLock);
-    auto recordConfigIt = mConfigs.find(propId);
-    return recordConfigIt != mConfigs.end() ? &recordConfigIt->second.propConfig : nullptr;
+    PropertyShard* shard = getShardOrNull(propId);
+    return shard != nullptr ? &shard->recordConfig.propConfig : nullptr;
 }
 
 const VehiclePropConfig* VehiclePropertyStore::getConfigOrDie(int32_t propId) const {
@@ -138,35 +212,49 @@ const VehiclePropConfig* VehiclePropertyStore::getConfigOrDie(int32_t propId) co
     return cfg;
 }
 
-VehiclePropertyStore::RecordId VehiclePropertyStore::getRecordIdLocked(
-        const VehiclePropValue& valuePrototype) const {
+VehiclePropertyStore::RecordId VehiclePropertyStore::getRecordId(
+        const PropertyShard& shard, const VehiclePropValue& valuePrototype) {
     RecordId recId = {
-        .prop = valuePrototype.prop,
         .area = isGlobalProp(valuePrototype.prop) ? 0 : valuePrototype.areaId,
         .token = 0
     };
 
-    auto it = mConfigs.find(recId.prop);
-    if (it == mConfigs.end()) return {};
-
-    if (it->second.tokenFunction != nullptr) {
-        recId.token = it->second.tokenFunction(valuePrototype);
+    if (shard.recordConfig.tokenFunction != nullptr) {
+        recId.token = shard.recordConfig.tokenFunction(valuePrototype);
     }
     return recId;
 }
 
-const VehiclePropValue* VehiclePropertyStore::getValueOrNullLocked(
-        const VehiclePropertyStore::RecordId& recId) const  {
-    auto it = mPropertyValues.find(recId);
-    return it == mPropertyValues.end() ? nullptr : &it->second;
+VehiclePropertyStore::ValuePtr VehiclePropertyStore::getValueOrNull(
+        const PropertyShard& shard, const VehiclePropertyStore::RecordId& recId) {
+    auto records = std::atomic_load(&shard.records);
+    auto it = records->find(recId);
+    return it == records->end() ? nullptr : std::atomic_load(&it->second->value);
 }
 
-VehiclePropertyStore::PropertyMapRange VehiclePropertyStore::findRangeLocked(int32_t propId) const {
-    // Based on the fact that mPropertyValues is a sorted map by RecordId.
-    auto beginIt = mPropertyValues.lower_bound( RecordId { propId, INT32_MIN, 0 });
-    auto endIt = mPropertyValues.lower_bound( RecordId { propId + 1, INT32_MIN, 0 });
+std::vector<const VehiclePropertyStore::PropertyShard*>
+VehiclePropertyStore::getShardsInPropertyOrder() const {
+    const ShardTable* table = mShardTable.load(std::memory_order_acquire);
+    std::vector<const PropertyShard*> shards;
+    shards.reserve(table->capacity / 2);
+    for (size_t i = 0; i < table->capacity; i++) {
+        const PropertyShard* shard = table->slots[i].load(std::memory_order_acquire);
+        if (shard != nullptr) {
+            shards.push_back(shard);
+        }
+    }
+    std::sort(shards.begin(), shards.end(), [](const PropertyShard* a, const PropertyShard* b) {
+        return a->recordConfig.propConfig.prop < b->recordConfig.propConfig.prop;
+    });
+    return shards;
+}
 
-    return  PropertyMapRange { beginIt, endIt };
+void VehiclePropertyStore::appendValues(const PropertyShard& shard,
+                                        std::vector<VehiclePropValue>* values) {
+    auto records = std::atomic_load(&shard.records);
+    for (auto&& it : *records) {
+        values->push_back(*std::atomic_load(&it.second->value));
+    }
 }
 
 }  // namespace V2_0
@@ -0,0 +1,418 @@
+/*
+ * Copyright (C) 2018 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#define LOG_TAG "VehiclePropertyStoreSnapshot"
+#include <log/log.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <type_traits>
+
+#include "VehiclePropertyStoreSnapshot.h"
+
+namespace android {
+namespace hardware {
+namespace automotive {
+namespace vehicle {
+namespace V2_0 {
+
+namespace {
+
+struct SnapshotHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t configCount;
+    uint32_t valueCount;
+    uint64_t payloadSize;
+    uint32_t checksum;  // FNV-1a of the payload words.
+    uint32_t reserved;
+};
+static_assert(sizeof(SnapshotHeader) == 32, "Snapshot header layout must not change");
+
+// Payload is always 4-byte aligned in size, so it is hashed a word at a time.
+uint32_t checksum(const uint8_t* data, size_t size) {
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i + sizeof(uint32_t) <= size; i += sizeof(uint32_t)) {
+        uint32_t word;
+        memcpy(&word, data + i, sizeof(word));
+        hash = (hash ^ word) * 16777619u;
+    }
+    return hash;
+}
+
+size_t alignUp(size_t size) {
+    return (size + 3) & ~size_t(3);
+}
+
+class Encoder {
+public:
+    explicit Encoder(std::vector<uint8_t>* out) : mOut(out) {}
+
+    template <typename T>
+    void put(T value) {
+        static_assert(std::is_trivially_copyable<T>::value, "Only plain values can be encoded");
+        append(&value, sizeof(value));
+    }
+
+    template <typename T>
+    void putVector(const hidl_vec<T>& vec) {
+        put(static_cast<uint32_t>(vec.size()));
+        append(vec.data(), vec.size() * sizeof(T));
+    }
+
+    void putString(const hidl_string& str) {
+        put(static_cast<uint32_t>(str.size()));
+        append(str.c_str(), str.size());
+    }
+
+    void putConfig(const VehiclePropConfig& config) {
+        size_t start = beginRecord();
+        put(config.prop);
+        put(config.access);
+        put(config.changeMode);
+        put(static_cast<uint32_t>(config.areaConfigs.size()));
+        for (const auto& areaConfig : config.areaConfigs) {
+            put(areaConfig.areaId);
+            put(areaConfig.minInt32Value);
+            put(areaConfig.maxInt32Value);
+            put(areaConfig.minInt64Value);
+            put(areaConfig.maxInt64Value);
+            put(areaConfig.minFloatValue);
+            put(areaConfig.maxFloatValue);
+        }
+        putVector(config.configArray);
+        putString(config.configString);
+        put(config.minSampleRate);
+        put(config.maxSampleRate);
+        endRecord(start);
+    }
+
+    void putValue(const VehiclePropValue& value) {
+        size_t start = beginRecord();
+        put(value.timestamp);
+        put(value.areaId);
+        put(value.prop);
+        put(value.status);
+        putVector(value.value.int32Values);
+        putVector(value.value.floatValues);
+        putVector(value.value.int64Values);
+        putVector(value.value.bytes);
+        putString(value.value.stringValue);
+        endRecord(start);
+    }
+
+private:
+    void append(const void* data, size_t size) {
+        const uint8_t* bytes = static_cast<const uint8_t*>(data);
+        mOut->insert(mOut->end(), bytes, bytes + size);
+        mOut->resize(alignUp(mOut->size()));
+    }
+
+    // Records are prefixed with their size, which is filled in when the record is complete.
+    size_t beginRecord() {
+        size_t start = mOut->size();
+        put(uint32_t(0));
+        return start;
+    }
+
+    void endRecord(size_t start) {
+        uint32_t size = mOut->size() - start - sizeof(uint32_t);
+        memcpy(mOut->data() + start, &size, sizeof(size));
+    }
+
+    std::vector<uint8_t>* mOut;
+};
+
+/* Bounds checked reader, once it runs out of data all subsequent reads fail. */
+class Decoder {
+public:
+    Decoder(const uint8_t* data, size_t size) : mData(data), mSize(size) {}
+
+    bool ok() const { return mOk; }
+    bool atEnd() const { return mPos == mSize; }
+
+    template <typename T>
+    bool get(T* value) {
+        return read(value, sizeof(T));
+    }
+
+    template <typename T>
+    bool getVector(hidl_vec<T>* vec) {
+        uint32_t count = 0;
+        if (!get(&count) || count > (mSize - mPos) / sizeof(T)) {
+            return fail();
+        }
+        if (count == 0) {
+            return true;  // Most vectors are empty, don't allocate for them.
+        }
+        vec->resize(count);
+        return read(vec->data(), count * sizeof(T));
+    }
+
+    bool getString(hidl_string* str) {
+        uint32_t length = 0;
+        if (!get(&length) || length > mSize - mPos) {
+            return fail();
+        }
+        if (length > 0) {
+            *str = std::string(reinterpret_cast<const char*>(mData + mPos), length);
+        }
+        return skip(length);
+    }
+
+    /* Returns decoder over the next record and moves past it. */
+    Decoder nextRecord() {
+        uint32_t size = 0;
+        if (!get(&size) || size > mSize - mPos) {
+            fail();
+            return Decoder(nullptr, 0, false);
+        }
+        Decoder record(mData + mPos, size);
+        skip(size);
+        return record;
+    }
+
+    /* Raw bytes of the record without decoding, used to compare configs. */
+    const uint8_t* data() const { return mData; }
+    size_t size() const { return mSize; }
+
+private:
+    Decoder(const uint8_t* data, size_t size, bool ok) : mData(data), mSize(size), mOk(ok) {}
+
+    bool read(void* out, size_t size) {
+        if (!mOk || size > mSize - mPos) {
+            return fail();
+        }
+        if (size > 0) {
+            memcpy(out, mData + mPos, size);
+        }
+        return skip(size);
+    }
+
+    bool skip(size_t size) {
+        mPos = std::min(mSize, mPos + alignUp(size));
+        return mOk;
+    }
+
+    bool fail() {
+        mOk = false;
+        return false;
+    }
+
+    const uint8_t* mData;
+    size_t mSize;
+    size_t mPos = 0;
+    bool mOk = true;
+};
+
+bool decodeValue(Decoder* d, VehiclePropValue* value) {
+    d->get(&value->timestamp);
+    d->get(&value->areaId);
+    d->get(&value->prop);
+    d->get(&value->status);
+    d->getVector(&value->value.int32Values);
+    d->getVector(&value->value.floatValues);
+    d->getVector(&value->value.int64Values);
+    d->getVector(&value->value.bytes);
+    d->getString(&value->value.stringValue);
+    return d->ok() && d->atEnd();
+}
+
+}  // namespace
+
+std::vector<uint8_t> VehiclePropertyStoreSnapshot::serialize(const VehiclePropertyStore& store) {
+    std::vector<VehiclePropConfig> configs = store.getAllConfigs();
+    std::vector<VehiclePropValue> values = store.readAllValues();
+
+    std::vector<uint8_t> out(sizeof(SnapshotHeader));
+    Encoder encoder(&out);
+    for (const auto& config : configs) {
+        encoder.putConfig(config);
+    }
+    for (const auto& value : values) {
+        encoder.putValue(value);
+    }
+
+    SnapshotHeader header {
+        .magic = kMagic,
+        .version = kVersion,
+        .configCount = static_cast<uint32_t>(configs.size()),
+        .valueCount = static_cast<uint32_t>(values.size()),
+        .payloadSize = out.size() - sizeof(SnapshotHeader),
+        .checksum = checksum(out.data() + sizeof(SnapshotHeader),
+                             out.size() - sizeof(SnapshotHeader)),
+        .reserved = 0,
+    };
+    memcpy(out.data(), &header, sizeof(header));
+    return out;
+}
+
+int VehiclePropertyStoreSnapshot::deserialize(const uint8_t* data, size_t size,
+                                              VehiclePropertyStore* store) {
+    SnapshotHeader header;
+    if (size < sizeof(header)) {
+        ALOGE("Snapshot is too short: %zu bytes", size);
+        return -1;
+    }
+    memcpy(&header, data, sizeof(header));
+    const uint8_t* payload = data + sizeof(header);
+    if (header.magic != kMagic || header.version != kVersion) {
+        ALOGE("Unsupported snapshot, magic: 0x%x, version: %u", header.magic, header.version);
+        return -1;
+    }
+    if (header.payloadSize != size - sizeof(header) || header.payloadSize % sizeof(uint32_t) != 0
+            || header.checksum != checksum(payload, header.payloadSize)) {
+        ALOGE("Snapshot is corrupted");
+        return -1;
+    }
+
+    // The counts are not covered by the checksum. Each record takes at least its size word, which
+    // bounds them before anything is allocated for them.
+    const uint64_t recordCount = static_cast<uint64_t>(header.configCount) + header.valueCount;
+    if (recordCount > header.payloadSize / sizeof(uint32_t)) {
+        ALOGE("Snapshot header has too many records: %u configs, %u values",
+              header.configCount, header.valueCount);
+        return -1;
+    }
+
+    // Check the layout first, so the store is not modified if the snapshot turns out invalid.
+    Decoder decoder(payload, header.payloadSize);
+    std::vector<Decoder> records;
+    records.reserve(recordCount);
+    for (uint64_t i = 0; i < recordCount && decoder.ok(); i++) {
+        records.push_back(decoder.nextRecord());
+    }
+    if (!decoder.ok() || !decoder.atEnd()) {
+        ALOGE("Snapshot layout doesn't match its header");
+        return -1;
+    }
+
+    // Values are only restored for properties the store still supports with the same config, so
+    // the snapshot can neither resurrect removed properties nor feed values that might not be
+    // valid for a new config, e.g. with a different set of areas.
+    std::vector<int32_t> restorableProps;
+    std::vector<uint8_t> encoded;
+    for (uint32_t i = 0; i < header.configCount; i++) {
+        const Decoder& record = records[i];
+        int32_t propId = 0;
+        if (record.size() >= sizeof(propId)) {
+            memcpy(&propId, record.data(), sizeof(propId));
+        }
+        const VehiclePropConfig* registered = store->getConfigOrNull(propId);
+        if (registered == nullptr) {
+            ALOGI("Property 0x%x is no longer supported, ignoring its values", propId);
+            continue;
+        }
+        // Configs are compared in their encoded form.
+        encoded.clear();
+        Encoder(&encoded).putConfig(*registered);
+        if (encoded.size() != record.size() + sizeof(uint32_t)
+                || memcmp(encoded.data() + sizeof(uint32_t), record.data(), record.size()) != 0) {
+            ALOGW("Config of property 0x%x has changed, ignoring its values", propId);
+            continue;
+        }
+        restorableProps.push_back(propId);
+    }
+
+    int restored = 0;
+    for (uint32_t i = header.configCount; i < records.size(); i++) {
+        VehiclePropValue value;
+        if (!decodeValue(&records[i], &value)) {
+            ALOGE("Unable to decode value record");
+            continue;
+        }
+        if (std::find(restorableProps.begin(), restorableProps.end(), value.prop)
+                == restorableProps.end()) {
+            continue;
+        }
+        if (store->writeValue(value, true /* updateStatus */)) {
+            restored++;
+        }
+    }
+    return restored;
+}
+
+bool VehiclePropertyStoreSnapshot::save(const VehiclePropertyStore& store,
+                                        const std::string& path) {
+    std::vector<uint8_t> data = serialize(store);
+    std::string tmpPath = path + ".tmp";
+
+    int fd = TEMP_FAILURE_RETRY(open(tmpPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC,
+                                     0600));
+    if (fd < 0) {
+        ALOGE("Unable to create %s: %s", tmpPath.c_str(), strerror(errno));
+        return false;
+    }
+
+    size_t written = 0;
+    while (written < data.size()) {
+        ssize_t n = TEMP_FAILURE_RETRY(write(fd, data.data() + written, data.size() - written));
+        if (n < 0) {
+            ALOGE("Unable to write %s: %s", tmpPath.c_str(), strerror(errno));
+            close(fd);
+            unlink(tmpPath.c_str());
+            return false;
+        }
+        written += n;
+    }
+
+    bool ok = fsync(fd) == 0;
+    close(fd);
+    if (!ok || rename(tmpPath.c_str(), path.c_str()) != 0) {
+        ALOGE("Unable to store snapshot to %s: %s", path.c_str(), strerror(errno));
+        unlink(tmpPath.c_str());
+        return false;
+    }
+    return true;
+}
+
+int VehiclePropertyStoreSnapshot::restore(const std::string& path, VehiclePropertyStore* store) {
+    int fd = TEMP_FAILURE_RETRY(open(path.c_str(), O_RDONLY | O_CLOEXEC));
+    if (fd < 0) {
+        if (errno != ENOENT) {
+            ALOGE("Unable to open %s: %s", path.c_str(), strerror(errno));
+        }
+        return -1;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size == 0) {
+        close(fd);
+        return -1;
+    }
+    size_t size = st.st_size;
+    void* data = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        ALOGE("Unable to map %s: %s", path.c_str(), strerror(errno));
+        return -1;
+    }
+
+    int restored = deserialize(static_cast<const uint8_t*>(data), size, store);
+    munmap(data, size);
+    return restored;
+}
+
+}  // namespace V2_0
+}  // namespace vehicle
+}  // namespace automotive
+}  // namespace hardware
+}  // namespace android
@@ -42,28 +42,34 @@ void CommConn::stop() {
 }
 
 void CommConn::sendMessage(emulator::EmulatorMessage const& msg) {
+    std::lock_guard<std::mutex> lock(mTxMutex);
     int numBytes = msg.ByteSize();
-    std::vector<uint8_t> buffer(static_cast<size_t>(numBytes));
-    if (!msg.SerializeToArray(buffer.data(), numBytes)) {
+    // Keeps capacity, so the buffer is only reallocated for a message larger than all before.
+    mTxBuffer.resize(static_cast<size_t>(numBytes));
+    if (!msg.SerializeToArray(mTxBuffer.data(), numBytes)) {
         ALOGE("%s: SerializeToString failed!", __func__);
         return;
     }
 
-    write(buffer);
+    write(mTxBuffer);
 }
 
 void CommConn::readThread() {
-    std::vector<uint8_t> buffer;
+    // Messages are reused between iterations, protobuf keeps memory of cleared repeated fields
+    // and strings, so parsing a stream of similar messages doesn't allocate.
+    emulator::EmulatorMessage rxMsg;
+    emulator::EmulatorMessage respMsg;
+    const uint8_t* data;
+    size_t size;
+
     while (isOpen()) {
-        buffer = read();
-        if (buffer.size() == 0) {
+        if (!read(&data, &size) || size == 0) {
             ALOGI("%s: Read returned empty message, exiting read loop.", __func__);
             break;
         }
 
-        emulator::EmulatorMessage rxMsg;
-        if (rxMsg.ParseFromArray(buffer.data(), static_cast<int32_t>(buffer.size()))) {
-            emulator::EmulatorMessage respMsg;
+        if (rxMsg.ParseFromArray(data, static_cast<int32_t>(size))) {
+            respMsg.Clear();
             mMessageProcessor->processMessage(rxMsg, respMsg);
 
             sendMessage(respMsg);
@@ -18,6 +18,7 @@
 #define android_hardware_automotive_vehicle_V2_0_impl_CommBase_H_
 
 #include <android/hardware/automotive/vehicle/2.0/IVehicle.h>
+#include <mutex>
 #include <string>
 #include <thread>
 #include <vector>
@@ -74,12 +75,17 @@ class CommConn {
     virtual bool isOpen() = 0;
 
     /**
-     * Blocking call to read data from the connection.
+     * Blocking call to read next message from the connection. Messages are read into a receive
+     * buffer owned by the connection, so no allocation happens once the buffer has grown to the
+     * size of the largest message.
      *
-     * @return std::vector<uint8_t> Serialized protobuf data received from emulator.  This will be
-     *              an empty vector if the connection was closed or some other error occurred.
+     * @param data Set to serialized protobuf data received from emulator. It stays valid until
+     *              the next call to read().
+     * @param size Set to the size of the data.
+     *
+     * @return bool False if the connection was closed or some other error occurred.
      */
-    virtual std::vector<uint8_t> read() = 0;
+    virtual bool read(const uint8_t** data, size_t* size) = 0;
 
     /**
      * Transmits a string of data to the emulator.
@@ -99,6 +105,10 @@ class CommConn {
     std::unique_ptr<std::thread> mReadThread;
     MessageProcessor* mMessageProcessor;
 
+    // Serializes writes from the read thread and from the HAL, guards mTxBuffer.
+    std::mutex mTxMutex;
+    std::vector<uint8_t> mTxBuffer;
+
     /**
      * A thread that reads messages in a loop, and responds. You can stop this thread by calling
      * stop().
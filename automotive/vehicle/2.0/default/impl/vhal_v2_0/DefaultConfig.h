@@ -122,7 +122,12 @@ enum class FakeDataCommand : int32_t {
      * Caller must provide additional data:
      *     int32Values[1] - number of iterations. If it is not provided or -1. The iteration will be
      *                      repeated infinite times.
-     *     stringValue    - path to the fake values JSON file
+     *     floatValues[0] - optional replay speed, e.g. 10 replays the trace 10 times faster than
+     *                      it was recorded. Events are replayed in real time by default.
+     *     stringValue    - path to the fake values JSON file or to the binary trace compiled from
+     *                      it by android.hardware.automotive.vehicle@2.0-trace-compiler
+     *
+     * Several traces can be replayed at the same time, events of all of them are merged by time.
      */
     StartJson = 2,
 
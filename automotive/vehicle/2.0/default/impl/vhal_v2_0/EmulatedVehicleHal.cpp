@@ -15,6 +15,9 @@
  */
 #define LOG_TAG "DefaultVehicleHal_v2_0"
 
+#include <algorithm>
+#include <iterator>
+
 #include <android/log.h>
 #include <android-base/macros.h>
 
@@ -31,6 +34,9 @@ namespace V2_0 {
 
 namespace impl {
 
+// How often the property store snapshot is updated if values have changed.
+static constexpr std::chrono::seconds kSnapshotInterval(30);
+
 static std::unique_ptr<Obd2SensorStore> fillDefaultObd2Frame(size_t numVendorIntegerSensors,
                                                              size_t numVendorFloatSensors) {
     std::unique_ptr<Obd2SensorStore> sensorStore(
@@ -87,13 +93,17 @@ static std::unique_ptr<Obd2SensorStore> fillDefaultObd2Frame(size_t numVendorInt
     return sensorStore;
 }
 
-EmulatedVehicleHal::EmulatedVehicleHal(VehiclePropertyStore* propStore)
+EmulatedVehicleHal::EmulatedVehicleHal(VehiclePropertyStore* propStore,
+                                       const std::string& snapshotPath)
     : mPropStore(propStore),
       mHvacPowerProps(std::begin(kHvacPowerProperties), std::end(kHvacPowerProperties)),
       mRecurrentTimer(
           std::bind(&EmulatedVehicleHal::onContinuousPropertyTimer, this, std::placeholders::_1)),
       mGeneratorHub(
-          std::bind(&EmulatedVehicleHal::onFakeValueGenerated, this, std::placeholders::_1)) {
+          std::bind(&EmulatedVehicleHal::onFakeValueGenerated, this, std::placeholders::_1)),
+      mSnapshotPath(snapshotPath),
+      mSnapshotTimer(std::bind(&EmulatedVehicleHal::onSnapshotTimer, this, std::placeholders::_1),
+                     std::chrono::seconds(1) /* resolution */) {
     initStaticConfig();
     for (size_t i = 0; i < arraysize(kVehicleProperties); i++) {
         mPropStore->registerProperty(kVehicleProperties[i].config);
@@ -107,6 +117,10 @@ VehicleHal::VehiclePropValuePtr EmulatedVehicleHal::get(
     VehiclePropValuePtr v = nullptr;
 
     switch (propId) {
+        case OBD2_LIVE_FRAME:
+            v = pool.obtainComplex();
+            *outStatus = fillObd2LiveFrame(v.get());
+            break;
         case OBD2_FREEZE_FRAME:
             v = pool.obtainComplex();
             *outStatus = fillObd2FreezeFrame(requestedPropValue, v.get());
@@ -201,6 +215,7 @@ StatusCode EmulatedVehicleHal::set(const VehiclePropValue& propValue) {
     if (!mPropStore->writeValue(propValue, shouldUpdateStatus)) {
         return StatusCode::INVALID_ARG;
     }
+    markSnapshotDirty(propValue.prop);
 
     getEmulatorOrDie()->doSetValueFromClient(propValue);
     doHalEvent(getValuePool()->obtain(propValue));
@@ -267,8 +282,23 @@ void EmulatedVehicleHal::onCreate() {
             mPropStore->writeValue(prop, shouldUpdateStatus);
         }
     }
+
+    // Restored values override the defaults, properties added or re-configured since the
+    // snapshot was taken keep their default values.
+    if (!mSnapshotPath.empty()) {
+        mSnapshotTimer.registerRecurrentEvent(kSnapshotInterval, 0 /* cookie */);
+        int restored = VehiclePropertyStoreSnapshot::restore(mSnapshotPath, mPropStore);
+        if (restored > 0) {
+            ALOGI("Restored %d property values from %s", restored, mSnapshotPath.c_str());
+        }
+        // Take a snapshot of the current configs as soon as possible, so that stale entries are
+        // dropped from it.
+        mSnapshotDirty = true;
+    }
+
+    // Diagnostic frames are never restored.
     initObd2LiveFrame(*mPropStore->getConfigOrDie(OBD2_LIVE_FRAME));
-    initObd2FreezeFrame(*mPropStore->getConfigOrDie(OBD2_FREEZE_FRAME));
+    initObd2FreezeFrame();
 }
 
 std::vector<VehiclePropConfig> EmulatedVehicleHal::listProperties()  {
@@ -331,9 +361,27 @@ bool EmulatedVehicleHal::setPropertyFromVehicle(const VehiclePropValue& propValu
         if (status != StatusCode::OK) {
             return false;
         }
+    } else if (propValue.prop == OBD2_LIVE_FRAME) {
+        std::lock_guard<std::mutex> lock(mObd2Lock);
+        if (mObd2SensorStore->setSensors(propValue) != StatusCode::OK) {
+            ALOGE("%s: OBD2_LIVE_FRAME doesn't match the configured sensors", __func__);
+            return false;
+        }
+    } else if (propValue.prop == OBD2_FREEZE_FRAME) {
+        // Freeze frames are kept by the sensor store, where get, info and clear find them.
+        {
+            std::lock_guard<std::mutex> lock(mObd2Lock);
+            if (mObd2SensorStore->addFreezeFrame(propValue) != StatusCode::OK) {
+                ALOGE("%s: OBD2_FREEZE_FRAME doesn't match the configured sensors", __func__);
+                return false;
+            }
+        }
+        doHalEvent(getValuePool()->obtain(propValue));
+        return true;
     }
 
     if (mPropStore->writeValue(propValue, shouldUpdateStatus)) {
+        markSnapshotDirty(propValue.prop);
         doHalEvent(getValuePool()->obtain(propValue));
         return true;
     } else {
@@ -342,7 +390,30 @@ bool EmulatedVehicleHal::setPropertyFromVehicle(const VehiclePropValue& propValu
 }
 
 std::vector<VehiclePropValue> EmulatedVehicleHal::getAllProperties() const  {
-    return mPropStore->readAllValues();
+    std::vector<VehiclePropValue> values = mPropStore->readAllValues();
+    // Freeze frames are not in the property store, they go where the store would keep them: in
+    // property order, sorted by their timestamp token.
+    std::vector<VehiclePropValue> freezeFrames;
+    {
+        std::lock_guard<std::mutex> lock(mObd2Lock);
+        if (mObd2SensorStore != nullptr) {
+            for (int64_t timestamp : mObd2SensorStore->getFreezeFrameTimestamps()) {
+                VehiclePropValue freezeFrame;
+                mObd2SensorStore->fillFreezeFrame(timestamp, &freezeFrame);
+                freezeFrame.prop = OBD2_FREEZE_FRAME;
+                freezeFrames.push_back(std::move(freezeFrame));
+            }
+        }
+    }
+    std::sort(freezeFrames.begin(), freezeFrames.end(),
+            [](const VehiclePropValue& a, const VehiclePropValue& b) {
+                return a.timestamp < b.timestamp;
+            });
+    auto position = std::upper_bound(values.begin(), values.end(), OBD2_FREEZE_FRAME,
+            [](int32_t prop, const VehiclePropValue& value) { return prop < value.prop; });
+    values.insert(position, std::make_move_iterator(freezeFrames.begin()),
+                  std::make_move_iterator(freezeFrames.end()));
+    return values;
 }
 
 StatusCode EmulatedVehicleHal::handleGenerateFakeDataRequest(const VehiclePropValue& request) {
@@ -458,6 +529,7 @@ void EmulatedVehicleHal::onFakeValueGenerated(const VehiclePropValue& value) {
         updatedPropValue->timestamp = elapsedRealtimeNano();
         updatedPropValue->status = VehiclePropertyStatus::AVAILABLE;
         mPropStore->writeValue(*updatedPropValue, shouldUpdateStatus);
+        markSnapshotDirty(value.prop);
         auto changeMode = mPropStore->getConfigOrDie(value.prop)->changeMode;
         if (VehiclePropertyChangeMode::ON_CHANGE == changeMode) {
             doHalEvent(std::move(updatedPropValue));
@@ -489,32 +561,32 @@ void EmulatedVehicleHal::initObd2LiveFrame(const VehiclePropConfig& propConfig)
     static constexpr bool shouldUpdateStatus = true;
 
     auto liveObd2Frame = createVehiclePropValue(VehiclePropertyType::MIXED, 0);
-    auto sensorStore = fillDefaultObd2Frame(static_cast<size_t>(propConfig.configArray[0]),
+    std::lock_guard<std::mutex> lock(mObd2Lock);
+    mObd2SensorStore = fillDefaultObd2Frame(static_cast<size_t>(propConfig.configArray[0]),
                                             static_cast<size_t>(propConfig.configArray[1]));
-    sensorStore->fillPropValue("", liveObd2Frame.get());
+    mObd2SensorStore->fillPropValue("", liveObd2Frame.get());
     liveObd2Frame->prop = OBD2_LIVE_FRAME;
 
     mPropStore->writeValue(*liveObd2Frame, shouldUpdateStatus);
 }
 
-void EmulatedVehicleHal::initObd2FreezeFrame(const VehiclePropConfig& propConfig) {
-    static constexpr bool shouldUpdateStatus = true;
-
-    auto sensorStore = fillDefaultObd2Frame(static_cast<size_t>(propConfig.configArray[0]),
-                                            static_cast<size_t>(propConfig.configArray[1]));
-
+void EmulatedVehicleHal::initObd2FreezeFrame() {
     static std::vector<std::string> sampleDtcs = {"P0070",
                                                   "P0102"
                                                   "P0123"};
+    std::lock_guard<std::mutex> lock(mObd2Lock);
     for (auto&& dtc : sampleDtcs) {
-        auto freezeFrame = createVehiclePropValue(VehiclePropertyType::MIXED, 0);
-        sensorStore->fillPropValue(dtc, freezeFrame.get());
-        freezeFrame->prop = OBD2_FREEZE_FRAME;
-
-        mPropStore->writeValue(*freezeFrame, shouldUpdateStatus);
+        mObd2SensorStore->captureFreezeFrame(dtc);
     }
 }
 
+StatusCode EmulatedVehicleHal::fillObd2LiveFrame(VehiclePropValue* outValue) {
+    std::lock_guard<std::mutex> lock(mObd2Lock);
+    mObd2SensorStore->fillPropValue("", outValue);
+    outValue->prop = OBD2_LIVE_FRAME;
+    return StatusCode::OK;
+}
+
 StatusCode EmulatedVehicleHal::fillObd2FreezeFrame(const VehiclePropValue& requestedPropValue,
                                                    VehiclePropValue* outValue) {
     if (requestedPropValue.value.int64Values.size() != 1) {
@@ -522,47 +594,62 @@ StatusCode EmulatedVehicleHal::fillObd2FreezeFrame(const VehiclePropValue& reque
         return StatusCode::INVALID_ARG;
     }
     auto timestamp = requestedPropValue.value.int64Values[0];
-    auto freezeFrame = mPropStore->readValueOrNull(OBD2_FREEZE_FRAME, 0, timestamp);
-    if (freezeFrame == nullptr) {
+    std::lock_guard<std::mutex> lock(mObd2Lock);
+    if (mObd2SensorStore->fillFreezeFrame(timestamp, outValue) != StatusCode::OK) {
         ALOGE("asked for OBD2_FREEZE_FRAME at invalid timestamp");
         return StatusCode::INVALID_ARG;
     }
     outValue->prop = OBD2_FREEZE_FRAME;
-    outValue->value.int32Values = freezeFrame->value.int32Values;
-    outValue->value.floatValues = freezeFrame->value.floatValues;
-    outValue->value.bytes = freezeFrame->value.bytes;
-    outValue->value.stringValue = freezeFrame->value.stringValue;
-    outValue->timestamp = freezeFrame->timestamp;
     return StatusCode::OK;
 }
 
 StatusCode EmulatedVehicleHal::clearObd2FreezeFrames(const VehiclePropValue& propValue) {
+    std::lock_guard<std::mutex> lock(mObd2Lock);
     if (propValue.value.int64Values.size() == 0) {
-        mPropStore->removeValuesForProperty(OBD2_FREEZE_FRAME);
+        mObd2SensorStore->clearFreezeFrames();
         return StatusCode::OK;
     } else {
         for (int64_t timestamp : propValue.value.int64Values) {
-            auto freezeFrame = mPropStore->readValueOrNull(OBD2_FREEZE_FRAME, 0, timestamp);
-            if (freezeFrame == nullptr) {
+            if (mObd2SensorStore->removeFreezeFrame(timestamp) != StatusCode::OK) {
                 ALOGE("asked for OBD2_FREEZE_FRAME at invalid timestamp");
                 return StatusCode::INVALID_ARG;
             }
-            mPropStore->removeValue(*freezeFrame);
         }
     }
     return StatusCode::OK;
 }
 
 StatusCode EmulatedVehicleHal::fillObd2DtcInfo(VehiclePropValue* outValue) {
-    std::vector<int64_t> timestamps;
-    for (const auto& freezeFrame : mPropStore->readValuesForProperty(OBD2_FREEZE_FRAME)) {
-        timestamps.push_back(freezeFrame.timestamp);
-    }
-    outValue->value.int64Values = timestamps;
+    std::lock_guard<std::mutex> lock(mObd2Lock);
+    outValue->value.int64Values = mObd2SensorStore->getFreezeFrameTimestamps();
     outValue->prop = OBD2_FREEZE_FRAME_INFO;
     return StatusCode::OK;
 }
 
+void EmulatedVehicleHal::markSnapshotDirty(int32_t propId) {
+    // Continuous properties change with every sample, they are saved along with the next change
+    // of any other property instead of causing a snapshot every interval.
+    const VehiclePropConfig* config = mPropStore->getConfigOrNull(propId);
+    if (config == nullptr || config->changeMode != VehiclePropertyChangeMode::CONTINUOUS) {
+        mSnapshotDirty = true;
+    }
+}
+
+void EmulatedVehicleHal::onSnapshotTimer(const std::vector<int32_t>& /* cookies */) {
+    if (!mSnapshotDirty.exchange(false)) {
+        return;
+    }
+    bool saved = VehiclePropertyStoreSnapshot::save(*mPropStore, mSnapshotPath);
+    if (!saved && !mSnapshotSaveFailed) {
+        // Keep trying, but do not flood the log if the location is not writable.
+        ALOGW("Unable to save property store snapshot, will retry silently");
+    }
+    mSnapshotSaveFailed = !saved;
+    if (!saved) {
+        mSnapshotDirty = true;
+    }
+}
+
 }  // impl
 
 }  // namespace V2_0
@@ -17,8 +17,10 @@
 #ifndef android_hardware_automotive_vehicle_V2_0_impl_EmulatedVehicleHal_H_
 #define android_hardware_automotive_vehicle_V2_0_impl_EmulatedVehicleHal_H_
 
+#include <atomic>
 #include <map>
 #include <memory>
+#include <mutex>
 #include <sys/socket.h>
 #include <thread>
 #include <unordered_set>
@@ -27,7 +29,9 @@
 
 #include <vhal_v2_0/RecurrentTimer.h>
 #include <vhal_v2_0/VehicleHal.h>
+#include "vhal_v2_0/Obd2SensorStore.h"
 #include "vhal_v2_0/VehiclePropertyStore.h"
+#include "vhal_v2_0/VehiclePropertyStoreSnapshot.h"
 
 #include "DefaultConfig.h"
 #include "GeneratorHub.h"
@@ -44,7 +48,10 @@ namespace impl {
 /** Implementation of VehicleHal that connected to emulator instead of real vehicle network. */
 class EmulatedVehicleHal : public EmulatedVehicleHalIface {
 public:
-    EmulatedVehicleHal(VehiclePropertyStore* propStore);
+    /* If snapshotPath is not empty, the values restored from the snapshot on create are laid over
+     * the default values, and the snapshot is periodically updated while non-continuous values
+     * keep changing. */
+    EmulatedVehicleHal(VehiclePropertyStore* propStore, const std::string& snapshotPath = "");
     ~EmulatedVehicleHal() = default;
 
     //  Methods from VehicleHal
@@ -75,17 +82,29 @@ private:
     bool isContinuousProperty(int32_t propId) const;
     void initStaticConfig();
     void initObd2LiveFrame(const VehiclePropConfig& propConfig);
-    void initObd2FreezeFrame(const VehiclePropConfig& propConfig);
+    void initObd2FreezeFrame();
+    StatusCode fillObd2LiveFrame(VehiclePropValue* outValue);
     StatusCode fillObd2FreezeFrame(const VehiclePropValue& requestedPropValue,
                                    VehiclePropValue* outValue);
     StatusCode fillObd2DtcInfo(VehiclePropValue* outValue);
     StatusCode clearObd2FreezeFrames(const VehiclePropValue& propValue);
+    void onSnapshotTimer(const std::vector<int32_t>& cookies);
+    void markSnapshotDirty(int32_t propId);
 
     /* Private members */
     VehiclePropertyStore* mPropStore;
     std::unordered_set<int32_t> mHvacPowerProps;
     RecurrentTimer mRecurrentTimer;
     GeneratorHub mGeneratorHub;
+
+    // Live frame sensors and the freeze frame ring, frames are served from here.
+    mutable std::mutex mObd2Lock;
+    std::unique_ptr<Obd2SensorStore> mObd2SensorStore;
+
+    const std::string mSnapshotPath;
+    std::atomic<bool> mSnapshotDirty { false };
+    bool mSnapshotSaveFailed = false;  // Accessed only from mSnapshotTimer thread.
+    RecurrentTimer mSnapshotTimer;  // Must be the last, so it is stopped first on destruction.
 };
 
 }  // impl
@@ -16,6 +16,14 @@
 
 #define LOG_TAG "JsonFakeValueGenerator"
 
+#include <ctype.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
 #include <fstream>
 #include <type_traits>
 #include <typeinfo>
@@ -33,19 +41,343 @@ namespace V2_0 {
 
 namespace impl {
 
+namespace {
+
+/**
+ * Binary trace layout: header followed by event records. Every record is prefixed with its size
+ * and consists of timestamp, area, property, status, then int32, int64, float vectors, bytes and
+ * string, each prefixed with the number of elements. Fields are padded to 4 bytes and stored in
+ * native byte order, the format is meant to be compiled for and replayed on the same device.
+ */
+struct TraceHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t eventCount;
+    uint32_t reserved;
+};
+
+size_t alignUp(size_t size) {
+    return (size + 3) & ~size_t(3);
+}
+
+class TraceRecordWriter {
+public:
+    void putEvent(const VehiclePropValue& event) {
+        mRecord.clear();
+        put(uint32_t(0));  // Size, filled in below.
+        put(event.timestamp);
+        put(event.areaId);
+        put(event.prop);
+        put(event.status);
+        putArray(event.value.int32Values.data(), event.value.int32Values.size());
+        putArray(event.value.int64Values.data(), event.value.int64Values.size());
+        putArray(event.value.floatValues.data(), event.value.floatValues.size());
+        putArray(event.value.bytes.data(), event.value.bytes.size());
+        putArray(event.value.stringValue.c_str(), event.value.stringValue.size());
+
+        uint32_t size = mRecord.size() - sizeof(uint32_t);
+        memcpy(mRecord.data(), &size, sizeof(size));
+    }
+
+    const std::vector<uint8_t>& record() const { return mRecord; }
+
+private:
+    template <typename T>
+    void put(T value) {
+        append(&value, sizeof(value));
+    }
+
+    template <typename T>
+    void putArray(const T* data, size_t count) {
+        put(static_cast<uint32_t>(count));
+        append(data, count * sizeof(T));
+    }
+
+    void append(const void* data, size_t size) {
+        const uint8_t* bytes = static_cast<const uint8_t*>(data);
+        mRecord.insert(mRecord.end(), bytes, bytes + size);
+        mRecord.resize(alignUp(mRecord.size()));
+    }
+
+    std::vector<uint8_t> mRecord;
+};
+
+/* Bounds checked reader of a single record. */
+class TraceRecordReader {
+public:
+    TraceRecordReader(const uint8_t* data, size_t size) : mData(data), mSize(size) {}
+
+    bool getEvent(VehiclePropValue* event) {
+        return get(&event->timestamp) && get(&event->areaId) && get(&event->prop)
+               && get(&event->status)
+               && getVector(&event->value.int32Values)
+               && getVector(&event->value.int64Values)
+               && getVector(&event->value.floatValues)
+               && getVector(&event->value.bytes)
+               && getString(&event->value.stringValue);
+    }
+
+private:
+    template <typename T>
+    bool get(T* value) {
+        return read(value, sizeof(T));
+    }
+
+    template <typename T>
+    bool getVector(hidl_vec<T>* vec) {
+        uint32_t count;
+        if (!get(&count) || count > (mSize - mPos) / sizeof(T)) {
+            return false;
+        }
+        vec->resize(count);
+        return read(vec->data(), count * sizeof(T));
+    }
+
+    bool getString(hidl_string* str) {
+        uint32_t length;
+        if (!get(&length) || length > mSize - mPos) {
+            return false;
+        }
+        *str = std::string(reinterpret_cast<const char*>(mData + mPos), length);
+        mPos = std::min(mSize, mPos + alignUp(length));
+        return true;
+    }
+
+    bool read(void* out, size_t size) {
+        if (size > mSize - mPos) {
+            return false;
+        }
+        memcpy(out, mData + mPos, size);
+        mPos = std::min(mSize, mPos + alignUp(size));
+        return true;
+    }
+
+    const uint8_t* mData;
+    size_t mSize;
+    size_t mPos = 0;
+};
+
+}  // namespace
+
+/* Scans JSON array one element at a time and parses only that element. */
+class JsonFakeValueGenerator::JsonEventSource : public EventSource {
+public:
+    explicit JsonEventSource(const std::string& path) : mStream(path) {
+        if (!mStream) {
+            ALOGE("%s: couldn't open %s for parsing.", __func__, path.c_str());
+        }
+        mDone = !begin();
+    }
+
+    bool next(VehiclePropValue* event) override {
+        while (readElement()) {
+            Json::Value rawEvent;
+            if (!mReader.parse(mElement.data(), mElement.data() + mElement.size(), rawEvent,
+                               false /* collectComments */)) {
+                ALOGE("%s: Failed to parse fake data JSON event. Error: %s", __func__,
+                      mReader.getFormattedErrorMessages().c_str());
+                continue;
+            }
+            if (parseEvent(rawEvent, event)) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    bool rewind() override {
+        mStream.clear();
+        mStream.seekg(0);
+        mDone = !begin();
+        return !mDone;
+    }
+
+private:
+    int skipWhitespace() {
+        int c;
+        do {
+            c = mStream.get();
+        } while (c != EOF && isspace(c));
+        return c;
+    }
+
+    bool begin() {
+        if (skipWhitespace() != '[') {
+            ALOGE("%s: Fake data JSON file should contain an array of events", __func__);
+            return false;
+        }
+        return true;
+    }
+
+    /* Collects text of the next array element into mElement. */
+    bool readElement() {
+        if (mDone) {
+            return false;
+        }
+        int c = skipWhitespace();
+        if (c == ',') {
+            c = skipWhitespace();
+        }
+        mElement.clear();
+
+        int depth = 0;
+        bool inString = false;
+        bool escaped = false;
+        for (; c != EOF; c = mStream.get()) {
+            if (inString) {
+                if (escaped) {
+                    escaped = false;
+                } else if (c == '\\') {
+                    escaped = true;
+                } else if (c == '"') {
+                    inString = false;
+                }
+            } else if (c == '"') {
+                inString = true;
+            } else if (c == '{' || c == '[') {
+                depth++;
+            } else if (c == '}' || c == ']') {
+                if (depth == 0) {  // End of the array.
+                    mDone = true;
+                    return !mElement.empty();
+                }
+                if (--depth == 0) {
+                    mElement.push_back(c);
+                    return true;
+                }
+            } else if (c == ',' && depth == 0) {
+                return true;
+            }
+            mElement.push_back(c);
+        }
+
+        ALOGE("%s: Fake data JSON file is truncated", __func__);
+        mDone = true;
+        return false;
+    }
+
+    std::ifstream mStream;
+    Json::Reader mReader;
+    std::string mElement;  // Keeps its capacity, so elements are read without allocations.
+    bool mDone;
+};
+
+/* Reads events from memory mapped binary trace. */
+class JsonFakeValueGenerator::BinaryEventSource : public EventSource {
+public:
+    BinaryEventSource(const uint8_t* data, size_t size) : mData(data), mSize(size) {
+        madvise(const_cast<uint8_t*>(mData), mSize, MADV_SEQUENTIAL);
+    }
+
+    ~BinaryEventSource() {
+        munmap(const_cast<uint8_t*>(mData), mSize);
+    }
+
+    bool next(VehiclePropValue* event) override {
+        while (mPos + sizeof(uint32_t) <= mSize) {
+            uint32_t size;
+            memcpy(&size, mData + mPos, sizeof(size));
+            mPos += sizeof(size);
+            if (size > mSize - mPos) {
+                ALOGE("%s: Binary trace is truncated", __func__);
+                break;
+            }
+            TraceRecordReader record(mData + mPos, size);
+            mPos += size;
+            if (record.getEvent(event)) {
+                return true;
+            }
+            ALOGE("%s: Malformed event in binary trace, skip it", __func__);
+        }
+        mPos = mSize;
+        return false;
+    }
+
+    bool rewind() override {
+        mPos = sizeof(TraceHeader);
+        return true;
+    }
+
+private:
+    const uint8_t* mData;
+    size_t mSize;
+    size_t mPos = sizeof(TraceHeader);
+};
+
 JsonFakeValueGenerator::JsonFakeValueGenerator(const VehiclePropValue& request) {
     const auto& v = request.value;
-    const char* file = v.stringValue.c_str();
-    std::ifstream ifs(file);
-    if (!ifs) {
-        ALOGE("%s: couldn't open %s for parsing.", __func__, file);
-    }
-    mGenCfg = {
-        .index = 0,
-        .events = parseFakeValueJson(ifs),
-    };
+    mSource = openTrace(v.stringValue);
     // Iterate infinitely if repetition number is not provided
     mNumOfIterations = v.int32Values.size() < 2 ? -1 : v.int32Values[1];
+    // Replay in real time if time scale is not provided
+    mTimeScale = v.floatValues.size() < 1 || v.floatValues[0] <= 0 ? 1.0f : v.floatValues[0];
+    prefetch();
+}
+
+std::unique_ptr<JsonFakeValueGenerator::EventSource> JsonFakeValueGenerator::openTrace(
+        const std::string& path) {
+    int fd = TEMP_FAILURE_RETRY(open(path.c_str(), O_RDONLY | O_CLOEXEC));
+    if (fd < 0) {
+        ALOGE("%s: couldn't open %s: %s", __func__, path.c_str(), strerror(errno));
+        return nullptr;
+    }
+
+    TraceHeader header;
+    struct stat st;
+    bool isBinary = TEMP_FAILURE_RETRY(read(fd, &header, sizeof(header))) == sizeof(header)
+                    && header.magic == kTraceMagic;
+    if (isBinary && header.version != kTraceVersion) {
+        ALOGE("%s: unsupported version %u of binary trace %s", __func__, header.version,
+              path.c_str());
+        close(fd);
+        return nullptr;
+    }
+
+    void* data = MAP_FAILED;
+    if (isBinary && fstat(fd, &st) == 0) {
+        data = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    }
+    close(fd);
+
+    if (!isBinary) {
+        return std::make_unique<JsonEventSource>(path);
+    }
+    if (data == MAP_FAILED) {
+        ALOGE("%s: couldn't map %s: %s", __func__, path.c_str(), strerror(errno));
+        return nullptr;
+    }
+    return std::make_unique<BinaryEventSource>(static_cast<const uint8_t*>(data), st.st_size);
+}
+
+int JsonFakeValueGenerator::compileTrace(const std::string& jsonPath,
+                                         const std::string& tracePath) {
+    JsonEventSource source(jsonPath);
+    std::ofstream out(tracePath, std::ios::binary | std::ios::trunc);
+    if (!out) {
+        ALOGE("%s: couldn't open %s for writing", __func__, tracePath.c_str());
+        return -1;
+    }
+
+    TraceHeader header = { kTraceMagic, kTraceVersion, 0, 0 };
+    out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+
+    VehiclePropValue event;
+    TraceRecordWriter writer;
+    while (source.next(&event)) {
+        writer.putEvent(event);
+        out.write(reinterpret_cast<const char*>(writer.record().data()), writer.record().size());
+        header.eventCount++;
+    }
+
+    // Event count is known only at the end.
+    out.seekp(0);
+    out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    out.close();
+    if (!out) {
+        ALOGE("%s: failed to write %s", __func__, tracePath.c_str());
+        return -1;
+    }
+    return header.eventCount;
 }
 
 VehiclePropValue JsonFakeValueGenerator::nextEvent() {
@@ -54,91 +386,92 @@ VehiclePropValue JsonFakeValueGenerator::nextEvent() {
         return generatedValue;
     }
     TimePoint eventTime = Clock::now();
-    if (mGenCfg.index != 0) {
+    if (!mNextIsFirst) {
         // All events (start from 2nd one) are supposed to happen in the future with a delay
         // equals to the duration between previous and current event.
-        eventTime += Nanos(mGenCfg.events[mGenCfg.index].timestamp -
-                           mGenCfg.events[mGenCfg.index - 1].timestamp);
+        eventTime += Nanos(static_cast<int64_t>((mNextEvent.timestamp - mLastTimestamp)
+                                                / mTimeScale));
     }
-    generatedValue = mGenCfg.events[mGenCfg.index];
+    mLastTimestamp = mNextEvent.timestamp;
+    generatedValue = std::move(mNextEvent);
     generatedValue.timestamp = eventTime.time_since_epoch().count();
 
-    mGenCfg.index++;
-    if (mGenCfg.index == mGenCfg.events.size()) {
-        mGenCfg.index = 0;
-        if (mNumOfIterations > 0) {
-            mNumOfIterations--;
-        }
-    }
+    prefetch();
     return generatedValue;
 }
 
 bool JsonFakeValueGenerator::hasNext() {
-    return mNumOfIterations != 0 && mGenCfg.events.size() > 0;
+    return mNumOfIterations != 0 && mHasNextEvent;
 }
 
-std::vector<VehiclePropValue> JsonFakeValueGenerator::parseFakeValueJson(std::istream& is) {
-    std::vector<VehiclePropValue> fakeVhalEvents;
+void JsonFakeValueGenerator::prefetch() {
+    if (mSource == nullptr) {
+        mHasNextEvent = false;
+        return;
+    }
+    mNextEvent = VehiclePropValue();
+    mNextIsFirst = !mHasNextEvent;
+    mHasNextEvent = mSource->next(&mNextEvent);
+    if (mHasNextEvent) {
+        return;
+    }
 
-    Json::Reader reader;
-    Json::Value rawEvents;
-    if (!reader.parse(is, rawEvents)) {
-        ALOGE("%s: Failed to parse fake data JSON file. Error: %s", __func__,
-              reader.getFormattedErrorMessages().c_str());
-        return fakeVhalEvents;
+    // The end of iteration, start the next one unless it was the last.
+    if (mNumOfIterations > 0) {
+        mNumOfIterations--;
     }
+    mNextIsFirst = true;
+    mHasNextEvent = mNumOfIterations != 0 && mSource->rewind() && mSource->next(&mNextEvent);
+}
 
-    for (Json::Value::ArrayIndex i = 0; i < rawEvents.size(); i++) {
-        Json::Value rawEvent = rawEvents[i];
-        if (!rawEvent.isObject()) {
-            ALOGE("%s: VHAL JSON event should be an object, %s", __func__,
-                  rawEvent.toStyledString().c_str());
-            continue;
-        }
-        if (rawEvent["prop"].empty() || rawEvent["areaId"].empty() || rawEvent["value"].empty() ||
-            rawEvent["timestamp"].empty()) {
-            ALOGE("%s: VHAL JSON event has missing fields, skip it, %s", __func__,
-                  rawEvent.toStyledString().c_str());
-            continue;
-        }
-        VehiclePropValue event = {
-                .timestamp = rawEvent["timestamp"].asInt64(),
-                .areaId = rawEvent["areaId"].asInt(),
-                .prop = rawEvent["prop"].asInt(),
-        };
-
-        Json::Value rawEventValue = rawEvent["value"];
-        auto& value = event.value;
-        switch (getPropType(event.prop)) {
-            case VehiclePropertyType::BOOLEAN:
-            case VehiclePropertyType::INT32:
-                value.int32Values.resize(1);
-                value.int32Values[0] = rawEventValue.asInt();
-                break;
-            case VehiclePropertyType::INT64:
-                value.int64Values.resize(1);
-                value.int64Values[0] = rawEventValue.asInt64();
-                break;
-            case VehiclePropertyType::FLOAT:
-                value.floatValues.resize(1);
-                value.floatValues[0] = rawEventValue.asFloat();
-                break;
-            case VehiclePropertyType::STRING:
-                value.stringValue = rawEventValue.asString();
-                break;
-            case VehiclePropertyType::MIXED:
-                copyMixedValueJson(value, rawEventValue);
-                if (isDiagnosticProperty(event.prop)) {
-                    value.bytes = generateDiagnosticBytes(value);
-                }
-                break;
-            default:
-                ALOGE("%s: unsupported type for property: 0x%x", __func__, event.prop);
-                continue;
-        }
-        fakeVhalEvents.push_back(event);
+bool JsonFakeValueGenerator::parseEvent(const Json::Value& rawEvent, VehiclePropValue* event) {
+    if (!rawEvent.isObject()) {
+        ALOGE("%s: VHAL JSON event should be an object, %s", __func__,
+              rawEvent.toStyledString().c_str());
+        return false;
+    }
+    if (rawEvent["prop"].empty() || rawEvent["areaId"].empty() || rawEvent["value"].empty() ||
+        rawEvent["timestamp"].empty()) {
+        ALOGE("%s: VHAL JSON event has missing fields, skip it, %s", __func__,
+              rawEvent.toStyledString().c_str());
+        return false;
+    }
+    *event = {
+            .timestamp = rawEvent["timestamp"].asInt64(),
+            .areaId = rawEvent["areaId"].asInt(),
+            .prop = rawEvent["prop"].asInt(),
+    };
+
+    Json::Value rawEventValue = rawEvent["value"];
+    auto& value = event->value;
+    switch (getPropType(event->prop)) {
+        case VehiclePropertyType::BOOLEAN:
+        case VehiclePropertyType::INT32:
+            value.int32Values.resize(1);
+            value.int32Values[0] = rawEventValue.asInt();
+            break;
+        case VehiclePropertyType::INT64:
+            value.int64Values.resize(1);
+            value.int64Values[0] = rawEventValue.asInt64();
+            break;
+        case VehiclePropertyType::FLOAT:
+            value.floatValues.resize(1);
+            value.floatValues[0] = rawEventValue.asFloat();
+            break;
+        case VehiclePropertyType::STRING:
+            value.stringValue = rawEventValue.asString();
+            break;
+        case VehiclePropertyType::MIXED:
+            copyMixedValueJson(value, rawEventValue);
+            if (isDiagnosticProperty(event->prop)) {
+                value.bytes = generateDiagnosticBytes(value);
+            }
+            break;
+        default:
+            ALOGE("%s: unsupported type for property: 0x%x", __func__, event->prop);
+            return false;
     }
-    return fakeVhalEvents;
+    return true;
 }
 
 void JsonFakeValueGenerator::copyMixedValueJson(VehiclePropValue::RawValue& dest,
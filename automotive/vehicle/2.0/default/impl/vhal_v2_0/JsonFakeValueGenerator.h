@@ -18,7 +18,10 @@
 #define android_hardware_automotive_vehicle_V2_0_impl_JsonFakeValueGenerator_H_
 
 #include <chrono>
+#include <fstream>
 #include <iostream>
+#include <memory>
+#include <string>
 
 #include <json/json.h>
 
@@ -32,14 +35,20 @@ namespace V2_0 {
 
 namespace impl {
 
+/**
+ * Replays VHAL events recorded in a trace file. The trace is either a JSON array of events or
+ * a binary trace pre-compiled from it with compileTrace(...), the format is detected by the
+ * magic number at the start of the file.
+ *
+ * Traces are never loaded as a whole: JSON is parsed one event at a time while replaying and
+ * binary traces are memory mapped, so only the next event is kept in memory. Replay speed can be
+ * scaled, events are then delivered with intervals divided by the scale.
+ */
 class JsonFakeValueGenerator : public FakeValueGenerator {
-private:
-    struct GeneratorCfg {
-        size_t index;
-        std::vector<VehiclePropValue> events;
-    };
-
 public:
+    static constexpr uint32_t kTraceMagic = 0x52544656;  // "VFTR"
+    static constexpr uint32_t kTraceVersion = 1;
+
     JsonFakeValueGenerator(const VehiclePropValue& request);
     ~JsonFakeValueGenerator() = default;
 
@@ -47,19 +56,48 @@ public:
 
     bool hasNext();
 
+    /**
+     * Converts JSON trace into the binary format, streaming it event by event. Events that fail
+     * to parse are dropped, exactly as they would be skipped during JSON replay.
+     *
+     * Returns number of compiled events or -1 on error.
+     */
+    static int compileTrace(const std::string& jsonPath, const std::string& tracePath);
+
 private:
-    std::vector<VehiclePropValue> parseFakeValueJson(std::istream& is);
-    void copyMixedValueJson(VehiclePropValue::RawValue& dest, const Json::Value& jsonValue);
+    /* Sequential reader of trace events which can be rewound for the next iteration. */
+    class EventSource {
+    public:
+        virtual ~EventSource() = default;
+        virtual bool next(VehiclePropValue* event) = 0;
+        virtual bool rewind() = 0;
+    };
+    class JsonEventSource;
+    class BinaryEventSource;
+
+    static std::unique_ptr<EventSource> openTrace(const std::string& path);
+
+    static bool parseEvent(const Json::Value& rawEvent, VehiclePropValue* event);
+    static void copyMixedValueJson(VehiclePropValue::RawValue& dest, const Json::Value& jsonValue);
 
     template <typename T>
-    void copyJsonArray(hidl_vec<T>& dest, const Json::Value& jsonArray);
+    static void copyJsonArray(hidl_vec<T>& dest, const Json::Value& jsonArray);
+
+    static bool isDiagnosticProperty(int32_t prop);
+    static hidl_vec<uint8_t> generateDiagnosticBytes(
+            const VehiclePropValue::RawValue& diagnosticValue);
+    static void setBit(hidl_vec<uint8_t>& bytes, size_t idx);
 
-    bool isDiagnosticProperty(int32_t prop);
-    hidl_vec<uint8_t> generateDiagnosticBytes(const VehiclePropValue::RawValue& diagnosticValue);
-    void setBit(hidl_vec<uint8_t>& bytes, size_t idx);
+    /* Reads the next event into mNextEvent, starting the next iteration if needed. */
+    void prefetch();
 
 private:
-    GeneratorCfg mGenCfg;
+    std::unique_ptr<EventSource> mSource;
+    VehiclePropValue mNextEvent;
+    bool mHasNextEvent = false;
+    bool mNextIsFirst = true;  // Whether mNextEvent starts an iteration.
+    int64_t mLastTimestamp = 0;  // Trace timestamp of the last returned event.
+    float mTimeScale;
     int32_t mNumOfIterations;
 };
 
@@ -57,24 +57,28 @@ void PipeComm::stop() {
     CommConn::stop();
 }
 
-std::vector<uint8_t> PipeComm::read() {
-    static constexpr int MAX_RX_MSG_SZ = 2048;
-    std::vector<uint8_t> msg = std::vector<uint8_t>(MAX_RX_MSG_SZ);
-    int numBytes;
+bool PipeComm::read(const uint8_t** data, size_t* size) {
+    // qemud frames carry their length as 4 hex digits, so any frame fits, batches included.
+    static constexpr int MAX_RX_MSG_SZ = 0x10000;
+    if (mRxBuffer.empty()) {
+        mRxBuffer.resize(MAX_RX_MSG_SZ);
+    }
 
-    numBytes = qemu_pipe_frame_recv(mPipeFd, msg.data(), msg.size());
+    int numBytes;
+    numBytes = qemu_pipe_frame_recv(mPipeFd, mRxBuffer.data(), mRxBuffer.size());
 
     if (numBytes == MAX_RX_MSG_SZ) {
         ALOGE("%s: Received max size = %d", __FUNCTION__, MAX_RX_MSG_SZ);
     } else if (numBytes > 0) {
-        msg.resize(numBytes);
-        return msg;
+        *data = mRxBuffer.data();
+        *size = static_cast<size_t>(numBytes);
+        return true;
     } else {
         ALOGD("%s: Connection terminated on pipe %d, numBytes=%d", __FUNCTION__, mPipeFd, numBytes);
         mPipeFd = -1;
     }
 
-    return std::vector<uint8_t>();
+    return false;
 }
 
 int PipeComm::write(const std::vector<uint8_t>& data) {
@@ -43,13 +43,14 @@ class PipeComm : public CommConn {
     void start() override;
     void stop() override;
 
-    std::vector<uint8_t> read() override;
+    bool read(const uint8_t** data, size_t* size) override;
     int write(const std::vector<uint8_t>& data) override;
 
     inline bool isOpen() override { return mPipeFd > 0; }
 
    private:
     int mPipeFd;
+    std::vector<uint8_t> mRxBuffer;
 };
 
 }  // impl
@@ -16,18 +16,28 @@
 
 #define LOG_TAG "SocketComm"
 
+#include <algorithm>
+
 #include <android/hardware/automotive/vehicle/2.0/IVehicle.h>
 #include <android/log.h>
 #include <arpa/inet.h>
 #include <log/log.h>
 #include <netinet/in.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
 
 #include "SocketComm.h"
 
 // Socket to use when communicating with Host PC
 static constexpr int DEBUG_SOCKET = 33452;
 
+// Every message is prefixed with its length as a 32-bit integer in network byte order.
+static constexpr size_t MSG_HEADER_LEN = 4;
+static constexpr uint32_t MAX_MSG_SIZE = 16 * 1024 * 1024;
+
+// Enough for a batch of a few hundred property updates, grows for larger messages.
+static constexpr size_t RX_BUFFER_SIZE = 64 * 1024;
+
 namespace android {
 namespace hardware {
 namespace automotive {
@@ -52,6 +62,8 @@ void SocketComm::start() {
 
 void SocketComm::stop() {
     if (mListenFd > 0) {
+        // Closing the socket alone doesn't wake up the listen thread blocked in accept().
+        ::shutdown(mListenFd, SHUT_RDWR);
         ::close(mListenFd);
         if (mListenThread->joinable()) {
             mListenThread->join();
@@ -139,48 +151,54 @@ void SocketComm::removeClosedConnections() {
 SocketConn::SocketConn(MessageProcessor* messageProcessor, int sfd)
     : CommConn(messageProcessor), mSockFd(sfd) {}
 
-/**
- * Reads, in a loop, exactly numBytes from the given fd. If the connection is closed, returns
- * an empty buffer, otherwise will return exactly the given number of bytes.
- */
-std::vector<uint8_t> readExactly(int fd, int numBytes) {
-    std::vector<uint8_t> buffer(numBytes);
-    int totalRead = 0;
-    int offset = 0;
-    while (totalRead < numBytes) {
-        int numRead = ::read(fd, &buffer.data()[offset], numBytes - offset);
-        if (numRead == 0) {
-            buffer.resize(0);
-            return buffer;
-        }
-
-        totalRead += numRead;
+bool SocketConn::read(const uint8_t** data, size_t* size) {
+    if (mRxBuffer.empty()) {
+        mRxBuffer.resize(RX_BUFFER_SIZE);
     }
-    return buffer;
-}
 
-/**
- * Reads an int, guaranteed to be non-zero, from the given fd. If the connection is closed, returns
- * -1.
- */
-int32_t readInt(int fd) {
-    std::vector<uint8_t> buffer = readExactly(fd, sizeof(int32_t));
-    if (buffer.size() == 0) {
-        return -1;
-    }
+    while (true) {
+        size_t available = mRxEnd - mRxBegin;
+        size_t needed = MSG_HEADER_LEN;
+        if (available == 0) {
+            mRxBegin = mRxEnd = 0;
+        } else if (available >= MSG_HEADER_LEN) {
+            uint32_t msgLen;
+            memcpy(&msgLen, &mRxBuffer[mRxBegin], MSG_HEADER_LEN);
+            msgLen = ntohl(msgLen);
+            if (msgLen == 0 || msgLen > MAX_MSG_SIZE) {
+                ALOGE("%s: Invalid message size %u on socket %d", __FUNCTION__, msgLen, mSockFd);
+                return false;
+            }
+
+            needed += msgLen;
+            if (available >= needed) {
+                *data = &mRxBuffer[mRxBegin + MSG_HEADER_LEN];
+                *size = msgLen;
+                mRxBegin += needed;
+                return true;
+            }
+        }
 
-    int32_t value = *reinterpret_cast<int32_t*>(buffer.data());
-    return ntohl(value);
-}
+        // Make room for the rest of the message at the end of the buffer.
+        if (mRxBegin + needed > mRxBuffer.size()) {
+            memmove(mRxBuffer.data(), &mRxBuffer[mRxBegin], available);
+            mRxBegin = 0;
+            mRxEnd = available;
+            if (needed > mRxBuffer.size()) {
+                mRxBuffer.resize(needed);
+            }
+        }
 
-std::vector<uint8_t> SocketConn::read() {
-    int32_t msgSize = readInt(mSockFd);
-    if (msgSize <= 0) {
-        ALOGD("%s: Connection terminated on socket %d", __FUNCTION__, mSockFd);
-        return std::vector<uint8_t>();
+        ssize_t numRead = ::read(mSockFd, &mRxBuffer[mRxEnd], mRxBuffer.size() - mRxEnd);
+        if (numRead < 0 && errno == EINTR) {
+            continue;
+        }
+        if (numRead <= 0) {
+            ALOGD("%s: Connection terminated on socket %d", __FUNCTION__, mSockFd);
+            return false;
+        }
+        mRxEnd += static_cast<size_t>(numRead);
     }
-
-    return readExactly(mSockFd, msgSize);
 }
 
 void SocketConn::stop() {
@@ -191,26 +209,45 @@ void SocketConn::stop() {
 }
 
 int SocketConn::write(const std::vector<uint8_t>& data) {
-    static constexpr int MSG_HEADER_LEN = 4;
-    int retVal = 0;
-    union {
-        uint32_t msgLen;
-        uint8_t msgLenBytes[MSG_HEADER_LEN];
-    };
-
-    // Prepare header for the message
-    msgLen = static_cast<uint32_t>(data.size());
-    msgLen = htonl(msgLen);
-
-    if (mSockFd > 0) {
-        retVal = ::write(mSockFd, msgLenBytes, MSG_HEADER_LEN);
+    if (mSockFd <= 0) {
+        return 0;
+    }
 
-        if (retVal == MSG_HEADER_LEN) {
-            retVal = ::write(mSockFd, data.data(), data.size());
+    // Prepare header for the message, both are sent with a single syscall.
+    uint32_t msgLen = htonl(static_cast<uint32_t>(data.size()));
+    struct iovec iov[] = {
+        { &msgLen, MSG_HEADER_LEN },
+        { const_cast<uint8_t*>(data.data()), data.size() },
+    };
+    const size_t totalLen = MSG_HEADER_LEN + data.size();
+    size_t written = 0;
+    int iovIndex = 0;
+
+    while (written < totalLen) {
+        ssize_t numWritten = ::writev(mSockFd, &iov[iovIndex], 2 - iovIndex);
+        if (numWritten < 0 && errno == EINTR) {
+            continue;
+        }
+        if (numWritten <= 0) {
+            ALOGE("%s: Write failed on socket %d, errno=%d", __FUNCTION__, mSockFd, errno);
+            return -1;
+        }
+        written += static_cast<size_t>(numWritten);
+
+        // Skip what has been written, in case of a partial write.
+        size_t remaining = static_cast<size_t>(numWritten);
+        while (remaining > 0) {
+            size_t step = std::min(remaining, iov[iovIndex].iov_len);
+            iov[iovIndex].iov_base = static_cast<uint8_t*>(iov[iovIndex].iov_base) + step;
+            iov[iovIndex].iov_len -= step;
+            remaining -= step;
+            if (iov[iovIndex].iov_len == 0) {
+                iovIndex++;
+            }
         }
     }
 
-    return retVal;
+    return static_cast<int>(written);
 }
 
 }  // impl
@@ -86,12 +86,11 @@ class SocketConn : public CommConn {
     virtual ~SocketConn() = default;
 
     /**
-     * Blocking call to read data from the connection.
-     *
-     * @return std::vector<uint8_t> Serialized protobuf data received from emulator.  This will be
-     *              an empty vector if the connection was closed or some other error occurred.
+     * Blocking call to read next length-prefixed message from the connection. Socket is read in
+     * chunks as large as the receive buffer, so a burst of small messages costs a single read(2)
+     * and messages are returned in place, without copying.
      */
-    std::vector<uint8_t> read() override;
+    bool read(const uint8_t** data, size_t* size) override;
 
     /**
      * Closes a connection if it is open.
@@ -111,6 +110,11 @@ class SocketConn : public CommConn {
 
    private:
     int mSockFd;
+
+    // Bytes [mRxBegin, mRxEnd) of the buffer are received but not yet returned by read().
+    std::vector<uint8_t> mRxBuffer;
+    size_t mRxBegin = 0;
+    size_t mRxEnd = 0;
 };
 
 }  // impl
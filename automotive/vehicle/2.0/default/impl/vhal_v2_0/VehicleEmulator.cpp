@@ -151,43 +151,90 @@ void VehicleEmulator::doGetPropertyAll(VehicleEmulator::EmulatorMessage const& /
 
 void VehicleEmulator::doSetProperty(VehicleEmulator::EmulatorMessage const& rxMsg,
                                     VehicleEmulator::EmulatorMessage& respMsg) {
-    emulator::VehiclePropValue protoVal = rxMsg.value(0);
-    VehiclePropValue val = {
-            .timestamp = elapsedRealtimeNano(),
-            .areaId = protoVal.area_id(),
-            .prop = protoVal.prop(),
-            .status = (VehiclePropertyStatus)protoVal.status(),
-    };
-
     respMsg.set_msg_type(emulator::SET_PROPERTY_RESP);
 
-    // Copy value data if it is set.  This automatically handles complex data types if needed.
-    if (protoVal.has_string_value()) {
-        val.value.stringValue = protoVal.string_value().c_str();
+    bool halRes = setPropertyFromProto(rxMsg.value(0), elapsedRealtimeNano());
+    respMsg.set_status(halRes ? emulator::RESULT_OK : emulator::ERROR_INVALID_PROPERTY);
+}
+
+void VehicleEmulator::doSetPropertyBatch(VehicleEmulator::EmulatorMessage const& rxMsg,
+                                         VehicleEmulator::EmulatorMessage& respMsg) {
+    respMsg.set_msg_type(emulator::SET_PROPERTY_BATCH_RESP);
+    respMsg.set_status(emulator::RESULT_OK);
+
+    // All values of the batch are considered received at the same time.
+    int64_t timestamp = elapsedRealtimeNano();
+    for (const auto& protoVal : rxMsg.value()) {
+        if (!setPropertyFromProto(protoVal, timestamp)) {
+            emulator::VehiclePropGet* rejected = respMsg.add_prop();
+            rejected->set_prop(protoVal.prop());
+            rejected->set_area_id(protoVal.area_id());
+            respMsg.set_status(emulator::ERROR_INVALID_PROPERTY);
+        }
     }
+}
 
-    if (protoVal.has_bytes_value()) {
-        val.value.bytes = std::vector<uint8_t> { protoVal.bytes_value().begin(),
-                                                 protoVal.bytes_value().end() };
+template <typename T, typename ProtoValues>
+static void copyProtoValues(const ProtoValues& src, hidl_vec<T>* dest) {
+    // Pooled values come with vectors of the right size, resize is only needed for MIXED type.
+    if (dest->size() != static_cast<size_t>(src.size())) {
+        dest->resize(src.size());
     }
+    std::copy(src.begin(), src.end(), dest->begin());
+}
 
-    if (protoVal.int32_values_size() > 0) {
-        val.value.int32Values = std::vector<int32_t> { protoVal.int32_values().begin(),
-                                                       protoVal.int32_values().end() };
+bool VehicleEmulator::setPropertyFromProto(const emulator::VehiclePropValue& protoVal,
+                                           int64_t timestamp) {
+    VehiclePropertyType type = getPropType(protoVal.prop());
+    size_t vecSize = 0;
+    switch (type) {
+        case VehiclePropertyType::BOOLEAN:
+        case VehiclePropertyType::INT32:
+        case VehiclePropertyType::INT32_VEC:
+            vecSize = protoVal.int32_values_size();
+            break;
+        case VehiclePropertyType::INT64:
+        case VehiclePropertyType::INT64_VEC:
+            vecSize = protoVal.int64_values_size();
+            break;
+        case VehiclePropertyType::FLOAT:
+        case VehiclePropertyType::FLOAT_VEC:
+            vecSize = protoVal.float_values_size();
+            break;
+        case VehiclePropertyType::STRING:
+        case VehiclePropertyType::BYTES:
+        case VehiclePropertyType::MIXED:
+            break;
+        default:
+            // Property id comes from the socket as is, don't let a malformed message reach the
+            // value pool, which only knows valid types.
+            ALOGE("%s: Invalid type of property 0x%x", __func__, protoVal.prop());
+            return false;
     }
 
-    if (protoVal.int64_values_size() > 0) {
-        val.value.int64Values = std::vector<int64_t> { protoVal.int64_values().begin(),
-                                                       protoVal.int64_values().end() };
+    // Value data goes straight into the vectors of a pooled value, so steady stream of updates
+    // doesn't allocate.
+    auto val = mHal->getValuePool()->obtain(type, vecSize);
+    val->timestamp = timestamp;
+    val->areaId = protoVal.area_id();
+    val->prop = protoVal.prop();
+    val->status = (VehiclePropertyStatus)protoVal.status();
+
+    // Copy value data if it is set.  This automatically handles complex data types if needed.
+    if (protoVal.has_string_value()) {
+        val->value.stringValue = protoVal.string_value().c_str();
     }
 
-    if (protoVal.float_values_size() > 0) {
-        val.value.floatValues = std::vector<float> { protoVal.float_values().begin(),
-                                                     protoVal.float_values().end() };
+    if (protoVal.has_bytes_value()) {
+        val->value.bytes = std::vector<uint8_t> { protoVal.bytes_value().begin(),
+                                                  protoVal.bytes_value().end() };
     }
 
-    bool halRes = mHal->setPropertyFromVehicle(val);
-    respMsg.set_status(halRes ? emulator::RESULT_OK : emulator::ERROR_INVALID_PROPERTY);
+    copyProtoValues(protoVal.int32_values(), &val->value.int32Values);
+    copyProtoValues(protoVal.int64_values(), &val->value.int64Values);
+    copyProtoValues(protoVal.float_values(), &val->value.floatValues);
+
+    return mHal->setPropertyFromVehicle(*val);
 }
 
 void VehicleEmulator::processMessage(emulator::EmulatorMessage const& rxMsg,
@@ -208,6 +255,9 @@ void VehicleEmulator::processMessage(emulator::EmulatorMessage const& rxMsg,
         case emulator::SET_PROPERTY_CMD:
             doSetProperty(rxMsg, respMsg);
             break;
+        case emulator::SET_PROPERTY_BATCH_CMD:
+            doSetPropertyBatch(rxMsg, respMsg);
+            break;
         default:
             ALOGW("%s: Unknown message received, type = %d", __func__, rxMsg.msg_type());
             respMsg.set_status(emulator::ERROR_UNIMPLEMENTED_CMD);
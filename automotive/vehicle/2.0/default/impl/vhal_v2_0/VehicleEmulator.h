@@ -84,6 +84,8 @@ class VehicleEmulator : public MessageProcessor {
     void doGetProperty(EmulatorMessage const& rxMsg, EmulatorMessage& respMsg);
     void doGetPropertyAll(EmulatorMessage const& rxMsg, EmulatorMessage& respMsg);
     void doSetProperty(EmulatorMessage const& rxMsg, EmulatorMessage& respMsg);
+    void doSetPropertyBatch(EmulatorMessage const& rxMsg, EmulatorMessage& respMsg);
+    bool setPropertyFromProto(const emulator::VehiclePropValue& protoVal, int64_t timestamp);
     void populateProtoVehicleConfig(emulator::VehiclePropConfig* protoCfg,
                                     const VehiclePropConfig& cfg);
     void populateProtoVehiclePropValue(emulator::VehiclePropValue* protoVal,
@@ -0,0 +1,136 @@
+/*
+ * Copyright (C) 2018 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <memory>
+#include <thread>
+
+#include <gtest/gtest.h>
+
+#include "vhal_v2_0/ConcurrentQueue.h"
+
+namespace android {
+namespace hardware {
+namespace automotive {
+namespace vehicle {
+namespace V2_0 {
+
+namespace {
+
+using IntQueue = RingConcurrentQueue<std::unique_ptr<int>>;
+
+std::unique_ptr<int> makeItem(int value) {
+    return std::make_unique<int>(value);
+}
+
+TEST(RingConcurrentQueueTest, pushAndFlush) {
+    IntQueue queue(3);
+    ASSERT_EQ(4u, queue.capacity());
+
+    queue.push(makeItem(1));
+    queue.push(makeItem(2));
+
+    std::vector<std::unique_ptr<int>> items;
+    queue.flush(&items);
+    ASSERT_EQ(2u, items.size());
+    ASSERT_EQ(1, *items[0]);
+    ASSERT_EQ(2, *items[1]);
+
+    QueueStats stats = queue.getStats();
+    ASSERT_EQ(0u, stats.depth);
+    ASSERT_EQ(2u, stats.maxDepth);
+    ASSERT_EQ(2u, stats.pushed);
+    ASSERT_EQ(0u, stats.dropped);
+}
+
+TEST(RingConcurrentQueueTest, dropOldest) {
+    IntQueue queue(4);
+    for (int i = 0; i < 6; i++) {
+        queue.push(makeItem(i));
+    }
+
+    auto items = queue.flush();
+    ASSERT_EQ(4u, items.size());
+    for (int i = 0; i < 4; i++) {
+        ASSERT_EQ(i + 2, *items[i]);
+    }
+    ASSERT_EQ(2u, queue.getStats().dropped);
+}
+
+TEST(RingConcurrentQueueTest, coalesceByKey) {
+    IntQueue queue(8, IntQueue::OverflowPolicy::COALESCE_BY_KEY,
+                   [](const std::unique_ptr<int>& item) { return *item / 10; });
+    for (int value : { 10, 20, 11, 30, 21, 12 }) {
+        queue.push(makeItem(value));
+    }
+
+    auto items = queue.flush();
+    ASSERT_EQ(3u, items.size());
+    ASSERT_EQ(30, *items[0]);
+    ASSERT_EQ(21, *items[1]);
+    ASSERT_EQ(12, *items[2]);
+    ASSERT_EQ(3u, queue.getStats().coalesced);
+}
+
+TEST(RingConcurrentQueueTest, deactivate) {
+    IntQueue queue(4);
+    std::thread consumer([&queue]() { queue.waitForItems(); });
+    queue.deactivate();
+    consumer.join();
+
+    queue.push(makeItem(1));
+    ASSERT_EQ(0u, queue.flush().size());
+}
+
+TEST(RingConcurrentQueueTest, multipleProducers) {
+    constexpr int kProducers = 4;
+    constexpr int kItemsPerProducer = 10000;
+    IntQueue queue(kProducers * kItemsPerProducer);
+
+    std::vector<std::thread> producers;
+    for (int p = 0; p < kProducers; p++) {
+        producers.emplace_back([&queue, p]() {
+            for (int i = 0; i < kItemsPerProducer; i++) {
+                queue.push(makeItem(p * kItemsPerProducer + i));
+            }
+        });
+    }
+
+    std::vector<std::unique_ptr<int>> items;
+    while (items.size() < static_cast<size_t>(kProducers * kItemsPerProducer)) {
+        queue.waitForItems();
+        queue.flush(&items);
+    }
+    for (auto& producer : producers) {
+        producer.join();
+    }
+
+    // Items from the same producer must keep their order.
+    std::vector<int> last(kProducers, -1);
+    for (const auto& item : items) {
+        int producer = *item / kItemsPerProducer;
+        ASSERT_LT(last[producer], *item);
+        last[producer] = *item;
+    }
+    ASSERT_EQ(0u, queue.getStats().dropped);
+}
+
+}  // namespace anonymous
+
+}  // namespace V2_0
+}  // namespace vehicle
+}  // namespace automotive
+}  // namespace hardware
+}  // namespace android
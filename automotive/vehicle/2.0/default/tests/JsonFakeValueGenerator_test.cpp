@@ -0,0 +1,147 @@
+/*
+ * Copyright (C) 2018 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <fstream>
+
+#include <gtest/gtest.h>
+
+#include "vhal_v2_0/DefaultConfig.h"
+#include "vhal_v2_0/JsonFakeValueGenerator.h"
+#include "vhal_v2_0/VehicleUtils.h"
+
+namespace android {
+namespace hardware {
+namespace automotive {
+namespace vehicle {
+namespace V2_0 {
+
+namespace impl {
+
+namespace {
+
+constexpr int32_t kSpeedProp = toInt(VehicleProperty::PERF_VEHICLE_SPEED);
+constexpr int32_t kGearProp = toInt(VehicleProperty::GEAR_SELECTION);
+
+// Second element is not an event and the third has no value, both are skipped.
+const char kTraceJson[] = R"([
+    {"timestamp": 1000000000, "areaId": 0, "prop": 291504647, "value": 10.5},
+    "not an event",
+    {"timestamp": 1100000000, "areaId": 0, "prop": 291504647},
+    {"timestamp": 1500000000, "areaId": 0, "prop": 289408000, "value": 8},
+    {"timestamp": 2000000000, "areaId": 0, "prop": 291504647, "value": 20.25}
+])";
+
+class JsonFakeValueGeneratorTest : public ::testing::Test {
+protected:
+    void SetUp() override {
+        const char* tmpDir = getenv("TMPDIR");
+        std::string prefix = std::string(tmpDir != nullptr ? tmpDir : "/data/local/tmp")
+                + "/JsonFakeValueGeneratorTest." + std::to_string(getpid());
+        jsonPath = prefix + ".json";
+        tracePath = prefix + ".trace";
+        std::ofstream(jsonPath) << kTraceJson;
+    }
+
+    void TearDown() override {
+        unlink(jsonPath.c_str());
+        unlink(tracePath.c_str());
+    }
+
+    static VehiclePropValue startRequest(const std::string& path, int32_t iterations,
+                                         float timeScale) {
+        VehiclePropValue request = {
+            .value = {
+                .int32Values = { toInt(FakeDataCommand::StartJson), iterations },
+                .floatValues = { timeScale },
+                .stringValue = path,
+            },
+        };
+        return request;
+    }
+
+    /* Replays the whole trace without waiting for events to happen. */
+    static std::vector<VehiclePropValue> replay(JsonFakeValueGenerator* generator) {
+        std::vector<VehiclePropValue> events;
+        while (generator->hasNext()) {
+            events.push_back(generator->nextEvent());
+        }
+        return events;
+    }
+
+public:
+    std::string jsonPath;
+    std::string tracePath;
+};
+
+TEST_F(JsonFakeValueGeneratorTest, streamingJsonReplay) {
+    JsonFakeValueGenerator generator(startRequest(jsonPath, 2, 1.0f));
+    std::vector<VehiclePropValue> events = replay(&generator);
+
+    ASSERT_EQ(6u, events.size());
+    ASSERT_EQ(kSpeedProp, events[0].prop);
+    ASSERT_EQ(10.5f, events[0].value.floatValues[0]);
+    ASSERT_EQ(kGearProp, events[1].prop);
+    ASSERT_EQ(8, events[1].value.int32Values[0]);
+    ASSERT_EQ(20.25f, events[2].value.floatValues[0]);
+    ASSERT_EQ(10.5f, events[3].value.floatValues[0]);
+
+    // Events are scheduled relative to the time previous one was generated.
+    ASSERT_GE(events[1].timestamp - events[0].timestamp, 500000000);
+    ASSERT_LT(events[1].timestamp - events[0].timestamp, 600000000);
+}
+
+TEST_F(JsonFakeValueGeneratorTest, timeScaledReplay) {
+    JsonFakeValueGenerator generator(startRequest(jsonPath, 1, 10.0f));
+    std::vector<VehiclePropValue> events = replay(&generator);
+
+    ASSERT_EQ(3u, events.size());
+    ASSERT_GE(events[1].timestamp - events[0].timestamp, 50000000);
+    ASSERT_LT(events[1].timestamp - events[0].timestamp, 100000000);
+}
+
+TEST_F(JsonFakeValueGeneratorTest, compiledTraceReplay) {
+    ASSERT_EQ(3, JsonFakeValueGenerator::compileTrace(jsonPath, tracePath));
+
+    JsonFakeValueGenerator jsonGenerator(startRequest(jsonPath, 2, 1.0f));
+    JsonFakeValueGenerator traceGenerator(startRequest(tracePath, 2, 1.0f));
+    std::vector<VehiclePropValue> jsonEvents = replay(&jsonGenerator);
+    std::vector<VehiclePropValue> traceEvents = replay(&traceGenerator);
+
+    ASSERT_EQ(jsonEvents.size(), traceEvents.size());
+    for (size_t i = 0; i < jsonEvents.size(); i++) {
+        ASSERT_EQ(jsonEvents[i].prop, traceEvents[i].prop);
+        ASSERT_EQ(jsonEvents[i].value.int32Values, traceEvents[i].value.int32Values);
+        ASSERT_EQ(jsonEvents[i].value.floatValues, traceEvents[i].value.floatValues);
+    }
+}
+
+TEST_F(JsonFakeValueGeneratorTest, missingTrace) {
+    JsonFakeValueGenerator generator(startRequest(jsonPath + ".missing", -1, 1.0f));
+    ASSERT_FALSE(generator.hasNext());
+}
+
+}  // namespace anonymous
+
+}  // namespace impl
+
+}  // namespace V2_0
+}  // namespace vehicle
+}  // namespace automotive
+}  // namespace hardware
+}  // namespace android
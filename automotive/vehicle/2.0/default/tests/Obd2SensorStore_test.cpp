@@ -0,0 +1,199 @@
+/*
+ * Copyright (C) 2018 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <gtest/gtest.h>
+
+#include "vhal_v2_0/Obd2SensorStore.h"
+#include "vhal_v2_0/VehicleUtils.h"
+
+namespace android {
+namespace hardware {
+namespace automotive {
+namespace vehicle {
+namespace V2_0 {
+
+namespace {
+
+constexpr size_t kNumIntegerSensors = toInt(DiagnosticIntegerSensorIndex::LAST_SYSTEM_INDEX) + 1;
+
+TEST(Obd2SensorStoreTest, publishReencodesOnlyChangedSensors) {
+    Obd2SensorStore store(0, 0);
+
+    ASSERT_EQ(StatusCode::OK, store.setIntegerSensor(DiagnosticIntegerSensorIndex::FUEL_TYPE, 1));
+    ASSERT_EQ(StatusCode::OK, store.setFloatSensor(DiagnosticFloatSensorIndex::ENGINE_RPM, 900.f));
+
+    // Nothing is visible until the frame is published.
+    ASSERT_EQ(0.f, store.getFloatSensors()[toInt(DiagnosticFloatSensorIndex::ENGINE_RPM)]);
+    ASSERT_EQ(2u, store.publishFrame());
+    ASSERT_EQ(0u, store.publishFrame());
+    ASSERT_EQ(900.f, store.getFloatSensors()[toInt(DiagnosticFloatSensorIndex::ENGINE_RPM)]);
+
+    // Setting the same value doesn't make the sensor dirty.
+    store.setIntegerSensor(DiagnosticIntegerSensorIndex::FUEL_TYPE, 1);
+    store.setFloatSensor(DiagnosticFloatSensorIndex::ENGINE_RPM, 1200.f);
+    ASSERT_EQ(1u, store.publishFrame());
+
+    const size_t fuelType = toInt(DiagnosticIntegerSensorIndex::FUEL_TYPE);
+    const size_t engineRpm = kNumIntegerSensors + toInt(DiagnosticFloatSensorIndex::ENGINE_RPM);
+    const std::vector<uint8_t>& bitmask = store.getSensorsBitmask();
+    for (size_t i = 0; i < bitmask.size() * 8; i++) {
+        bool present = (bitmask[i / 8] & (1 << (i % 8))) != 0;
+        ASSERT_EQ(i == fuelType || i == engineRpm, present) << "sensor " << i;
+    }
+
+    ASSERT_EQ(StatusCode::INVALID_ARG, store.setIntegerSensor(kNumIntegerSensors, 1));
+}
+
+TEST(Obd2SensorStoreTest, setSensorsFromFrame) {
+    Obd2SensorStore source(2, 1);
+    source.setIntegerSensor(DiagnosticIntegerSensorIndex::FUEL_TYPE, 3);
+    source.setIntegerSensor(kNumIntegerSensors + 1, 42);  // Vendor sensor.
+    source.setFloatSensor(DiagnosticFloatSensorIndex::VEHICLE_SPEED, 55.f);
+
+    VehiclePropValue frame;
+    source.fillPropValue("", &frame);
+
+    Obd2SensorStore store(2, 1);
+    ASSERT_EQ(StatusCode::OK, store.setSensors(frame));
+    ASSERT_EQ(3u, store.publishFrame());
+    ASSERT_EQ(std::vector<int32_t>(frame.value.int32Values), store.getIntegerSensors());
+    ASSERT_EQ(std::vector<float>(frame.value.floatValues), store.getFloatSensors());
+    ASSERT_EQ(std::vector<uint8_t>(frame.value.bytes), store.getSensorsBitmask());
+
+    Obd2SensorStore otherLayout(0, 0);
+    ASSERT_EQ(StatusCode::INVALID_ARG, otherLayout.setSensors(frame));
+}
+
+TEST(Obd2SensorStoreTest, setSensorsReplacesFrame) {
+    Obd2SensorStore source(0, 0);
+    source.setFloatSensor(DiagnosticFloatSensorIndex::VEHICLE_SPEED, 55.f);
+    VehiclePropValue frame;
+    source.fillPropValue("", &frame);
+    frame.timestamp = 1234;
+
+    Obd2SensorStore store(0, 0);
+    store.setIntegerSensor(DiagnosticIntegerSensorIndex::FUEL_TYPE, 3);
+    store.setFloatSensor(DiagnosticFloatSensorIndex::ENGINE_RPM, 900.f);
+    store.publishFrame();
+
+    // Sensors missing from the injected frame are no longer present.
+    ASSERT_EQ(StatusCode::OK, store.setSensors(frame));
+    VehiclePropValue value;
+    store.fillPropValue("", &value);
+    ASSERT_EQ(frame.value.int32Values, value.value.int32Values);
+    ASSERT_EQ(frame.value.floatValues, value.value.floatValues);
+    ASSERT_EQ(frame.value.bytes, value.value.bytes);
+
+    // Reading the frame keeps the timestamp it was set with.
+    ASSERT_EQ(1234, value.timestamp);
+    store.fillPropValue("", &value);
+    ASSERT_EQ(1234, value.timestamp);
+}
+
+TEST(Obd2SensorStoreTest, freezeFrameRing) {
+    Obd2SensorStore store(0, 0, 2 /* maxFreezeFrames */);
+
+    store.setFloatSensor(DiagnosticFloatSensorIndex::VEHICLE_SPEED, 10.f);
+    int64_t first = store.captureFreezeFrame("P0070");
+    store.setFloatSensor(DiagnosticFloatSensorIndex::VEHICLE_SPEED, 20.f);
+    int64_t second = store.captureFreezeFrame("P0102");
+    ASSERT_LT(first, second);
+    ASSERT_EQ((std::vector<int64_t> { first, second }), store.getFreezeFrameTimestamps());
+
+    VehiclePropValue value;
+    ASSERT_EQ(StatusCode::OK, store.fillFreezeFrame(first, &value));
+    ASSERT_EQ(first, value.timestamp);
+    ASSERT_EQ(std::string("P0070"), std::string(value.value.stringValue));
+    ASSERT_EQ(10.f, value.value.floatValues[toInt(DiagnosticFloatSensorIndex::VEHICLE_SPEED)]);
+
+    // The ring is full, the oldest frame is dropped.
+    int64_t third = store.captureFreezeFrame("P0123");
+    ASSERT_EQ((std::vector<int64_t> { second, third }), store.getFreezeFrameTimestamps());
+    ASSERT_EQ(StatusCode::INVALID_ARG, store.fillFreezeFrame(first, &value));
+
+    ASSERT_EQ(StatusCode::OK, store.removeFreezeFrame(second));
+    ASSERT_EQ(StatusCode::INVALID_ARG, store.removeFreezeFrame(second));
+    ASSERT_EQ(std::vector<int64_t> { third }, store.getFreezeFrameTimestamps());
+
+    store.clearFreezeFrames();
+    ASSERT_TRUE(store.getFreezeFrameTimestamps().empty());
+}
+
+TEST(Obd2SensorStoreTest, freezeFrameRemovalFreesSlot) {
+    Obd2SensorStore store(0, 0, 3 /* maxFreezeFrames */);
+    int64_t first = store.captureFreezeFrame("P0070");
+    int64_t second = store.captureFreezeFrame("P0102");
+    int64_t third = store.captureFreezeFrame("P0123");
+
+    // The slot of a removed frame is reused instead of dropping the oldest frame.
+    ASSERT_EQ(StatusCode::OK, store.removeFreezeFrame(second));
+    int64_t fourth = store.captureFreezeFrame("P0200");
+    ASSERT_EQ((std::vector<int64_t> { first, third, fourth }), store.getFreezeFrameTimestamps());
+
+    VehiclePropValue value;
+    ASSERT_EQ(StatusCode::OK, store.fillFreezeFrame(third, &value));
+    ASSERT_EQ(std::string("P0123"), std::string(value.value.stringValue));
+
+    int64_t fifth = store.captureFreezeFrame("P0300");
+    ASSERT_EQ((std::vector<int64_t> { third, fourth, fifth }), store.getFreezeFrameTimestamps());
+}
+
+TEST(Obd2SensorStoreTest, injectedFreezeFrame) {
+    Obd2SensorStore store(0, 0);
+    VehiclePropValue injected;
+    store.fillPropValue("", &injected);
+    injected.timestamp = 5678;
+    injected.value.stringValue = "P0070";
+    injected.value.floatValues[toInt(DiagnosticFloatSensorIndex::VEHICLE_SPEED)] = 30.f;
+    ASSERT_EQ(StatusCode::OK, store.addFreezeFrame(injected));
+    ASSERT_EQ(std::vector<int64_t> { 5678 }, store.getFreezeFrameTimestamps());
+
+    VehiclePropValue value;
+    ASSERT_EQ(StatusCode::OK, store.fillFreezeFrame(5678, &value));
+    ASSERT_EQ(5678, value.timestamp);
+    ASSERT_EQ(std::string("P0070"), std::string(value.value.stringValue));
+    ASSERT_EQ(30.f, value.value.floatValues[toInt(DiagnosticFloatSensorIndex::VEHICLE_SPEED)]);
+
+    // Injecting a frame with the same timestamp replaces it.
+    injected.value.stringValue = "P0102";
+    ASSERT_EQ(StatusCode::OK, store.addFreezeFrame(injected));
+    ASSERT_EQ(std::vector<int64_t> { 5678 }, store.getFreezeFrameTimestamps());
+    ASSERT_EQ(StatusCode::OK, store.fillFreezeFrame(5678, &value));
+    ASSERT_EQ(std::string("P0102"), std::string(value.value.stringValue));
+
+    // Frames without a timestamp get a unique one.
+    injected.timestamp = 0;
+    ASSERT_EQ(StatusCode::OK, store.addFreezeFrame(injected));
+    auto timestamps = store.getFreezeFrameTimestamps();
+    ASSERT_EQ(2u, timestamps.size());
+    ASSERT_NE(0, timestamps[1]);
+    ASSERT_NE(5678, timestamps[1]);
+
+    ASSERT_EQ(StatusCode::OK, store.removeFreezeFrame(5678));
+    ASSERT_EQ(std::vector<int64_t> { timestamps[1] }, store.getFreezeFrameTimestamps());
+
+    // Frames that do not match the configured sensors are rejected.
+    injected.value.floatValues.resize(1);
+    ASSERT_EQ(StatusCode::INVALID_ARG, store.addFreezeFrame(injected));
+}
+
+}  // namespace anonymous
+
+}  // namespace V2_0
+}  // namespace vehicle
+}  // namespace automotive
+}  // namespace hardware
+}  // namespace android
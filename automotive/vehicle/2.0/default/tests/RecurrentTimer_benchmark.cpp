@@ -0,0 +1,62 @@
+/*
+ * Copyright (C) 2018 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <atomic>
+#include <thread>
+
+#include <benchmark/benchmark.h>
+
+#include "vhal_v2_0/RecurrentTimer.h"
+
+namespace {
+
+using std::chrono::milliseconds;
+using std::chrono::nanoseconds;
+
+// Typical sample rates of continuous vehicle properties.
+constexpr int kRatesHz[] = { 1, 2, 5, 10, 20, 50, 100 };
+
+/* Registers given number of events with mixed rates and lets the timer run for a while. Reports
+ * timer thread wake-ups per second and how late events fired on average and at most. */
+void BM_RecurrentTimer(benchmark::State& state) {
+    const int numEvents = state.range(0);
+    constexpr auto kRunTime = milliseconds(500);
+
+    for (auto _ : state) {
+        std::atomic<uint64_t> fired { 0 };
+        RecurrentTimer timer([&fired](const std::vector<int32_t>& cookies) {
+            fired += cookies.size();
+        });
+
+        for (int i = 0; i < numEvents; i++) {
+            int rate = kRatesHz[i % (sizeof(kRatesHz) / sizeof(kRatesHz[0]))];
+            timer.registerRecurrentEvent(nanoseconds(1000000000 / rate), i);
+        }
+        std::this_thread::sleep_for(kRunTime);
+
+        RecurrentTimer::Stats stats = timer.getStats();
+        double seconds = std::chrono::duration<double>(kRunTime).count();
+        state.counters["wakeups/s"] = stats.wakeups / seconds;
+        state.counters["events/s"] = stats.firedEvents / seconds;
+        state.counters["avgLateUs"] = stats.firedEvents > 0
+                ? stats.totalLateness.count() / 1000.0 / stats.firedEvents : 0;
+        state.counters["maxLateUs"] = stats.maxLateness.count() / 1000.0;
+    }
+}
+BENCHMARK(BM_RecurrentTimer)->Arg(10)->Arg(100)->Arg(200)->Arg(500)
+        ->Iterations(1)->Unit(benchmark::kMillisecond);
+
+}  // anonymous namespace
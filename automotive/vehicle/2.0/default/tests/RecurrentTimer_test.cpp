@@ -70,4 +70,42 @@ TEST(RecurrentTimerTest, multipleIntervals) {
     ASSERT_EQ_WITH_TOLERANCE(20, counter5ms.load(), 5);
 }
 
+TEST(RecurrentTimerTest, intervalsAcrossWheelLevels) {
+    std::atomic<int64_t> counter70ms { 0L };
+    std::atomic<int64_t> counter5ms { 0L };
+    // With 1us resolution 5ms interval spans multiple wheel levels and needs to be cascaded.
+    RecurrentTimer timer([&counter70ms, &counter5ms](const std::vector<int32_t>& cookies) {
+        for (int32_t cookie : cookies) {
+            (cookie == 70 ? counter70ms : counter5ms)++;
+        }
+    }, std::chrono::microseconds(1));
+
+    timer.registerRecurrentEvent(milliseconds(70), 70);
+    timer.registerRecurrentEvent(milliseconds(5), 5);
+
+    std::this_thread::sleep_for(milliseconds(200));
+    ASSERT_EQ_WITH_TOLERANCE(3, counter70ms.load(), 1);
+    ASSERT_EQ_WITH_TOLERANCE(40, counter5ms.load(), 8);
+
+    RecurrentTimer::Stats stats = timer.getStats();
+    ASSERT_LE(static_cast<uint64_t>(counter70ms + counter5ms), stats.firedEvents);
+    // The thread sleeps until the next deadline instead of waking up on every 1us tick, which
+    // would be ~200000 wakeups. Loose bound, registration and late wakeups add a few extra ones.
+    ASSERT_LT(stats.wakeups, 10 * (stats.firedEvents + 1));
+}
+
+TEST(RecurrentTimerTest, unregister) {
+    std::atomic<int64_t> counter { 0L };
+    RecurrentTimer timer([&counter](const std::vector<int32_t>&) { counter++; });
+
+    timer.registerRecurrentEvent(milliseconds(1), 0xdead);
+    std::this_thread::sleep_for(milliseconds(20));
+    timer.unregisterRecurrentEvent(0xdead);
+    std::this_thread::sleep_for(milliseconds(5));
+
+    int64_t counterAfterUnregister = counter.load();
+    std::this_thread::sleep_for(milliseconds(20));
+    ASSERT_EQ(counterAfterUnregister, counter.load());
+}
+
 }  // anonymous namespace
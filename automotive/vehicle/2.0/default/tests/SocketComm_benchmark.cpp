@@ -0,0 +1,182 @@
+/*
+ * Copyright (C) 2018 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <thread>
+
+#include <benchmark/benchmark.h>
+
+#include "vhal_v2_0/SocketComm.h"
+#include "vhal_v2_0/VehicleEmulator.h"
+#include "vhal_v2_0/VehicleObjectPool.h"
+#include "vhal_v2_0/VehicleUtils.h"
+
+namespace android {
+namespace hardware {
+namespace automotive {
+namespace vehicle {
+namespace V2_0 {
+
+namespace {
+
+using impl::EmulatedVehicleHalIface;
+using impl::SocketConn;
+using impl::VehicleEmulator;
+
+constexpr int kUpdatesPerIteration = 4096;
+constexpr int32_t kProp = toInt(VehicleProperty::PERF_VEHICLE_SPEED);
+
+/* Accepts every value set by the emulator, so only the transport and VehicleEmulator's conversion
+ * of received values into pooled VehiclePropValues are measured. */
+class AcceptingVehicleHal : public EmulatedVehicleHalIface {
+public:
+    AcceptingVehicleHal() {
+        init(&mValuePool, [](VehiclePropValuePtr) {}, [](StatusCode, int32_t, int32_t) {});
+    }
+
+    bool setPropertyFromVehicle(const VehiclePropValue& propValue) override {
+        benchmark::DoNotOptimize(propValue.value.floatValues[0]);
+        return true;
+    }
+
+    std::vector<VehiclePropValue> getAllProperties() const override { return {}; }
+    std::vector<VehiclePropConfig> listProperties() override { return {}; }
+
+    VehiclePropValuePtr get(const VehiclePropValue& /* requestedPropValue */,
+                            StatusCode* outStatus) override {
+        *outStatus = StatusCode::NOT_AVAILABLE;
+        return nullptr;
+    }
+
+    StatusCode set(const VehiclePropValue& /* propValue */) override {
+        return StatusCode::NOT_AVAILABLE;
+    }
+
+    StatusCode subscribe(int32_t /* property */, float /* sampleRate */) override {
+        return StatusCode::OK;
+    }
+
+    StatusCode unsubscribe(int32_t /* property */) override { return StatusCode::OK; }
+
+private:
+    VehiclePropValuePool mValuePool;
+};
+
+std::vector<uint8_t> frameMessage(const emulator::EmulatorMessage& msg) {
+    uint32_t msgLen = msg.ByteSize();
+    std::vector<uint8_t> frame(sizeof(msgLen) + msgLen);
+    uint32_t header = htonl(msgLen);
+    memcpy(frame.data(), &header, sizeof(header));
+    msg.SerializeToArray(frame.data() + sizeof(header), msgLen);
+    return frame;
+}
+
+/* Builds the byte stream that HIL rig sends for one iteration: kUpdatesPerIteration updates of
+ * a float property, batchSize updates per frame. Batch of 1 uses plain SET_PROPERTY_CMD. */
+std::vector<uint8_t> buildStream(int batchSize) {
+    std::vector<uint8_t> stream;
+    for (int sent = 0; sent < kUpdatesPerIteration; sent += batchSize) {
+        emulator::EmulatorMessage msg;
+        msg.set_msg_type(batchSize == 1 ? emulator::SET_PROPERTY_CMD
+                                        : emulator::SET_PROPERTY_BATCH_CMD);
+        for (int i = 0; i < batchSize; i++) {
+            emulator::VehiclePropValue* val = msg.add_value();
+            val->set_prop(kProp);
+            val->set_area_id(0);
+            val->add_float_values(static_cast<float>(sent + i));
+        }
+        std::vector<uint8_t> frame = frameMessage(msg);
+        stream.insert(stream.end(), frame.begin(), frame.end());
+    }
+    return stream;
+}
+
+/* Streams property updates into SocketConn over a socketpair, responses are drained by a separate
+ * thread. Reports property updates per second. */
+void BM_SocketConnThroughput(benchmark::State& state) {
+    const int batchSize = state.range(0);
+    const int framesPerIteration = (kUpdatesPerIteration + batchSize - 1) / batchSize;
+    const std::vector<uint8_t> stream = buildStream(batchSize);
+
+    int fds[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) != 0) {
+        state.SkipWithError("socketpair() failed");
+        return;
+    }
+
+    // The emulator also listens on its debug port, the benchmark bypasses it with a socketpair.
+    AcceptingVehicleHal hal;
+    VehicleEmulator vehicleEmulator(&hal);
+    SocketConn conn(&vehicleEmulator, fds[0]);
+    conn.start();
+
+    // Responses are tiny, so counting bytes is enough to know how many frames were answered.
+    std::atomic<uint64_t> receivedBytes { 0 };
+    std::thread drainThread([&receivedBytes, fd = fds[1]] {
+        uint8_t buffer[4096];
+        ssize_t numRead;
+        while ((numRead = ::read(fd, buffer, sizeof(buffer))) > 0) {
+            receivedBytes += static_cast<uint64_t>(numRead);
+        }
+    });
+
+    emulator::EmulatorMessage resp;
+    resp.set_msg_type(batchSize == 1 ? emulator::SET_PROPERTY_RESP
+                                     : emulator::SET_PROPERTY_BATCH_RESP);
+    resp.set_status(emulator::RESULT_OK);
+    const uint64_t respFrameSize = frameMessage(resp).size();
+
+    uint64_t expectedBytes = 0;
+    for (auto _ : state) {
+        size_t written = 0;
+        while (written < stream.size()) {
+            ssize_t n = ::write(fds[1], stream.data() + written, stream.size() - written);
+            if (n <= 0) {
+                state.SkipWithError("write() failed");
+                break;
+            }
+            written += static_cast<size_t>(n);
+        }
+
+        expectedBytes += framesPerIteration * respFrameSize;
+        while (receivedBytes.load() < expectedBytes) {
+            std::this_thread::yield();
+        }
+    }
+    state.SetItemsProcessed(state.iterations() * kUpdatesPerIteration);
+
+    // Read thread exits on end of stream, only then the socket can be closed.
+    shutdown(fds[1], SHUT_WR);
+    conn.CommConn::stop();
+    conn.stop();
+    drainThread.join();
+    close(fds[1]);
+}
+BENCHMARK(BM_SocketConnThroughput)->Arg(1)->Arg(16)->Arg(256)->UseRealTime();
+
+}  // anonymous namespace
+
+}  // namespace V2_0
+}  // namespace vehicle
+}  // namespace automotive
+}  // namespace hardware
+}  // namespace android
+
+BENCHMARK_MAIN();
@@ -188,6 +188,136 @@ TEST_F(SubscriptionManagerTest, unsubscribe) {
     assertLastUnsubscribedProperty(PROP1);
 }
 
+TEST_F(SubscriptionManagerTest, continuousPropertyDecimation) {
+    const int32_t prop = toInt(VehicleProperty::PERF_VEHICLE_SPEED);
+    constexpr int64_t kOneMs = 1000000;
+    std::list<SubscribeOptions> updatedOptions;
+    ASSERT_EQ(StatusCode::OK, manager.addOrUpdateSubscription(
+        1, cb1, {SubscribeOptions{.propId = prop, .sampleRate = 10,
+                                  .flags = SubscribeFlags::EVENTS_FROM_CAR}},
+        &updatedOptions));
+    ASSERT_EQ(StatusCode::OK, manager.addOrUpdateSubscription(
+        2, cb2, {SubscribeOptions{.propId = prop, .sampleRate = 100,
+                                  .flags = SubscribeFlags::EVENTS_FROM_CAR}},
+        &updatedOptions));
+
+    VehiclePropValuePool pool;
+    auto sendBatch = [&](int64_t firstTimestamp, int count) {
+        std::vector<recyclable_ptr<VehiclePropValue>> batch;
+        for (int i = 0; i < count; i++) {
+            auto value = pool.obtainFloat(i);
+            value->prop = prop;
+            value->timestamp = firstTimestamp + i * 10 * kOneMs;
+            batch.push_back(std::move(value));
+        }
+        std::map<sp<IVehicleCallback>, std::vector<int64_t>> received;
+        for (const auto& clientValues :
+                 manager.distributeValuesToClients(batch, SubscribeFlags::EVENTS_FROM_CAR)) {
+            for (const VehiclePropValue* value : clientValues.values) {
+                received[clientValues.client->getCallback()].push_back(value->timestamp);
+            }
+        }
+        return received;
+    };
+
+    // Batch of 100Hz updates: only the newest value goes to both clients.
+    auto received = sendBatch(0, 5);
+    ASSERT_EQ(std::vector<int64_t> { 40 * kOneMs }, received[cb1]);
+    ASSERT_EQ(std::vector<int64_t> { 40 * kOneMs }, received[cb2]);
+
+    // 10ms later: too early for the 10Hz client.
+    received = sendBatch(50 * kOneMs, 1);
+    ASSERT_TRUE(received[cb1].empty());
+    ASSERT_EQ(std::vector<int64_t> { 50 * kOneMs }, received[cb2]);
+
+    // 100ms after the last value delivered to the 10Hz client.
+    received = sendBatch(140 * kOneMs, 1);
+    ASSERT_EQ(std::vector<int64_t> { 140 * kOneMs }, received[cb1]);
+    ASSERT_EQ(std::vector<int64_t> { 140 * kOneMs }, received[cb2]);
+}
+
+TEST_F(SubscriptionManagerTest, continuousPropertyEqualTimestamps) {
+    const int32_t prop = toInt(VehicleProperty::PERF_VEHICLE_SPEED);
+    std::list<SubscribeOptions> updatedOptions;
+    ASSERT_EQ(StatusCode::OK, manager.addOrUpdateSubscription(
+        1, cb1, {SubscribeOptions{.propId = prop, .sampleRate = 10,
+                                  .flags = SubscribeFlags::EVENTS_FROM_CAR}},
+        &updatedOptions));
+
+    VehiclePropValuePool pool;
+    auto sendValue = [&](float speed, int64_t timestamp) {
+        std::vector<recyclable_ptr<VehiclePropValue>> batch;
+        auto value = pool.obtainFloat(speed);
+        value->prop = prop;
+        value->timestamp = timestamp;
+        batch.push_back(std::move(value));
+        auto clientValues =
+            manager.distributeValuesToClients(batch, SubscribeFlags::EVENTS_FROM_CAR);
+        std::vector<float> received;
+        for (const auto& cv : clientValues) {
+            for (const VehiclePropValue* v : cv.values) {
+                received.push_back(v->value.floatValues[0]);
+            }
+        }
+        return received;
+    };
+
+    // Source clock did not advance, new values must not be lost.
+    ASSERT_EQ(std::vector<float> { 1 }, sendValue(1, 1000));
+    ASSERT_EQ(std::vector<float> { 2 }, sendValue(2, 1000));
+    ASSERT_EQ(std::vector<float> { 3 }, sendValue(3, 1000));
+    // Still decimated once the clock advances.
+    ASSERT_TRUE(sendValue(4, 2000).empty());
+}
+
+TEST_F(SubscriptionManagerTest, resubscribeResetsDecimation) {
+    const int32_t prop = toInt(VehicleProperty::PERF_VEHICLE_SPEED);
+    const hidl_vec<SubscribeOptions> options = {
+        SubscribeOptions{.propId = prop, .sampleRate = 10,
+                         .flags = SubscribeFlags::EVENTS_FROM_CAR}};
+    std::list<SubscribeOptions> updatedOptions;
+    ASSERT_EQ(StatusCode::OK, manager.addOrUpdateSubscription(1, cb1, options, &updatedOptions));
+    // Keep the client alive across the unsubscribe below.
+    ASSERT_EQ(StatusCode::OK,
+              manager.addOrUpdateSubscription(1, cb1, subscrToProp1, &updatedOptions));
+
+    VehiclePropValuePool pool;
+    auto sendValue = [&](int64_t timestamp) {
+        std::vector<recyclable_ptr<VehiclePropValue>> batch;
+        auto value = pool.obtainFloat(0);
+        value->prop = prop;
+        value->timestamp = timestamp;
+        batch.push_back(std::move(value));
+        return manager.distributeValuesToClients(batch, SubscribeFlags::EVENTS_FROM_CAR).size();
+    };
+
+    ASSERT_EQ(1u, sendValue(1000));
+    ASSERT_EQ(0u, sendValue(2000));
+
+    manager.unsubscribe(1, prop);
+    ASSERT_EQ(StatusCode::OK, manager.addOrUpdateSubscription(1, cb1, options, &updatedOptions));
+    ASSERT_EQ(1u, sendValue(3000));
+}
+
+TEST_F(SubscriptionManagerTest, onChangePropertyNotCoalesced) {
+    std::list<SubscribeOptions> updatedOptions;
+    ASSERT_EQ(StatusCode::OK,
+              manager.addOrUpdateSubscription(1, cb1, subscrToProp1, &updatedOptions));
+
+    VehiclePropValuePool pool;
+    std::vector<recyclable_ptr<VehiclePropValue>> batch;
+    for (int i = 0; i < 3; i++) {
+        auto value = pool.obtainInt32(i);
+        value->prop = PROP1;
+        batch.push_back(std::move(value));
+    }
+
+    auto clientValues = manager.distributeValuesToClients(batch, SubscribeFlags::EVENTS_FROM_CAR);
+    ASSERT_EQ(1u, clientValues.size());
+    ASSERT_EQ(3u, clientValues.front().values.size());
+    ASSERT_EQ(0, clientValues.front().values.front()->value.int32Values[0]);
+}
+
 }  // namespace anonymous
 
 }  // namespace V2_0
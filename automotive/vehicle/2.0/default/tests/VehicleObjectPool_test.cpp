@@ -21,6 +21,7 @@
 #include <utils/SystemClock.h>
 
 #include "vhal_v2_0/VehicleObjectPool.h"
+#include "vhal_v2_0/VehicleUtils.h"
 
 namespace android {
 namespace hardware {
@@ -49,6 +50,7 @@ private:
         stats->Obtained = 0;
         stats->Created = 0;
         stats->Recycled = 0;
+        stats->Discarded = 0;
     }
 
 public:
@@ -122,6 +124,81 @@ TEST_F(VehicleObjectPoolTest, valuePoolMultithreadedBenchmark) {
                                  // Typically it takes about 0.1s on Nexus6P.
 }
 
+TEST_F(VehicleObjectPoolTest, valuePoolSizeClasses) {
+    auto value = valuePool->obtain(VehiclePropertyType::INT32_VEC, 4);
+    ASSERT_EQ(4u, value->value.int32Values.size());
+    void* raw = value.get();
+    value.reset();
+
+    // Sizes 3 and 4 share the same size class.
+    value = valuePool->obtain(VehiclePropertyType::INT32_VEC, 3);
+    ASSERT_EQ(raw, value.get());
+    ASSERT_EQ(3u, value->value.int32Values.size());
+    ASSERT_EQ(0u, value->value.floatValues.size());
+    value.reset();
+
+    ASSERT_NE(raw, valuePool->obtain(VehiclePropertyType::INT32_VEC, 2).get());
+}
+
+TEST_F(VehicleObjectPoolTest, valuePoolDiscardsReallocatedPayload) {
+    auto value = valuePool->obtain(VehiclePropertyType::FLOAT_VEC, 2);
+    value->value.floatValues = std::vector<float> { 1, 2, 3, 4 };
+    value.reset();
+
+    value = valuePool->obtain(VehiclePropertyType::FLOAT_VEC, 2);
+    ASSERT_EQ(2u, value->value.floatValues.size());
+    value.reset();
+
+    ObjectPoolStats poolStats = valuePool->getStats();
+    ASSERT_EQ(2u, poolStats.obtained);
+    ASSERT_EQ(1u, poolStats.discarded);
+    ASSERT_EQ(1u, poolStats.recycled);
+    ASSERT_EQ(0u, poolStats.outstanding());
+    ASSERT_EQ(2u, stats->Recycled);
+    ASSERT_EQ(1u, stats->Discarded);
+}
+
+TEST_F(VehicleObjectPoolTest, valuePoolRecyclesCopiedValues) {
+    VehiclePropValue src;
+    src.prop = toInt(VehicleProperty::INFO_FUEL_TYPE);  // INT32_VEC
+    src.value.int32Values = std::vector<int32_t> { 1, 2, 3 };
+
+    auto value = valuePool->obtain(src);
+    void* raw = value.get();
+    ASSERT_EQ(src.value.int32Values, value->value.int32Values);
+    value.reset();
+
+    ObjectPoolStats poolStats = valuePool->getStats();
+    ASSERT_EQ(1u, poolStats.recycled);
+    ASSERT_EQ(0u, poolStats.discarded);
+    ASSERT_EQ(0u, stats->Discarded);
+    ASSERT_EQ(raw, valuePool->obtain(src).get());
+}
+
+TEST_F(VehicleObjectPoolTest, valuePoolObjectsMigrateBetweenThreads) {
+    const int kObjects = 1000;
+
+    std::vector<recyclable_ptr<VehiclePropValue>> values;
+    for (int i = 0; i < kObjects; i++) {
+        values.push_back(valuePool->obtain(VehiclePropertyType::INT32));
+    }
+    // Objects obtained in this thread and recycled in another thread.
+    std::thread([&values]() { values.clear(); }).join();
+
+    std::thread([this, kObjects]() {
+        std::vector<recyclable_ptr<VehiclePropValue>> values;
+        for (int i = 0; i < kObjects; i++) {
+            values.push_back(valuePool->obtain(VehiclePropertyType::INT32));
+        }
+    }).join();
+
+    ObjectPoolStats poolStats = valuePool->getStats();
+    ASSERT_EQ(2u * kObjects, poolStats.obtained);
+    ASSERT_EQ(static_cast<uint64_t>(kObjects), poolStats.created);
+    ASSERT_EQ(0u, poolStats.outstanding());
+    ASSERT_DOUBLE_EQ(0.5, poolStats.hitRate());
+}
+
 }  // namespace anonymous
 
 }  // namespace V2_0
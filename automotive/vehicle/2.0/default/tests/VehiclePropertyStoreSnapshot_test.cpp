@@ -0,0 +1,200 @@
+/*
+ * Copyright (C) 2018 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <gtest/gtest.h>
+
+#include "vhal_v2_0/VehiclePropertyStoreSnapshot.h"
+#include "vhal_v2_0/VehicleUtils.h"
+
+namespace android {
+namespace hardware {
+namespace automotive {
+namespace vehicle {
+namespace V2_0 {
+
+namespace {
+
+constexpr int32_t kFloatProp = toInt(VehicleProperty::PERF_VEHICLE_SPEED);
+constexpr int32_t kSeatProp = toInt(VehicleProperty::HVAC_FAN_SPEED);
+constexpr int32_t kStringProp = toInt(VehicleProperty::INFO_MAKE);
+
+const VehiclePropConfig kConfigs[] = {
+    {
+        .prop = kFloatProp,
+        .access = VehiclePropertyAccess::READ,
+        .changeMode = VehiclePropertyChangeMode::CONTINUOUS,
+        .minSampleRate = 1.0f,
+        .maxSampleRate = 10.0f,
+    },
+    {
+        .prop = kSeatProp,
+        .access = VehiclePropertyAccess::READ_WRITE,
+        .changeMode = VehiclePropertyChangeMode::ON_CHANGE,
+        .areaConfigs = {
+            VehicleAreaConfig { .areaId = toInt(VehicleAreaSeat::ROW_1_LEFT),
+                                .minInt32Value = 1, .maxInt32Value = 7 },
+            VehicleAreaConfig { .areaId = toInt(VehicleAreaSeat::ROW_1_RIGHT),
+                                .minInt32Value = 1, .maxInt32Value = 5 },
+        },
+    },
+    {
+        .prop = kStringProp,
+        .access = VehiclePropertyAccess::READ,
+        .changeMode = VehiclePropertyChangeMode::STATIC,
+        .configString = "some=config",
+    },
+};
+
+class VehiclePropertyStoreSnapshotTest : public ::testing::Test {
+protected:
+    void SetUp() override {
+        registerConfigs(&store);
+
+        store.writeValue({ .timestamp = 100,
+                           .prop = kFloatProp,
+                           .value = { .floatValues = { 42.5f } } }, true);
+        store.writeValue({ .areaId = toInt(VehicleAreaSeat::ROW_1_LEFT),
+                           .prop = kSeatProp,
+                           .status = VehiclePropertyStatus::UNAVAILABLE,
+                           .value = { .int32Values = { 3 } } }, true);
+        store.writeValue({ .prop = kStringProp, .value = { .stringValue = "Toy Vehicle" } }, true);
+    }
+
+public:
+    static void registerConfigs(VehiclePropertyStore* target) {
+        for (const auto& config : kConfigs) {
+            target->registerProperty(config);
+        }
+    }
+
+    VehiclePropertyStore store;
+};
+
+TEST_F(VehiclePropertyStoreSnapshotTest, roundTrip) {
+    std::vector<uint8_t> snapshot = VehiclePropertyStoreSnapshot::serialize(store);
+
+    VehiclePropertyStore restored;
+    registerConfigs(&restored);
+    ASSERT_EQ(3, VehiclePropertyStoreSnapshot::deserialize(snapshot.data(), snapshot.size(),
+                                                           &restored));
+
+    auto value = restored.readValueOrNull(kFloatProp);
+    ASSERT_NE(nullptr, value);
+    ASSERT_EQ(100, value->timestamp);
+    ASSERT_EQ(42.5f, value->value.floatValues[0]);
+
+    value = restored.readValueOrNull(kSeatProp, toInt(VehicleAreaSeat::ROW_1_LEFT));
+    ASSERT_NE(nullptr, value);
+    ASSERT_EQ(3, value->value.int32Values[0]);
+    ASSERT_EQ(VehiclePropertyStatus::UNAVAILABLE, value->status);
+
+    ASSERT_EQ(std::string("Toy Vehicle"),
+              std::string(restored.readValueOrNull(kStringProp)->value.stringValue));
+}
+
+TEST_F(VehiclePropertyStoreSnapshotTest, changedConfigValuesSkipped) {
+    std::vector<uint8_t> snapshot = VehiclePropertyStoreSnapshot::serialize(store);
+
+    VehiclePropertyStore restored;
+    VehiclePropConfig seatConfig = kConfigs[1];
+    seatConfig.areaConfigs[1].maxInt32Value = 6;
+    restored.registerProperty(kConfigs[0]);
+    restored.registerProperty(seatConfig);
+    restored.registerProperty(kConfigs[2]);
+
+    ASSERT_EQ(2, VehiclePropertyStoreSnapshot::deserialize(snapshot.data(), snapshot.size(),
+                                                           &restored));
+    ASSERT_EQ(nullptr, restored.readValueOrNull(kSeatProp, toInt(VehicleAreaSeat::ROW_1_LEFT)));
+    ASSERT_EQ(6, restored.getConfigOrNull(kSeatProp)->areaConfigs[1].maxInt32Value);
+    ASSERT_NE(nullptr, restored.readValueOrNull(kFloatProp));
+}
+
+TEST_F(VehiclePropertyStoreSnapshotTest, removedPropertiesNotRestored) {
+    std::vector<uint8_t> snapshot = VehiclePropertyStoreSnapshot::serialize(store);
+
+    VehiclePropertyStore restored;
+    restored.registerProperty(kConfigs[0]);
+    restored.writeValue({ .timestamp = 50,
+                          .prop = kFloatProp,
+                          .value = { .floatValues = { 1.0f } } }, true);
+
+    ASSERT_EQ(1, VehiclePropertyStoreSnapshot::deserialize(snapshot.data(), snapshot.size(),
+                                                           &restored));
+    ASSERT_EQ(1u, restored.getAllConfigs().size());
+    ASSERT_EQ(nullptr, restored.getConfigOrNull(kSeatProp));
+    ASSERT_EQ(nullptr, restored.readValueOrNull(kStringProp));
+    // Restored value overrides the one already in the store.
+    ASSERT_EQ(42.5f, restored.readValueOrNull(kFloatProp)->value.floatValues[0]);
+}
+
+TEST_F(VehiclePropertyStoreSnapshotTest, corruptedSnapshotRejected) {
+    std::vector<uint8_t> snapshot = VehiclePropertyStoreSnapshot::serialize(store);
+    VehiclePropertyStore restored;
+
+    std::vector<uint8_t> truncated(snapshot.begin(), snapshot.end() - 4);
+    ASSERT_EQ(-1, VehiclePropertyStoreSnapshot::deserialize(truncated.data(), truncated.size(),
+                                                            &restored));
+
+    snapshot[snapshot.size() / 2] ^= 0xff;
+    ASSERT_EQ(-1, VehiclePropertyStoreSnapshot::deserialize(snapshot.data(), snapshot.size(),
+                                                            &restored));
+    ASSERT_EQ(-1, VehiclePropertyStoreSnapshot::deserialize(snapshot.data(), 16, &restored));
+
+    ASSERT_EQ(0u, restored.getAllConfigs().size());
+}
+
+TEST_F(VehiclePropertyStoreSnapshotTest, oversizedRecordCountsRejected) {
+    std::vector<uint8_t> snapshot = VehiclePropertyStoreSnapshot::serialize(store);
+    VehiclePropertyStore restored;
+    registerConfigs(&restored);
+
+    // Record counts follow magic and version in the header and are not checksummed.
+    const uint32_t counts[][2] = { { 0xffffffff, 1 }, { 0x80000000, 0x80000000 }, { 0, 1u << 30 } };
+    for (const auto& count : counts) {
+        std::vector<uint8_t> corrupted = snapshot;
+        memcpy(corrupted.data() + 2 * sizeof(uint32_t), count, sizeof(count));
+        ASSERT_EQ(-1, VehiclePropertyStoreSnapshot::deserialize(corrupted.data(),
+                                                                corrupted.size(), &restored));
+    }
+    ASSERT_EQ(nullptr, restored.readValueOrNull(kFloatProp));
+}
+
+TEST_F(VehiclePropertyStoreSnapshotTest, saveAndRestore) {
+    const char* tmpDir = getenv("TMPDIR");
+    std::string path = std::string(tmpDir != nullptr ? tmpDir : "/data/local/tmp")
+            + "/VehiclePropertyStoreSnapshotTest." + std::to_string(getpid());
+
+    ASSERT_TRUE(VehiclePropertyStoreSnapshot::save(store, path));
+
+    VehiclePropertyStore restored;
+    registerConfigs(&restored);
+    ASSERT_EQ(3, VehiclePropertyStoreSnapshot::restore(path, &restored));
+    ASSERT_EQ(42.5f, restored.readValueOrNull(kFloatProp)->value.floatValues[0]);
+
+    unlink(path.c_str());
+    ASSERT_EQ(-1, VehiclePropertyStoreSnapshot::restore(path, &restored));
+}
+
+}  // namespace anonymous
+
+}  // namespace V2_0
+}  // namespace vehicle
+}  // namespace automotive
+}  // namespace hardware
+}  // namespace android
@@ -0,0 +1,167 @@
+/*
+ * Copyright (C) 2018 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <map>
+#include <mutex>
+
+#include <benchmark/benchmark.h>
+
+#include "vhal_v2_0/VehiclePropertyStore.h"
+#include "vhal_v2_0/VehiclePropertyStoreSnapshot.h"
+#include "vhal_v2_0/VehicleUtils.h"
+
+namespace android {
+namespace hardware {
+namespace automotive {
+namespace vehicle {
+namespace V2_0 {
+
+namespace {
+
+constexpr int kNumProperties = 256;
+constexpr int32_t kBaseProp = 0x1000 | VehiclePropertyGroup::VENDOR | VehiclePropertyType::FLOAT
+                              | VehicleArea::GLOBAL;
+
+/* Single map guarded by single mutex, the way VehiclePropertyStore used to store values. Used as
+ * a baseline. */
+class LockedMapStore {
+public:
+    void writeValue(const VehiclePropValue& propValue) {
+        std::lock_guard<std::mutex> g(mLock);
+        mValues[propValue.prop] = propValue;
+    }
+
+    std::unique_ptr<VehiclePropValue> readValueOrNull(int32_t prop) const {
+        std::lock_guard<std::mutex> g(mLock);
+        auto it = mValues.find(prop);
+        return it != mValues.end() ? std::make_unique<VehiclePropValue>(it->second) : nullptr;
+    }
+
+private:
+    mutable std::mutex mLock;
+    std::map<int32_t, VehiclePropValue> mValues;
+};
+
+VehiclePropValue createValue(int32_t prop, int64_t timestamp) {
+    return VehiclePropValue {
+        .timestamp = timestamp,
+        .prop = prop,
+        .value = { .floatValues = { static_cast<float>(timestamp) } },
+    };
+}
+
+template <typename Store>
+void populate(Store* store) {
+    for (int i = 0; i < kNumProperties; i++) {
+        store->writeValue(createValue(kBaseProp + i, 0));
+    }
+}
+
+/* Thread 0 keeps writing to all properties, the other threads read. */
+template <typename Store>
+void readWhileWriting(benchmark::State& state, Store* store) {
+    int32_t i = 0;
+    for (auto _ : state) {
+        int32_t prop = kBaseProp + (i++ % kNumProperties);
+        if (state.thread_index == 0) {
+            store->writeValue(createValue(prop, i));
+        } else {
+            benchmark::DoNotOptimize(store->readValueOrNull(prop));
+        }
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+
+/* Adapts VehiclePropertyStore to the interface of LockedMapStore. */
+class ShardedStore {
+public:
+    ShardedStore() {
+        for (int i = 0; i < kNumProperties; i++) {
+            mStore.registerProperty(VehiclePropConfig { .prop = kBaseProp + i });
+        }
+    }
+
+    void writeValue(const VehiclePropValue& propValue) {
+        mStore.writeValue(propValue, true);
+    }
+
+    std::unique_ptr<VehiclePropValue> readValueOrNull(int32_t prop) const {
+        return mStore.readValueOrNull(prop);
+    }
+
+    VehiclePropertyStore* get() { return &mStore; }
+
+private:
+    VehiclePropertyStore mStore;
+};
+
+LockedMapStore gLockedMapStore;
+ShardedStore gShardedStore;
+
+void BM_LockedMapStore(benchmark::State& state) {
+    if (state.thread_index == 0) populate(&gLockedMapStore);
+    readWhileWriting(state, &gLockedMapStore);
+}
+BENCHMARK(BM_LockedMapStore)->ThreadRange(1, 8)->UseRealTime();
+
+void BM_VehiclePropertyStore(benchmark::State& state) {
+    if (state.thread_index == 0) populate(&gShardedStore);
+    readWhileWriting(state, &gShardedStore);
+}
+BENCHMARK(BM_VehiclePropertyStore)->ThreadRange(1, 8)->UseRealTime();
+
+/* Cold start: writes initial values of all properties one by one, the way EmulatedVehicleHal
+ * populates the store from default config. */
+void BM_PopulateStore(benchmark::State& state) {
+    for (auto _ : state) {
+        state.PauseTiming();
+        auto store = std::make_unique<ShardedStore>();
+        state.ResumeTiming();
+        populate(store.get());
+    }
+}
+BENCHMARK(BM_PopulateStore);
+
+/* Cold start with a snapshot: the store is populated from defaults as above, then the snapshot is
+ * laid over it, the way EmulatedVehicleHal restores it. */
+void BM_RestoreSnapshot(benchmark::State& state) {
+    VehiclePropertyStore source;
+    for (int i = 0; i < kNumProperties; i++) {
+        source.registerProperty(VehiclePropConfig { .prop = kBaseProp + i });
+        source.writeValue(createValue(kBaseProp + i, 1), true);
+    }
+    std::vector<uint8_t> snapshot = VehiclePropertyStoreSnapshot::serialize(source);
+
+    for (auto _ : state) {
+        state.PauseTiming();
+        auto store = std::make_unique<ShardedStore>();
+        state.ResumeTiming();
+        populate(store.get());
+        VehiclePropertyStoreSnapshot::deserialize(snapshot.data(), snapshot.size(), store->get());
+    }
+    state.counters["snapshotBytes"] = snapshot.size();
+}
+BENCHMARK(BM_RestoreSnapshot);
+
+}  // namespace anonymous
+
+}  // namespace V2_0
+}  // namespace vehicle
+}  // namespace automotive
+}  // namespace hardware
+}  // namespace android
+
+BENCHMARK_MAIN();
@@ -0,0 +1,178 @@
+/*
+ * Copyright (C) 2018 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <atomic>
+#include <thread>
+
+#include <gtest/gtest.h>
+
+#include "vhal_v2_0/VehiclePropertyStore.h"
+#include "vhal_v2_0/VehicleUtils.h"
+
+namespace android {
+namespace hardware {
+namespace automotive {
+namespace vehicle {
+namespace V2_0 {
+
+namespace {
+
+constexpr int32_t kGlobalProp = toInt(VehicleProperty::PERF_VEHICLE_SPEED);
+constexpr int32_t kSeatProp = toInt(VehicleProperty::HVAC_FAN_SPEED);
+constexpr int32_t kTokenProp = toInt(VehicleProperty::OBD2_FREEZE_FRAME);
+
+class VehiclePropertyStoreTest : public ::testing::Test {
+protected:
+    void SetUp() override {
+        store.registerProperty(VehiclePropConfig { .prop = kGlobalProp });
+        store.registerProperty(VehiclePropConfig { .prop = kSeatProp });
+        store.registerProperty(VehiclePropConfig { .prop = kTokenProp },
+                               [](const VehiclePropValue& value) { return value.timestamp; });
+    }
+
+    static VehiclePropValue createValue(int32_t prop, int32_t area, int64_t timestamp) {
+        return VehiclePropValue {
+            .timestamp = timestamp,
+            .areaId = area,
+            .prop = prop,
+            .value = { .floatValues = { static_cast<float>(timestamp) } },
+        };
+    }
+
+public:
+    VehiclePropertyStore store;
+};
+
+TEST_F(VehiclePropertyStoreTest, writeUnregistered) {
+    ASSERT_FALSE(store.writeValue(createValue(toInt(VehicleProperty::INFO_MAKE), 0, 1), true));
+    ASSERT_EQ(nullptr, store.readValueOrNull(toInt(VehicleProperty::INFO_MAKE)));
+    ASSERT_EQ(nullptr, store.getConfigOrNull(toInt(VehicleProperty::INFO_MAKE)));
+}
+
+TEST_F(VehiclePropertyStoreTest, writeAndRead) {
+    ASSERT_TRUE(store.writeValue(createValue(kGlobalProp, 0, 1), true));
+    ASSERT_TRUE(store.writeValue(createValue(kGlobalProp, 0, 2), true));
+
+    auto value = store.readValueOrNull(kGlobalProp);
+    ASSERT_NE(nullptr, value);
+    ASSERT_EQ(2, value->timestamp);
+    ASSERT_EQ(1u, value->value.floatValues.size());
+    ASSERT_EQ(2.0f, value->value.floatValues[0]);
+    ASSERT_EQ(1u, store.readAllValues().size());
+}
+
+TEST_F(VehiclePropertyStoreTest, statusPreservedUnlessUpdated) {
+    auto value = createValue(kGlobalProp, 0, 1);
+    value.status = VehiclePropertyStatus::UNAVAILABLE;
+    ASSERT_TRUE(store.writeValue(value, true));
+
+    value.status = VehiclePropertyStatus::AVAILABLE;
+    ASSERT_TRUE(store.writeValue(value, false));
+    ASSERT_EQ(VehiclePropertyStatus::UNAVAILABLE, store.readValueOrNull(kGlobalProp)->status);
+
+    ASSERT_TRUE(store.writeValue(value, true));
+    ASSERT_EQ(VehiclePropertyStatus::AVAILABLE, store.readValueOrNull(kGlobalProp)->status);
+}
+
+TEST_F(VehiclePropertyStoreTest, areasAndTokens) {
+    const int32_t left = toInt(VehicleAreaSeat::ROW_1_LEFT);
+    const int32_t right = toInt(VehicleAreaSeat::ROW_1_RIGHT);
+    store.writeValue(createValue(kSeatProp, left, 1), true);
+    store.writeValue(createValue(kSeatProp, right, 2), true);
+    store.writeValue(createValue(kTokenProp, 0, 10), true);
+    store.writeValue(createValue(kTokenProp, 0, 20), true);
+
+    ASSERT_EQ(1, store.readValueOrNull(kSeatProp, left)->timestamp);
+    ASSERT_EQ(2, store.readValueOrNull(kSeatProp, right)->timestamp);
+    ASSERT_EQ(2u, store.readValuesForProperty(kSeatProp).size());
+    ASSERT_EQ(20, store.readValueOrNull(kTokenProp, 0, 20)->timestamp);
+
+    store.removeValue(createValue(kTokenProp, 0, 10));
+    ASSERT_EQ(nullptr, store.readValueOrNull(kTokenProp, 0, 10));
+    ASSERT_EQ(1u, store.readValuesForProperty(kTokenProp).size());
+
+    store.removeValuesForProperty(kSeatProp);
+    ASSERT_EQ(0u, store.readValuesForProperty(kSeatProp).size());
+    ASSERT_EQ(1u, store.readAllValues().size());
+}
+
+TEST_F(VehiclePropertyStoreTest, bulkReadsInPropertyOrder) {
+    // Registered and written out of order, in a separate store so that both properties and their
+    // table slots differ from the fixture.
+    VehiclePropertyStore shuffled;
+    const int32_t props[] = { kTokenProp, kGlobalProp, toInt(VehicleProperty::INFO_MAKE),
+                              kSeatProp };
+    for (int32_t prop : props) {
+        shuffled.registerProperty(VehiclePropConfig { .prop = prop });
+    }
+    const int32_t right = toInt(VehicleAreaSeat::ROW_1_RIGHT);
+    const int32_t left = toInt(VehicleAreaSeat::ROW_1_LEFT);
+    shuffled.writeValue(createValue(kSeatProp, right, 1), true);
+    shuffled.writeValue(createValue(kTokenProp, 0, 2), true);
+    shuffled.writeValue(createValue(kSeatProp, left, 3), true);
+    shuffled.writeValue(createValue(kGlobalProp, 0, 4), true);
+
+    std::vector<VehiclePropConfig> configs = shuffled.getAllConfigs();
+    ASSERT_EQ(4u, configs.size());
+    for (size_t i = 1; i < configs.size(); i++) {
+        ASSERT_LT(configs[i - 1].prop, configs[i].prop);
+    }
+
+    std::vector<VehiclePropValue> values = shuffled.readAllValues();
+    ASSERT_EQ(4u, values.size());
+    for (size_t i = 1; i < values.size(); i++) {
+        ASSERT_TRUE(values[i - 1].prop < values[i].prop
+                    || (values[i - 1].prop == values[i].prop
+                        && values[i - 1].areaId < values[i].areaId));
+    }
+}
+
+TEST_F(VehiclePropertyStoreTest, concurrentReadWrite) {
+    constexpr int64_t kIterations = 10000;
+    std::atomic<bool> done { false };
+
+    std::thread writer([this, kIterations]() {
+        for (int64_t i = 1; i <= kIterations; i++) {
+            store.writeValue(createValue(kGlobalProp, 0, i), true);
+        }
+    });
+
+    std::thread reader([this, &done]() {
+        int64_t lastTimestamp = 0;
+        while (!done) {
+            auto value = store.readValueOrNull(kGlobalProp);
+            if (value == nullptr) continue;
+            // Readers must always observe a consistent value that never goes back in time.
+            ASSERT_LE(lastTimestamp, value->timestamp);
+            ASSERT_EQ(static_cast<float>(value->timestamp), value->value.floatValues[0]);
+            lastTimestamp = value->timestamp;
+        }
+    });
+
+    writer.join();
+    done = true;
+    reader.join();
+
+    ASSERT_EQ(kIterations, store.readValueOrNull(kGlobalProp)->timestamp);
+}
+
+}  // namespace anonymous
+
+}  // namespace V2_0
+}  // namespace vehicle
+}  // namespace automotive
+}  // namespace hardware
+}  // namespace android
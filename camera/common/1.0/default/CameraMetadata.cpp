@@ -17,9 +17,13 @@
 // #define LOG_NDEBUG 0
 
 #define LOG_TAG "CamComm1.0-MD"
+#include <inttypes.h>
+#include <stdio.h>
 #include <log/log.h>
 #include <utils/Errors.h>
 
+#include <algorithm>
+
 #include "CameraMetadata.h"
 #include "VendorTagDescriptor.h"
 
@@ -170,6 +174,64 @@ status_t CameraMetadata::sort() {
     return sort_camera_metadata(mBuffer);
 }
 
+status_t CameraMetadata::reserve(size_t entryCapacity, size_t dataCapacity) {
+    if (mLocked) {
+        ALOGE("%s: CameraMetadata is locked", __FUNCTION__);
+        return INVALID_OPERATION;
+    }
+    if (mBuffer != NULL) {
+        size_t currentEntryCap = get_camera_metadata_entry_capacity(mBuffer);
+        size_t currentDataCap = get_camera_metadata_data_capacity(mBuffer);
+        if (entryCapacity <= currentEntryCap && dataCapacity <= currentDataCap) {
+            return OK;
+        }
+        entryCapacity = std::max(entryCapacity, currentEntryCap);
+        dataCapacity = std::max(dataCapacity, currentDataCap);
+    }
+    return reallocate(entryCapacity, dataCapacity);
+}
+
+status_t CameraMetadata::copyFrom(const CameraMetadata &other,
+        size_t extraEntries, size_t extraData) {
+    if (mLocked) {
+        ALOGE("%s: CameraMetadata is locked", __FUNCTION__);
+        return INVALID_OPERATION;
+    }
+    if (other.mBuffer == mBuffer) {
+        return reserve(entryCount() + extraEntries, (mBuffer == NULL) ? extraData :
+                get_camera_metadata_data_count(mBuffer) + extraData);
+    }
+
+    size_t entryCapacity = other.entryCount() + extraEntries;
+    size_t dataCapacity = extraData;
+    if (other.mBuffer != NULL) {
+        dataCapacity += get_camera_metadata_data_count(other.mBuffer);
+    }
+
+    // A large enough buffer is placed so that it keeps its whole size, the
+    // space left over goes to data capacity. The size is only recorded in the
+    // buffer itself, so a smaller placement would shrink it for good, and later
+    // reserve() or copyFrom() calls would reallocate.
+    size_t neededSize = calculate_camera_metadata_size(entryCapacity, dataCapacity);
+    size_t bufferSize = (mBuffer == NULL) ? 0 : get_camera_metadata_size(mBuffer);
+    if (bufferSize >= neededSize) {
+        place_camera_metadata(mBuffer, bufferSize, entryCapacity,
+                dataCapacity + bufferSize - neededSize);
+    } else {
+        clear();
+        mBuffer = allocate_camera_metadata(entryCapacity, dataCapacity);
+        if (mBuffer == NULL) {
+            ALOGE("%s: Can't allocate metadata buffer", __FUNCTION__);
+            return NO_MEMORY;
+        }
+    }
+
+    if (other.mBuffer == NULL) {
+        return OK;
+    }
+    return append_camera_metadata(mBuffer, other.mBuffer);
+}
+
 status_t CameraMetadata::checkType(uint32_t tag, uint8_t expectedType) {
     int tagType = get_local_camera_metadata_tag_type(tag, mBuffer);
     if ( CC_UNLIKELY(tagType == -1)) {
@@ -316,17 +378,27 @@ status_t CameraMetadata::updateImpl(uint32_t tag, const void *data,
     size_t data_size = calculate_camera_metadata_entry_data_size(type,
             data_count);
 
-    res = resizeIfNeeded(1, data_size);
+    // Updating an existing entry doesn't take a new entry slot, and only needs
+    // more data space if the size of its data changes. Otherwise the data is
+    // overwritten in place.
+    camera_metadata_entry_t entry;
+    bool exists = (mBuffer != NULL) &&
+            (find_camera_metadata_entry(mBuffer, tag, &entry) == OK);
+    size_t extraData = data_size;
+    if (exists && calculate_camera_metadata_entry_data_size(type, entry.count) == data_size) {
+        extraData = 0;
+    }
+
+    res = resizeIfNeeded(exists ? 0 : 1, extraData);
 
     if (res == OK) {
-        camera_metadata_entry_t entry;
-        res = find_camera_metadata_entry(mBuffer, tag, &entry);
-        if (res == NAME_NOT_FOUND) {
-            res = add_camera_metadata_entry(mBuffer,
-                    tag, data, data_count);
-        } else if (res == OK) {
+        if (exists) {
+            // Reallocation keeps the order of entries, so the index is still valid
             res = update_camera_metadata_entry(mBuffer,
                     entry.index, data, data_count, NULL);
+        } else {
+            res = add_camera_metadata_entry(mBuffer,
+                    tag, data, data_count);
         }
     }
 
@@ -432,20 +504,27 @@ status_t CameraMetadata::resizeIfNeeded(size_t extraEntries, size_t extraData) {
 
         if (newEntryCount > currentEntryCap ||
                 newDataCount > currentDataCap) {
-            camera_metadata_t *oldBuffer = mBuffer;
-            mBuffer = allocate_camera_metadata(newEntryCount,
-                    newDataCount);
-            if (mBuffer == NULL) {
-                ALOGE("%s: Can't allocate larger metadata buffer", __FUNCTION__);
-                return NO_MEMORY;
-            }
-            append_camera_metadata(mBuffer, oldBuffer);
-            free_camera_metadata(oldBuffer);
+            return reallocate(newEntryCount, newDataCount);
         }
     }
     return OK;
 }
 
+status_t CameraMetadata::reallocate(size_t entryCapacity, size_t dataCapacity) {
+    camera_metadata_t *newBuffer = allocate_camera_metadata(entryCapacity,
+            dataCapacity);
+    if (newBuffer == NULL) {
+        ALOGE("%s: Can't allocate larger metadata buffer", __FUNCTION__);
+        return NO_MEMORY;
+    }
+    if (mBuffer != NULL) {
+        append_camera_metadata(newBuffer, mBuffer);
+        free_camera_metadata(mBuffer);
+    }
+    mBuffer = newBuffer;
+    return OK;
+}
+
 void CameraMetadata::swap(CameraMetadata& other) {
     if (mLocked) {
         ALOGE("%s: CameraMetadata is locked", __FUNCTION__);
@@ -554,6 +633,67 @@ status_t CameraMetadata::getTagFromName(const char *name,
     return OK;
 }
 
+CameraMetadataPool::CameraMetadataPool(size_t maxPooled) : mMaxPooled(maxPooled) {
+    mBuffers.reserve(maxPooled);
+}
+
+CameraMetadataPool::~CameraMetadataPool() {
+    for (camera_metadata_t *buffer : mBuffers) {
+        free_camera_metadata(buffer);
+    }
+}
+
+status_t CameraMetadataPool::obtain(const CameraMetadata &base, CameraMetadata *out,
+        size_t extraEntries, size_t extraData) {
+    if (out == nullptr) {
+        return BAD_VALUE;
+    }
+    if (out->mLocked) {
+        ALOGE("%s: CameraMetadata is locked", __FUNCTION__);
+        return INVALID_OPERATION;
+    }
+
+    std::unique_lock<std::mutex> lk(mLock);
+    mObtainCount++;
+    if (out->mBuffer == NULL && !mBuffers.empty()) {
+        out->mBuffer = mBuffers.back();
+        mBuffers.pop_back();
+    }
+    lk.unlock();
+
+    camera_metadata_t *oldBuffer = out->mBuffer;
+    status_t res = out->copyFrom(base, extraEntries, extraData);
+    if (out->mBuffer != NULL && out->mBuffer != oldBuffer) {
+        lk.lock();
+        mAllocCount++;
+    }
+    return res;
+}
+
+void CameraMetadataPool::recycle(CameraMetadata *md) {
+    if (md == nullptr) {
+        return;
+    }
+    camera_metadata_t *buffer = md->release();
+    if (buffer == NULL) {
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lk(mLock);
+        if (mBuffers.size() < mMaxPooled) {
+            mBuffers.push_back(buffer);
+            return;
+        }
+    }
+    free_camera_metadata(buffer);
+}
+
+void CameraMetadataPool::dump(int fd, int indentation) const {
+    std::lock_guard<std::mutex> lk(mLock);
+    dprintf(fd, "%*sMetadata pool: %zu buffers pooled, %" PRIu64 " obtained, "
+            "%" PRIu64 " allocated\n", indentation, "", mBuffers.size(),
+            mObtainCount, mAllocCount);
+}
 
 } // namespace helper
 } // namespace V1_0
@@ -23,6 +23,8 @@
 #include <inttypes.h>
 #include <math.h>
 #include <stdint.h>
+#include <string.h>
+#include <time.h>
 #include <string>
 #include <vector>
 
@@ -1107,6 +1109,499 @@ bool ExifUtilsImpl::setFromMetadata(const CameraMetadata& metadata,
     return true;
 }
 
+namespace {
+
+// APP1 segment payload starts with the Exif header, followed by the TIFF
+// header. All offsets in the IFDs are relative to the TIFF header.
+const uint8_t kExifHeader[] = {'E', 'x', 'i', 'f', 0x0, 0x0};
+const uint8_t kTiffHeader[] = {'I', 'I', 0x2a, 0x0, 0x08, 0x0, 0x0, 0x0};
+const size_t kTiffStart = sizeof(kExifHeader);
+// Two bytes of the 16 bit JPEG segment size are taken by the size field.
+const size_t kMaxApp1Length = 65533;
+// Length of DateTime tags including NULL for termination in Exif standard.
+const size_t kDateTimeLength = 20;
+const size_t kGpsDateStampLength = 11;
+const size_t kSubsecTimeLength = 4;
+
+enum ExifField {
+    // IFD0
+    FIELD_IMAGE_WIDTH = 0,
+    FIELD_IMAGE_LENGTH,
+    FIELD_MAKE,
+    FIELD_MODEL,
+    FIELD_ORIENTATION,
+    FIELD_X_RESOLUTION,
+    FIELD_Y_RESOLUTION,
+    FIELD_RESOLUTION_UNIT,
+    FIELD_DATE_TIME,
+    FIELD_YCBCR_POSITIONING,
+    FIELD_EXIF_IFD_POINTER,
+    FIELD_GPS_IFD_POINTER,
+    // Exif IFD
+    FIELD_EXPOSURE_TIME,
+    FIELD_FNUMBER,
+    FIELD_EXIF_VERSION,
+    FIELD_DATE_TIME_ORIGINAL,
+    FIELD_DATE_TIME_DIGITIZED,
+    FIELD_COMPONENTS_CONFIGURATION,
+    FIELD_FLASH,
+    FIELD_FOCAL_LENGTH,
+    FIELD_SUBSEC_TIME,
+    FIELD_SUBSEC_TIME_ORIGINAL,
+    FIELD_SUBSEC_TIME_DIGITIZED,
+    FIELD_FLASHPIX_VERSION,
+    FIELD_COLOR_SPACE,
+    FIELD_PIXEL_X_DIMENSION,
+    FIELD_PIXEL_Y_DIMENSION,
+    FIELD_WHITE_BALANCE,
+    // GPS IFD
+    FIELD_GPS_VERSION_ID,
+    FIELD_GPS_LATITUDE_REF,
+    FIELD_GPS_LATITUDE,
+    FIELD_GPS_LONGITUDE_REF,
+    FIELD_GPS_LONGITUDE,
+    FIELD_GPS_ALTITUDE_REF,
+    FIELD_GPS_ALTITUDE,
+    FIELD_GPS_TIME_STAMP,
+    FIELD_GPS_PROCESSING_METHOD,
+    FIELD_GPS_DATE_STAMP,
+    // IFD1, describes the thumbnail
+    FIELD_THUMBNAIL_COMPRESSION,
+    FIELD_THUMBNAIL_X_RESOLUTION,
+    FIELD_THUMBNAIL_Y_RESOLUTION,
+    FIELD_THUMBNAIL_RESOLUTION_UNIT,
+    FIELD_THUMBNAIL_OFFSET,
+    FIELD_THUMBNAIL_LENGTH,
+    FIELD_COUNT
+};
+
+struct ExifFieldInfo {
+    ExifIfd ifd;
+    uint16_t tag;
+    ExifFormat format;
+    uint32_t components; // 0 if it depends on the value
+};
+
+// Indexed by ExifField. Sorted by IFD in the order they are written and by
+// tag within an IFD, as the Exif standard requires.
+const ExifFieldInfo kExifFields[FIELD_COUNT] = {
+    {EXIF_IFD_0, EXIF_TAG_IMAGE_WIDTH, EXIF_FORMAT_LONG, 1},
+    {EXIF_IFD_0, EXIF_TAG_IMAGE_LENGTH, EXIF_FORMAT_LONG, 1},
+    {EXIF_IFD_0, EXIF_TAG_MAKE, EXIF_FORMAT_ASCII, 0},
+    {EXIF_IFD_0, EXIF_TAG_MODEL, EXIF_FORMAT_ASCII, 0},
+    {EXIF_IFD_0, EXIF_TAG_ORIENTATION, EXIF_FORMAT_SHORT, 1},
+    {EXIF_IFD_0, EXIF_TAG_X_RESOLUTION, EXIF_FORMAT_RATIONAL, 1},
+    {EXIF_IFD_0, EXIF_TAG_Y_RESOLUTION, EXIF_FORMAT_RATIONAL, 1},
+    {EXIF_IFD_0, EXIF_TAG_RESOLUTION_UNIT, EXIF_FORMAT_SHORT, 1},
+    {EXIF_IFD_0, EXIF_TAG_DATE_TIME, EXIF_FORMAT_ASCII, kDateTimeLength},
+    {EXIF_IFD_0, EXIF_TAG_YCBCR_POSITIONING, EXIF_FORMAT_SHORT, 1},
+    {EXIF_IFD_0, EXIF_TAG_EXIF_IFD_POINTER, EXIF_FORMAT_LONG, 1},
+    {EXIF_IFD_0, EXIF_TAG_GPS_INFO_IFD_POINTER, EXIF_FORMAT_LONG, 1},
+    {EXIF_IFD_EXIF, EXIF_TAG_EXPOSURE_TIME, EXIF_FORMAT_RATIONAL, 1},
+    {EXIF_IFD_EXIF, EXIF_TAG_FNUMBER, EXIF_FORMAT_RATIONAL, 1},
+    {EXIF_IFD_EXIF, EXIF_TAG_EXIF_VERSION, EXIF_FORMAT_UNDEFINED, 4},
+    {EXIF_IFD_EXIF, EXIF_TAG_DATE_TIME_ORIGINAL, EXIF_FORMAT_ASCII, kDateTimeLength},
+    {EXIF_IFD_EXIF, EXIF_TAG_DATE_TIME_DIGITIZED, EXIF_FORMAT_ASCII, kDateTimeLength},
+    {EXIF_IFD_EXIF, EXIF_TAG_COMPONENTS_CONFIGURATION, EXIF_FORMAT_UNDEFINED, 4},
+    {EXIF_IFD_EXIF, EXIF_TAG_FLASH, EXIF_FORMAT_SHORT, 1},
+    {EXIF_IFD_EXIF, EXIF_TAG_FOCAL_LENGTH, EXIF_FORMAT_RATIONAL, 1},
+    {EXIF_IFD_EXIF, EXIF_TAG_SUB_SEC_TIME, EXIF_FORMAT_ASCII, kSubsecTimeLength},
+    {EXIF_IFD_EXIF, EXIF_TAG_SUB_SEC_TIME_ORIGINAL, EXIF_FORMAT_ASCII, kSubsecTimeLength},
+    {EXIF_IFD_EXIF, EXIF_TAG_SUB_SEC_TIME_DIGITIZED, EXIF_FORMAT_ASCII, kSubsecTimeLength},
+    {EXIF_IFD_EXIF, EXIF_TAG_FLASH_PIX_VERSION, EXIF_FORMAT_UNDEFINED, 4},
+    {EXIF_IFD_EXIF, EXIF_TAG_COLOR_SPACE, EXIF_FORMAT_SHORT, 1},
+    {EXIF_IFD_EXIF, EXIF_TAG_PIXEL_X_DIMENSION, EXIF_FORMAT_LONG, 1},
+    {EXIF_IFD_EXIF, EXIF_TAG_PIXEL_Y_DIMENSION, EXIF_FORMAT_LONG, 1},
+    {EXIF_IFD_EXIF, EXIF_TAG_WHITE_BALANCE, EXIF_FORMAT_SHORT, 1},
+    {EXIF_IFD_GPS, EXIF_TAG_GPS_VERSION_ID, EXIF_FORMAT_BYTE, 4},
+    {EXIF_IFD_GPS, EXIF_TAG_GPS_LATITUDE_REF, EXIF_FORMAT_ASCII, 2},
+    {EXIF_IFD_GPS, EXIF_TAG_GPS_LATITUDE, EXIF_FORMAT_RATIONAL, 3},
+    {EXIF_IFD_GPS, EXIF_TAG_GPS_LONGITUDE_REF, EXIF_FORMAT_ASCII, 2},
+    {EXIF_IFD_GPS, EXIF_TAG_GPS_LONGITUDE, EXIF_FORMAT_RATIONAL, 3},
+    {EXIF_IFD_GPS, EXIF_TAG_GPS_ALTITUDE_REF, EXIF_FORMAT_BYTE, 1},
+    {EXIF_IFD_GPS, EXIF_TAG_GPS_ALTITUDE, EXIF_FORMAT_RATIONAL, 1},
+    {EXIF_IFD_GPS, EXIF_TAG_GPS_TIME_STAMP, EXIF_FORMAT_RATIONAL, 3},
+    {EXIF_IFD_GPS, EXIF_TAG_GPS_PROCESSING_METHOD, EXIF_FORMAT_UNDEFINED, 0},
+    {EXIF_IFD_GPS, EXIF_TAG_GPS_DATE_STAMP, EXIF_FORMAT_ASCII, kGpsDateStampLength},
+    {EXIF_IFD_1, EXIF_TAG_COMPRESSION, EXIF_FORMAT_SHORT, 1},
+    {EXIF_IFD_1, EXIF_TAG_X_RESOLUTION, EXIF_FORMAT_RATIONAL, 1},
+    {EXIF_IFD_1, EXIF_TAG_Y_RESOLUTION, EXIF_FORMAT_RATIONAL, 1},
+    {EXIF_IFD_1, EXIF_TAG_RESOLUTION_UNIT, EXIF_FORMAT_SHORT, 1},
+    {EXIF_IFD_1, EXIF_TAG_JPEG_INTERCHANGE_FORMAT, EXIF_FORMAT_LONG, 1},
+    {EXIF_IFD_1, EXIF_TAG_JPEG_INTERCHANGE_FORMAT_LENGTH, EXIF_FORMAT_LONG, 1},
+};
+
+const ExifIfd kIfdOrder[] = {EXIF_IFD_0, EXIF_IFD_EXIF, EXIF_IFD_GPS, EXIF_IFD_1};
+
+inline uint64_t fieldBit(int field) {
+    return 1ull << field;
+}
+
+const uint64_t kMandatoryFields =
+        fieldBit(FIELD_IMAGE_WIDTH) | fieldBit(FIELD_IMAGE_LENGTH) |
+        fieldBit(FIELD_MAKE) | fieldBit(FIELD_MODEL) |
+        fieldBit(FIELD_X_RESOLUTION) | fieldBit(FIELD_Y_RESOLUTION) |
+        fieldBit(FIELD_RESOLUTION_UNIT) | fieldBit(FIELD_DATE_TIME) |
+        fieldBit(FIELD_YCBCR_POSITIONING) | fieldBit(FIELD_EXIF_IFD_POINTER) |
+        fieldBit(FIELD_EXIF_VERSION) | fieldBit(FIELD_DATE_TIME_ORIGINAL) |
+        fieldBit(FIELD_DATE_TIME_DIGITIZED) | fieldBit(FIELD_COMPONENTS_CONFIGURATION) |
+        fieldBit(FIELD_FLASHPIX_VERSION) | fieldBit(FIELD_COLOR_SPACE) |
+        fieldBit(FIELD_PIXEL_X_DIMENSION) | fieldBit(FIELD_PIXEL_Y_DIMENSION);
+
+const uint64_t kGpsCoordinateFields =
+        fieldBit(FIELD_GPS_LATITUDE_REF) | fieldBit(FIELD_GPS_LATITUDE) |
+        fieldBit(FIELD_GPS_LONGITUDE_REF) | fieldBit(FIELD_GPS_LONGITUDE) |
+        fieldBit(FIELD_GPS_ALTITUDE_REF) | fieldBit(FIELD_GPS_ALTITUDE);
+
+const uint64_t kGpsTimestampFields =
+        fieldBit(FIELD_GPS_TIME_STAMP) | fieldBit(FIELD_GPS_DATE_STAMP);
+
+const uint64_t kSubsecTimeFields =
+        fieldBit(FIELD_SUBSEC_TIME) | fieldBit(FIELD_SUBSEC_TIME_ORIGINAL) |
+        fieldBit(FIELD_SUBSEC_TIME_DIGITIZED);
+
+const uint64_t kThumbnailFields =
+        fieldBit(FIELD_THUMBNAIL_COMPRESSION) | fieldBit(FIELD_THUMBNAIL_X_RESOLUTION) |
+        fieldBit(FIELD_THUMBNAIL_Y_RESOLUTION) | fieldBit(FIELD_THUMBNAIL_RESOLUTION_UNIT) |
+        fieldBit(FIELD_THUMBNAIL_OFFSET) | fieldBit(FIELD_THUMBNAIL_LENGTH);
+
+// Same mapping as ExifUtilsImpl::setOrientation()
+uint16_t toExifOrientation(int32_t degrees) {
+    switch (degrees) {
+        case 90:
+            return 6;
+        case 180:
+            return 3;
+        case 270:
+            return 8;
+        default:
+            return 1;
+    }
+}
+
+} // anonymous namespace
+
+ExifApp1Writer::ExifApp1Writer(const CameraMetadata& characteristics,
+                               const std::string& make, const std::string& model)
+        : mMake(make), mModel(model), mHasFlash(false), mFlash(0),
+          mLayoutValid(false), mLayoutFields(0), mLayoutGpsMethodLength(0),
+          mValueOffsets(FIELD_COUNT, 0), mThumbnailOffset(0) {
+    camera_metadata_ro_entry entry = characteristics.find(ANDROID_FLASH_INFO_AVAILABLE);
+    if (entry.count) {
+        if (entry.data.u8[0] == ANDROID_FLASH_INFO_AVAILABLE_FALSE) {
+            const uint16_t kNoFlashFunction = 0x20;
+            mHasFlash = true;
+            mFlash = kNoFlashFunction;
+        } else {
+            ALOGE("%s: Unsupported flash info: %d", __FUNCTION__, entry.data.u8[0]);
+        }
+    }
+    mApp1.reserve(kMaxApp1Length);
+}
+
+uint8_t* ExifApp1Writer::valueOf(int field) {
+    return mApp1.data() + kTiffStart + mValueOffsets[field];
+}
+
+void ExifApp1Writer::buildLayout(uint64_t fields, uint32_t gpsMethodLength) {
+    uint32_t components[FIELD_COUNT];
+    for (int f = 0; f < FIELD_COUNT; f++) {
+        components[f] = kExifFields[f].components;
+    }
+    components[FIELD_MAKE] = mMake.size() + 1;
+    components[FIELD_MODEL] = mModel.size() + 1;
+    components[FIELD_GPS_PROCESSING_METHOD] = sizeof(gExifAsciiPrefix) + gpsMethodLength;
+
+    // First pass: place the IFDs, each one is followed by its values that
+    // don't fit into the 4 byte value field of an entry.
+    uint32_t ifdOffset[EXIF_IFD_COUNT] = {};
+    uint32_t ifdEntries[EXIF_IFD_COUNT] = {};
+    uint32_t offset = sizeof(kTiffHeader);
+    for (ExifIfd ifd : kIfdOrder) {
+        uint32_t valueSize = 0;
+        for (int f = 0; f < FIELD_COUNT; f++) {
+            if (kExifFields[f].ifd != ifd || !(fields & fieldBit(f))) {
+                continue;
+            }
+            ifdEntries[ifd]++;
+            uint32_t size = exif_format_get_size(kExifFields[f].format) * components[f];
+            if (size > 4) {
+                valueSize += (size + 1) & ~1u;
+            }
+        }
+        if (ifdEntries[ifd] == 0) {
+            continue;
+        }
+        ifdOffset[ifd] = offset;
+        offset += 2 + 12 * ifdEntries[ifd] + 4 + valueSize;
+    }
+    mThumbnailOffset = offset;
+
+    mApp1.assign(kTiffStart + offset, 0);
+    memcpy(mApp1.data(), kExifHeader, sizeof(kExifHeader));
+    uint8_t* tiff = mApp1.data() + kTiffStart;
+    memcpy(tiff, kTiffHeader, sizeof(kTiffHeader));
+
+    // Second pass: write the entries and remember where the values go.
+    for (ExifIfd ifd : kIfdOrder) {
+        if (ifdEntries[ifd] == 0) {
+            continue;
+        }
+        uint8_t* entry = tiff + ifdOffset[ifd];
+        exif_set_short(entry, EXIF_BYTE_ORDER_INTEL, ifdEntries[ifd]);
+        entry += 2;
+        uint32_t valueOffset = ifdOffset[ifd] + 2 + 12 * ifdEntries[ifd] + 4;
+        for (int f = 0; f < FIELD_COUNT; f++) {
+            if (kExifFields[f].ifd != ifd || !(fields & fieldBit(f))) {
+                continue;
+            }
+            uint32_t size = exif_format_get_size(kExifFields[f].format) * components[f];
+            exif_set_short(entry, EXIF_BYTE_ORDER_INTEL, kExifFields[f].tag);
+            exif_set_short(entry + 2, EXIF_BYTE_ORDER_INTEL, kExifFields[f].format);
+            exif_set_long(entry + 4, EXIF_BYTE_ORDER_INTEL, components[f]);
+            if (size <= 4) {
+                mValueOffsets[f] = entry + 8 - tiff;
+            } else {
+                exif_set_long(entry + 8, EXIF_BYTE_ORDER_INTEL, valueOffset);
+                mValueOffsets[f] = valueOffset;
+                valueOffset += (size + 1) & ~1u;
+            }
+            entry += 12;
+        }
+        // Offset of the next IFD, only IFD0 is linked to IFD1.
+        exif_set_long(entry, EXIF_BYTE_ORDER_INTEL,
+                      ifd == EXIF_IFD_0 ? ifdOffset[EXIF_IFD_1] : 0);
+    }
+
+    // Static values
+    const ExifRational kResolution = {72, 1};
+    const uint16_t kInchResolutionUnit = 2;
+    memcpy(valueOf(FIELD_MAKE), mMake.c_str(), components[FIELD_MAKE]);
+    memcpy(valueOf(FIELD_MODEL), mModel.c_str(), components[FIELD_MODEL]);
+    exif_set_rational(valueOf(FIELD_X_RESOLUTION), EXIF_BYTE_ORDER_INTEL, kResolution);
+    exif_set_rational(valueOf(FIELD_Y_RESOLUTION), EXIF_BYTE_ORDER_INTEL, kResolution);
+    exif_set_short(valueOf(FIELD_RESOLUTION_UNIT), EXIF_BYTE_ORDER_INTEL, kInchResolutionUnit);
+    exif_set_short(valueOf(FIELD_YCBCR_POSITIONING), EXIF_BYTE_ORDER_INTEL, 1 /* centered */);
+    exif_set_long(valueOf(FIELD_EXIF_IFD_POINTER), EXIF_BYTE_ORDER_INTEL,
+                  ifdOffset[EXIF_IFD_EXIF]);
+    memcpy(valueOf(FIELD_EXIF_VERSION), "0220", 4);
+    const uint8_t kComponentsConfiguration[] = {1, 2, 3, 0}; // YCbCr
+    memcpy(valueOf(FIELD_COMPONENTS_CONFIGURATION), kComponentsConfiguration, 4);
+    memcpy(valueOf(FIELD_FLASHPIX_VERSION), "0100", 4);
+    exif_set_short(valueOf(FIELD_COLOR_SPACE), EXIF_BYTE_ORDER_INTEL, 1 /* sRGB */);
+    if (fields & fieldBit(FIELD_FLASH)) {
+        exif_set_short(valueOf(FIELD_FLASH), EXIF_BYTE_ORDER_INTEL, mFlash);
+    }
+    if (fields & fieldBit(FIELD_GPS_IFD_POINTER)) {
+        exif_set_long(valueOf(FIELD_GPS_IFD_POINTER), EXIF_BYTE_ORDER_INTEL,
+                      ifdOffset[EXIF_IFD_GPS]);
+        const uint8_t kGpsVersion[] = {2, 2, 0, 0};
+        memcpy(valueOf(FIELD_GPS_VERSION_ID), kGpsVersion, 4);
+    }
+    if (fields & fieldBit(FIELD_GPS_PROCESSING_METHOD)) {
+        memcpy(valueOf(FIELD_GPS_PROCESSING_METHOD), gExifAsciiPrefix,
+               sizeof(gExifAsciiPrefix));
+    }
+    if (fields & kThumbnailFields) {
+        const uint16_t kJpegCompression = 6;
+        exif_set_short(valueOf(FIELD_THUMBNAIL_COMPRESSION), EXIF_BYTE_ORDER_INTEL,
+                       kJpegCompression);
+        exif_set_rational(valueOf(FIELD_THUMBNAIL_X_RESOLUTION), EXIF_BYTE_ORDER_INTEL,
+                          kResolution);
+        exif_set_rational(valueOf(FIELD_THUMBNAIL_Y_RESOLUTION), EXIF_BYTE_ORDER_INTEL,
+                          kResolution);
+        exif_set_short(valueOf(FIELD_THUMBNAIL_RESOLUTION_UNIT), EXIF_BYTE_ORDER_INTEL,
+                       kInchResolutionUnit);
+        exif_set_long(valueOf(FIELD_THUMBNAIL_OFFSET), EXIF_BYTE_ORDER_INTEL,
+                      mThumbnailOffset);
+    }
+
+    mLayoutFields = fields;
+    mLayoutGpsMethodLength = gpsMethodLength;
+    mLayoutValid = true;
+}
+
+bool ExifApp1Writer::generateApp1(const CameraMetadata& settings,
+                                  size_t imageWidth, size_t imageHeight,
+                                  const void* thumbnailBuffer, uint32_t thumbnailSize) {
+    // How precise the float-to-rational conversion for EXIF tags would be.
+    constexpr int kRationalPrecision = 10000;
+    uint64_t fields = kMandatoryFields;
+    if (mHasFlash) {
+        fields |= fieldBit(FIELD_FLASH);
+    }
+
+    struct timespec tp = {};
+    bool timeAvailable = clock_gettime(CLOCK_REALTIME, &tp) != -1;
+    if (timeAvailable) {
+        fields |= kSubsecTimeFields;
+    }
+
+    camera_metadata_ro_entry focalLength = settings.find(ANDROID_LENS_FOCAL_LENGTH);
+    if (focalLength.count) {
+        fields |= fieldBit(FIELD_FOCAL_LENGTH);
+    }
+
+    camera_metadata_ro_entry gpsCoordinates = settings.find(ANDROID_JPEG_GPS_COORDINATES);
+    if (gpsCoordinates.count >= 3) {
+        fields |= kGpsCoordinateFields;
+    } else if (gpsCoordinates.count) {
+        ALOGE("%s: Gps coordinates in metadata is not complete.", __FUNCTION__);
+    }
+
+    uint32_t gpsMethodLength = 0;
+    camera_metadata_ro_entry gpsMethod = settings.find(ANDROID_JPEG_GPS_PROCESSING_METHOD);
+    if (gpsMethod.count) {
+        fields |= fieldBit(FIELD_GPS_PROCESSING_METHOD);
+        gpsMethodLength = strnlen(reinterpret_cast<const char*>(gpsMethod.data.u8),
+                                  gpsMethod.count);
+    }
+
+    struct tm gpsTime;
+    camera_metadata_ro_entry gpsTimestamp = settings.find(ANDROID_JPEG_GPS_TIMESTAMP);
+    if (timeAvailable && gpsTimestamp.count) {
+        time_t timestamp = static_cast<time_t>(gpsTimestamp.data.i64[0]);
+        if (gmtime_r(&timestamp, &gpsTime)) {
+            fields |= kGpsTimestampFields;
+        } else {
+            ALOGE("%s: Time tranformation failed.", __FUNCTION__);
+        }
+    }
+
+    if (fields & (kGpsCoordinateFields | kGpsTimestampFields |
+                  fieldBit(FIELD_GPS_PROCESSING_METHOD))) {
+        fields |= fieldBit(FIELD_GPS_IFD_POINTER) | fieldBit(FIELD_GPS_VERSION_ID);
+    }
+
+    camera_metadata_ro_entry orientation = settings.find(ANDROID_JPEG_ORIENTATION);
+    if (orientation.count) {
+        fields |= fieldBit(FIELD_ORIENTATION);
+    }
+
+    camera_metadata_ro_entry exposureTime = settings.find(ANDROID_SENSOR_EXPOSURE_TIME);
+    if (exposureTime.count) {
+        fields |= fieldBit(FIELD_EXPOSURE_TIME);
+    }
+
+    camera_metadata_ro_entry aperture = settings.find(ANDROID_LENS_APERTURE);
+    if (aperture.count) {
+        fields |= fieldBit(FIELD_FNUMBER);
+    }
+
+    camera_metadata_ro_entry awbMode = settings.find(ANDROID_CONTROL_AWB_MODE);
+    if (awbMode.count) {
+        if (awbMode.data.u8[0] == ANDROID_CONTROL_AWB_MODE_AUTO) {
+            fields |= fieldBit(FIELD_WHITE_BALANCE);
+        } else {
+            ALOGE("%s: Unsupported awb mode: %d", __FUNCTION__, awbMode.data.u8[0]);
+        }
+    }
+
+    if (thumbnailBuffer != nullptr && thumbnailSize > 0) {
+        fields |= kThumbnailFields;
+    }
+
+    if (!mLayoutValid || fields != mLayoutFields || gpsMethodLength != mLayoutGpsMethodLength) {
+        buildLayout(fields, gpsMethodLength);
+    }
+
+    // Per-image values
+    exif_set_long(valueOf(FIELD_IMAGE_WIDTH), EXIF_BYTE_ORDER_INTEL, imageWidth);
+    exif_set_long(valueOf(FIELD_IMAGE_LENGTH), EXIF_BYTE_ORDER_INTEL, imageHeight);
+    exif_set_long(valueOf(FIELD_PIXEL_X_DIMENSION), EXIF_BYTE_ORDER_INTEL, imageWidth);
+    exif_set_long(valueOf(FIELD_PIXEL_Y_DIMENSION), EXIF_BYTE_ORDER_INTEL, imageHeight);
+
+    struct tm timeInfo;
+    localtime_r(&tp.tv_sec, &timeInfo);
+    char* dateTime = reinterpret_cast<char*>(valueOf(FIELD_DATE_TIME));
+    if (snprintf(dateTime, kDateTimeLength, "%04i:%02i:%02i %02i:%02i:%02i",
+                 timeInfo.tm_year + 1900, timeInfo.tm_mon + 1, timeInfo.tm_mday,
+                 timeInfo.tm_hour, timeInfo.tm_min, timeInfo.tm_sec) !=
+            static_cast<int>(kDateTimeLength - 1)) {
+        ALOGW("%s: Input time is invalid", __FUNCTION__);
+    }
+    memcpy(valueOf(FIELD_DATE_TIME_ORIGINAL), dateTime, kDateTimeLength);
+    memcpy(valueOf(FIELD_DATE_TIME_DIGITIZED), dateTime, kDateTimeLength);
+
+    if (fields & kSubsecTimeFields) {
+        char* subsecTime = reinterpret_cast<char*>(valueOf(FIELD_SUBSEC_TIME));
+        snprintf(subsecTime, kSubsecTimeLength, "%03ld", tp.tv_nsec / 1000000);
+        memcpy(valueOf(FIELD_SUBSEC_TIME_ORIGINAL), subsecTime, kSubsecTimeLength);
+        memcpy(valueOf(FIELD_SUBSEC_TIME_DIGITIZED), subsecTime, kSubsecTimeLength);
+    }
+
+    if (fields & fieldBit(FIELD_FOCAL_LENGTH)) {
+        exif_set_rational(valueOf(FIELD_FOCAL_LENGTH), EXIF_BYTE_ORDER_INTEL,
+                {static_cast<ExifLong>(focalLength.data.f[0] * kRationalPrecision),
+                 kRationalPrecision});
+    }
+
+    if (fields & kGpsCoordinateFields) {
+        double latitude = gpsCoordinates.data.d[0];
+        double longitude = gpsCoordinates.data.d[1];
+        double altitude = gpsCoordinates.data.d[2];
+        memcpy(valueOf(FIELD_GPS_LATITUDE_REF), latitude >= 0 ? "N" : "S", 2);
+        setLatitudeOrLongitudeData(valueOf(FIELD_GPS_LATITUDE), fabs(latitude));
+        memcpy(valueOf(FIELD_GPS_LONGITUDE_REF), longitude >= 0 ? "E" : "W", 2);
+        setLatitudeOrLongitudeData(valueOf(FIELD_GPS_LONGITUDE), fabs(longitude));
+        *valueOf(FIELD_GPS_ALTITUDE_REF) = altitude >= 0 ? 0 : 1;
+        exif_set_rational(valueOf(FIELD_GPS_ALTITUDE), EXIF_BYTE_ORDER_INTEL,
+                {static_cast<ExifLong>(fabs(altitude) * 1000), 1000});
+    }
+
+    if (fields & fieldBit(FIELD_GPS_PROCESSING_METHOD)) {
+        memcpy(valueOf(FIELD_GPS_PROCESSING_METHOD) + sizeof(gExifAsciiPrefix),
+               gpsMethod.data.u8, gpsMethodLength);
+    }
+
+    if (fields & kGpsTimestampFields) {
+        snprintf(reinterpret_cast<char*>(valueOf(FIELD_GPS_DATE_STAMP)), kGpsDateStampLength,
+                 "%04i:%02i:%02i", gpsTime.tm_year + 1900, gpsTime.tm_mon + 1, gpsTime.tm_mday);
+        uint8_t* timeStamp = valueOf(FIELD_GPS_TIME_STAMP);
+        exif_set_rational(timeStamp, EXIF_BYTE_ORDER_INTEL,
+                          {static_cast<ExifLong>(gpsTime.tm_hour), 1});
+        exif_set_rational(timeStamp + sizeof(ExifRational), EXIF_BYTE_ORDER_INTEL,
+                          {static_cast<ExifLong>(gpsTime.tm_min), 1});
+        exif_set_rational(timeStamp + 2 * sizeof(ExifRational), EXIF_BYTE_ORDER_INTEL,
+                          {static_cast<ExifLong>(gpsTime.tm_sec), 1});
+    }
+
+    if (fields & fieldBit(FIELD_ORIENTATION)) {
+        exif_set_short(valueOf(FIELD_ORIENTATION), EXIF_BYTE_ORDER_INTEL,
+                       toExifOrientation(orientation.data.i32[0]));
+    }
+
+    if (fields & fieldBit(FIELD_EXPOSURE_TIME)) {
+        // int64_t of nanoseconds
+        exif_set_rational(valueOf(FIELD_EXPOSURE_TIME), EXIF_BYTE_ORDER_INTEL,
+                {static_cast<ExifLong>(exposureTime.data.i64[0]), 1000000000u});
+    }
+
+    if (fields & fieldBit(FIELD_FNUMBER)) {
+        exif_set_rational(valueOf(FIELD_FNUMBER), EXIF_BYTE_ORDER_INTEL,
+                {static_cast<ExifLong>(aperture.data.f[0] * kRationalPrecision),
+                 kRationalPrecision});
+    }
+
+    if (fields & fieldBit(FIELD_WHITE_BALANCE)) {
+        const uint16_t kAutoWhiteBalance = 0;
+        exif_set_short(valueOf(FIELD_WHITE_BALANCE), EXIF_BYTE_ORDER_INTEL, kAutoWhiteBalance);
+    }
+
+    // The thumbnail goes right after the IFDs, replacing the previous one.
+    mApp1.resize(kTiffStart + mThumbnailOffset);
+    if (mApp1.size() + ((fields & kThumbnailFields) ? thumbnailSize : 0) > kMaxApp1Length) {
+        ALOGE("%s: The size of APP1 segment is too large", __FUNCTION__);
+        return false;
+    }
+    if (fields & kThumbnailFields) {
+        exif_set_long(valueOf(FIELD_THUMBNAIL_LENGTH), EXIF_BYTE_ORDER_INTEL, thumbnailSize);
+        const uint8_t* thumbnail = static_cast<const uint8_t*>(thumbnailBuffer);
+        mApp1.insert(mApp1.end(), thumbnail, thumbnail + thumbnailSize);
+    }
+    return true;
+}
+
 } // namespace helper
 } // namespace V1_0
 } // namespace common
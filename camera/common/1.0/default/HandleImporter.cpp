@@ -16,6 +16,8 @@
 
 #define LOG_TAG "HandleImporter"
 #include "HandleImporter.h"
+#include <inttypes.h>
+#include <stdio.h>
 #include <log/log.h>
 
 namespace android {
@@ -31,14 +33,24 @@ using IMapperV3 = android::hardware::graphics::mapper::V3_0::IMapper;
 
 HandleImporter::HandleImporter() : mInitialized(false) {}
 
+bool HandleImporter::initialize() {
+    if (mInitialized.load(std::memory_order_acquire)) {
+        return true;
+    }
+
+    Mutex::Autolock lock(mLock);
+    initializeLocked();
+    return mInitialized.load(std::memory_order_relaxed);
+}
+
 void HandleImporter::initializeLocked() {
-    if (mInitialized) {
+    if (mInitialized.load(std::memory_order_relaxed)) {
         return;
     }
 
     mMapperV3 = IMapperV3::getService();
     if (mMapperV3 != nullptr) {
-        mInitialized = true;
+        mInitialized.store(true, std::memory_order_release);
         return;
     }
 
@@ -48,16 +60,10 @@ void HandleImporter::initializeLocked() {
         return;
     }
 
-    mInitialized = true;
+    mInitialized.store(true, std::memory_order_release);
     return;
 }
 
-void HandleImporter::cleanup() {
-    mMapperV3.clear();
-    mMapperV2.clear();
-    mInitialized = false;
-}
-
 template<class M, class E>
 bool HandleImporter::importBufferInternal(const sp<M> mapper, buffer_handle_t& handle) {
     E error;
@@ -146,21 +152,16 @@ bool HandleImporter::importBuffer(buffer_handle_t& handle) {
         return true;
     }
 
-    Mutex::Autolock lock(mLock);
-    if (!mInitialized) {
-        initializeLocked();
+    if (!initialize()) {
+        ALOGE("%s: mMapperV3 and mMapperV2 are both null!", __FUNCTION__);
+        return false;
     }
 
     if (mMapperV3 != nullptr) {
         return importBufferInternal<IMapperV3, MapperErrorV3>(mMapperV3, handle);
     }
 
-    if (mMapperV2 != nullptr) {
-        return importBufferInternal<IMapper, MapperErrorV2>(mMapperV2, handle);
-    }
-
-    ALOGE("%s: mMapperV3 and mMapperV2 are both null!", __FUNCTION__);
-    return false;
+    return importBufferInternal<IMapper, MapperErrorV2>(mMapperV2, handle);
 }
 
 void HandleImporter::freeBuffer(buffer_handle_t handle) {
@@ -168,8 +169,7 @@ void HandleImporter::freeBuffer(buffer_handle_t handle) {
         return;
     }
 
-    Mutex::Autolock lock(mLock);
-    if (mMapperV3 == nullptr && mMapperV2 == nullptr) {
+    if (!initialize()) {
         ALOGE("%s: mMapperV3 and mMapperV2 are both null!", __FUNCTION__);
         return;
     }
@@ -215,14 +215,9 @@ void HandleImporter::closeFence(int fd) const {
 
 void* HandleImporter::lock(
         buffer_handle_t& buf, uint64_t cpuUsage, size_t size) {
-    Mutex::Autolock lock(mLock);
     void *ret = 0;
 
-    if (!mInitialized) {
-        initializeLocked();
-    }
-
-    if (mMapperV3 == nullptr && mMapperV2 == nullptr) {
+    if (!initialize()) {
         ALOGE("%s: mMapperV3 and mMapperV2 are both null!", __FUNCTION__);
         return ret;
     }
@@ -263,10 +258,9 @@ void* HandleImporter::lock(
 YCbCrLayout HandleImporter::lockYCbCr(
         buffer_handle_t& buf, uint64_t cpuUsage,
         const IMapper::Rect& accessRegion) {
-    Mutex::Autolock lock(mLock);
-
-    if (!mInitialized) {
-        initializeLocked();
+    if (!initialize()) {
+        ALOGE("%s: mMapperV3 and mMapperV2 are both null!", __FUNCTION__);
+        return {};
     }
 
     if (mMapperV3 != nullptr) {
@@ -274,25 +268,109 @@ YCbCrLayout HandleImporter::lockYCbCr(
                 mMapperV3, buf, cpuUsage, accessRegion);
     }
 
-    if (mMapperV2 != nullptr) {
-        return lockYCbCrInternal<IMapper, MapperErrorV2>(
-                mMapperV2, buf, cpuUsage, accessRegion);
-    }
-
-    ALOGE("%s: mMapperV3 and mMapperV2 are both null!", __FUNCTION__);
-    return {};
+    return lockYCbCrInternal<IMapper, MapperErrorV2>(
+            mMapperV2, buf, cpuUsage, accessRegion);
 }
 
 int HandleImporter::unlock(buffer_handle_t& buf) {
+    if (!initialize()) {
+        ALOGE("%s: mMapperV3 and mMapperV2 are both null!", __FUNCTION__);
+        return -1;
+    }
+
     if (mMapperV3 != nullptr) {
         return unlockInternal<IMapperV3, MapperErrorV3>(mMapperV3, buf);
     }
-    if (mMapperV2 != nullptr) {
-        return unlockInternal<IMapper, MapperErrorV2>(mMapperV2, buf);
+    return unlockInternal<IMapper, MapperErrorV2>(mMapperV2, buf);
+}
+
+ImportedBufferCache::ImportedBufferCache(HandleImporter& importer) :
+        mImporter(importer), mHits(0), mMisses(0) {}
+
+ImportedBufferCache::~ImportedBufferCache() {
+    clear();
+}
+
+buffer_handle_t* ImportedBufferCache::getOrImport(
+        int32_t streamId, uint64_t bufferId, buffer_handle_t buf) {
+    const Key key = {streamId, bufferId};
+    Stripe& stripe = stripeOf(key);
+    {
+        Mutex::Autolock _l(stripe.lock);
+        auto it = stripe.buffers.find(key);
+        if (it != stripe.buffers.end()) {
+            mHits.fetch_add(1, std::memory_order_relaxed);
+            return &it->second;
+        }
+    }
+
+    // Register a newly seen buffer. The import clones the handle through the mapper, so it is done
+    // without holding the stripe lock.
+    mMisses.fetch_add(1, std::memory_order_relaxed);
+    buffer_handle_t importedBuf = buf;
+    if (!mImporter.importBuffer(importedBuf) || importedBuf == nullptr) {
+        return nullptr;
+    }
+
+    Mutex::Autolock _l(stripe.lock);
+    auto res = stripe.buffers.emplace(key, importedBuf);
+    if (!res.second) {
+        // Imported concurrently by another thread, keep the cached copy
+        mImporter.freeBuffer(importedBuf);
+    }
+    return &res.first->second;
+}
+
+bool ImportedBufferCache::remove(int32_t streamId, uint64_t bufferId) {
+    const Key key = {streamId, bufferId};
+    Stripe& stripe = stripeOf(key);
+    buffer_handle_t buf;
+    {
+        Mutex::Autolock _l(stripe.lock);
+        auto it = stripe.buffers.find(key);
+        if (it == stripe.buffers.end()) {
+            return false;
+        }
+        buf = it->second;
+        stripe.buffers.erase(it);
     }
+    mImporter.freeBuffer(buf);
+    return true;
+}
 
-    ALOGE("%s: mMapperV3 and mMapperV2 are both null!", __FUNCTION__);
-    return -1;
+void ImportedBufferCache::removeStream(int32_t streamId) {
+    for (auto& stripe : mStripes) {
+        Mutex::Autolock _l(stripe.lock);
+        for (auto it = stripe.buffers.begin(); it != stripe.buffers.end();) {
+            if (it->first.streamId == streamId) {
+                mImporter.freeBuffer(it->second);
+                it = stripe.buffers.erase(it);
+            } else {
+                ++it;
+            }
+        }
+    }
+}
+
+void ImportedBufferCache::clear() {
+    for (auto& stripe : mStripes) {
+        Mutex::Autolock _l(stripe.lock);
+        for (auto& pair : stripe.buffers) {
+            mImporter.freeBuffer(pair.second);
+        }
+        stripe.buffers.clear();
+    }
+}
+
+void ImportedBufferCache::dump(int fd, int indentation) const {
+    size_t numBuffers = 0;
+    for (const auto& stripe : mStripes) {
+        Mutex::Autolock _l(stripe.lock);
+        numBuffers += stripe.buffers.size();
+    }
+    dprintf(fd, "%*sImported buffers: %zu cached, %" PRIu64 " hits, %" PRIu64 " misses\n",
+            indentation, "", numBuffers, mHits.load(std::memory_order_relaxed),
+            mMisses.load(std::memory_order_relaxed));
 }
 
 } // namespace helper
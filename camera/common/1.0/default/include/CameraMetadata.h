@@ -22,6 +22,9 @@
 #include <utils/String8.h>
 #include <utils/Vector.h>
 
+#include <mutex>
+#include <vector>
+
 namespace android {
 namespace hardware {
 namespace camera {
@@ -125,6 +128,23 @@ class CameraMetadata {
      */
     status_t sort();
 
+    /**
+     * Make sure the buffer has room for at least entryCapacity entries and
+     * dataCapacity bytes of data, reallocating it at most once. Useful before
+     * a series of updates whose total size is known up front.
+     */
+    status_t reserve(size_t entryCapacity, size_t dataCapacity);
+
+    /**
+     * Replace the contents with a copy of other, with room for extraEntries
+     * more entries and extraData more bytes of data. The current buffer is
+     * reused if it is large enough, so copying metadata of similar size into
+     * the same object over and over doesn't allocate. A reused buffer keeps
+     * its capacity, any space beyond what other needs is data capacity.
+     */
+    status_t copyFrom(const CameraMetadata &other, size_t extraEntries = 0,
+            size_t extraData = 0);
+
     /**
      * Update metadata entry. Will create entry if it doesn't exist already, and
      * will reallocate the buffer if insufficient space exists. Overloaded for
@@ -200,6 +220,8 @@ class CameraMetadata {
             const VendorTagDescriptor* vTags, uint32_t *tag);
 
   private:
+    friend class CameraMetadataPool;
+
     camera_metadata_t *mBuffer;
     mutable bool       mLocked;
 
@@ -218,6 +240,52 @@ class CameraMetadata {
      */
     status_t resizeIfNeeded(size_t extraEntries, size_t extraData);
 
+    /**
+     * Move the contents into a new buffer of the given capacity. The current
+     * buffer is kept if the allocation fails.
+     */
+    status_t reallocate(size_t entryCapacity, size_t dataCapacity);
+
+};
+
+/**
+ * Recycles metadata buffers of CameraMetadata objects that are built and
+ * dropped at a high rate, such as per-frame capture results. A result is
+ * obtained as a copy of a pre-built template that already has all of its
+ * entries, so only the entries which change from frame to frame need to be
+ * updated, in place. In steady state this doesn't touch the heap at all.
+ *
+ * The pool is thread-safe.
+ */
+class CameraMetadataPool {
+  public:
+    explicit CameraMetadataPool(size_t maxPooled = 4);
+    ~CameraMetadataPool();
+
+    /**
+     * Fill out with a copy of base, see CameraMetadata::copyFrom. A pooled
+     * buffer is used if out doesn't have one.
+     */
+    status_t obtain(const CameraMetadata &base, CameraMetadata *out,
+            size_t extraEntries = 0, size_t extraData = 0);
+
+    /**
+     * Take the buffer of md back to the pool, md is left empty.
+     */
+    void recycle(CameraMetadata *md);
+
+    /**
+     * Dump pool statistics into FD for debugging.
+     */
+    void dump(int fd, int indentation = 0) const;
+
+  private:
+    const size_t mMaxPooled;
+
+    mutable std::mutex mLock;
+    std::vector<camera_metadata_t*> mBuffers; // guarded by mLock
+    uint64_t mObtainCount = 0; // guarded by mLock
+    uint64_t mAllocCount = 0; // guarded by mLock
 };
 
 } // namespace helper
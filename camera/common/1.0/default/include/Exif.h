@@ -17,6 +17,9 @@
 #ifndef ANDROID_HARDWARE_INTERFACES_CAMERA_COMMON_1_0_EXIF_H
 #define ANDROID_HARDWARE_INTERFACES_CAMERA_COMMON_1_0_EXIF_H
 
+#include <string>
+#include <vector>
+
 #include "CameraMetadata.h"
 
 namespace android {
@@ -244,6 +247,53 @@ class ExifUtils {
     virtual unsigned int getApp1Length() = 0;
 };
 
+// ExifApp1Writer generates the same tags as ExifUtils::setFromMetadata for one
+// camera, without building a libexif tree for every image. Tags that never
+// change for the camera (make, model, flash info, versions) are serialized
+// once together with the IFD layout. Each image then only patches its values
+// (time, size, exposure, GPS, orientation, thumbnail) into the preallocated
+// segment. The layout is rebuilt when the set of tags changes, e.g. when a
+// request starts carrying GPS location.
+//
+// Not thread safe, each JPEG producer owns its writer.
+class ExifApp1Writer {
+
+ public:
+    // Static tags are taken from |characteristics|.
+    ExifApp1Writer(const CameraMetadata& characteristics,
+                   const std::string& make, const std::string& model);
+
+    // Generates APP1 segment with per-image tags from |settings| and the
+    // thumbnail, if |thumbnailSize| is not 0.
+    // Returns false if the segment doesn't fit into a JPEG APP1 segment.
+    bool generateApp1(const CameraMetadata& settings,
+                      size_t imageWidth, size_t imageHeight,
+                      const void* thumbnailBuffer, uint32_t thumbnailSize);
+
+    // Valid until the next generateApp1() call.
+    const uint8_t* getApp1Buffer() const { return mApp1.data(); }
+    unsigned int getApp1Length() const { return mApp1.size(); }
+
+ private:
+    // Lays out all IFDs for the given set of fields and writes the static values.
+    void buildLayout(uint64_t fields, uint32_t gpsMethodLength);
+    uint8_t* valueOf(int field);
+
+    const std::string mMake;
+    const std::string mModel;
+    bool mHasFlash;
+    uint16_t mFlash;
+
+    bool mLayoutValid;
+    uint64_t mLayoutFields;
+    uint32_t mLayoutGpsMethodLength;
+    // Offsets of field values from the TIFF header, by field
+    std::vector<uint32_t> mValueOffsets;
+    uint32_t mThumbnailOffset;
+
+    std::vector<uint8_t> mApp1;
+};
+
 
 } // namespace helper
 } // namespace V1_0
@@ -17,6 +17,10 @@
 #ifndef CAMERA_COMMON_1_0_HANDLEIMPORTED_H
 #define CAMERA_COMMON_1_0_HANDLEIMPORTED_H
 
+#include <array>
+#include <atomic>
+#include <unordered_map>
+
 #include <utils/Mutex.h>
 #include <android/hardware/graphics/mapper/2.0/IMapper.h>
 #include <android/hardware/graphics/mapper/3.0/IMapper.h>
@@ -55,8 +59,10 @@ public:
     int unlock(buffer_handle_t& buf); // returns release fence
 
 private:
+    // Fetches the mapper service on first use. Returns false if neither mapper is available.
+    // Once initialized the mapper handles never change, so callers use them without mLock.
+    bool initialize();
     void initializeLocked();
-    void cleanup();
 
     template<class M, class E>
     bool importBufferInternal(const sp<M> mapper, buffer_handle_t& handle);
@@ -66,12 +72,69 @@ private:
     template<class M, class E>
     int unlockInternal(const sp<M> mapper, buffer_handle_t& buf);
 
-    Mutex mLock;
-    bool mInitialized;
+    Mutex mLock; // only protects the mapper service lookup
+    std::atomic<bool> mInitialized;
     sp<IMapper> mMapperV2;
     sp<graphics::mapper::V3_0::IMapper> mMapperV3;
 };
 
+// Buffers imported by a camera device session, keyed by stream ID and the buffer ID assigned by
+// camera service. Entries are spread over a fixed number of stripes with a lock each, so lookups
+// don't serialize on a single session lock, and a newly seen buffer is imported outside of any
+// lock.
+class ImportedBufferCache {
+public:
+    explicit ImportedBufferCache(HandleImporter& importer);
+    ~ImportedBufferCache();
+
+    // Returns the imported handle of the buffer, importing buf first if the buffer is not cached.
+    // The pointer stays valid until the buffer is removed. Returns nullptr if the import fails.
+    buffer_handle_t* getOrImport(int32_t streamId, uint64_t bufferId, buffer_handle_t buf);
+
+    // Frees a cached buffer. Returns false if the buffer is not cached.
+    bool remove(int32_t streamId, uint64_t bufferId);
+
+    // Frees all buffers of a stream
+    void removeStream(int32_t streamId);
+
+    // Frees all buffers
+    void clear();
+
+    void dump(int fd, int indentation = 0) const;
+
+private:
+    static const size_t kNumStripes = 8;
+
+    struct Key {
+        int32_t streamId;
+        uint64_t bufferId;
+        bool operator==(const Key& other) const {
+            return streamId == other.streamId && bufferId == other.bufferId;
+        }
+    };
+
+    struct KeyHash {
+        size_t operator()(const Key& key) const {
+            // Buffer IDs are allocated sequentially per stream
+            return static_cast<size_t>(key.bufferId * 31 + static_cast<uint32_t>(key.streamId));
+        }
+    };
+
+    struct Stripe {
+        mutable Mutex lock;
+        std::unordered_map<Key, buffer_handle_t, KeyHash> buffers;
+    };
+
+    Stripe& stripeOf(const Key& key) {
+        return mStripes[KeyHash()(key) % kNumStripes];
+    }
+
+    HandleImporter& mImporter;
+    std::array<Stripe, kNumStripes> mStripes;
+    std::atomic<uint64_t> mHits;
+    std::atomic<uint64_t> mMisses;
+};
+
 } // namespace helper
 } // namespace V1_0
 } // namespace common
@@ -0,0 +1,183 @@
+/*
+ * Copyright (C) 2018 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <benchmark/benchmark.h>
+
+#include "CameraMetadata.h"
+
+namespace android {
+namespace hardware {
+namespace camera {
+namespace common {
+namespace V1_0 {
+namespace helper {
+
+namespace {
+
+#define ARRAY_SIZE(a) (sizeof(a) / sizeof(a[0]))
+
+// Settings of a typical preview request
+CameraMetadata previewSettings() {
+    CameraMetadata md;
+    const struct {
+        uint32_t tag;
+        uint8_t value;
+    } byteEntries[] = {
+        {ANDROID_COLOR_CORRECTION_ABERRATION_MODE,
+                ANDROID_COLOR_CORRECTION_ABERRATION_MODE_FAST},
+        {ANDROID_CONTROL_AE_ANTIBANDING_MODE, ANDROID_CONTROL_AE_ANTIBANDING_MODE_AUTO},
+        {ANDROID_CONTROL_AE_LOCK, ANDROID_CONTROL_AE_LOCK_OFF},
+        {ANDROID_CONTROL_AE_MODE, ANDROID_CONTROL_AE_MODE_ON},
+        {ANDROID_CONTROL_AE_PRECAPTURE_TRIGGER, ANDROID_CONTROL_AE_PRECAPTURE_TRIGGER_IDLE},
+        {ANDROID_CONTROL_AF_MODE, ANDROID_CONTROL_AF_MODE_CONTINUOUS_PICTURE},
+        {ANDROID_CONTROL_AF_TRIGGER, ANDROID_CONTROL_AF_TRIGGER_IDLE},
+        {ANDROID_CONTROL_AWB_LOCK, ANDROID_CONTROL_AWB_LOCK_OFF},
+        {ANDROID_CONTROL_AWB_MODE, ANDROID_CONTROL_AWB_MODE_AUTO},
+        {ANDROID_CONTROL_CAPTURE_INTENT, ANDROID_CONTROL_CAPTURE_INTENT_PREVIEW},
+        {ANDROID_CONTROL_EFFECT_MODE, ANDROID_CONTROL_EFFECT_MODE_OFF},
+        {ANDROID_CONTROL_MODE, ANDROID_CONTROL_MODE_AUTO},
+        {ANDROID_CONTROL_SCENE_MODE, ANDROID_CONTROL_SCENE_MODE_DISABLED},
+        {ANDROID_CONTROL_VIDEO_STABILIZATION_MODE,
+                ANDROID_CONTROL_VIDEO_STABILIZATION_MODE_OFF},
+        {ANDROID_FLASH_MODE, ANDROID_FLASH_MODE_OFF},
+        {ANDROID_JPEG_QUALITY, 90},
+        {ANDROID_JPEG_THUMBNAIL_QUALITY, 90},
+        {ANDROID_NOISE_REDUCTION_MODE, ANDROID_NOISE_REDUCTION_MODE_FAST},
+        {ANDROID_STATISTICS_FACE_DETECT_MODE, ANDROID_STATISTICS_FACE_DETECT_MODE_OFF},
+    };
+    for (const auto& entry : byteEntries) {
+        md.update(entry.tag, &entry.value, 1);
+    }
+
+    const int32_t fpsRange[] = {15, 30};
+    md.update(ANDROID_CONTROL_AE_TARGET_FPS_RANGE, fpsRange, ARRAY_SIZE(fpsRange));
+    const int32_t exposureCompensation = 0;
+    md.update(ANDROID_CONTROL_AE_EXPOSURE_COMPENSATION, &exposureCompensation, 1);
+    const int32_t thumbnailSize[] = {240, 180};
+    md.update(ANDROID_JPEG_THUMBNAIL_SIZE, thumbnailSize, ARRAY_SIZE(thumbnailSize));
+    const int32_t orientation = 0;
+    md.update(ANDROID_JPEG_ORIENTATION, &orientation, 1);
+    const float focalLength = 3.04f;
+    md.update(ANDROID_LENS_FOCAL_LENGTH, &focalLength, 1);
+    md.sort();
+    return md;
+}
+
+const camera_metadata_t* bufferOf(const CameraMetadata& md) {
+    const camera_metadata_t* buffer = md.getAndLock();
+    md.unlock(buffer);
+    return buffer;
+}
+
+// Updates md and counts the times its buffer got reallocated
+template<typename T>
+void update(CameraMetadata& md, uint32_t tag, const T* data, size_t count,
+        uint64_t* allocations) {
+    const camera_metadata_t* buffer = bufferOf(md);
+    md.update(tag, data, count);
+    if (bufferOf(md) != buffer) {
+        (*allocations)++;
+    }
+}
+
+// Result entries the external camera HAL adds to request settings
+void fillStaticResult(CameraMetadata& md, uint64_t* allocations) {
+    const struct {
+        uint32_t tag;
+        uint8_t value;
+    } byteEntries[] = {
+        {ANDROID_CONTROL_AE_STATE, ANDROID_CONTROL_AE_STATE_CONVERGED},
+        {ANDROID_CONTROL_AE_LOCK, ANDROID_CONTROL_AE_LOCK_OFF},
+        {ANDROID_CONTROL_AWB_STATE, ANDROID_CONTROL_AWB_STATE_CONVERGED},
+        {ANDROID_CONTROL_AWB_LOCK, ANDROID_CONTROL_AWB_LOCK_OFF},
+        {ANDROID_FLASH_STATE, ANDROID_FLASH_STATE_UNAVAILABLE},
+        {ANDROID_REQUEST_PIPELINE_DEPTH, 4},
+        {ANDROID_STATISTICS_LENS_SHADING_MAP_MODE,
+                ANDROID_STATISTICS_LENS_SHADING_MAP_MODE_OFF},
+        {ANDROID_STATISTICS_SCENE_FLICKER, ANDROID_STATISTICS_SCENE_FLICKER_NONE},
+    };
+    for (const auto& entry : byteEntries) {
+        update(md, entry.tag, &entry.value, 1, allocations);
+    }
+    const int32_t cropRegion[] = {0, 0, 1920, 1080};
+    update(md, ANDROID_SCALER_CROP_REGION, cropRegion, ARRAY_SIZE(cropRegion), allocations);
+}
+
+void fillFrameResult(CameraMetadata& md, int64_t timestamp, uint64_t* allocations) {
+    const uint8_t afState = ANDROID_CONTROL_AF_STATE_INACTIVE;
+    update(md, ANDROID_CONTROL_AF_STATE, &afState, 1, allocations);
+    update(md, ANDROID_SENSOR_TIMESTAMP, &timestamp, 1, allocations);
+}
+
+// Previous implementation: every result is a clone of request settings, which then grows to fit
+// the result entries.
+void BM_CloneResult(benchmark::State& state) {
+    const CameraMetadata settings = previewSettings();
+    int64_t timestamp = 0;
+    uint64_t allocations = 0;
+
+    for (auto _ : state) {
+        CameraMetadata md(settings);
+        allocations++;
+        fillStaticResult(md, &allocations);
+        fillFrameResult(md, timestamp++, &allocations);
+        benchmark::DoNotOptimize(bufferOf(md));
+    }
+    state.counters["allocs"] = benchmark::Counter(allocations, benchmark::Counter::kAvgIterations);
+}
+
+// Result is a pooled copy of a template with the static result entries, only the per-frame
+// entries are updated in place.
+void BM_PooledResult(benchmark::State& state) {
+    uint64_t allocations = 0;
+    CameraMetadata resultTemplate = previewSettings();
+    fillStaticResult(resultTemplate, &allocations);
+    fillFrameResult(resultTemplate, 0, &allocations);
+    resultTemplate.sort();
+    allocations = 0;
+
+    CameraMetadataPool pool;
+    int64_t timestamp = 0;
+    const camera_metadata_t* lastBuffer = nullptr;
+
+    for (auto _ : state) {
+        CameraMetadata md;
+        pool.obtain(resultTemplate, &md);
+        const camera_metadata_t* buffer = bufferOf(md);
+        if (buffer != lastBuffer) {
+            allocations++;
+            lastBuffer = buffer;
+        }
+        fillFrameResult(md, timestamp++, &allocations);
+        benchmark::DoNotOptimize(bufferOf(md));
+        pool.recycle(&md);
+    }
+    state.counters["allocs"] = benchmark::Counter(allocations, benchmark::Counter::kAvgIterations);
+}
+
+BENCHMARK(BM_CloneResult);
+BENCHMARK(BM_PooledResult);
+
+}  // anonymous namespace
+
+}  // namespace helper
+}  // namespace V1_0
+}  // namespace common
+}  // namespace camera
+}  // namespace hardware
+}  // namespace android
+
+BENCHMARK_MAIN();
@@ -0,0 +1,138 @@
+/*
+ * Copyright (C) 2018 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <memory>
+#include <vector>
+
+#include <benchmark/benchmark.h>
+
+#include "CameraMetadata.h"
+#include "Exif.h"
+
+namespace android {
+namespace hardware {
+namespace camera {
+namespace common {
+namespace V1_0 {
+namespace helper {
+
+namespace {
+
+const size_t kWidth = 1920;
+const size_t kHeight = 1080;
+// Size of a typical 240x180 thumbnail
+const size_t kThumbnailSize = 12 * 1024;
+
+// The subset of external camera characteristics that matters for EXIF, plus some
+// unrelated entries to make lookups realistic.
+CameraMetadata characteristics() {
+    CameraMetadata md;
+    const uint8_t flashAvailable = ANDROID_FLASH_INFO_AVAILABLE_FALSE;
+    md.update(ANDROID_FLASH_INFO_AVAILABLE, &flashAvailable, 1);
+    const float focalLengths[] = {3.04f};
+    md.update(ANDROID_LENS_INFO_AVAILABLE_FOCAL_LENGTHS, focalLengths, 1);
+    const int32_t thumbnailSizes[] = {0, 0, 176, 144, 240, 144, 256, 144, 240, 160, 256, 154};
+    md.update(ANDROID_JPEG_AVAILABLE_THUMBNAIL_SIZES, thumbnailSizes,
+            sizeof(thumbnailSizes) / sizeof(thumbnailSizes[0]));
+    const int32_t maxJpegSize = 3 * 1024 * 1024;
+    md.update(ANDROID_JPEG_MAX_SIZE, &maxJpegSize, 1);
+    const int32_t sensorOrientation = 0;
+    md.update(ANDROID_SENSOR_ORIENTATION, &sensorOrientation, 1);
+    md.sort();
+    return md;
+}
+
+// Settings of a still capture request, with or without location
+CameraMetadata stillSettings(bool withGps) {
+    CameraMetadata md;
+    const uint8_t awbMode = ANDROID_CONTROL_AWB_MODE_AUTO;
+    md.update(ANDROID_CONTROL_AWB_MODE, &awbMode, 1);
+    const uint8_t intent = ANDROID_CONTROL_CAPTURE_INTENT_STILL_CAPTURE;
+    md.update(ANDROID_CONTROL_CAPTURE_INTENT, &intent, 1);
+    const uint8_t quality = 95;
+    md.update(ANDROID_JPEG_QUALITY, &quality, 1);
+    const int32_t orientation = 90;
+    md.update(ANDROID_JPEG_ORIENTATION, &orientation, 1);
+    const float focalLength = 3.04f;
+    md.update(ANDROID_LENS_FOCAL_LENGTH, &focalLength, 1);
+    const float aperture = 2.0f;
+    md.update(ANDROID_LENS_APERTURE, &aperture, 1);
+    const int64_t exposureTime = 33333333;
+    md.update(ANDROID_SENSOR_EXPOSURE_TIME, &exposureTime, 1);
+    if (withGps) {
+        const double coordinates[] = {37.4219, -122.0840, 32.0};
+        md.update(ANDROID_JPEG_GPS_COORDINATES, coordinates, 3);
+        const uint8_t method[] = "fused";
+        md.update(ANDROID_JPEG_GPS_PROCESSING_METHOD, method, sizeof(method));
+        const int64_t timestamp = 1538000000;
+        md.update(ANDROID_JPEG_GPS_TIMESTAMP, &timestamp, 1);
+    }
+    md.sort();
+    return md;
+}
+
+// Previous external camera path: merge characteristics with the request and
+// build a libexif tree for every capture.
+void BM_ExifUtils(benchmark::State& state) {
+    const CameraMetadata chars = characteristics();
+    const CameraMetadata settings = stillSettings(state.range(0));
+    std::vector<uint8_t> thumbnail(kThumbnailSize, 0x5a);
+
+    for (auto _ : state) {
+        CameraMetadata meta(chars);
+        meta.append(settings);
+        std::unique_ptr<ExifUtils> utils(ExifUtils::create());
+        utils->initialize();
+        utils->setFromMetadata(meta, kWidth, kHeight);
+        utils->setMake("Generic");
+        utils->setModel("USB Camera");
+        if (!utils->generateApp1(thumbnail.data(), thumbnail.size())) {
+            state.SkipWithError("generateApp1 failed");
+            break;
+        }
+        benchmark::DoNotOptimize(utils->getApp1Buffer());
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+
+void BM_ExifApp1Writer(benchmark::State& state) {
+    const CameraMetadata chars = characteristics();
+    const CameraMetadata settings = stillSettings(state.range(0));
+    std::vector<uint8_t> thumbnail(kThumbnailSize, 0x5a);
+
+    ExifApp1Writer writer(chars, "Generic", "USB Camera");
+    for (auto _ : state) {
+        if (!writer.generateApp1(settings, kWidth, kHeight,
+                thumbnail.data(), thumbnail.size())) {
+            state.SkipWithError("generateApp1 failed");
+            break;
+        }
+        benchmark::DoNotOptimize(writer.getApp1Buffer());
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+
+BENCHMARK(BM_ExifUtils)->ArgName("gps")->Arg(0)->Arg(1);
+BENCHMARK(BM_ExifApp1Writer)->ArgName("gps")->Arg(0)->Arg(1);
+
+}  // anonymous namespace
+
+}  // namespace helper
+}  // namespace V1_0
+}  // namespace common
+}  // namespace camera
+}  // namespace hardware
+}  // namespace android
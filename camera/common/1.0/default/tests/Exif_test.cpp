@@ -0,0 +1,273 @@
+/*
+ * Copyright (C) 2018 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <string.h>
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <gtest/gtest.h>
+#include <libexif/exif-data.h>
+
+#include "CameraMetadata.h"
+#include "Exif.h"
+
+namespace android {
+namespace hardware {
+namespace camera {
+namespace common {
+namespace V1_0 {
+namespace helper {
+
+namespace {
+
+const size_t kWidth = 1920;
+const size_t kHeight = 1080;
+const char kMake[] = "Generic";
+const char kModel[] = "USB Camera";
+
+struct GpsLocation {
+    double coordinates[3];
+    std::string method;
+    int64_t timestamp;
+};
+
+const GpsLocation kMountainView = {{37.4219, -122.0840, 32.0}, "fused", 1538000000};
+const GpsLocation kSydney = {{-33.8688, 151.2093, -5.0}, "network", 1538086399};
+
+CameraMetadata characteristics() {
+    CameraMetadata md;
+    const uint8_t flashAvailable = ANDROID_FLASH_INFO_AVAILABLE_FALSE;
+    md.update(ANDROID_FLASH_INFO_AVAILABLE, &flashAvailable, 1);
+    const float focalLengths[] = {3.04f};
+    md.update(ANDROID_LENS_INFO_AVAILABLE_FOCAL_LENGTHS, focalLengths, 1);
+    md.sort();
+    return md;
+}
+
+// Settings of a still capture request, with location if |gps| is not null
+CameraMetadata stillSettings(const GpsLocation* gps, int32_t orientation = 90) {
+    CameraMetadata md;
+    const uint8_t awbMode = ANDROID_CONTROL_AWB_MODE_AUTO;
+    md.update(ANDROID_CONTROL_AWB_MODE, &awbMode, 1);
+    md.update(ANDROID_JPEG_ORIENTATION, &orientation, 1);
+    const float focalLength = 3.04f;
+    md.update(ANDROID_LENS_FOCAL_LENGTH, &focalLength, 1);
+    const float aperture = 2.0f;
+    md.update(ANDROID_LENS_APERTURE, &aperture, 1);
+    const int64_t exposureTime = 33333333;
+    md.update(ANDROID_SENSOR_EXPOSURE_TIME, &exposureTime, 1);
+    if (gps != nullptr) {
+        md.update(ANDROID_JPEG_GPS_COORDINATES, gps->coordinates, 3);
+        md.update(ANDROID_JPEG_GPS_PROCESSING_METHOD,
+                  reinterpret_cast<const uint8_t*>(gps->method.c_str()), gps->method.size() + 1);
+        md.update(ANDROID_JPEG_GPS_TIMESTAMP, &gps->timestamp, 1);
+    }
+    md.sort();
+    return md;
+}
+
+std::vector<uint8_t> thumbnail(size_t size) {
+    std::vector<uint8_t> data(size);
+    for (size_t i = 0; i < size; i++) {
+        data[i] = static_cast<uint8_t>(i * 13);
+    }
+    return data;
+}
+
+using ExifDataPtr = std::unique_ptr<ExifData, decltype(&exif_data_unref)>;
+
+ExifDataPtr parseApp1(const uint8_t* app1, unsigned int length) {
+    ExifDataPtr data(exif_data_new(), exif_data_unref);
+    // Compare the tags as written, without libexif adding or fixing entries on load.
+    exif_data_unset_option(data.get(), EXIF_DATA_OPTION_FOLLOW_SPECIFICATION);
+    exif_data_load_data(data.get(), app1, length);
+    return data;
+}
+
+// APP1 segment of the previous external camera path
+ExifDataPtr exifUtilsApp1(const CameraMetadata& settings, const std::vector<uint8_t>& thumb) {
+    CameraMetadata meta(characteristics());
+    meta.append(settings);
+    std::unique_ptr<ExifUtils> utils(ExifUtils::create());
+    if (!utils->initialize() || !utils->setFromMetadata(meta, kWidth, kHeight) ||
+            !utils->setMake(kMake) || !utils->setModel(kModel) ||
+            !utils->generateApp1(thumb.empty() ? nullptr : thumb.data(), thumb.size())) {
+        return ExifDataPtr(nullptr, exif_data_unref);
+    }
+    return parseApp1(utils->getApp1Buffer(), utils->getApp1Length());
+}
+
+// Values taken from the clock, which may tick between the two segments
+bool isTimeTag(ExifTag tag) {
+    return tag == EXIF_TAG_DATE_TIME || tag == EXIF_TAG_DATE_TIME_ORIGINAL ||
+            tag == EXIF_TAG_DATE_TIME_DIGITIZED || tag == EXIF_TAG_SUB_SEC_TIME ||
+            tag == EXIF_TAG_SUB_SEC_TIME_ORIGINAL || tag == EXIF_TAG_SUB_SEC_TIME_DIGITIZED;
+}
+
+// Tags with fixed values the writer always sets, which ExifUtils leaves to libexif to fill in
+// when data is fixed up to follow the specification
+bool isWriterOnlyTag(int ifd, ExifTag tag) {
+    switch (ifd) {
+        case EXIF_IFD_0:
+        case EXIF_IFD_1:
+            return tag == EXIF_TAG_X_RESOLUTION || tag == EXIF_TAG_Y_RESOLUTION ||
+                    tag == EXIF_TAG_RESOLUTION_UNIT ||
+                    (ifd == EXIF_IFD_0 && tag == EXIF_TAG_YCBCR_POSITIONING) ||
+                    (ifd == EXIF_IFD_1 && tag == EXIF_TAG_COMPRESSION);
+        case EXIF_IFD_EXIF:
+            return tag == EXIF_TAG_COMPONENTS_CONFIGURATION ||
+                    tag == EXIF_TAG_FLASH_PIX_VERSION || tag == EXIF_TAG_COLOR_SPACE;
+        case EXIF_IFD_GPS:
+            return tag == static_cast<ExifTag>(EXIF_TAG_GPS_VERSION_ID);
+        default:
+            return false;
+    }
+}
+
+void expectSameTags(ExifData* expected, ExifData* actual) {
+    for (int ifd = 0; ifd < EXIF_IFD_COUNT; ifd++) {
+        ExifContent* expectedContent = expected->ifd[ifd];
+        ExifContent* actualContent = actual->ifd[ifd];
+        for (unsigned int i = 0; i < expectedContent->count; i++) {
+            const ExifEntry* expectedEntry = expectedContent->entries[i];
+            SCOPED_TRACE(::testing::Message() << "IFD " << ifd << ", tag 0x" << std::hex
+                         << expectedEntry->tag);
+            const ExifEntry* entry = exif_content_get_entry(actualContent, expectedEntry->tag);
+            ASSERT_NE(nullptr, entry);
+            EXPECT_EQ(expectedEntry->format, entry->format);
+            EXPECT_EQ(expectedEntry->components, entry->components);
+            ASSERT_EQ(expectedEntry->size, entry->size);
+            if (!isTimeTag(expectedEntry->tag)) {
+                EXPECT_EQ(0, memcmp(expectedEntry->data, entry->data, entry->size));
+            }
+        }
+        for (unsigned int i = 0; i < actualContent->count; i++) {
+            const ExifEntry* entry = actualContent->entries[i];
+            if (exif_content_get_entry(expectedContent, entry->tag) == nullptr) {
+                EXPECT_TRUE(isWriterOnlyTag(ifd, entry->tag))
+                        << "Unexpected tag 0x" << std::hex << entry->tag << " in IFD " << ifd;
+            }
+        }
+    }
+
+    EXPECT_EQ(expected->ifd[EXIF_IFD_GPS]->count == 0, actual->ifd[EXIF_IFD_GPS]->count == 0);
+    EXPECT_EQ(expected->size == 0, actual->ifd[EXIF_IFD_1]->count == 0);
+    ASSERT_EQ(expected->size, actual->size);
+    if (expected->size > 0) {
+        EXPECT_EQ(0, memcmp(expected->data, actual->data, actual->size));
+    }
+}
+
+void expectMatchesExifUtils(ExifApp1Writer* writer, const CameraMetadata& settings,
+                            const std::vector<uint8_t>& thumb) {
+    ASSERT_TRUE(writer->generateApp1(settings, kWidth, kHeight,
+                                     thumb.empty() ? nullptr : thumb.data(), thumb.size()));
+    ExifDataPtr actual = parseApp1(writer->getApp1Buffer(), writer->getApp1Length());
+    ExifDataPtr expected = exifUtilsApp1(settings, thumb);
+    ASSERT_NE(nullptr, expected);
+    expectSameTags(expected.get(), actual.get());
+}
+
+uint16_t getShort(ExifData* data, ExifIfd ifd, ExifTag tag) {
+    ExifEntry* entry = exif_content_get_entry(data->ifd[ifd], tag);
+    return entry != nullptr ? exif_get_short(entry->data, EXIF_BYTE_ORDER_INTEL) : 0;
+}
+
+TEST(ExifApp1WriterTest, MatchesExifUtilsWithoutGps) {
+    ExifApp1Writer writer(characteristics(), kMake, kModel);
+    expectMatchesExifUtils(&writer, stillSettings(nullptr), {});
+}
+
+TEST(ExifApp1WriterTest, MatchesExifUtilsWithGps) {
+    ExifApp1Writer writer(characteristics(), kMake, kModel);
+    expectMatchesExifUtils(&writer, stillSettings(&kMountainView), {});
+    expectMatchesExifUtils(&writer, stillSettings(&kSydney), {});
+}
+
+TEST(ExifApp1WriterTest, MatchesExifUtilsWithThumbnail) {
+    ExifApp1Writer writer(characteristics(), kMake, kModel);
+    expectMatchesExifUtils(&writer, stillSettings(nullptr), thumbnail(12 * 1024));
+    expectMatchesExifUtils(&writer, stillSettings(&kMountainView), thumbnail(6 * 1024));
+}
+
+// The layout is only rebuilt when the set of tags changes, values of the previous capture must
+// not leak into the next one either way
+TEST(ExifApp1WriterTest, RebuildsLayoutWhenGpsOrThumbnailToggles) {
+    ExifApp1Writer writer(characteristics(), kMake, kModel);
+    const struct {
+        const GpsLocation* gps;
+        size_t thumbnailSize;
+        int32_t orientation;
+    } kCaptures[] = {
+        {nullptr, 0, 0},
+        {&kMountainView, 0, 90},
+        {&kMountainView, 12 * 1024, 90},
+        {nullptr, 12 * 1024, 180},
+        {&kSydney, 8 * 1024, 270},
+        {&kMountainView, 8 * 1024, 270},
+        {nullptr, 0, 0},
+    };
+    for (size_t i = 0; i < sizeof(kCaptures) / sizeof(kCaptures[0]); i++) {
+        SCOPED_TRACE(::testing::Message() << "capture " << i);
+        expectMatchesExifUtils(&writer,
+                               stillSettings(kCaptures[i].gps, kCaptures[i].orientation),
+                               thumbnail(kCaptures[i].thumbnailSize));
+    }
+}
+
+TEST(ExifApp1WriterTest, WritesStaticTags) {
+    ExifApp1Writer writer(characteristics(), kMake, kModel);
+    std::vector<uint8_t> thumb = thumbnail(1024);
+    ASSERT_TRUE(writer.generateApp1(stillSettings(&kMountainView), kWidth, kHeight,
+                                    thumb.data(), thumb.size()));
+    ExifDataPtr data = parseApp1(writer.getApp1Buffer(), writer.getApp1Length());
+
+    const uint16_t kInch = 2;
+    EXPECT_EQ(kInch, getShort(data.get(), EXIF_IFD_0, EXIF_TAG_RESOLUTION_UNIT));
+    EXPECT_EQ(1, getShort(data.get(), EXIF_IFD_0, EXIF_TAG_YCBCR_POSITIONING));
+    EXPECT_EQ(1, getShort(data.get(), EXIF_IFD_EXIF, EXIF_TAG_COLOR_SPACE));
+    EXPECT_EQ(0x20, getShort(data.get(), EXIF_IFD_EXIF, EXIF_TAG_FLASH));
+    const uint16_t kJpegCompression = 6;
+    EXPECT_EQ(kJpegCompression, getShort(data.get(), EXIF_IFD_1, EXIF_TAG_COMPRESSION));
+    EXPECT_EQ(kInch, getShort(data.get(), EXIF_IFD_1, EXIF_TAG_RESOLUTION_UNIT));
+
+    ExifEntry* resolution = exif_content_get_entry(data->ifd[EXIF_IFD_0], EXIF_TAG_X_RESOLUTION);
+    ASSERT_NE(nullptr, resolution);
+    ExifRational dpi = exif_get_rational(resolution->data, EXIF_BYTE_ORDER_INTEL);
+    EXPECT_EQ(72u, dpi.numerator);
+    EXPECT_EQ(1u, dpi.denominator);
+
+    ExifEntry* version = exif_content_get_entry(data->ifd[EXIF_IFD_EXIF],
+                                                EXIF_TAG_EXIF_VERSION);
+    ASSERT_NE(nullptr, version);
+    EXPECT_EQ(0, memcmp("0220", version->data, 4));
+    ExifEntry* gpsVersion = exif_content_get_entry(data->ifd[EXIF_IFD_GPS],
+                                                   static_cast<ExifTag>(EXIF_TAG_GPS_VERSION_ID));
+    ASSERT_NE(nullptr, gpsVersion);
+    const uint8_t kGpsVersion[] = {2, 2, 0, 0};
+    EXPECT_EQ(0, memcmp(kGpsVersion, gpsVersion->data, 4));
+}
+
+}  // anonymous namespace
+
+}  // namespace helper
+}  // namespace V1_0
+}  // namespace common
+}  // namespace camera
+}  // namespace hardware
+}  // namespace android
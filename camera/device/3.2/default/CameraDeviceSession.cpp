@@ -59,6 +59,7 @@ CameraDeviceSession::CameraDeviceSession(
         mIsAELockAvailable(false),
         mDerivePostRawSensKey(false),
         mNumPartialResults(1),
+        mCirculatingBuffers(sHandleImporter),
         mResultBatcher(callback) {
     mDeviceInfo = deviceInfo;
     camera_metadata_entry partialResultsCount =
@@ -194,6 +195,7 @@ void CameraDeviceSession::dumpState(const native_handle_t* fd) {
     if (!isClosed()) {
         mDevice->ops->dump(mDevice, fd->data[0]);
     }
+    mCirculatingBuffers.dump(fd->data[0]);
 }
 
 /**
@@ -282,20 +284,12 @@ Status CameraDeviceSession::importBuffer(int32_t streamId,
         }
     }
 
-    Mutex::Autolock _l(mInflightLock);
-    CirculatingBuffers& cbs = mCirculatingBuffers[streamId];
-    if (cbs.count(bufId) == 0) {
-        // Register a newly seen buffer
-        buffer_handle_t importedBuf = buf;
-        sHandleImporter.importBuffer(importedBuf);
-        if (importedBuf == nullptr) {
-            ALOGE("%s: output buffer for stream %d is invalid!", __FUNCTION__, streamId);
-            return Status::INTERNAL_ERROR;
-        } else {
-            cbs[bufId] = importedBuf;
-        }
+    buffer_handle_t* importedBuf = mCirculatingBuffers.getOrImport(streamId, bufId, buf);
+    if (importedBuf == nullptr) {
+        ALOGE("%s: output buffer for stream %d is invalid!", __FUNCTION__, streamId);
+        return Status::INTERNAL_ERROR;
     }
-    *outBufPtr = &cbs[bufId];
+    *outBufPtr = importedBuf;
     return Status::OK;
 }
 
@@ -923,7 +917,6 @@ bool CameraDeviceSession::preProcessConfigurationLocked(
             mStreamMap[id] = stream;
             mStreamMap[id].data_space = mapToLegacyDataspace(
                     mStreamMap[id].data_space);
-            mCirculatingBuffers.emplace(stream.mId, CirculatingBuffers{});
         } else {
             // width/height/format must not change, but usage/rotation might need to change
             if (mStreamMap[id].stream_type !=
@@ -1005,23 +998,9 @@ void CameraDeviceSession::postProcessConfigurationLocked(
 
 
 void CameraDeviceSession::postProcessConfigurationFailureLocked(
-        const StreamConfiguration& requestedConfiguration) {
-    if (mFreeBufEarly) {
-        // Re-build the buf cache entry for deleted streams
-        for(auto it = mStreamMap.begin(); it != mStreamMap.end(); it++) {
-            int id = it->first;
-            bool found = false;
-            for (const auto& stream : requestedConfiguration.streams) {
-                if (id == stream.id) {
-                    found = true;
-                    break;
-                }
-            }
-            if (!found) {
-                mCirculatingBuffers.emplace(id, CirculatingBuffers{});
-            }
-        }
-    }
+        const StreamConfiguration& /*requestedConfiguration*/) {
+    // Nothing to re-build: buffers of deleted streams freed early are imported again when a
+    // request uses them.
 }
 
 Return<void> CameraDeviceSession::configureStreams(
@@ -1095,29 +1074,18 @@ Return<void> CameraDeviceSession::configureStreams(
 
 // Needs to get called after acquiring 'mInflightLock'
 void CameraDeviceSession::cleanupBuffersLocked(int id) {
-    for (auto& pair : mCirculatingBuffers.at(id)) {
-        sHandleImporter.freeBuffer(pair.second);
-    }
-    mCirculatingBuffers[id].clear();
-    mCirculatingBuffers.erase(id);
+    mCirculatingBuffers.removeStream(id);
 }
 
 void CameraDeviceSession::updateBufferCaches(const hidl_vec<BufferCache>& cachesToRemove) {
-    Mutex::Autolock _l(mInflightLock);
     for (auto& cache : cachesToRemove) {
-        auto cbsIt = mCirculatingBuffers.find(cache.streamId);
-        if (cbsIt == mCirculatingBuffers.end()) {
+        if (!mCirculatingBuffers.remove(cache.streamId, cache.bufferId)) {
             // The stream could have been removed
-            continue;
-        }
-        CirculatingBuffers& cbs = cbsIt->second;
-        auto it = cbs.find(cache.bufferId);
-        if (it != cbs.end()) {
-            sHandleImporter.freeBuffer(it->second);
-            cbs.erase(it);
-        } else {
-            ALOGE("%s: stream %d buffer %" PRIu64 " is not cached",
-                    __FUNCTION__, cache.streamId, cache.bufferId);
+            Mutex::Autolock _l(mInflightLock);
+            if (mStreamMap.count(cache.streamId) != 0) {
+                ALOGE("%s: stream %d buffer %" PRIu64 " is not cached",
+                        __FUNCTION__, cache.streamId, cache.bufferId);
+            }
         }
     }
 }
@@ -1322,14 +1290,6 @@ Return<void> CameraDeviceSession::close()  {
         ATRACE_END();
 
         // free all imported buffers
-        Mutex::Autolock _l(mInflightLock);
-        for(auto& pair : mCirculatingBuffers) {
-            CirculatingBuffers& buffers = pair.second;
-            for (auto& p2 : buffers) {
-                sHandleImporter.freeBuffer(p2.second);
-            }
-            buffers.clear();
-        }
         mCirculatingBuffers.clear();
 
         mClosed = true;
@@ -45,6 +45,7 @@ using ::android::hardware::camera::device::V3_2::StreamConfiguration;
 using ::android::hardware::camera::device::V3_2::ICameraDeviceSession;
 using ::android::hardware::camera::common::V1_0::Status;
 using ::android::hardware::camera::common::V1_0::helper::HandleImporter;
+using ::android::hardware::camera::common::V1_0::helper::ImportedBufferCache;
 using ::android::hardware::kSynchronizedReadWrite;
 using ::android::hardware::MessageQueue;
 using ::android::hardware::MQDescriptorSync;
@@ -151,7 +152,7 @@ protected:
     // Stream ID -> Camera3Stream cache
     std::map<int, Camera3Stream> mStreamMap;
 
-    mutable Mutex mInflightLock; // protecting mInflightBuffers and mCirculatingBuffers
+    mutable Mutex mInflightLock; // protecting mInflightBuffers
     // (streamID, frameNumber) -> inflight buffer cache
     std::map<std::pair<int, uint32_t>, camera3_stream_buffer_t>  mInflightBuffers;
 
@@ -163,13 +164,12 @@ protected:
 
     static const uint64_t BUFFER_ID_NO_BUFFER = 0;
     // buffers currently ciculating between HAL and camera service
-    // key: bufferId sent via HIDL interface
+    // key: (stream ID, bufferId sent via HIDL interface)
     // value: imported buffer_handle_t
     // Buffer will be imported during process_capture_request and will be freed
-    // when the its stream is deleted or camera device session is closed
-    typedef std::unordered_map<uint64_t, buffer_handle_t> CirculatingBuffers;
-    // Stream ID -> circulating buffers map
-    std::map<int, CirculatingBuffers> mCirculatingBuffers;
+    // when the its stream is deleted or camera device session is closed.
+    // The cache has its own locking and doesn't need mInflightLock.
+    ImportedBufferCache mCirculatingBuffers;
 
     static HandleImporter sHandleImporter;
     static buffer_handle_t sEmptyBuffer;
@@ -188,7 +188,6 @@ bool CameraDeviceSession::preProcessConfigurationLocked_3_4(
             mPhysicalCameraIdMap[id] = requestedConfiguration.streams[i].physicalCameraId;
             mStreamMap[id].data_space = mapToLegacyDataspace(
                     mStreamMap[id].data_space);
-            mCirculatingBuffers.emplace(stream.mId, CirculatingBuffers{});
         } else {
             // width/height/format must not change, but usage/rotation might need to change.
             // format and data_space may change.
@@ -286,23 +285,9 @@ void CameraDeviceSession::postProcessConfigurationLocked_3_4(
 }
 
 void CameraDeviceSession::postProcessConfigurationFailureLocked_3_4(
-        const StreamConfiguration& requestedConfiguration) {
-    if (mFreeBufEarly) {
-        // Re-build the buf cache entry for deleted streams
-        for(auto it = mStreamMap.begin(); it != mStreamMap.end(); it++) {
-            int id = it->first;
-            bool found = false;
-            for (const auto& stream : requestedConfiguration.streams) {
-                if (id == stream.v3_2.id) {
-                    found = true;
-                    break;
-                }
-            }
-            if (!found) {
-                mCirculatingBuffers.emplace(id, CirculatingBuffers{});
-            }
-        }
-    }
+        const StreamConfiguration& /*requestedConfiguration*/) {
+    // Nothing to re-build: buffers of deleted streams freed early are imported again when a
+    // request uses them.
 }
 
 Return<void> CameraDeviceSession::processCaptureRequest_3_4(
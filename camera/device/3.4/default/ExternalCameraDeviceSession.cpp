@@ -26,6 +26,7 @@
 #include <utils/Trace.h>
 #include <linux/videodev2.h>
 #include <sync/sync.h>
+#include <poll.h>
 
 #define HAVE_JPEG // required for libyuv.h to export MJPEG decode APIs
 #include <libyuv.h>
@@ -51,6 +52,10 @@ constexpr int MAX_RETRY = 15; // Allow retry some ioctl failures a few times to
                              // webcam showing temporarily ioctl failures.
 constexpr int IOCTL_RETRY_SLEEP_US = 33000; // 33ms * MAX_RETRY = 0.5 seconds
 
+// Entries and data bytes fillStaticCaptureResult adds at most to request settings
+constexpr size_t kResultEntryCount = 11;
+constexpr size_t kResultDataCount = 24;
+
 // Constants for tryLock during dumpstate
 static constexpr int kDumpLockRetries = 50;
 static constexpr int kDumpLockSleep = 60000;
@@ -83,11 +88,103 @@ bool tryLock(std::mutex& mutex)
 
 buffer_handle_t sEmptyBuffer = nullptr;
 
+// Names of OutputThread::Stage values, as shown in dumpState
+const char* kStageNames[] = {
+    "decode to YU12",
+    "decode queue",
+    "crop/scale/convert",
+    "V4L2 passthrough",
+    "JPEG prepare",
+    "total",
+};
+
+// Names of OutputThread::OutputPath values, as shown in dumpState
+const char* kOutputPathNames[] = {
+    "YU12",
+    "passthrough copy",
+    "passthrough convert",
+};
+
+// Uncompressed V4L2 formats OutputThread can read directly, in order of preference: NV12 can be
+// copied as is into NV12 outputs
+const std::array<uint32_t, /*size*/ 2> kPassthroughFourCCs{
+    {V4L2_PIX_FMT_NV12, V4L2_PIX_FMT_YUYV}};
+
+// Bytes per line of the first plane of a tightly packed passthrough format, 0 for other formats
+uint32_t getPassthroughBytesPerLine(uint32_t fourcc, uint32_t width) {
+    switch (fourcc) {
+        case V4L2_PIX_FMT_NV12: return width;
+        case V4L2_PIX_FMT_YUYV: return width * 2;
+        default: return 0;
+    }
+}
+
+// Size of a tightly packed passthrough frame, 0 for other formats
+size_t getPassthroughFrameSize(uint32_t fourcc, uint32_t width, uint32_t height) {
+    switch (fourcc) {
+        case V4L2_PIX_FMT_NV12: return width * height * 3 / 2;
+        case V4L2_PIX_FMT_YUYV: return width * height * 2;
+        default: return 0;
+    }
+}
+
+// Swaps the bytes of interleaved chroma pairs, i.e. converts NV12 chroma to NV21 or back.
+// src and dst may be the same.
+void swapUVPlane(const uint8_t* src, int srcStride, uint8_t* dst, int dstStride,
+        int width, int height) {
+    for (int y = 0; y < height; y++) {
+        const uint8_t* srcRow = src + y * srcStride;
+        uint8_t* dstRow = dst + y * dstStride;
+        for (int x = 0; x < width; x++) {
+            uint8_t u = srcRow[2 * x];
+            uint8_t v = srcRow[2 * x + 1];
+            dstRow[2 * x] = v;
+            dstRow[2 * x + 1] = u;
+        }
+    }
+}
+
+// JPEG markers used when joining separately encoded strips of an image
+constexpr uint8_t kJpegMarkerSOF0 = 0xC0;
+constexpr uint8_t kJpegMarkerRST0 = 0xD0;
+constexpr uint8_t kJpegMarkerEOI = 0xD9;
+constexpr uint8_t kJpegMarkerSOS = 0xDA;
+constexpr uint32_t kJpegMcuSize = 16;         // YUV420 MCU is 16x16 pixels
+constexpr uint32_t kMinJpegStripMcuRows = 8;  // Smaller strips are not worth a thread
+constexpr size_t kJpegStripHeaderSize = 1024; // Room for headers of a strip without EXIF
+
+size_t getNumJpegWorkers(size_t maxWorkers) {
+    size_t numCpus = std::thread::hardware_concurrency();
+    return std::max<size_t>(1, std::min(numCpus, maxWorkers));
+}
+
+// Returns offset of entropy coded data in a baseline JPEG encoded by libjpeg, i.e. the end of
+// SOS segment, or -1 if the layout is broken. If height is non zero the image height in SOF0
+// segment is rewritten to it.
+ssize_t findJpegScanData(uint8_t* code, size_t codeSize, uint32_t height) {
+    size_t pos = 2; // Skip SOI
+    while (pos + 4 <= codeSize && code[pos] == 0xFF) {
+        uint8_t marker = code[pos + 1];
+        size_t length = (code[pos + 2] << 8) | code[pos + 3];
+        if (marker == kJpegMarkerSOF0 && height != 0 && pos + 7 <= codeSize) {
+            code[pos + 5] = (height >> 8) & 0xFF;
+            code[pos + 6] = height & 0xFF;
+        }
+        pos += 2 + length;
+        if (marker == kJpegMarkerSOS) {
+            return pos <= codeSize ? static_cast<ssize_t>(pos) : -1;
+        }
+    }
+    return -1;
+}
+
 } // Anonymous namespace
 
 // Static instances
 const int ExternalCameraDeviceSession::kMaxProcessedStream;
 const int ExternalCameraDeviceSession::kMaxStallStream;
+const uint32_t ExternalCameraDeviceSession::kMinV4L2BufferCount;
+const uint32_t ExternalCameraDeviceSession::kMaxExtraV4L2Buffers;
 HandleImporter ExternalCameraDeviceSession::sHandleImporter;
 
 ExternalCameraDeviceSession::ExternalCameraDeviceSession(
@@ -168,6 +265,12 @@ bool ExternalCameraDeviceSession::initialize() {
         return true;
     }
 
+    mResultBatcher = new ResultBatcher(mCallback, mResultMetadataQueue, &mResultMetadataPool,
+            mCfg.resultBatchSize, ms2ns(mCfg.resultBatchLatencyMs));
+    if (mResultBatcher->isBatching()) {
+        mResultBatcher->run("ExtCamResult", PRIORITY_DISPLAY);
+    }
+
     // TODO: check is PRIORITY_DISPLAY enough?
     mOutputThread->run("ExtCamOut", PRIORITY_DISPLAY);
     return false;
@@ -279,13 +382,10 @@ void ExternalCameraDeviceSession::dumpState(const native_handle_t* handle) {
                 streamingFmt.width, streamingFmt.height,
                 mV4l2StreamingFps);
 
-        size_t numDequeuedV4l2Buffers = 0;
-        {
-            std::lock_guard<std::mutex> lk(mV4l2BufferLock);
-            numDequeuedV4l2Buffers = mNumDequeuedV4l2Buffers;
-        }
+        std::lock_guard<std::mutex> lk(mV4l2BufferLock);
         dprintf(fd, "V4L2 buffer queue size %zu, dequeued %zu\n",
-                v4L2BufferCount, numDequeuedV4l2Buffers);
+                v4L2BufferCount, mNumDequeuedV4l2Buffers);
+        mV4l2BufferScheduler.dump(fd);
     }
 
     dprintf(fd, "In-flight frames (not sorted):");
@@ -293,6 +393,10 @@ void ExternalCameraDeviceSession::dumpState(const native_handle_t* handle) {
         dprintf(fd, "%d, ", frameNumber);
     }
     dprintf(fd, "\n");
+    mResultMetadataPool.dump(fd);
+    if (mResultBatcher != nullptr) {
+        mResultBatcher->dump(fd);
+    }
     mOutputThread->dump(fd);
     dprintf(fd, "\n");
 
@@ -470,6 +574,8 @@ Return<Status> ExternalCameraDeviceSession::flush() {
         return status;
     }
     mOutputThread->flush();
+    // All results must have reached the framework when flush returns
+    mResultBatcher->flush();
     return Status::OK;
 }
 
@@ -482,6 +588,11 @@ Return<void> ExternalCameraDeviceSession::close(bool callerIsDtor) {
         } else {
             closeOutputThread();
         }
+        if (mResultBatcher != nullptr) {
+            mResultBatcher->requestExit();
+            mResultBatcher->join();
+            mResultBatcher->flush();
+        }
 
         Mutex::Autolock _l(mLock);
         // free all buffers
@@ -622,6 +733,45 @@ int ExternalCameraDeviceSession::waitForV4L2BufferReturnLocked(std::unique_lock<
     return 0;
 }
 
+int ExternalCameraDeviceSession::waitForV4L2IdleLocked() {
+    std::unique_lock<std::mutex> lk(mV4l2BufferLock);
+    while (mNumDequeuedV4l2Buffers != 0) {
+        int waitRet = waitForV4L2BufferReturnLocked(lk);
+        if (waitRet != 0) {
+            return waitRet;
+        }
+    }
+    return 0;
+}
+
+Status ExternalCameraDeviceSession::updateV4L2BufferCountLocked() {
+    uint32_t newCount = 0;
+    {
+        std::lock_guard<std::mutex> lk(mV4l2BufferLock);
+        newCount = mV4l2BufferScheduler.getResizeCount(systemTime());
+    }
+    if (newCount == 0) {
+        return Status::OK;
+    }
+
+    ALOGI("%s: resizing V4L2 buffer queue from %zu to %u buffers", __FUNCTION__,
+            mV4L2BufferCount, newCount);
+    uint32_t oldCount = mV4L2BufferCount;
+    if (waitForV4L2IdleLocked() != 0) {
+        ALOGE("%s: wait for pipeline idle failed!", __FUNCTION__);
+        return Status::INTERNAL_ERROR;
+    }
+    if (configureV4l2StreamLocked(mV4l2StreamingFmt, mV4l2StreamingFps, newCount) != 0) {
+        ALOGE("%s: resizing V4L2 buffer queue failed, keeping %u buffers", __FUNCTION__,
+                oldCount);
+        if (configureV4l2StreamLocked(mV4l2StreamingFmt, mV4l2StreamingFps, oldCount) != 0) {
+            ALOGE("%s: restoring V4L2 stream failed!", __FUNCTION__);
+            return Status::INTERNAL_ERROR;
+        }
+    }
+    return Status::OK;
+}
+
 Status ExternalCameraDeviceSession::processOneCaptureRequest(const CaptureRequest& request)  {
     ATRACE_CALL();
     Status status = initStatus();
@@ -658,15 +808,25 @@ Status ExternalCameraDeviceSession::processOneCaptureRequest(const CaptureReques
         converted = V3_2::implementation::convertFromHidl(request.settings, &rawSettings);
     }
 
-    if (converted && rawSettings != nullptr) {
-        mLatestReqSetting = rawSettings;
-    }
-
     if (!converted) {
         ALOGE("%s: capture request settings metadata is corrupt!", __FUNCTION__);
         return Status::ILLEGAL_ARGUMENT;
     }
 
+    if (rawSettings != nullptr) {
+        // Apps only send settings when they change, so requests share one copy of them and the
+        // static result entries are filled in here once rather than for every capture result.
+        auto setting = std::make_shared<common::V1_0::helper::CameraMetadata>();
+        *setting = rawSettings;
+        setting->reserve(setting->entryCount() + kResultEntryCount,
+                get_camera_metadata_data_count(rawSettings) + kResultDataCount);
+        if (fillStaticCaptureResult(*setting) != OK) {
+            ALOGE("%s: failed to prepare capture result metadata!", __FUNCTION__);
+            return Status::INTERNAL_ERROR;
+        }
+        mLatestReqSetting = setting;
+    }
+
     if (mFirstRequest && rawSettings == nullptr) {
         ALOGE("%s: capture request settings must not be null for first request!",
                 __FUNCTION__);
@@ -682,7 +842,8 @@ Status ExternalCameraDeviceSession::processOneCaptureRequest(const CaptureReques
         return Status::ILLEGAL_ARGUMENT;
     }
 
-    camera_metadata_entry fpsRange = mLatestReqSetting.find(ANDROID_CONTROL_AE_TARGET_FPS_RANGE);
+    camera_metadata_ro_entry fpsRange =
+            mLatestReqSetting->find(ANDROID_CONTROL_AE_TARGET_FPS_RANGE);
     if (fpsRange.count == 2) {
         double requestFpsMax = fpsRange.data.i32[1];
         double closestFps = 0.0;
@@ -715,21 +876,20 @@ Status ExternalCameraDeviceSession::processOneCaptureRequest(const CaptureReques
         }
 
         if (requestFpsMax != mV4l2StreamingFps) {
-            {
-                std::unique_lock<std::mutex> lk(mV4l2BufferLock);
-                while (mNumDequeuedV4l2Buffers != 0) {
-                    // Wait until pipeline is idle before reconfigure stream
-                    int waitRet = waitForV4L2BufferReturnLocked(lk);
-                    if (waitRet != 0) {
-                        ALOGE("%s: wait for pipeline idle failed!", __FUNCTION__);
-                        return Status::INTERNAL_ERROR;
-                    }
-                }
+            // Wait until pipeline is idle before reconfigure stream
+            if (waitForV4L2IdleLocked() != 0) {
+                ALOGE("%s: wait for pipeline idle failed!", __FUNCTION__);
+                return Status::INTERNAL_ERROR;
             }
             configureV4l2StreamLocked(mV4l2StreamingFmt, requestFpsMax);
         }
     }
 
+    status = updateV4L2BufferCountLocked();
+    if (status != Status::OK) {
+        return status;
+    }
+
     status = importRequestLocked(request, allBufPtrs, allFences);
     if (status != Status::OK) {
         return status;
@@ -776,7 +936,7 @@ void ExternalCameraDeviceSession::notifyShutter(uint32_t frameNumber, nsecs_t sh
     msg.type = MsgType::SHUTTER;
     msg.msg.shutter.frameNumber = frameNumber;
     msg.msg.shutter.timestamp = shutterTs;
-    mCallback->notify({msg});
+    mResultBatcher->notify(msg);
 }
 
 void ExternalCameraDeviceSession::notifyError(
@@ -786,7 +946,7 @@ void ExternalCameraDeviceSession::notifyError(
     msg.msg.error.frameNumber = frameNumber;
     msg.msg.error.errorStreamId = streamId;
     msg.msg.error.errorCode = ec;
-    mCallback->notify({msg});
+    mResultBatcher->notify(msg);
 }
 
 //TODO: refactor with processCaptureResult
@@ -802,9 +962,7 @@ Status ExternalCameraDeviceSession::processCaptureRequestError(
     notifyError(/*frameNum*/req->frameNumber, /*stream*/-1, ErrorCode::ERROR_REQUEST);
 
     // Fill output buffers
-    hidl_vec<CaptureResult> results;
-    results.resize(1);
-    CaptureResult& result = results[0];
+    CaptureResult result;
     result.frameNumber = req->frameNumber;
     result.partialResult = 1;
     result.inputBuffer.streamId = -1;
@@ -827,8 +985,7 @@ Status ExternalCameraDeviceSession::processCaptureRequestError(
     }
 
     // Callback into framework
-    invokeProcessCaptureResultCallback(results, /* tryWriteFmq */true);
-    freeReleaseFences(results);
+    mResultBatcher->processCaptureResult(std::move(result));
     return Status::OK;
 }
 
@@ -841,9 +998,7 @@ Status ExternalCameraDeviceSession::processCaptureResult(std::shared_ptr<HalRequ
     notifyShutter(req->frameNumber, req->shutterTs);
 
     // Fill output buffers
-    hidl_vec<CaptureResult> results;
-    results.resize(1);
-    CaptureResult& result = results[0];
+    CaptureResult result;
     result.frameNumber = req->frameNumber;
     result.partialResult = 1;
     result.inputBuffer.streamId = -1;
@@ -871,56 +1026,54 @@ Status ExternalCameraDeviceSession::processCaptureResult(std::shared_ptr<HalRequ
     }
 
     // Fill capture result metadata
-    fillCaptureResult(req->setting, req->shutterTs);
-    const camera_metadata_t *rawResult = req->setting.getAndLock();
+    common::V1_0::helper::CameraMetadata resultMd;
+    mResultMetadataPool.obtain(*req->setting, &resultMd);
+    fillCaptureResult(resultMd, req->shutterTs);
+    const camera_metadata_t *rawResult = resultMd.getAndLock();
     V3_2::implementation::convertToHidl(rawResult, &result.result);
-    req->setting.unlock(rawResult);
+    resultMd.unlock(rawResult);
 
-    // update inflight records
-    {
+    // update inflight records, unless a buffer will still be returned by processCaptureResultBuffer
+    if (!req->jpegPending) {
         std::lock_guard<std::mutex> lk(mInflightFramesLock);
         mInflightFrames.erase(req->frameNumber);
     }
 
-    // Callback into framework
-    invokeProcessCaptureResultCallback(results, /* tryWriteFmq */true);
-    freeReleaseFences(results);
+    // Callback into framework. result.result points into resultMd, which is recycled once the
+    // result is sent.
+    mResultBatcher->processCaptureResult(std::move(result), &resultMd);
     return Status::OK;
 }
 
-void ExternalCameraDeviceSession::invokeProcessCaptureResultCallback(
-        hidl_vec<CaptureResult> &results, bool tryWriteFmq) {
-    if (mProcessCaptureResultLock.tryLock() != OK) {
-        const nsecs_t NS_TO_SECOND = 1000000000;
-        ALOGV("%s: previous call is not finished! waiting 1s...", __FUNCTION__);
-        if (mProcessCaptureResultLock.timedLock(/* 1s */NS_TO_SECOND) != OK) {
-            ALOGE("%s: cannot acquire lock in 1s, cannot proceed",
-                    __FUNCTION__);
-            return;
-        }
+Status ExternalCameraDeviceSession::processCaptureResultBuffer(
+        uint32_t frameNumber, HalStreamBuffer& buf) {
+    ATRACE_CALL();
+    CaptureResult result;
+    result.frameNumber = frameNumber;
+    result.partialResult = 0; // Buffer only, metadata has been sent already
+    result.inputBuffer.streamId = -1;
+    result.outputBuffers.resize(1);
+    result.outputBuffers[0].streamId = buf.streamId;
+    result.outputBuffers[0].bufferId = buf.bufferId;
+    result.outputBuffers[0].status = buf.fenceTimeout ? BufferStatus::ERROR : BufferStatus::OK;
+    if (buf.acquireFence >= 0) {
+        native_handle_t* handle = native_handle_create(/*numFds*/1, /*numInts*/0);
+        handle->data[0] = buf.acquireFence;
+        result.outputBuffers[0].releaseFence.setTo(handle, /*shouldOwn*/false);
     }
-    if (tryWriteFmq && mResultMetadataQueue->availableToWrite() > 0) {
-        for (CaptureResult &result : results) {
-            if (result.result.size() > 0) {
-                if (mResultMetadataQueue->write(result.result.data(), result.result.size())) {
-                    result.fmqResultSize = result.result.size();
-                    result.result.resize(0);
-                } else {
-                    ALOGW("%s: couldn't utilize fmq, fall back to hwbinder", __FUNCTION__);
-                    result.fmqResultSize = 0;
-                }
-            } else {
-                result.fmqResultSize = 0;
-            }
-        }
+    if (buf.fenceTimeout) {
+        notifyError(frameNumber, buf.streamId, ErrorCode::ERROR_BUFFER);
     }
-    auto status = mCallback->processCaptureResult(results);
-    if (!status.isOk()) {
-        ALOGE("%s: processCaptureResult ERROR : %s", __FUNCTION__,
-              status.description().c_str());
+
+    // update inflight records
+    {
+        std::lock_guard<std::mutex> lk(mInflightFramesLock);
+        mInflightFrames.erase(frameNumber);
     }
 
-    mProcessCaptureResultLock.unlock();
+    // Callback into framework
+    mResultBatcher->processCaptureResult(std::move(result));
+    return Status::OK;
 }
 
 void ExternalCameraDeviceSession::freeReleaseFences(hidl_vec<CaptureResult>& results) {
@@ -943,11 +1096,184 @@ void ExternalCameraDeviceSession::freeReleaseFences(hidl_vec<CaptureResult>& res
     return;
 }
 
+ExternalCameraDeviceSession::ResultBatcher::ResultBatcher(
+        const sp<ICameraDeviceCallback>& callback,
+        const std::shared_ptr<ResultMetadataQueue>& resultMetadataQueue,
+        common::V1_0::helper::CameraMetadataPool* metadataPool,
+        uint32_t batchSize, nsecs_t latencyBudget) :
+        mCallback(callback), mResultMetadataQueue(resultMetadataQueue),
+        mMetadataPool(metadataPool), mBatchSize(std::max(batchSize, 1u)),
+        mLatencyBudget(latencyBudget) {}
+
+void ExternalCameraDeviceSession::ResultBatcher::notify(const NotifyMsg& msg) {
+    {
+        std::lock_guard<std::mutex> lk(mLock);
+        if (mPending.empty()) {
+            mPending.startTs = systemTime();
+            mBatchCond.notify_one();
+        }
+        mPending.msgs.push_back(msg);
+    }
+    if (!isBatching()) {
+        flush();
+    }
+}
+
+void ExternalCameraDeviceSession::ResultBatcher::processCaptureResult(
+        CaptureResult&& result, common::V1_0::helper::CameraMetadata* md) {
+    bool full;
+    {
+        std::lock_guard<std::mutex> lk(mLock);
+        if (mPending.empty()) {
+            mPending.startTs = systemTime();
+            mBatchCond.notify_one();
+        }
+        mPending.results.push_back(std::move(result));
+        if (md != nullptr) {
+            // Swapping keeps the buffer result.result points into
+            mPending.mds.emplace_back();
+            mPending.mds.back().swap(*md);
+        }
+        full = mPending.results.size() >= mBatchSize;
+    }
+    if (full) {
+        flush();
+    }
+}
+
+void ExternalCameraDeviceSession::ResultBatcher::flush() {
+    if (mSendLock.tryLock() != OK) {
+        const nsecs_t NS_TO_SECOND = 1000000000;
+        ALOGV("%s: previous call is not finished! waiting 1s...", __FUNCTION__);
+        if (mSendLock.timedLock(/* 1s */NS_TO_SECOND) != OK) {
+            ALOGE("%s: cannot acquire lock in 1s, cannot proceed",
+                    __FUNCTION__);
+            return;
+        }
+    }
+    Batch batch;
+    {
+        std::lock_guard<std::mutex> lk(mLock);
+        std::swap(batch, mPending);
+    }
+    sendLocked(batch);
+    mSendLock.unlock();
+}
+
+void ExternalCameraDeviceSession::ResultBatcher::sendLocked(Batch& batch) {
+    ATRACE_CALL();
+    if (!batch.msgs.empty()) {
+        hidl_vec<NotifyMsg> msgs;
+        msgs.setToExternal(batch.msgs.data(), batch.msgs.size());
+        auto status = mCallback->notify(msgs);
+        if (!status.isOk()) {
+            ALOGE("%s: notify ERROR : %s", __FUNCTION__, status.description().c_str());
+        }
+        mNotifyCalls++;
+    }
+
+    if (!batch.results.empty()) {
+        hidl_vec<CaptureResult> results;
+        results.setToExternal(batch.results.data(), batch.results.size());
+        if (mResultMetadataQueue->availableToWrite() > 0) {
+            for (CaptureResult &result : results) {
+                if (result.result.size() > 0) {
+                    if (mResultMetadataQueue->write(
+                            result.result.data(), result.result.size())) {
+                        result.fmqResultSize = result.result.size();
+                        result.result.resize(0);
+                    } else {
+                        ALOGW("%s: couldn't utilize fmq, fall back to hwbinder", __FUNCTION__);
+                        result.fmqResultSize = 0;
+                    }
+                } else {
+                    result.fmqResultSize = 0;
+                }
+            }
+        }
+        auto status = mCallback->processCaptureResult(results);
+        if (!status.isOk()) {
+            ALOGE("%s: processCaptureResult ERROR : %s", __FUNCTION__,
+                  status.description().c_str());
+        }
+        mResultCalls++;
+        mResultsSent += results.size();
+        ATRACE_INT("ExtCamResultBatch", static_cast<int32_t>(results.size()));
+        freeReleaseFences(results);
+    }
+
+    for (auto& md : batch.mds) {
+        mMetadataPool->recycle(&md);
+    }
+}
+
+bool ExternalCameraDeviceSession::ResultBatcher::threadLoop() {
+    std::unique_lock<std::mutex> lk(mLock);
+    if (mPending.empty()) {
+        mBatchCond.wait_for(lk, std::chrono::milliseconds(kIdleWaitTimeoutMs));
+        return true;
+    }
+    nsecs_t waitTime = mPending.startTs + mLatencyBudget - systemTime();
+    if (waitTime > 0) {
+        mBatchCond.wait_for(lk, std::chrono::nanoseconds(waitTime));
+        return true;
+    }
+    lk.unlock();
+    flush();
+    return true;
+}
+
+void ExternalCameraDeviceSession::ResultBatcher::dump(int fd) {
+    const uint64_t notifyCalls = mNotifyCalls;
+    const uint64_t resultCalls = mResultCalls;
+    const uint64_t resultsSent = mResultsSent;
+    const nsecs_t now = systemTime();
+
+    std::lock_guard<std::mutex> lk(mLock);
+    double callsPerSec = 0.0;
+    if (mLastDumpTs != 0 && now > mLastDumpTs) {
+        callsPerSec = (notifyCalls + resultCalls - mLastDumpCalls) * 1e9 / (now - mLastDumpTs);
+    }
+    dprintf(fd, "Result batch size %u, latency budget %" PRId64 "us: %" PRIu64 " notify and %"
+            PRIu64 " processCaptureResult calls for %" PRIu64 " results",
+            mBatchSize, ns2us(mLatencyBudget), notifyCalls, resultCalls, resultsSent);
+    if (mLastDumpTs != 0) {
+        dprintf(fd, ", %.1f calls/s since last dump", callsPerSec);
+    }
+    dprintf(fd, "\n");
+    mLastDumpTs = now;
+    mLastDumpCalls = notifyCalls + resultCalls;
+}
+
 ExternalCameraDeviceSession::OutputThread::OutputThread(
         wp<ExternalCameraDeviceSession> parent,
-        CroppingType ct) : mParent(parent), mCroppingType(ct) {}
+        CroppingType ct) : mParent(parent), mCroppingType(ct),
+        mDecodeThread(new DecodeThread(this)),
+        mJpegThread(new JpegThread(this)),
+        mJpegWorkers(getNumJpegWorkers(kMaxJpegWorkers)) {}
+
+ExternalCameraDeviceSession::OutputThread::~OutputThread() {
+    // DecodeThread and JpegThread stop on their own once OutputThread exit is requested, this
+    // only makes sure they are gone before their parent is.
+    mDecodeThread->requestExitAndWait();
+    mJpegThread->requestExitAndWait();
+}
+
+status_t ExternalCameraDeviceSession::OutputThread::readyToRun() {
+    status_t ret = mDecodeThread->run("ExtCamDecode", PRIORITY_DISPLAY);
+    if (ret != OK) {
+        return ret;
+    }
+    return mJpegThread->run("ExtCamJpeg", PRIORITY_DISPLAY);
+}
+
+bool ExternalCameraDeviceSession::OutputThread::DecodeThread::threadLoop() {
+    return mParent->decodeNextRequest();
+}
 
-ExternalCameraDeviceSession::OutputThread::~OutputThread() {}
+bool ExternalCameraDeviceSession::OutputThread::JpegThread::threadLoop() {
+    return mParent->encodeNextJpeg();
+}
 
 void ExternalCameraDeviceSession::OutputThread::setExifMakeModel(
         const std::string& make, const std::string& model) {
@@ -955,29 +1281,6 @@ void ExternalCameraDeviceSession::OutputThread::setExifMakeModel(
     mExifModel = model;
 }
 
-uint32_t ExternalCameraDeviceSession::OutputThread::getFourCcFromLayout(
-        const YCbCrLayout& layout) {
-    intptr_t cb = reinterpret_cast<intptr_t>(layout.cb);
-    intptr_t cr = reinterpret_cast<intptr_t>(layout.cr);
-    if (std::abs(cb - cr) == 1 && layout.chromaStep == 2) {
-        // Interleaved format
-        if (layout.cb > layout.cr) {
-            return V4L2_PIX_FMT_NV21;
-        } else {
-            return V4L2_PIX_FMT_NV12;
-        }
-    } else if (layout.chromaStep == 1) {
-        // Planar format
-        if (layout.cb > layout.cr) {
-            return V4L2_PIX_FMT_YVU420; // YV12
-        } else {
-            return V4L2_PIX_FMT_YUV420; // YU12
-        }
-    } else {
-        return FLEX_YUV_GENERIC;
-    }
-}
-
 int ExternalCameraDeviceSession::OutputThread::getCropRect(
         CroppingType ct, const Size& inSize, const Size& outSize, IMapper::Rect* out) {
     if (out == nullptr) {
@@ -1274,92 +1577,109 @@ int ExternalCameraDeviceSession::OutputThread::cropAndScaleThumbLocked(
     return 0;
 }
 
-int ExternalCameraDeviceSession::OutputThread::formatConvertLocked(
-        const YCbCrLayout& in, const YCbCrLayout& out, Size sz, uint32_t format) {
-    int ret = 0;
-    switch (format) {
-        case V4L2_PIX_FMT_NV21:
-            ret = libyuv::I420ToNV21(
-                    static_cast<uint8_t*>(in.y),
-                    in.yStride,
-                    static_cast<uint8_t*>(in.cb),
-                    in.cStride,
-                    static_cast<uint8_t*>(in.cr),
-                    in.cStride,
-                    static_cast<uint8_t*>(out.y),
-                    out.yStride,
-                    static_cast<uint8_t*>(out.cr),
-                    out.cStride,
-                    sz.width,
-                    sz.height);
-            if (ret != 0) {
-                ALOGE("%s: convert to NV21 buffer failed! ret %d",
-                            __FUNCTION__, ret);
-                return ret;
-            }
-            break;
+int ExternalCameraDeviceSession::OutputThread::convertToYu12Locked(
+        const uint8_t* inData, uint32_t fourcc) {
+    const int width = mYu12Frame->mWidth;
+    const int height = mYu12Frame->mHeight;
+    uint8_t* dstY = static_cast<uint8_t*>(mYu12FrameLayout.y);
+    uint8_t* dstCb = static_cast<uint8_t*>(mYu12FrameLayout.cb);
+    uint8_t* dstCr = static_cast<uint8_t*>(mYu12FrameLayout.cr);
+    int ret = -EINVAL;
+
+    nsecs_t start = systemTime();
+    ATRACE_BEGIN("convertToYu12Locked");
+    switch (fourcc) {
         case V4L2_PIX_FMT_NV12:
-            ret = libyuv::I420ToNV12(
-                    static_cast<uint8_t*>(in.y),
-                    in.yStride,
-                    static_cast<uint8_t*>(in.cb),
-                    in.cStride,
-                    static_cast<uint8_t*>(in.cr),
-                    in.cStride,
-                    static_cast<uint8_t*>(out.y),
-                    out.yStride,
-                    static_cast<uint8_t*>(out.cb),
-                    out.cStride,
-                    sz.width,
-                    sz.height);
-            if (ret != 0) {
-                ALOGE("%s: convert to NV12 buffer failed! ret %d",
-                            __FUNCTION__, ret);
-                return ret;
-            }
+            ret = libyuv::NV12ToI420(
+                    inData, width,
+                    inData + width * height, width,
+                    dstY, mYu12FrameLayout.yStride,
+                    dstCb, mYu12FrameLayout.cStride,
+                    dstCr, mYu12FrameLayout.cStride,
+                    width, height);
             break;
-        case V4L2_PIX_FMT_YVU420: // YV12
-        case V4L2_PIX_FMT_YUV420: // YU12
-            // TODO: maybe we can speed up here by somehow save this copy?
-            ret = libyuv::I420Copy(
-                    static_cast<uint8_t*>(in.y),
-                    in.yStride,
-                    static_cast<uint8_t*>(in.cb),
-                    in.cStride,
-                    static_cast<uint8_t*>(in.cr),
-                    in.cStride,
-                    static_cast<uint8_t*>(out.y),
-                    out.yStride,
-                    static_cast<uint8_t*>(out.cb),
-                    out.cStride,
-                    static_cast<uint8_t*>(out.cr),
-                    out.cStride,
-                    sz.width,
-                    sz.height);
-            if (ret != 0) {
-                ALOGE("%s: copy to YV12 or YU12 buffer failed! ret %d",
-                            __FUNCTION__, ret);
+        case V4L2_PIX_FMT_YUYV:
+            ret = libyuv::YUY2ToI420(
+                    inData, width * 2,
+                    dstY, mYu12FrameLayout.yStride,
+                    dstCb, mYu12FrameLayout.cStride,
+                    dstCr, mYu12FrameLayout.cStride,
+                    width, height);
+            break;
+        default:
+            ALOGE("%s: unknown V4L2 format 0x%x!", __FUNCTION__, fourcc);
+            break;
+    }
+    ATRACE_END();
+    recordLatency(STAGE_DECODE, systemTime() - start);
+    return ret;
+}
+
+int ExternalCameraDeviceSession::OutputThread::passthroughLocked(
+        const uint8_t* inData, uint32_t fourcc, const Size& sz,
+        const YCbCrLayout& out, OutputPath* path) {
+    const int width = sz.width;
+    const int height = sz.height;
+    uint8_t* dstY = static_cast<uint8_t*>(out.y);
+    uint8_t* dstCb = static_cast<uint8_t*>(out.cb);
+    uint8_t* dstCr = static_cast<uint8_t*>(out.cr);
+    const bool planar = out.chromaStep == 1;
+    const bool nv12 = out.chromaStep == 2 && dstCr == dstCb + 1;
+    const bool nv21 = out.chromaStep == 2 && dstCb == dstCr + 1;
+
+    switch (fourcc) {
+        case V4L2_PIX_FMT_NV12: {
+            const uint8_t* srcUV = inData + width * height;
+            if (planar) {
+                *path = PATH_PASSTHROUGH_CONVERT;
+                return libyuv::NV12ToI420(
+                        inData, width, srcUV, width,
+                        dstY, out.yStride, dstCb, out.cStride, dstCr, out.cStride,
+                        width, height);
+            }
+            if (nv12 || nv21) {
+                libyuv::CopyPlane(inData, width, dstY, out.yStride, width, height);
+                if (nv12) {
+                    *path = PATH_PASSTHROUGH_COPY;
+                    libyuv::CopyPlane(srcUV, width, dstCb, out.cStride, width, height / 2);
+                } else {
+                    *path = PATH_PASSTHROUGH_CONVERT;
+                    swapUVPlane(srcUV, width, dstCr, out.cStride, width / 2, height / 2);
+                }
+                return 0;
+            }
+        } break;
+        case V4L2_PIX_FMT_YUYV: {
+            *path = PATH_PASSTHROUGH_CONVERT;
+            if (planar) {
+                return libyuv::YUY2ToI420(
+                        inData, width * 2,
+                        dstY, out.yStride, dstCb, out.cStride, dstCr, out.cStride,
+                        width, height);
+            }
+            if (nv12 || nv21) {
+                uint8_t* dstUV = nv12 ? dstCb : dstCr;
+                int ret = libyuv::YUY2ToNV12(
+                        inData, width * 2, dstY, out.yStride, dstUV, out.cStride,
+                        width, height);
+                if (ret == 0 && nv21) {
+                    swapUVPlane(dstUV, out.cStride, dstUV, out.cStride, width / 2, height / 2);
+                }
                 return ret;
             }
-            break;
-        case FLEX_YUV_GENERIC:
-            // TODO: b/72261744 write to arbitrary flexible YUV layout. Slow.
-            ALOGE("%s: unsupported flexible yuv layout"
-                    " y %p cb %p cr %p y_str %d c_str %d c_step %d",
-                    __FUNCTION__, out.y, out.cb, out.cr,
-                    out.yStride, out.cStride, out.chromaStep);
-            return -1;
+        } break;
         default:
-            ALOGE("%s: unknown YUV format 0x%x!", __FUNCTION__, format);
-            return -1;
+            break;
     }
-    return 0;
+    // Flexible layouts go through the YU12 frame and YuvCropScaler
+    return -EINVAL;
 }
 
 int ExternalCameraDeviceSession::OutputThread::encodeJpegYU12(
         const Size & inSz, const YCbCrLayout& inLayout,
         int jpegQuality, const void *app1Buffer, size_t app1Size,
-        void *out, const size_t maxOutSize, size_t &actualCodeSize)
+        void *out, const size_t maxOutSize, size_t &actualCodeSize,
+        uint32_t restartInterval)
 {
     /* libjpeg is a C library so we use C-style "inheritance" by
      * putting libjpeg's jpeg_destination_mgr first in our custom
@@ -1444,6 +1764,7 @@ int ExternalCameraDeviceSession::OutputThread::encodeJpegYU12(
     jpeg_set_colorspace(&cinfo, JCS_YCbCr);
     cinfo.raw_data_in = 1;
     cinfo.dct_method = JDCT_IFAST;
+    cinfo.restart_interval = restartInterval;
 
     /* Configure sampling factors. The sampling factor is JPEG subsampling 420
      * because the source format is YUV420. Note that libjpeg sampling factors
@@ -1493,8 +1814,10 @@ int ExternalCameraDeviceSession::OutputThread::encodeJpegYU12(
         yLines[i]  = static_cast<JSAMPROW>(py + li * inLayout.yStride);
         if(i < paddedHeight / cVSubSampling)
         {
-            crLines[i] = static_cast<JSAMPROW>(pcr + li * inLayout.cStride);
-            cbLines[i] = static_cast<JSAMPROW>(pcb + li * inLayout.cStride);
+            /* Chroma planes have fewer lines, clamp to their own last line */
+            int ci = std::min(i, (inSz.height + cVSubSampling - 1) / cVSubSampling - 1);
+            crLines[i] = static_cast<JSAMPROW>(pcr + ci * inLayout.cStride);
+            cbLines[i] = static_cast<JSAMPROW>(pcb + ci * inLayout.cStride);
         }
     }
 
@@ -1520,12 +1843,18 @@ int ExternalCameraDeviceSession::OutputThread::encodeJpegYU12(
             ALOGE("%s: compressed %u lines, expected %u (total %u/%u)",
               __FUNCTION__, done, batchSize, cinfo.next_scanline,
               cinfo.image_height);
+            jpeg_destroy_compress(&cinfo);
             return -1;
         }
     }
 
     /* This will flush everything */
     jpeg_finish_compress(&cinfo);
+    jpeg_destroy_compress(&cinfo);
+
+    if (!dmgr.mSuccess) {
+        return -1;
+    }
 
     /* Grab the actual code size and set it */
     actualCodeSize = dmgr.mEncodedSize;
@@ -1533,6 +1862,108 @@ int ExternalCameraDeviceSession::OutputThread::encodeJpegYU12(
     return 0;
 }
 
+int ExternalCameraDeviceSession::OutputThread::encodeJpegYU12Parallel(
+        const Size & inSz, const YCbCrLayout& inLayout,
+        int jpegQuality, const void *app1Buffer, size_t app1Size,
+        void *out, const size_t maxOutSize, size_t &actualCodeSize)
+{
+    ATRACE_CALL();
+    /* Every strip but the last one is a whole number of MCU rows and is
+     * encoded as a separate image with the same (default) tables. Resetting
+     * DC prediction at the start of a strip is exactly what a decoder does
+     * after a restart marker, so the entropy coded data of strips can simply
+     * be concatenated with RSTn markers in between, given restart interval
+     * in the first strip's header is the number of MCUs in a strip. */
+    const uint32_t mcuRows = (inSz.height + kJpegMcuSize - 1) / kJpegMcuSize;
+    const uint32_t mcusPerRow = (inSz.width + kJpegMcuSize - 1) / kJpegMcuSize;
+    size_t numStrips = std::min<size_t>(mJpegWorkers.size(), mcuRows / kMinJpegStripMcuRows);
+    const uint32_t stripMcuRows = numStrips > 1 ? (mcuRows + numStrips - 1) / numStrips : 0;
+    const uint32_t restartInterval = stripMcuRows * mcusPerRow;
+    /* Restart interval is a 16 bit field in DRI marker */
+    if (numStrips < 2 || restartInterval > 0xFFFF) {
+        return encodeJpegYU12(inSz, inLayout, jpegQuality, app1Buffer, app1Size,
+                out, maxOutSize, actualCodeSize);
+    }
+    numStrips = (mcuRows + stripMcuRows - 1) / stripMcuRows;
+    const uint32_t stripHeight = stripMcuRows * kJpegMcuSize;
+
+    /* First strip goes straight to the output buffer along with the headers,
+     * others to temporary buffers. These are sized for the raw strip, encoder
+     * falls back to single strip if the code doesn't fit there. */
+    mJpegStripCode.resize(numStrips);
+    std::vector<size_t> codeSizes(numStrips, 0);
+    std::vector<int> results(numStrips, -1);
+    std::vector<std::function<void()>> tasks;
+    for (size_t i = 0; i < numStrips; i++) {
+        uint32_t top = i * stripHeight;
+        Size stripSz { inSz.width, std::min(stripHeight, inSz.height - top) };
+        YCbCrLayout stripLayout = inLayout;
+        stripLayout.y = static_cast<uint8_t*>(inLayout.y) + top * inLayout.yStride;
+        stripLayout.cb = static_cast<uint8_t*>(inLayout.cb) + top / 2 * inLayout.cStride;
+        stripLayout.cr = static_cast<uint8_t*>(inLayout.cr) + top / 2 * inLayout.cStride;
+
+        if (i == 0) {
+            tasks.push_back([=, &codeSizes, &results] {
+                results[0] = encodeJpegYU12(stripSz, stripLayout, jpegQuality,
+                        app1Buffer, app1Size, out, maxOutSize, codeSizes[0], restartInterval);
+            });
+        } else {
+            std::vector<uint8_t>& code = mJpegStripCode[i];
+            size_t maxStripSize = std::min(maxOutSize,
+                    stripSz.width * stripSz.height * 3 / 2 + kJpegStripHeaderSize);
+            if (code.size() < maxStripSize) {
+                code.resize(maxStripSize);
+            }
+            tasks.push_back([=, &code, &codeSizes, &results] {
+                results[i] = encodeJpegYU12(stripSz, stripLayout, jpegQuality,
+                        nullptr, 0, code.data(), code.size(), codeSizes[i]);
+            });
+        }
+    }
+    mJpegWorkers.runAll(tasks);
+
+    for (size_t i = 0; i < numStrips; i++) {
+        if (results[i] != 0) {
+            ALOGW("%s: encoding strip %zu/%zu failed, retrying in one piece",
+                    __FUNCTION__, i, numStrips);
+            return encodeJpegYU12(inSz, inLayout, jpegQuality, app1Buffer, app1Size,
+                    out, maxOutSize, actualCodeSize);
+        }
+    }
+
+    /* Patch the image height into the first strip's header and replace its
+     * EOI with the scans of the following strips */
+    uint8_t* dst = static_cast<uint8_t*>(out);
+    size_t pos = codeSizes[0];
+    if (findJpegScanData(dst, pos, inSz.height) < 0 || pos < 2) {
+        ALOGE("%s: cannot parse JPEG strip headers", __FUNCTION__);
+        return -1;
+    }
+    pos -= 2;
+    for (size_t i = 1; i < numStrips; i++) {
+        uint8_t* code = mJpegStripCode[i].data();
+        ssize_t scanStart = findJpegScanData(code, codeSizes[i], 0);
+        if (scanStart < 0 || codeSizes[i] < static_cast<size_t>(scanStart) + 2) {
+            ALOGE("%s: cannot parse JPEG strip headers", __FUNCTION__);
+            return -1;
+        }
+        size_t scanSize = codeSizes[i] - 2 - scanStart;
+        if (pos + 2 + scanSize + 2 > maxOutSize) {
+            ALOGE("%s: JPEG code does not fit in %zu bytes", __FUNCTION__, maxOutSize);
+            return -1;
+        }
+        dst[pos++] = 0xFF;
+        dst[pos++] = kJpegMarkerRST0 + ((i - 1) & 7);
+        memcpy(dst + pos, code + scanStart, scanSize);
+        pos += scanSize;
+    }
+    dst[pos++] = 0xFF;
+    dst[pos++] = kJpegMarkerEOI;
+
+    actualCodeSize = pos;
+    return 0;
+}
+
 /*
  * TODO: There needs to be a mechanism to discover allocated buffer size
  * in the HAL.
@@ -1616,7 +2047,8 @@ ssize_t ExternalCameraDeviceSession::getJpegBufferSize(
 
 int ExternalCameraDeviceSession::OutputThread::createJpegLocked(
         HalStreamBuffer &halBuf,
-        const std::shared_ptr<HalRequest>& req)
+        const std::shared_ptr<HalRequest>& req,
+        std::shared_ptr<JpegJob>* job)
 {
     ATRACE_CALL();
     int ret;
@@ -1645,17 +2077,17 @@ int ExternalCameraDeviceSession::OutputThread::createJpegLocked(
     Size thumbSize;
     bool outputThumbnail = true;
 
-    if (req->setting.exists(ANDROID_JPEG_QUALITY)) {
-        camera_metadata_entry entry =
-            req->setting.find(ANDROID_JPEG_QUALITY);
+    if (req->setting->exists(ANDROID_JPEG_QUALITY)) {
+        camera_metadata_ro_entry entry =
+            req->setting->find(ANDROID_JPEG_QUALITY);
         jpegQuality = entry.data.u8[0];
     } else {
         return lfail("%s: ANDROID_JPEG_QUALITY not set",__FUNCTION__);
     }
 
-    if (req->setting.exists(ANDROID_JPEG_THUMBNAIL_QUALITY)) {
-        camera_metadata_entry entry =
-            req->setting.find(ANDROID_JPEG_THUMBNAIL_QUALITY);
+    if (req->setting->exists(ANDROID_JPEG_THUMBNAIL_QUALITY)) {
+        camera_metadata_ro_entry entry =
+            req->setting->find(ANDROID_JPEG_THUMBNAIL_QUALITY);
         thumbQuality = entry.data.u8[0];
     } else {
         return lfail(
@@ -1663,9 +2095,9 @@ int ExternalCameraDeviceSession::OutputThread::createJpegLocked(
             __FUNCTION__);
     }
 
-    if (req->setting.exists(ANDROID_JPEG_THUMBNAIL_SIZE)) {
-        camera_metadata_entry entry =
-            req->setting.find(ANDROID_JPEG_THUMBNAIL_SIZE);
+    if (req->setting->exists(ANDROID_JPEG_THUMBNAIL_SIZE)) {
+        camera_metadata_ro_entry entry =
+            req->setting->find(ANDROID_JPEG_THUMBNAIL_SIZE);
         thumbSize = Size { static_cast<uint32_t>(entry.data.i32[0]),
                            static_cast<uint32_t>(entry.data.i32[1])
         };
@@ -1697,8 +2129,8 @@ int ExternalCameraDeviceSession::OutputThread::createJpegLocked(
     }
 
 
-    /* Hold actual thumbnail and main image code sizes */
-    size_t thumbCodeSize = 0, jpegCodeSize = 0;
+    /* Hold actual thumbnail code size */
+    size_t thumbCodeSize = 0;
     /* Temporary thumbnail code buffer */
     std::vector<uint8_t> thumbCode(outputThumbnail ? maxThumbCodeSize : 0);
 
@@ -1730,96 +2162,348 @@ int ExternalCameraDeviceSession::OutputThread::createJpegLocked(
         }
     }
 
-    /* Combine camera characteristics with request settings to form EXIF
-     * metadata */
-    common::V1_0::helper::CameraMetadata meta(parent->mCameraCharacteristics);
-    meta.append(req->setting);
-
-    /* Generate EXIF object */
-    std::unique_ptr<ExifUtils> utils(ExifUtils::create());
-    /* Make sure it's initialized */
-    utils->initialize();
-
-    utils->setFromMetadata(meta, jpegSize.width, jpegSize.height);
-    utils->setMake(mExifMake);
-    utils->setModel(mExifModel);
+    /* Generate EXIF. Static tags come from camera characteristics and are
+     * only serialized once, per-image tags from request settings */
+    if (mExifWriter == nullptr) {
+        mExifWriter = std::make_unique<ExifApp1Writer>(
+                parent->mCameraCharacteristics, mExifMake, mExifModel);
+    }
 
-    ret = utils->generateApp1(outputThumbnail ? &thumbCode[0] : 0, thumbCodeSize);
+    ret = mExifWriter->generateApp1(*req->setting, jpegSize.width, jpegSize.height,
+            outputThumbnail ? &thumbCode[0] : 0, thumbCodeSize);
 
     if (!ret) {
         return lfail("%s: generating APP1 failed", __FUNCTION__);
     }
 
     /* Get internal buffer */
-    size_t exifDataSize = utils->getApp1Length();
-    const uint8_t* exifData = utils->getApp1Buffer();
-
-    /* Lock the HAL jpeg code buffer */
-    void *bufPtr = sHandleImporter.lock(
-            *(halBuf.bufPtr), halBuf.usage, maxJpegCodeSize);
-
-    if (!bufPtr) {
-        return lfail("%s: could not lock %zu bytes", __FUNCTION__, maxJpegCodeSize);
+    size_t exifDataSize = mExifWriter->getApp1Length();
+    const uint8_t* exifData = mExifWriter->getApp1Buffer();
+
+    /* The main image is copied as the intermediate buffers are reused by the
+     * next request before JpegThread gets to encode it */
+    sp<AllocatedFrame> yu12Copy;
+    std::unique_lock<std::mutex> lk(mJpegLock);
+    for (auto it = mFreeJpegFrames.begin(); it != mFreeJpegFrames.end(); it++) {
+        if ((*it)->mWidth == jpegSize.width && (*it)->mHeight == jpegSize.height) {
+            yu12Copy = *it;
+            mFreeJpegFrames.erase(it);
+            break;
+        }
     }
+    lk.unlock();
 
-    /* Encode the main jpeg image */
-    ret = encodeJpegYU12(jpegSize, yu12Main,
-            jpegQuality, exifData, exifDataSize,
-            bufPtr, maxJpegCodeSize, jpegCodeSize);
-
-    /* TODO: Not sure this belongs here, maybe better to pass jpegCodeSize out
-     * and do this when returning buffer to parent */
-    CameraBlob blob { CameraBlobId::JPEG, static_cast<uint32_t>(jpegCodeSize) };
-    void *blobDst =
-        reinterpret_cast<void*>(reinterpret_cast<uintptr_t>(bufPtr) +
-                           maxJpegCodeSize -
-                           sizeof(CameraBlob));
-    memcpy(blobDst, &blob, sizeof(CameraBlob));
-
-    /* Unlock the HAL jpeg code buffer */
-    int relFence = sHandleImporter.unlock(*(halBuf.bufPtr));
-    if (relFence >= 0) {
-        halBuf.acquireFence = relFence;
+    YCbCrLayout yu12CopyLayout;
+    if (yu12Copy == nullptr) {
+        yu12Copy = new AllocatedFrame(jpegSize.width, jpegSize.height);
+        ret = yu12Copy->allocate(&yu12CopyLayout);
+    } else {
+        ret = yu12Copy->getLayout(&yu12CopyLayout);
     }
-
-    /* Check if our JPEG actually succeeded */
     if (ret != 0) {
-        return lfail(
-            "%s: encodeJpegYU12 failed with %d",__FUNCTION__, ret);
+        return lfail("%s: allocating JPEG input frame failed!", __FUNCTION__);
+    }
+
+    ATRACE_BEGIN("I420Copy");
+    ret = libyuv::I420Copy(
+            static_cast<uint8_t*>(yu12Main.y), yu12Main.yStride,
+            static_cast<uint8_t*>(yu12Main.cb), yu12Main.cStride,
+            static_cast<uint8_t*>(yu12Main.cr), yu12Main.cStride,
+            static_cast<uint8_t*>(yu12CopyLayout.y), yu12CopyLayout.yStride,
+            static_cast<uint8_t*>(yu12CopyLayout.cb), yu12CopyLayout.cStride,
+            static_cast<uint8_t*>(yu12CopyLayout.cr), yu12CopyLayout.cStride,
+            jpegSize.width, jpegSize.height);
+    ATRACE_END();
+    if (ret != 0) {
+        return lfail("%s: copying JPEG input frame failed!", __FUNCTION__);
     }
 
-    ALOGV("%s: encoded JPEG (ret:%d) with Q:%d max size: %zu",
-          __FUNCTION__, ret, jpegQuality, maxJpegCodeSize);
+    auto newJob = std::make_shared<JpegJob>();
+    newJob->frameNumber = req->frameNumber;
+    newJob->buffer = halBuf;
+    newJob->yu12 = yu12Copy;
+    newJob->app1.assign(exifData, exifData + exifDataSize);
+    newJob->quality = jpegQuality;
+    newJob->maxCodeSize = maxJpegCodeSize;
+    *job = newJob;
+
+    ALOGV("%s: prepared JPEG with Q:%d max size: %zu",
+          __FUNCTION__, jpegQuality, maxJpegCodeSize);
 
     return 0;
 }
 
-bool ExternalCameraDeviceSession::OutputThread::threadLoop() {
-    std::shared_ptr<HalRequest> req;
-    auto parent = mParent.promote();
-    if (parent == nullptr) {
-       ALOGE("%s: session has been disconnected!", __FUNCTION__);
-       return false;
-    }
+void ExternalCameraDeviceSession::OutputThread::submitJpegJob(
+        const std::shared_ptr<JpegJob>& job) {
+    std::unique_lock<std::mutex> lk(mJpegLock);
+    job->submitTs = systemTime();
+    mJpegJobs.push_back(job);
+    lk.unlock();
+    mJpegCond.notify_one();
+}
 
-    // TODO: maybe we need to setup a sensor thread to dq/enq v4l frames
-    //       regularly to prevent v4l buffer queue filled with stale buffers
-    //       when app doesn't program a preveiw request
-    waitForNextRequest(&req);
-    if (req == nullptr) {
-        // No new request, wait again
-        return true;
-    }
+bool ExternalCameraDeviceSession::OutputThread::waitForJpegJobSlot() {
+    std::unique_lock<std::mutex> lk(mJpegLock);
+    std::chrono::seconds timeout = std::chrono::seconds(kFlushWaitTimeoutSec);
+    return mJpegDoneCond.wait_for(lk, timeout,
+            [this] { return mJpegJobs.size() < kMaxPendingJpegJobs; });
+}
 
-    auto onDeviceError = [&](auto... args) {
-        ALOGE(args...);
-        parent->notifyError(
-                req->frameNumber, /*stream*/-1, ErrorCode::ERROR_DEVICE);
-        signalRequestDone();
+bool ExternalCameraDeviceSession::OutputThread::encodeNextJpeg() {
+    std::unique_lock<std::mutex> lk(mJpegLock);
+    if (exitPending() && !mJpegJobs.empty()) {
+        // Don't leave BLOB buffers behind, the framework is still waiting for them
+        std::list<std::shared_ptr<JpegJob>> jobs = std::move(mJpegJobs);
+        mJpegJobs.clear();
+        lk.unlock();
+        mJpegDoneCond.notify_all();
+        auto parent = mParent.promote();
+        if (parent != nullptr) {
+            failJpegJobs(parent, jobs);
+        }
         return false;
-    };
-
-    if (req->frameIn->mFourcc != V4L2_PIX_FMT_MJPEG && req->frameIn->mFourcc != V4L2_PIX_FMT_Z16) {
+    }
+    while (mJpegJobs.empty()) {
+        if (exitPending()) {
+            return false;
+        }
+        mJpegCond.wait_for(lk, std::chrono::milliseconds(kReqWaitTimeoutMs));
+    }
+    std::shared_ptr<JpegJob> job = mJpegJobs.front();
+    mJpegJobs.pop_front();
+    mEncodingJpeg = true;
+    mEncodingJpegFrameNumber = job->frameNumber;
+    lk.unlock();
+
+    encodeJpegJob(job);
+
+    lk.lock();
+    mEncodingJpeg = false;
+    mEncodingJpegFrameNumber = 0;
+    lk.unlock();
+    mJpegDoneCond.notify_all();
+    return true;
+}
+
+void ExternalCameraDeviceSession::OutputThread::encodeJpegJob(
+        const std::shared_ptr<JpegJob>& job) {
+    ATRACE_CALL();
+    HalStreamBuffer& halBuf = job->buffer;
+    Size jpegSize { job->yu12->mWidth, job->yu12->mHeight };
+    size_t jpegCodeSize = 0;
+    nsecs_t encodeStart = systemTime();
+    int ret = -1;
+
+    /* Lock the HAL jpeg code buffer */
+    void *bufPtr = sHandleImporter.lock(
+            *(halBuf.bufPtr), halBuf.usage, job->maxCodeSize);
+    if (!bufPtr) {
+        ALOGE("%s: could not lock %zu bytes", __FUNCTION__, job->maxCodeSize);
+    } else {
+        /* Encode the main jpeg image */
+        YCbCrLayout yu12Main;
+        ret = job->yu12->getLayout(&yu12Main);
+        if (ret == 0) {
+            ret = encodeJpegYU12Parallel(jpegSize, yu12Main,
+                    job->quality, job->app1.data(), job->app1.size(),
+                    bufPtr, job->maxCodeSize, jpegCodeSize);
+        }
+
+        /* TODO: Not sure this belongs here, maybe better to pass jpegCodeSize out
+         * and do this when returning buffer to parent */
+        CameraBlob blob { CameraBlobId::JPEG, static_cast<uint32_t>(jpegCodeSize) };
+        void *blobDst =
+            reinterpret_cast<void*>(reinterpret_cast<uintptr_t>(bufPtr) +
+                               job->maxCodeSize -
+                               sizeof(CameraBlob));
+        memcpy(blobDst, &blob, sizeof(CameraBlob));
+
+        /* Unlock the HAL jpeg code buffer */
+        int relFence = sHandleImporter.unlock(*(halBuf.bufPtr));
+        if (relFence >= 0) {
+            halBuf.acquireFence = relFence;
+        }
+    }
+    nsecs_t encodeEnd = systemTime();
+
+    /* Check if our JPEG actually succeeded, the buffer is returned with error
+     * status if not */
+    if (ret != 0) {
+        ALOGE("%s: encodeJpegYU12 failed with %d", __FUNCTION__, ret);
+        halBuf.fenceTimeout = true;
+    }
+
+    {
+        std::lock_guard<std::mutex> lk(mJpegLock);
+        mJpegStats.push_back({job->frameNumber, jpegSize, jpegCodeSize,
+                encodeStart - job->submitTs, encodeEnd - encodeStart});
+        if (mJpegStats.size() > kNumJpegCaptureStats) {
+            mJpegStats.pop_front();
+        }
+        if (mFreeJpegFrames.size() < kMaxPendingJpegJobs) {
+            mFreeJpegFrames.push_back(job->yu12);
+        }
+    }
+    job->yu12.clear();
+
+    auto parent = mParent.promote();
+    if (parent == nullptr) {
+       ALOGE("%s: session has been disconnected!", __FUNCTION__);
+       return;
+    }
+    parent->processCaptureResultBuffer(job->frameNumber, halBuf);
+}
+
+void ExternalCameraDeviceSession::OutputThread::flushJpegJobs(
+        const sp<ExternalCameraDeviceSession>& parent) {
+    ATRACE_CALL();
+    std::unique_lock<std::mutex> lk(mJpegLock);
+    std::list<std::shared_ptr<JpegJob>> jobs = std::move(mJpegJobs);
+    mJpegJobs.clear();
+    // BLOB buffers must be returned in order, so the one being encoded goes first
+    if (mEncodingJpeg) {
+        std::chrono::seconds timeout = std::chrono::seconds(kFlushWaitTimeoutSec);
+        if (!mJpegDoneCond.wait_for(lk, timeout, [this] { return !mEncodingJpeg; })) {
+            ALOGE("%s: wait for inflight JPEG encode timeout!", __FUNCTION__);
+        }
+    }
+    lk.unlock();
+    mJpegDoneCond.notify_all();
+
+    failJpegJobs(parent, jobs);
+}
+
+void ExternalCameraDeviceSession::OutputThread::failJpegJobs(
+        const sp<ExternalCameraDeviceSession>& parent,
+        std::list<std::shared_ptr<JpegJob>>& jobs) {
+    for (auto& job : jobs) {
+        job->buffer.fenceTimeout = true;
+        parent->processCaptureResultBuffer(job->frameNumber, job->buffer);
+    }
+    jobs.clear();
+}
+
+void ExternalCameraDeviceSession::OutputThread::waitForJpegJobsDone(
+        const sp<ExternalCameraDeviceSession>& parent) {
+    std::unique_lock<std::mutex> lk(mJpegLock);
+    std::chrono::seconds timeout = std::chrono::seconds(kFlushWaitTimeoutSec);
+    if (!mJpegDoneCond.wait_for(lk, timeout,
+            [this] { return mJpegJobs.empty() && !mEncodingJpeg; })) {
+        ALOGE("%s: wait for pending JPEG encodes timeout!", __FUNCTION__);
+        // Queued encodes are errored out, so that their BLOB buffers still go back before
+        // the buffers of later requests
+        std::list<std::shared_ptr<JpegJob>> jobs = std::move(mJpegJobs);
+        mJpegJobs.clear();
+        lk.unlock();
+        mJpegDoneCond.notify_all();
+        failJpegJobs(parent, jobs);
+    }
+}
+
+bool ExternalCameraDeviceSession::OutputThread::decodeNextRequest() {
+    if (exitPending()) {
+        return false;
+    }
+
+    // TODO: maybe we need to setup a sensor thread to dq/enq v4l frames
+    //       regularly to prevent v4l buffer queue filled with stale buffers
+    //       when app doesn't program a preveiw request
+    std::shared_ptr<HalRequest> req;
+    waitForNextRequest(&req);
+    if (req == nullptr) {
+        // No new request, wait again
+        return true;
+    }
+
+    auto decoded = std::make_shared<DecodedRequest>();
+    decoded->req = req;
+    decoded->decodeRes = 0;
+    decoded->startTs = systemTime();
+
+    if (req->frameIn->mFourcc == V4L2_PIX_FMT_MJPEG) {
+        std::unique_lock<std::mutex> lk(mRequestListLock);
+        while (mFreeYu12Buffers.empty()) {
+            if (exitPending()) {
+                // Leave the request for whoever flushes the queue
+                mRequestList.push_front(req);
+                mDecodingRequest = false;
+                mDecodingFrameNumber = 0;
+                lk.unlock();
+                mRequestDoneCond.notify_one();
+                return false;
+            }
+            mYu12FreeCond.wait_for(lk, std::chrono::milliseconds(kReqWaitTimeoutMs));
+        }
+        decoded->yu12 = mFreeYu12Buffers.back();
+        mFreeYu12Buffers.pop_back();
+        lk.unlock();
+
+        // Convert input V4L2 frame to YU12 of the same size
+        // TODO: see if we can save some computation by converting to YV12 here
+        uint8_t* inData;
+        size_t inDataSize;
+        decoded->decodeRes = req->frameIn->map(&inData, &inDataSize);
+        if (decoded->decodeRes == 0) {
+            const sp<AllocatedFrame>& frame = decoded->yu12.frame;
+            nsecs_t decodeStart = systemTime();
+            ATRACE_BEGIN("MJPGtoI420");
+            decoded->decodeRes = mMjpegDecoder.decode(
+                    inData, inDataSize, frame->mWidth, frame->mHeight, decoded->yu12.layout);
+            ATRACE_END();
+            recordLatency(STAGE_DECODE, systemTime() - decodeStart);
+        }
+    }
+
+    std::unique_lock<std::mutex> lk(mRequestListLock);
+    decoded->decodedTs = systemTime();
+    mDecodedList.push_back(decoded);
+    mDecodingRequest = false;
+    mDecodingFrameNumber = 0;
+    lk.unlock();
+    mDecodedCond.notify_one();
+    mRequestDoneCond.notify_one();
+    return true;
+}
+
+bool ExternalCameraDeviceSession::OutputThread::threadLoop() {
+    auto parent = mParent.promote();
+    if (parent == nullptr) {
+       ALOGE("%s: session has been disconnected!", __FUNCTION__);
+       return false;
+    }
+
+    std::shared_ptr<DecodedRequest> decoded;
+    waitForNextDecodedRequest(&decoded);
+    if (decoded == nullptr) {
+        // No new request, wait again
+        return true;
+    }
+    std::shared_ptr<HalRequest> req = decoded->req;
+    recordLatency(STAGE_QUEUE, systemTime() - decoded->decodedTs);
+
+    if (decoded->yu12.frame != nullptr) {
+        // Take over the freshly decoded frame, the previous one goes back to DecodeThread
+        std::lock_guard<std::mutex> bufLk(mBufferLock);
+        std::lock_guard<std::mutex> listLk(mRequestListLock);
+        mFreeYu12Buffers.push_back({mYu12Frame, mYu12FrameLayout});
+        mYu12Frame = decoded->yu12.frame;
+        mYu12FrameLayout = decoded->yu12.layout;
+        decoded->yu12.frame.clear();
+        mYu12FreeCond.notify_one();
+    }
+
+    auto onDeviceError = [&](auto... args) {
+        ALOGE(args...);
+        parent->notifyError(
+                req->frameNumber, /*stream*/-1, ErrorCode::ERROR_DEVICE);
+        signalRequestDone();
+        return false;
+    };
+
+    const uint32_t inFourcc = req->frameIn->mFourcc;
+    const size_t passthroughSize = getPassthroughFrameSize(
+            inFourcc, req->frameIn->mWidth, req->frameIn->mHeight);
+    if (inFourcc != V4L2_PIX_FMT_MJPEG && inFourcc != V4L2_PIX_FMT_Z16 && passthroughSize == 0) {
         return onDeviceError("%s: do not support V4L2 format %c%c%c%c", __FUNCTION__,
                 req->frameIn->mFourcc & 0xFF,
                 (req->frameIn->mFourcc >> 8) & 0xFF,
@@ -1833,9 +2517,17 @@ bool ExternalCameraDeviceSession::OutputThread::threadLoop() {
         return onDeviceError("%s: failed to send buffer request!", __FUNCTION__);
     }
 
+    // Don't let still captures pile up if they come faster than they can be encoded. Only this
+    // thread queues encodes, so a free slot stays free until the request is processed. This
+    // waits before taking mBufferLock, which flush and stream configuration also need.
+    bool hasBlob = std::any_of(req->buffers.begin(), req->buffers.end(),
+            [](const HalStreamBuffer& buf) { return buf.format == PixelFormat::BLOB; });
+    if (hasBlob && !waitForJpegJobSlot()) {
+        return onDeviceError("%s: timeout waiting for previous JPEG encode", __FUNCTION__);
+    }
+
     std::unique_lock<std::mutex> lk(mBufferLock);
-    // Convert input V4L2 frame to YU12 of the same size
-    // TODO: see if we can save some computation by converting to YV12 here
+    // The frame is already mapped by DecodeThread for MJPEG input
     uint8_t* inData;
     size_t inDataSize;
     if (req->frameIn->map(&inData, &inDataSize) != 0) {
@@ -1844,28 +2536,39 @@ bool ExternalCameraDeviceSession::OutputThread::threadLoop() {
     }
 
     // TODO: in some special case maybe we can decode jpg directly to gralloc output?
-    if (req->frameIn->mFourcc == V4L2_PIX_FMT_MJPEG) {
-        ATRACE_BEGIN("MJPGtoI420");
-        int res = libyuv::MJPGToI420(
-            inData, inDataSize, static_cast<uint8_t*>(mYu12FrameLayout.y), mYu12FrameLayout.yStride,
-            static_cast<uint8_t*>(mYu12FrameLayout.cb), mYu12FrameLayout.cStride,
-            static_cast<uint8_t*>(mYu12FrameLayout.cr), mYu12FrameLayout.cStride,
-            mYu12Frame->mWidth, mYu12Frame->mHeight, mYu12Frame->mWidth, mYu12Frame->mHeight);
-        ATRACE_END();
-
-        if (res != 0) {
-            // For some webcam, the first few V4L2 frames might be malformed...
-            ALOGE("%s: Convert V4L2 frame to YU12 failed! res %d", __FUNCTION__, res);
-            lk.unlock();
-            Status st = parent->processCaptureRequestError(req);
-            if (st != Status::OK) {
-                return onDeviceError("%s: failed to process capture request error!", __FUNCTION__);
-            }
-            signalRequestDone();
-            return true;
+    int inputRes = decoded->decodeRes;
+    if (inputRes == 0 && inDataSize < passthroughSize) {
+        ALOGE("%s: V4L2 frame has %zu bytes, expect %zu", __FUNCTION__,
+                inDataSize, passthroughSize);
+        inputRes = -EINVAL;
+    }
+    if (inputRes != 0) {
+        // For some webcam, the first few V4L2 frames might be malformed...
+        ALOGE("%s: Convert V4L2 frame to YU12 failed! res %d", __FUNCTION__, inputRes);
+        lk.unlock();
+        // Keep BLOB buffers in order
+        waitForJpegJobsDone(parent);
+        Status st = parent->processCaptureRequestError(req);
+        if (st != Status::OK) {
+            return onDeviceError("%s: failed to process capture request error!", __FUNCTION__);
         }
+        signalRequestDone();
+        return true;
     }
 
+    // Uncompressed frames are only converted to YU12 if some output can't be written directly
+    bool yu12Ready = passthroughSize == 0;
+    auto prepareYu12 = [&]() {
+        if (!yu12Ready) {
+            int ret = convertToYu12Locked(inData, inFourcc);
+            if (ret != 0) {
+                return ret;
+            }
+            yu12Ready = true;
+        }
+        return 0;
+    };
+
     ATRACE_BEGIN("Wait for BufferRequest done");
     res = waitForBufferRequestDone(&req->buffers);
     ATRACE_END();
@@ -1878,6 +2581,7 @@ bool ExternalCameraDeviceSession::OutputThread::threadLoop() {
 
     ALOGV("%s processing new request", __FUNCTION__);
     const int kSyncWaitTimeoutMs = 500;
+    std::shared_ptr<JpegJob> jpegJob; // At most one BLOB stream is supported
     for (auto& halBuf : req->buffers) {
         if (*(halBuf.bufPtr) == nullptr) {
             ALOGW("%s: buffer for stream %d missing", __FUNCTION__, halBuf.streamId);
@@ -1899,7 +2603,15 @@ bool ExternalCameraDeviceSession::OutputThread::threadLoop() {
         // Gralloc lockYCbCr the buffer
         switch (halBuf.format) {
             case PixelFormat::BLOB: {
-                int ret = createJpegLocked(halBuf, req);
+                int ret = prepareYu12();
+                if (ret != 0) {
+                    lk.unlock();
+                    return onDeviceError("%s: convert V4L2 frame to YU12 failed with %d",
+                          __FUNCTION__, ret);
+                }
+                nsecs_t jpegStart = systemTime();
+                ret = createJpegLocked(halBuf, req, &jpegJob);
+                recordLatency(STAGE_JPEG, systemTime() - jpegStart);
 
                 if(ret != 0) {
                     lk.unlock();
@@ -1928,34 +2640,53 @@ bool ExternalCameraDeviceSession::OutputThread::threadLoop() {
                         __FUNCTION__, outLayout.y, outLayout.cb, outLayout.cr,
                         outLayout.yStride, outLayout.cStride, outLayout.chromaStep);
 
-                // Convert to output buffer size/format
-                uint32_t outputFourcc = getFourCcFromLayout(outLayout);
-                ALOGV("%s: converting to format %c%c%c%c", __FUNCTION__,
-                        outputFourcc & 0xFF,
-                        (outputFourcc >> 8) & 0xFF,
-                        (outputFourcc >> 16) & 0xFF,
-                        (outputFourcc >> 24) & 0xFF);
-
-                YCbCrLayout cropAndScaled;
-                ATRACE_BEGIN("cropAndScaleLocked");
-                int ret = cropAndScaleLocked(
-                        mYu12Frame,
-                        Size { halBuf.width, halBuf.height },
-                        &cropAndScaled);
-                ATRACE_END();
-                if (ret != 0) {
-                    lk.unlock();
-                    return onDeviceError("%s: crop and scale failed!", __FUNCTION__);
+                Size sz {halBuf.width, halBuf.height};
+                OutputPath path = PATH_YU12;
+                int ret = -EINVAL;
+                if (passthroughSize != 0 && sz.width == req->frameIn->mWidth &&
+                        sz.height == req->frameIn->mHeight) {
+                    nsecs_t stageStart = systemTime();
+                    ATRACE_BEGIN("passthroughLocked");
+                    ret = passthroughLocked(inData, inFourcc, sz, outLayout, &path);
+                    ATRACE_END();
+                    if (ret == 0) {
+                        recordLatency(STAGE_PASSTHROUGH, systemTime() - stageStart);
+                    } else {
+                        path = PATH_YU12;
+                    }
                 }
 
-                Size sz {halBuf.width, halBuf.height};
-                ATRACE_BEGIN("formatConvertLocked");
-                ret = formatConvertLocked(cropAndScaled, outLayout, sz, outputFourcc);
-                ATRACE_END();
-                if (ret != 0) {
-                    lk.unlock();
-                    return onDeviceError("%s: format coversion failed!", __FUNCTION__);
+                if (path == PATH_YU12) {
+                    ret = prepareYu12();
+                    if (ret != 0) {
+                        lk.unlock();
+                        return onDeviceError("%s: convert V4L2 frame to YU12 failed with %d",
+                                __FUNCTION__, ret);
+                    }
+
+                    // Crop, scale and convert to output buffer size/format in one pass
+                    IMapper::Rect inputCrop;
+                    ret = getCropRect(mCroppingType,
+                            Size {mYu12Frame->mWidth, mYu12Frame->mHeight}, sz, &inputCrop);
+                    if (ret != 0) {
+                        lk.unlock();
+                        return onDeviceError(
+                                "%s: failed to compute crop rect for output size %dx%d",
+                                __FUNCTION__, sz.width, sz.height);
+                    }
+
+                    nsecs_t stageStart = systemTime();
+                    ATRACE_BEGIN("YuvCropScaler::convert");
+                    ret = mCropScalers[sz].convert(
+                            mYu12FrameLayout, inputCrop, outLayout, sz.width, sz.height);
+                    ATRACE_END();
+                    recordLatency(STAGE_CROP_SCALE_CONVERT, systemTime() - stageStart);
+                    if (ret != 0) {
+                        lk.unlock();
+                        return onDeviceError("%s: crop/scale/convert failed!", __FUNCTION__);
+                    }
                 }
+                recordOutputPath(halBuf.streamId, path);
                 int relFence = sHandleImporter.unlock(*(halBuf.bufPtr));
                 if (relFence >= 0) {
                     halBuf.acquireFence = relFence;
@@ -1968,12 +2699,26 @@ bool ExternalCameraDeviceSession::OutputThread::threadLoop() {
     } // for each buffer
     mScaledYu12Frames.clear();
 
+    if (jpegJob != nullptr) {
+        // The BLOB buffer is returned by JpegThread once encoded
+        req->jpegPending = true;
+        req->buffers.erase(std::remove_if(req->buffers.begin(), req->buffers.end(),
+                [&](const HalStreamBuffer& buf) {
+                    return buf.streamId == jpegJob->buffer.streamId;
+                }), req->buffers.end());
+    }
+
     // Don't hold the lock while calling back to parent
     lk.unlock();
     Status st = parent->processCaptureResult(req);
     if (st != Status::OK) {
         return onDeviceError("%s: failed to process capture result!", __FUNCTION__);
     }
+    // Only now that the shutter is sent buffers of the request can be returned
+    if (jpegJob != nullptr) {
+        submitJpegJob(jpegJob);
+    }
+    recordLatency(STAGE_TOTAL, systemTime() - decoded->startTs);
     signalRequestDone();
     return true;
 }
@@ -1989,9 +2734,16 @@ Status ExternalCameraDeviceSession::OutputThread::allocateIntermediateBuffers(
         return Status::INTERNAL_ERROR;
     }
 
-    // Allocating intermediate YU12 frame
+    // Allocating intermediate YU12 frames, one held by OutputThread and the rest for DecodeThread
     if (mYu12Frame == nullptr || mYu12Frame->mWidth != v4lSize.width ||
             mYu12Frame->mHeight != v4lSize.height) {
+        std::lock_guard<std::mutex> listLk(mRequestListLock);
+        if (mDecodingRequest || !mDecodedList.empty()) {
+            ALOGE("%s: MJPEG decoder has inflight frames! (expect 0)", __FUNCTION__);
+            return Status::INTERNAL_ERROR;
+        }
+
+        mFreeYu12Buffers.clear();
         mYu12Frame.clear();
         mYu12Frame = new AllocatedFrame(v4lSize.width, v4lSize.height);
         int ret = mYu12Frame->allocate(&mYu12FrameLayout);
@@ -1999,6 +2751,16 @@ Status ExternalCameraDeviceSession::OutputThread::allocateIntermediateBuffers(
             ALOGE("%s: allocating YU12 frame failed!", __FUNCTION__);
             return Status::INTERNAL_ERROR;
         }
+        for (size_t i = 1; i < kNumDecodeBuffers; i++) {
+            Yu12Buffer buf;
+            buf.frame = new AllocatedFrame(v4lSize.width, v4lSize.height);
+            ret = buf.frame->allocate(&buf.layout);
+            if (ret != 0) {
+                ALOGE("%s: allocating YU12 decode frame failed!", __FUNCTION__);
+                return Status::INTERNAL_ERROR;
+            }
+            mFreeYu12Buffers.push_back(buf);
+        }
     }
 
     // Allocating intermediate YU12 thumbnail frame
@@ -2014,10 +2776,17 @@ Status ExternalCameraDeviceSession::OutputThread::allocateIntermediateBuffers(
         }
     }
 
-    // Allocating scaled buffers
+    // Allocating scaled buffers for JPEG encoding, YUV outputs are written directly by
+    // mCropScalers
+    mCropScalers.clear();
+    {
+        // Stream ids may be reused by the new configuration
+        std::lock_guard<std::mutex> statsLk(mLatencyLock);
+        mOutputPaths.clear();
+    }
     for (const auto& stream : streams) {
         Size sz = {stream.width, stream.height};
-        if (sz == v4lSize) {
+        if (stream.format != PixelFormat::BLOB || sz == v4lSize) {
             continue; // Don't need an intermediate buffer same size as v4lBuffer
         }
         if (mIntermediateBuffers.count(sz) == 0) {
@@ -2039,7 +2808,8 @@ Status ExternalCameraDeviceSession::OutputThread::allocateIntermediateBuffers(
         bool configured = false;
         auto sz = it->first;
         for (const auto& stream : streams) {
-            if (stream.width == sz.width && stream.height == sz.height) {
+            if (stream.format == PixelFormat::BLOB &&
+                    stream.width == sz.width && stream.height == sz.height) {
                 configured = true;
                 break;
             }
@@ -2072,19 +2842,41 @@ void ExternalCameraDeviceSession::OutputThread::flush() {
        return;
     }
 
+    // Requests to be errored out, oldest first: decoded ones not picked up by OutputThread yet,
+    // the one DecodeThread is working on, then the ones in mRequestList. YU12 buffers of the
+    // decoded requests go straight back to DecodeThread.
+    std::list<std::shared_ptr<HalRequest>> reqs;
+    auto takeDecodedLocked = [&]() {
+        for (const auto& decoded : mDecodedList) {
+            if (decoded->yu12.frame != nullptr) {
+                mFreeYu12Buffers.push_back(decoded->yu12);
+            }
+            reqs.push_back(decoded->req);
+        }
+        mDecodedList.clear();
+        mYu12FreeCond.notify_one();
+    };
+
     std::unique_lock<std::mutex> lk(mRequestListLock);
-    std::list<std::shared_ptr<HalRequest>> reqs = std::move(mRequestList);
+    std::list<std::shared_ptr<HalRequest>> pendingReqs = std::move(mRequestList);
     mRequestList.clear();
-    if (mProcessingRequest) {
+    takeDecodedLocked();
+    if (mProcessingRequest || mDecodingRequest) {
         std::chrono::seconds timeout = std::chrono::seconds(kFlushWaitTimeoutSec);
-        auto st = mRequestDoneCond.wait_for(lk, timeout);
-        if (st == std::cv_status::timeout) {
+        bool done = mRequestDoneCond.wait_for(lk, timeout,
+                [this] { return !mProcessingRequest && !mDecodingRequest; });
+        if (!done) {
             ALOGE("%s: wait for inflight request finish timeout!", __FUNCTION__);
         }
+        takeDecodedLocked();
     }
+    lk.unlock();
+    reqs.splice(reqs.end(), pendingReqs);
+
+    // Pending still captures are older than any request left
+    flushJpegJobs(parent);
 
     ALOGV("%s: flusing inflight requests", __FUNCTION__);
-    lk.unlock();
     for (const auto& req : reqs) {
         parent->processCaptureRequestError(req);
     }
@@ -2116,8 +2908,38 @@ void ExternalCameraDeviceSession::OutputThread::waitForNextRequest(
     }
     *out = mRequestList.front();
     mRequestList.pop_front();
+    mDecodingRequest = true;
+    mDecodingFrameNumber = (*out)->frameNumber;
+}
+
+void ExternalCameraDeviceSession::OutputThread::waitForNextDecodedRequest(
+        std::shared_ptr<DecodedRequest>* out) {
+    ATRACE_CALL();
+    if (out == nullptr) {
+        ALOGE("%s: out is null", __FUNCTION__);
+        return;
+    }
+
+    std::unique_lock<std::mutex> lk(mRequestListLock);
+    int waitTimes = 0;
+    while (mDecodedList.empty()) {
+        if (exitPending()) {
+            return;
+        }
+        std::chrono::milliseconds timeout = std::chrono::milliseconds(kReqWaitTimeoutMs);
+        auto st = mDecodedCond.wait_for(lk, timeout);
+        if (st == std::cv_status::timeout) {
+            waitTimes++;
+            if (waitTimes == kReqWaitTimesMax) {
+                // no new request, return
+                return;
+            }
+        }
+    }
+    *out = mDecodedList.front();
+    mDecodedList.pop_front();
     mProcessingRequest = true;
-    mProcessingFrameNumer = (*out)->frameNumber;
+    mProcessingFrameNumer = (*out)->req->frameNumber;
 }
 
 void ExternalCameraDeviceSession::OutputThread::signalRequestDone() {
@@ -2128,18 +2950,99 @@ void ExternalCameraDeviceSession::OutputThread::signalRequestDone() {
     mRequestDoneCond.notify_one();
 }
 
+void ExternalCameraDeviceSession::OutputThread::recordLatency(Stage stage, nsecs_t latency) {
+    std::lock_guard<std::mutex> lk(mLatencyLock);
+    StageLatency& l = mLatency[stage];
+    l.count++;
+    l.total += latency;
+    l.max = std::max(l.max, latency);
+    l.last = latency;
+}
+
+void ExternalCameraDeviceSession::OutputThread::dumpLatency(int fd) {
+    std::lock_guard<std::mutex> lk(mLatencyLock);
+    dprintf(fd, "OutputThread stage latency (avg/max/last ms):\n");
+    for (int i = 0; i < STAGE_COUNT; i++) {
+        const StageLatency& l = mLatency[i];
+        if (l.count == 0) {
+            dprintf(fd, "  %s: no samples\n", kStageNames[i]);
+            continue;
+        }
+        dprintf(fd, "  %s: %.3f/%.3f/%.3f over %" PRIu64 " samples\n", kStageNames[i],
+                ns2us(l.total / l.count) / 1000.0, ns2us(l.max) / 1000.0,
+                ns2us(l.last) / 1000.0, l.count);
+    }
+}
+
+void ExternalCameraDeviceSession::OutputThread::recordOutputPath(int streamId, OutputPath path) {
+    std::lock_guard<std::mutex> lk(mLatencyLock);
+    auto it = mOutputPaths.find(streamId);
+    if (it == mOutputPaths.end()) {
+        it = mOutputPaths.emplace(streamId, std::array<uint64_t, PATH_COUNT>{}).first;
+    }
+    it->second[path]++;
+}
+
+void ExternalCameraDeviceSession::OutputThread::dumpOutputPaths(int fd) {
+    std::lock_guard<std::mutex> lk(mLatencyLock);
+    dprintf(fd, "OutputThread YUV output paths (buffers):\n");
+    for (const auto& pair : mOutputPaths) {
+        dprintf(fd, "  stream %d:", pair.first);
+        for (int i = 0; i < PATH_COUNT; i++) {
+            dprintf(fd, " %s %" PRIu64 "%s", kOutputPathNames[i], pair.second[i],
+                    (i + 1 < PATH_COUNT) ? "," : "\n");
+        }
+    }
+}
+
 void ExternalCameraDeviceSession::OutputThread::dump(int fd) {
-    std::lock_guard<std::mutex> lk(mRequestListLock);
-    if (mProcessingRequest) {
-        dprintf(fd, "OutputThread processing frame %d\n", mProcessingFrameNumer);
+    {
+        std::lock_guard<std::mutex> lk(mRequestListLock);
+        if (mProcessingRequest) {
+            dprintf(fd, "OutputThread processing frame %d\n", mProcessingFrameNumer);
+        } else {
+            dprintf(fd, "OutputThread not processing any frames\n");
+        }
+        if (mDecodingRequest) {
+            dprintf(fd, "OutputThread decoding frame %d\n", mDecodingFrameNumber);
+        } else {
+            dprintf(fd, "OutputThread not decoding any frames\n");
+        }
+        dprintf(fd, "OutputThread decoded list contains frame: ");
+        for (const auto& decoded : mDecodedList) {
+            dprintf(fd, "%d, ", decoded->req->frameNumber);
+        }
+        dprintf(fd, "\n");
+        dprintf(fd, "OutputThread request list contains frame: ");
+        for (const auto& req : mRequestList) {
+            dprintf(fd, "%d, ", req->frameNumber);
+        }
+        dprintf(fd, "\n");
+    }
+    dumpLatency(fd);
+    dumpOutputPaths(fd);
+    dumpJpegStats(fd);
+}
+
+void ExternalCameraDeviceSession::OutputThread::dumpJpegStats(int fd) {
+    std::lock_guard<std::mutex> lk(mJpegLock);
+    if (mEncodingJpeg) {
+        dprintf(fd, "OutputThread encoding JPEG of frame %d\n", mEncodingJpegFrameNumber);
     } else {
-        dprintf(fd, "OutputThread not processing any frames\n");
+        dprintf(fd, "OutputThread not encoding any JPEG\n");
     }
-    dprintf(fd, "OutputThread request list contains frame: ");
-    for (const auto& req : mRequestList) {
-        dprintf(fd, "%d, ", req->frameNumber);
+    dprintf(fd, "OutputThread JPEG queue contains frame: ");
+    for (const auto& job : mJpegJobs) {
+        dprintf(fd, "%d, ", job->frameNumber);
     }
     dprintf(fd, "\n");
+    dprintf(fd, "OutputThread last %zu JPEG captures (%zu encode threads):\n",
+            mJpegStats.size(), mJpegWorkers.size());
+    for (const auto& stats : mJpegStats) {
+        dprintf(fd, "  frame %d: %dx%d, %zu bytes, queued %.3f ms, encoded in %.3f ms\n",
+                stats.frameNumber, stats.size.width, stats.size.height, stats.codeSize,
+                ns2us(stats.queueTime) / 1000.0, ns2us(stats.encodeTime) / 1000.0);
+    }
 }
 
 void ExternalCameraDeviceSession::cleanupBuffersLocked(int id) {
@@ -2229,6 +3132,60 @@ bool ExternalCameraDeviceSession::isSupported(const Stream& stream,
     return false;
 }
 
+bool ExternalCameraDeviceSession::findPassthroughFormatLocked(
+        const SupportedV4L2Format& fmt, SupportedV4L2Format* passthroughFmt) {
+    if (!mCfg.uncompressedPassthrough || fmt.fourcc != V4L2_PIX_FMT_MJPEG) {
+        return false;
+    }
+
+    for (uint32_t fourcc : kPassthroughFourCCs) {
+        // Fails right away if the device can't produce this format in this size
+        std::vector<SupportedV4L2Format::FrameRate> frameRates;
+        v4l2_frmivalenum frameInterval {
+                .index = 0,
+                .pixel_format = fourcc,
+                .width = fmt.width,
+                .height = fmt.height,
+        };
+        for (; TEMP_FAILURE_RETRY(ioctl(mV4l2Fd.get(), VIDIOC_ENUM_FRAMEINTERVALS,
+                &frameInterval)) == 0; ++frameInterval.index) {
+            if (frameInterval.type == V4L2_FRMIVAL_TYPE_DISCRETE &&
+                    frameInterval.discrete.numerator != 0) {
+                frameRates.push_back({frameInterval.discrete.numerator,
+                        frameInterval.discrete.denominator});
+            }
+        }
+
+        // USB bandwidth of uncompressed streams usually limits their frame rate, only use the
+        // format if it doesn't take away any frame rate the MJPEG format offers
+        bool supportsAllRates = !frameRates.empty();
+        for (const auto& fr : fmt.frameRates) {
+            bool found = false;
+            for (const auto& passthroughFr : frameRates) {
+                if (std::fabs(fr.getDouble() - passthroughFr.getDouble()) < 0.01) {
+                    found = true;
+                    break;
+                }
+            }
+            if (!found) {
+                supportsAllRates = false;
+                break;
+            }
+        }
+
+        if (supportsAllRates) {
+            *passthroughFmt = fmt;
+            passthroughFmt->fourcc = fourcc;
+            ALOGI("%s: streaming %c%c%c%c instead of MJPEG at %dx%d", __FUNCTION__,
+                    fourcc & 0xFF, (fourcc >> 8) & 0xFF,
+                    (fourcc >> 16) & 0xFF, (fourcc >> 24) & 0xFF,
+                    fmt.width, fmt.height);
+            return true;
+        }
+    }
+    return false;
+}
+
 int ExternalCameraDeviceSession::v4l2StreamOffLocked() {
     if (!mV4l2Streaming) {
         return OK;
@@ -2304,7 +3261,7 @@ int ExternalCameraDeviceSession::setV4l2FpsLocked(double fps) {
 }
 
 int ExternalCameraDeviceSession::configureV4l2StreamLocked(
-        const SupportedV4L2Format& v4l2Fmt, double requestFps) {
+        const SupportedV4L2Format& v4l2Fmt, double requestFps, uint32_t bufferCount) {
     ATRACE_CALL();
     int ret = v4l2StreamOffLocked();
     if (ret != OK) {
@@ -2351,6 +3308,14 @@ int ExternalCameraDeviceSession::configureV4l2StreamLocked(
                 fmt.fmt.pix.width, fmt.fmt.pix.height);
         return -EINVAL;
     }
+    // OutputThread reads passthrough frames assuming tightly packed lines
+    uint32_t passthroughBpl = getPassthroughBytesPerLine(v4l2Fmt.fourcc, v4l2Fmt.width);
+    if (passthroughBpl != 0 && fmt.fmt.pix.bytesperline != passthroughBpl) {
+        ALOGE("%s: V4L2 bytes per line is %d, expect %d", __FUNCTION__,
+                fmt.fmt.pix.bytesperline, passthroughBpl);
+        return -EINVAL;
+    }
+
     uint32_t bufferSize = fmt.fmt.pix.sizeimage;
     ALOGI("%s: V4L2 buffer size is %d", __FUNCTION__, bufferSize);
     uint32_t expectedMaxBufferSize = kMaxBytesPerPixel * fmt.fmt.pix.width * fmt.fmt.pix.height;
@@ -2388,8 +3353,10 @@ int ExternalCameraDeviceSession::configureV4l2StreamLocked(
         return fpsRet;
     }
 
-    uint32_t v4lBufferCount = (fps >= kDefaultFps) ?
+    // The count from config is where mV4l2BufferScheduler starts from
+    uint32_t cfgBufferCount = (fps >= kDefaultFps) ?
             mCfg.numVideoBuffers : mCfg.numStillBuffers;
+    uint32_t v4lBufferCount = (bufferCount != 0) ? bufferCount : cfgBufferCount;
     // VIDIOC_REQBUFS: create buffers
     v4l2_requestbuffers req_buffers{};
     req_buffers.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
@@ -2410,6 +3377,13 @@ int ExternalCameraDeviceSession::configureV4l2StreamLocked(
     // VIDIOC_QUERYBUF:  get buffer offset in the V4L2 fd
     // VIDIOC_QBUF: send buffer to driver
     mV4L2BufferCount = req_buffers.count;
+    {
+        std::lock_guard<std::mutex> lk(mV4l2BufferLock);
+        mV4l2BufferScheduler.reset(req_buffers.count,
+                std::min(kMinV4L2BufferCount, cfgBufferCount),
+                std::max(cfgBufferCount + kMaxExtraV4L2Buffers, req_buffers.count),
+                fps, systemTime());
+    }
     for (uint32_t i = 0; i < req_buffers.count; i++) {
         v4l2_buffer buffer = {
                 .index = i, .type = V4L2_BUF_TYPE_VIDEO_CAPTURE, .memory = V4L2_MEMORY_MMAP};
@@ -2477,14 +3451,17 @@ sp<V4L2Frame> ExternalCameraDeviceSession::dequeueV4l2FrameLocked(/*out*/nsecs_t
         return ret;
     }
 
+    size_t numHeld = 0;
     {
         std::unique_lock<std::mutex> lk(mV4l2BufferLock);
         if (mNumDequeuedV4l2Buffers == mV4L2BufferCount) {
+            mV4l2BufferScheduler.onStarved();
             int waitRet = waitForV4L2BufferReturnLocked(lk);
             if (waitRet != 0) {
                 return ret;
             }
         }
+        numHeld = mNumDequeuedV4l2Buffers;
     }
 
     ATRACE_BEGIN("VIDIOC_DQBUF");
@@ -2497,6 +3474,30 @@ sp<V4L2Frame> ExternalCameraDeviceSession::dequeueV4l2FrameLocked(/*out*/nsecs_t
     }
     ATRACE_END();
 
+    // If requests come slower than the camera produces frames, newer frames may already be
+    // waiting. Use the newest one and put the stale ones back for the driver to refill.
+    size_t numDropped = 0;
+    pollfd pfd {.fd = mV4l2Fd.get(), .events = POLLIN};
+    while (TEMP_FAILURE_RETRY(poll(&pfd, 1, /*timeout*/0)) > 0 && (pfd.revents & POLLIN)) {
+        v4l2_buffer newer{};
+        newer.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+        newer.memory = V4L2_MEMORY_MMAP;
+        if (TEMP_FAILURE_RETRY(ioctl(mV4l2Fd.get(), VIDIOC_DQBUF, &newer)) < 0) {
+            break;
+        }
+        if (TEMP_FAILURE_RETRY(ioctl(mV4l2Fd.get(), VIDIOC_QBUF, &buffer)) < 0) {
+            ALOGE("%s: QBUF index %d fails: %s", __FUNCTION__, buffer.index, strerror(errno));
+            // Keep the stale buffer, like enqueueV4l2Frame does on failure
+            std::lock_guard<std::mutex> lk(mV4l2BufferLock);
+            mNumDequeuedV4l2Buffers++;
+            numHeld++;
+        } else {
+            numDropped++;
+        }
+        buffer = newer;
+    }
+    ATRACE_INT("V4L2 stale frames dropped", numDropped);
+
     if (buffer.index >= mV4L2BufferCount) {
         ALOGE("%s: Invalid buffer id: %d", __FUNCTION__, buffer.index);
         return ret;
@@ -2525,6 +3526,7 @@ sp<V4L2Frame> ExternalCameraDeviceSession::dequeueV4l2FrameLocked(/*out*/nsecs_t
     {
         std::lock_guard<std::mutex> lk(mV4l2BufferLock);
         mNumDequeuedV4l2Buffers++;
+        mV4l2BufferScheduler.onDequeue(buffer.index, numHeld, numDropped, systemTime());
     }
     return new V4L2Frame(
             mV4l2StreamingFmt.width, mV4l2StreamingFmt.height, mV4l2StreamingFmt.fourcc,
@@ -2549,6 +3551,7 @@ void ExternalCameraDeviceSession::enqueueV4l2Frame(const sp<V4L2Frame>& frame) {
     {
         std::lock_guard<std::mutex> lk(mV4l2BufferLock);
         mNumDequeuedV4l2Buffers--;
+        mV4l2BufferScheduler.onReturn(frame->mBufferIndex, systemTime());
     }
     mV4L2BufferReturned.notify_one();
 }
@@ -2706,7 +3709,24 @@ Status ExternalCameraDeviceSession::configureStreams(
         return Status::ILLEGAL_ARGUMENT;
     }
 
-    if (configureV4l2StreamLocked(v4l2Fmt) != 0) {
+    // Prefer streaming an uncompressed format of the same size, YUV outputs of that size can
+    // then be written without decoding MJPEG
+    SupportedV4L2Format passthroughFmt;
+    bool v4l2Configured = false;
+    if (findPassthroughFormatLocked(v4l2Fmt, &passthroughFmt)) {
+        v4l2Configured = (configureV4l2StreamLocked(passthroughFmt) == 0);
+        if (v4l2Configured) {
+            v4l2Fmt = passthroughFmt;
+        } else {
+            ALOGW("%s: configuring passthrough format %c%c%c%c failed, using MJPEG", __FUNCTION__,
+                    passthroughFmt.fourcc & 0xFF,
+                    (passthroughFmt.fourcc >> 8) & 0xFF,
+                    (passthroughFmt.fourcc >> 16) & 0xFF,
+                    (passthroughFmt.fourcc >> 24) & 0xFF);
+        }
+    }
+
+    if (!v4l2Configured && configureV4l2StreamLocked(v4l2Fmt) != 0) {
         ALOGE("V4L configuration failed!, format:%c%c%c%c, w %d, h %d",
             v4l2Fmt.fourcc & 0xFF,
             (v4l2Fmt.fourcc >> 8) & 0xFF,
@@ -2740,6 +3760,18 @@ Status ExternalCameraDeviceSession::configureStreams(
         return status;
     }
 
+    // The V4L2 buffer queue may grow up to the scheduler's limit while streaming. Buffers are
+    // also held after capture, by the result batcher until its batch is sent and, for BLOB
+    // streams, by the JPEG encoding jobs in flight.
+    uint32_t maxBuffers = 0;
+    {
+        std::lock_guard<std::mutex> lk(mV4l2BufferLock);
+        maxBuffers = mV4l2BufferScheduler.getMaxCount();
+    }
+    if (mCfg.resultBatchSize > 1) {
+        maxBuffers += mCfg.resultBatchSize;
+    }
+
     out->streams.resize(config.streams.size());
     for (size_t i = 0; i < config.streams.size(); i++) {
         out->streams[i].overrideDataSpace = config.streams[i].dataSpace;
@@ -2750,7 +3782,10 @@ Status ExternalCameraDeviceSession::configureStreams(
                 BufferUsage::CPU_WRITE_OFTEN |
                 BufferUsage::CAMERA_OUTPUT;
         out->streams[i].v3_2.consumerUsage = 0;
-        out->streams[i].v3_2.maxBuffers  = mV4L2BufferCount;
+        out->streams[i].v3_2.maxBuffers  = maxBuffers;
+        if (config.streams[i].format == PixelFormat::BLOB) {
+            out->streams[i].v3_2.maxBuffers += OutputThread::kMaxPendingJpegJobs;
+        }
 
         switch (config.streams[i].format) {
             case PixelFormat::BLOB:
@@ -2914,8 +3949,8 @@ status_t ExternalCameraDeviceSession::initDefaultRequests() {
     return OK;
 }
 
-status_t ExternalCameraDeviceSession::fillCaptureResult(
-        common::V1_0::helper::CameraMetadata &md, nsecs_t timestamp) {
+status_t ExternalCameraDeviceSession::fillStaticCaptureResult(
+        common::V1_0::helper::CameraMetadata &md) {
     // android.control
     // For USB camera, we don't know the AE state. Set the state to converged to
     // indicate the frame should be good to use. Then apps don't have to wait the
@@ -2926,29 +3961,8 @@ status_t ExternalCameraDeviceSession::fillCaptureResult(
     const uint8_t ae_lock = ANDROID_CONTROL_AE_LOCK_OFF;
     UPDATE(md, ANDROID_CONTROL_AE_LOCK, &ae_lock, 1);
 
-    bool afTrigger = false;
-    {
-        std::lock_guard<std::mutex> lk(mAfTriggerLock);
-        afTrigger = mAfTrigger;
-        if (md.exists(ANDROID_CONTROL_AF_TRIGGER)) {
-            camera_metadata_entry entry = md.find(ANDROID_CONTROL_AF_TRIGGER);
-            if (entry.data.u8[0] == ANDROID_CONTROL_AF_TRIGGER_START) {
-                mAfTrigger = afTrigger = true;
-            } else if (entry.data.u8[0] == ANDROID_CONTROL_AF_TRIGGER_CANCEL) {
-                mAfTrigger = afTrigger = false;
-            }
-        }
-    }
-
-    // For USB camera, the USB camera handles everything and we don't have control
-    // over AF. We only simply fake the AF metadata based on the request
-    // received here.
-    uint8_t afState;
-    if (afTrigger) {
-        afState = ANDROID_CONTROL_AF_STATE_FOCUSED_LOCKED;
-    } else {
-        afState = ANDROID_CONTROL_AF_STATE_INACTIVE;
-    }
+    // Set by fillCaptureResult
+    const uint8_t afState = ANDROID_CONTROL_AF_STATE_INACTIVE;
     UPDATE(md, ANDROID_CONTROL_AF_STATE, &afState, 1);
 
     // Set AWB state to converged to indicate the frame should be good to use.
@@ -2981,6 +3995,8 @@ status_t ExternalCameraDeviceSession::fillCaptureResult(
     UPDATE(md, ANDROID_SCALER_CROP_REGION, crop_region, ARRAY_SIZE(crop_region));
 
     // android.sensor
+    // Set by fillCaptureResult
+    const int64_t timestamp = 0;
     UPDATE(md, ANDROID_SENSOR_TIMESTAMP, &timestamp, 1);
 
     // android.statistics
@@ -2990,6 +4006,41 @@ status_t ExternalCameraDeviceSession::fillCaptureResult(
     const uint8_t sceneFlicker = ANDROID_STATISTICS_SCENE_FLICKER_NONE;
     UPDATE(md, ANDROID_STATISTICS_SCENE_FLICKER, &sceneFlicker, 1);
 
+    // Copies keep the sorted flag, which makes lookups in them a binary search
+    md.sort();
+    return OK;
+}
+
+status_t ExternalCameraDeviceSession::fillCaptureResult(
+        common::V1_0::helper::CameraMetadata &md, nsecs_t timestamp) {
+    bool afTrigger = false;
+    {
+        std::lock_guard<std::mutex> lk(mAfTriggerLock);
+        afTrigger = mAfTrigger;
+        if (md.exists(ANDROID_CONTROL_AF_TRIGGER)) {
+            camera_metadata_entry entry = md.find(ANDROID_CONTROL_AF_TRIGGER);
+            if (entry.data.u8[0] == ANDROID_CONTROL_AF_TRIGGER_START) {
+                mAfTrigger = afTrigger = true;
+            } else if (entry.data.u8[0] == ANDROID_CONTROL_AF_TRIGGER_CANCEL) {
+                mAfTrigger = afTrigger = false;
+            }
+        }
+    }
+
+    // For USB camera, the USB camera handles everything and we don't have control
+    // over AF. We only simply fake the AF metadata based on the request
+    // received here.
+    uint8_t afState;
+    if (afTrigger) {
+        afState = ANDROID_CONTROL_AF_STATE_FOCUSED_LOCKED;
+    } else {
+        afState = ANDROID_CONTROL_AF_STATE_INACTIVE;
+    }
+    UPDATE(md, ANDROID_CONTROL_AF_STATE, &afState, 1);
+
+    // android.sensor
+    UPDATE(md, ANDROID_SENSOR_TIMESTAMP, &timestamp, 1);
+
     return OK;
 }
 
@@ -17,9 +17,16 @@
 //#define LOG_NDEBUG 0
 #include <log/log.h>
 
+#include <algorithm>
 #include <cmath>
+#include <stdio.h>
 #include <sys/mman.h>
 #include <linux/videodev2.h>
+
+#define HAVE_JPEG // required for libyuv.h to export MJPEG decode APIs
+#include <libyuv.h>
+#include <libyuv/mjpeg_decoder.h>
+
 #include "ExternalCameraUtils.h"
 
 namespace android {
@@ -139,6 +146,266 @@ int AllocatedFrame::getCroppedLayout(const IMapper::Rect& rect, YCbCrLayout* out
     return 0;
 }
 
+namespace {
+
+// Destination of MjpegDecoder callbacks, advanced as decoded rows are converted.
+struct Yu12Rows {
+    uint8_t* y;
+    int yStride;
+    uint8_t* u;
+    uint8_t* v;
+    int cStride;
+    int width;
+};
+
+void advanceRows(Yu12Rows* dst, int rows) {
+    dst->y += rows * dst->yStride;
+    dst->u += ((rows + 1) >> 1) * dst->cStride;
+    dst->v += ((rows + 1) >> 1) * dst->cStride;
+}
+
+void copyI420Rows(void* opaque, const uint8_t* const* data, const int* strides, int rows) {
+    Yu12Rows* dst = static_cast<Yu12Rows*>(opaque);
+    libyuv::I420Copy(data[0], strides[0], data[1], strides[1], data[2], strides[2],
+            dst->y, dst->yStride, dst->u, dst->cStride, dst->v, dst->cStride, dst->width, rows);
+    advanceRows(dst, rows);
+}
+
+void convertI422Rows(void* opaque, const uint8_t* const* data, const int* strides, int rows) {
+    Yu12Rows* dst = static_cast<Yu12Rows*>(opaque);
+    libyuv::I422ToI420(data[0], strides[0], data[1], strides[1], data[2], strides[2],
+            dst->y, dst->yStride, dst->u, dst->cStride, dst->v, dst->cStride, dst->width, rows);
+    advanceRows(dst, rows);
+}
+
+void convertI444Rows(void* opaque, const uint8_t* const* data, const int* strides, int rows) {
+    Yu12Rows* dst = static_cast<Yu12Rows*>(opaque);
+    libyuv::I444ToI420(data[0], strides[0], data[1], strides[1], data[2], strides[2],
+            dst->y, dst->yStride, dst->u, dst->cStride, dst->v, dst->cStride, dst->width, rows);
+    advanceRows(dst, rows);
+}
+
+void convertI400Rows(void* opaque, const uint8_t* const* data, const int* strides, int rows) {
+    Yu12Rows* dst = static_cast<Yu12Rows*>(opaque);
+    libyuv::I400ToI420(data[0], strides[0],
+            dst->y, dst->yStride, dst->u, dst->cStride, dst->v, dst->cStride, dst->width, rows);
+    advanceRows(dst, rows);
+}
+
+bool hasSampling(libyuv::MJpegDecoder& decoder, int component, int horiz, int vert) {
+    return decoder.GetHorizSampFactor(component) == horiz &&
+            decoder.GetVertSampFactor(component) == vert;
+}
+
+} // anonymous namespace
+
+MjpegDecoder::MjpegDecoder() : mDecoder(std::make_unique<libyuv::MJpegDecoder>()) {}
+
+MjpegDecoder::~MjpegDecoder() {}
+
+int MjpegDecoder::decode(const uint8_t* data, size_t dataSize,
+        uint32_t width, uint32_t height, const YCbCrLayout& out) {
+    if (!mDecoder->LoadFrame(data, dataSize)) {
+        return -EINVAL;
+    }
+    if (mDecoder->GetWidth() != static_cast<int>(width) ||
+            mDecoder->GetHeight() != static_cast<int>(height)) {
+        ALOGE("%s: MJPEG frame size %dx%d does not match expected %dx%d", __FUNCTION__,
+                mDecoder->GetWidth(), mDecoder->GetHeight(), width, height);
+        mDecoder->UnloadFrame();
+        return -EINVAL;
+    }
+
+    // Same subsampling cases libyuv::MJPGToI420 supports
+    libyuv::MJpegDecoder::CallbackFunction convertRows = nullptr;
+    if (mDecoder->GetColorSpace() == libyuv::MJpegDecoder::kColorSpaceYCbCr &&
+            mDecoder->GetNumComponents() == 3 &&
+            hasSampling(*mDecoder, 1, 1, 1) && hasSampling(*mDecoder, 2, 1, 1)) {
+        if (hasSampling(*mDecoder, 0, 2, 2)) {
+            convertRows = copyI420Rows;
+        } else if (hasSampling(*mDecoder, 0, 2, 1)) {
+            convertRows = convertI422Rows;
+        } else if (hasSampling(*mDecoder, 0, 1, 1)) {
+            convertRows = convertI444Rows;
+        }
+    } else if (mDecoder->GetColorSpace() == libyuv::MJpegDecoder::kColorSpaceGrayscale &&
+            mDecoder->GetNumComponents() == 1 && hasSampling(*mDecoder, 0, 1, 1)) {
+        convertRows = convertI400Rows;
+    }
+    if (convertRows == nullptr) {
+        ALOGE("%s: unsupported MJPEG subsampling", __FUNCTION__);
+        mDecoder->UnloadFrame();
+        return -EINVAL;
+    }
+
+    Yu12Rows dst = {
+        static_cast<uint8_t*>(out.y), static_cast<int>(out.yStride),
+        static_cast<uint8_t*>(out.cb), static_cast<uint8_t*>(out.cr),
+        static_cast<int>(out.cStride), static_cast<int>(width)
+    };
+    // DecodeToCallback unloads the frame when it's done
+    return mDecoder->DecodeToCallback(convertRows, &dst, width, height) ? 0 : -EINVAL;
+}
+
+namespace {
+
+// Writes chroma samples with any output chroma step
+void stepChromaRow(const uint8_t* srcCb, const uint8_t* srcCr, uint8_t* dstCb, uint8_t* dstCr,
+        uint32_t dstStep, uint32_t width) {
+    for (uint32_t i = 0; i < width; i++) {
+        dstCb[i * dstStep] = srcCb[i];
+        dstCr[i * dstStep] = srcCr[i];
+    }
+}
+
+// Unscaled interleave, written so it can be vectorized into NEON/SSE interleaving stores
+void interleaveChromaRow(const uint8_t* srcU, const uint8_t* srcV, uint8_t* dst, uint32_t width) {
+    for (uint32_t i = 0; i < width; i++) {
+        dst[2 * i] = srcU[i];
+        dst[2 * i + 1] = srcV[i];
+    }
+}
+
+// Copies a YU12 image of the output size into the output layout in one pass, band by band (two
+// luma rows and the chroma row they share), so each output row is written once
+void copyToLayout(const uint8_t* srcY, uint32_t srcYStride, const uint8_t* srcCb,
+        const uint8_t* srcCr, uint32_t srcCStride, const YCbCrLayout& out,
+        uint32_t width, uint32_t height) {
+    uint8_t* dstY = static_cast<uint8_t*>(out.y);
+    uint8_t* dstCb = static_cast<uint8_t*>(out.cb);
+    uint8_t* dstCr = static_cast<uint8_t*>(out.cr);
+    const uint32_t cWidth = width / 2;
+    // NV12 or NV21: write chroma pairs starting from whichever plane comes first in memory
+    const bool interleaved = out.chromaStep == 2 && (dstCr == dstCb + 1 || dstCb == dstCr + 1);
+    const bool crFirst = dstCr < dstCb;
+
+    for (uint32_t cy = 0; cy < height / 2; cy++) {
+        memcpy(dstY + 2 * cy * out.yStride, srcY + 2 * cy * srcYStride, width);
+        memcpy(dstY + (2 * cy + 1) * out.yStride, srcY + (2 * cy + 1) * srcYStride, width);
+
+        const uint8_t* cbRow = srcCb + cy * srcCStride;
+        const uint8_t* crRow = srcCr + cy * srcCStride;
+        uint8_t* cbOut = dstCb + cy * out.cStride;
+        uint8_t* crOut = dstCr + cy * out.cStride;
+        if (out.chromaStep == 1) {
+            memcpy(cbOut, cbRow, cWidth);
+            memcpy(crOut, crRow, cWidth);
+        } else if (interleaved) {
+            if (crFirst) {
+                interleaveChromaRow(crRow, cbRow, crOut, cWidth);
+            } else {
+                interleaveChromaRow(cbRow, crRow, cbOut, cWidth);
+            }
+        } else {
+            stepChromaRow(cbRow, crRow, cbOut, crOut, out.chromaStep, cWidth);
+        }
+    }
+}
+
+} // anonymous namespace
+
+int YuvCropScaler::convert(const YCbCrLayout& in, const IMapper::Rect& crop,
+        const YCbCrLayout& out, uint32_t outWidth, uint32_t outHeight) {
+    if ((crop.left % 2) || (crop.top % 2) || (crop.width % 2) || (crop.height % 2) ||
+            crop.width <= 0 || crop.height <= 0 ||
+            (outWidth % 2) || (outHeight % 2) || outWidth == 0 || outHeight == 0 ||
+            in.chromaStep != 1 || out.chromaStep == 0) {
+        ALOGE("%s: bad crop rect %d,%d %dx%d or output %dx%d (chroma step %d)", __FUNCTION__,
+                crop.left, crop.top, crop.width, crop.height, outWidth, outHeight,
+                out.chromaStep);
+        return -EINVAL;
+    }
+
+    const uint8_t* srcY = static_cast<const uint8_t*>(in.y) + crop.top * in.yStride + crop.left;
+    const size_t cOffset = crop.top / 2 * in.cStride + crop.left / 2;
+    const uint8_t* srcCb = static_cast<const uint8_t*>(in.cb) + cOffset;
+    const uint8_t* srcCr = static_cast<const uint8_t*>(in.cr) + cOffset;
+    if (static_cast<uint32_t>(crop.width) == outWidth &&
+            static_cast<uint32_t>(crop.height) == outHeight) {
+        copyToLayout(srcY, in.yStride, srcCb, srcCr, in.cStride, out, outWidth, outHeight);
+        return 0;
+    }
+
+    // Scaled outputs use libyuv, planar ones are scaled directly into the output buffer
+    if (out.chromaStep == 1) {
+        return libyuv::I420Scale(
+                srcY, in.yStride, srcCb, in.cStride, srcCr, in.cStride,
+                crop.width, crop.height,
+                static_cast<uint8_t*>(out.y), out.yStride,
+                static_cast<uint8_t*>(out.cb), out.cStride,
+                static_cast<uint8_t*>(out.cr), out.cStride,
+                outWidth, outHeight, libyuv::FilterMode::kFilterNone);
+    }
+    mScaledFrame.resize(outWidth * outHeight * 3 / 2);
+    uint8_t* scaledY = mScaledFrame.data();
+    uint8_t* scaledCb = scaledY + outWidth * outHeight;
+    uint8_t* scaledCr = scaledCb + outWidth * outHeight / 4;
+    int ret = libyuv::I420Scale(
+            srcY, in.yStride, srcCb, in.cStride, srcCr, in.cStride,
+            crop.width, crop.height,
+            scaledY, outWidth, scaledCb, outWidth / 2, scaledCr, outWidth / 2,
+            outWidth, outHeight, libyuv::FilterMode::kFilterNone);
+    if (ret != 0) {
+        return ret;
+    }
+    copyToLayout(scaledY, outWidth, scaledCb, scaledCr, outWidth / 2, out, outWidth, outHeight);
+    return 0;
+}
+
+WorkerPool::WorkerPool(size_t numThreads) {
+    for (size_t i = 1; i < numThreads; i++) {
+        mWorkers.emplace_back(&WorkerPool::workerLoop, this);
+    }
+}
+
+WorkerPool::~WorkerPool() {
+    {
+        std::lock_guard<std::mutex> lk(mLock);
+        mExiting = true;
+    }
+    mTaskCond.notify_all();
+    for (auto& worker : mWorkers) {
+        worker.join();
+    }
+}
+
+bool WorkerPool::runNextTaskLocked(std::unique_lock<std::mutex>& lk) {
+    if (mTasks == nullptr || mNextTask == mTasks->size()) {
+        return false;
+    }
+    const std::function<void()>& task = (*mTasks)[mNextTask++];
+    lk.unlock();
+    task();
+    lk.lock();
+    if (++mTasksDone == mTasks->size()) {
+        mDoneCond.notify_all();
+    }
+    return true;
+}
+
+void WorkerPool::workerLoop() {
+    std::unique_lock<std::mutex> lk(mLock);
+    while (!mExiting) {
+        if (!runNextTaskLocked(lk)) {
+            mTaskCond.wait(lk);
+        }
+    }
+}
+
+void WorkerPool::runAll(const std::vector<std::function<void()>>& tasks) {
+    if (tasks.empty()) {
+        return;
+    }
+    std::unique_lock<std::mutex> lk(mLock);
+    mTasks = &tasks;
+    mNextTask = 0;
+    mTasksDone = 0;
+    mTaskCond.notify_all();
+    while (runNextTaskLocked(lk)) {}
+    mDoneCond.wait(lk, [&] { return mTasksDone == tasks.size(); });
+    mTasks = nullptr;
+}
+
 bool isAspectRatioClose(float ar1, float ar2) {
     const float kAspectRatioMatchThres = 0.025f; // This threshold is good enough to distinguish
                                                 // 4:3/16:9/20:9
@@ -150,6 +417,93 @@ double SupportedV4L2Format::FrameRate::getDouble() const {
     return durationDenominator / static_cast<double>(durationNumerator);
 }
 
+void V4L2BufferScheduler::reset(
+        uint32_t count, uint32_t minCount, uint32_t maxCount, double fps, nsecs_t now) {
+    mCount = count;
+    mMinCount = minCount;
+    mMaxCount = maxCount;
+    mFramePeriod = (fps > 0.0) ? static_cast<nsecs_t>(1000000000LL / fps) : 0;
+    mResetTs = now;
+    mDequeueTs.assign(count, 0);
+    mStarved = false;
+    mFramesUndersized = 0;
+    mFramesOversized = 0;
+    mNumResets++;
+}
+
+void V4L2BufferScheduler::onDequeue(
+        uint32_t index, size_t numHeld, size_t numDropped, nsecs_t now) {
+    if (index < mDequeueTs.size()) {
+        mDequeueTs[index] = now;
+    }
+    if (numHeld >= mOccupancy.size()) {
+        mOccupancy.resize(numHeld + 1, 0);
+    }
+    mOccupancy[numHeld]++;
+    mDropHistogram[std::min(numDropped, kNumDropBuckets - 1)]++;
+    mNumDropped += numDropped;
+}
+
+void V4L2BufferScheduler::onStarved() {
+    mStarved = true;
+    mNumStarved++;
+}
+
+void V4L2BufferScheduler::onReturn(uint32_t index, nsecs_t now) {
+    if (index >= mDequeueTs.size() || mDequeueTs[index] == 0) {
+        return;
+    }
+    nsecs_t holdTime = now - mDequeueTs[index];
+    mDequeueTs[index] = 0;
+    mAvgHoldTime = (mAvgHoldTime == 0) ? holdTime : (mAvgHoldTime * 7 + holdTime) / 8;
+    mMaxHoldTime = std::max(mMaxHoldTime, holdTime);
+
+    uint32_t needed = getNeededCount();
+    mFramesUndersized = (needed > mCount) ? mFramesUndersized + 1 : 0;
+    // Leave one spare buffer so the queue doesn't flip between two sizes
+    mFramesOversized = (needed + 1 < mCount) ? mFramesOversized + 1 : 0;
+}
+
+uint32_t V4L2BufferScheduler::getNeededCount() const {
+    if (mFramePeriod == 0) {
+        return mCount;
+    }
+    // Buffers held by the HAL on average, plus the one the driver is filling
+    return static_cast<uint32_t>((mAvgHoldTime + mFramePeriod - 1) / mFramePeriod) + 1;
+}
+
+uint32_t V4L2BufferScheduler::getResizeCount(nsecs_t now) const {
+    if (mCount == 0 || now - mResetTs < kMinResizeInterval) {
+        return 0;
+    }
+    uint32_t needed = getNeededCount();
+    if ((mStarved || mFramesUndersized >= kGrowAfterFrames) && mCount < mMaxCount) {
+        return std::min(std::max(needed, mCount + 1), mMaxCount);
+    }
+    if (mFramesOversized >= kShrinkAfterFrames && mCount > mMinCount) {
+        return std::max(needed + 1, mMinCount);
+    }
+    return 0;
+}
+
+void V4L2BufferScheduler::dump(int fd) const {
+    dprintf(fd, "V4L2 buffer scheduler: %u buffers (%u to %u), %u needed,"
+            " hold time avg %.3f ms max %.3f ms, %" PRIu64 " reconfigurations\n",
+            mCount, mMinCount, mMaxCount, getNeededCount(),
+            ns2us(mAvgHoldTime) / 1000.0, ns2us(mMaxHoldTime) / 1000.0, mNumResets);
+    dprintf(fd, "  buffers held when dequeuing:");
+    for (size_t i = 0; i < mOccupancy.size(); i++) {
+        dprintf(fd, " %zu: %" PRIu64 ",", i, mOccupancy[i]);
+    }
+    dprintf(fd, " starved: %" PRIu64 "\n", mNumStarved);
+    dprintf(fd, "  stale frames dropped per dequeue:");
+    for (size_t i = 0; i < kNumDropBuckets; i++) {
+        dprintf(fd, " %zu%s: %" PRIu64 ",", i, (i + 1 == kNumDropBuckets) ? "+" : "",
+                mDropHistogram[i]);
+    }
+    dprintf(fd, " total: %" PRIu64 "\n", mNumDropped);
+}
+
 }  // namespace implementation
 }  // namespace V3_4
 }  // namespace device
@@ -164,6 +518,8 @@ namespace {
     const int kDefaultNumStillBuffer = 2;
     const int kDefaultOrientation = 0; // suitable for natural landscape displays like tablet/TV
                                        // For phone devices 270 is better
+    const int kDefaultResultBatchSize = 1;
+    const int kDefaultResultBatchLatencyMs = 20;
 } // anonymous namespace
 
 const char* ExternalCameraConfig::kDefaultCfgPath = "/vendor/etc/external_camera_config.xml";
@@ -284,10 +640,29 @@ ExternalCameraConfig ExternalCameraConfig::loadFromCfg(const char* cfgPath) {
         ret.orientation = orientation->IntAttribute("degree", /*Default*/kDefaultOrientation);
     }
 
+    XMLElement *passthrough = deviceCfg->FirstChildElement("UncompressedPassthrough");
+    if (passthrough == nullptr) {
+        ALOGI("%s: no uncompressed passthrough setting specified", __FUNCTION__);
+    } else {
+        ret.uncompressedPassthrough = passthrough->BoolAttribute("enabled", /*Default*/true);
+    }
+
+    XMLElement *resultBatch = deviceCfg->FirstChildElement("ResultBatch");
+    if (resultBatch == nullptr) {
+        ALOGI("%s: no result batch setting specified", __FUNCTION__);
+    } else {
+        ret.resultBatchSize =
+                resultBatch->UnsignedAttribute("size", /*Default*/kDefaultResultBatchSize);
+        ret.resultBatchLatencyMs = resultBatch->UnsignedAttribute(
+                "latencyMs", /*Default*/kDefaultResultBatchLatencyMs);
+    }
+
     ALOGI("%s: external camera cfg loaded: maxJpgBufSize %d,"
-            " num video buffers %d, num still buffers %d, orientation %d",
+            " num video buffers %d, num still buffers %d, orientation %d,"
+            " uncompressed passthrough %d, result batch %u frames / %ums",
             __FUNCTION__, ret.maxJpegBufSize,
-            ret.numVideoBuffers, ret.numStillBuffers, ret.orientation);
+            ret.numVideoBuffers, ret.numStillBuffers, ret.orientation,
+            ret.uncompressedPassthrough, ret.resultBatchSize, ret.resultBatchLatencyMs);
     for (const auto& limit : ret.fpsLimits) {
         ALOGI("%s: fpsLimitList: %dx%d@%f", __FUNCTION__,
                 limit.size.width, limit.size.height, limit.fpsUpperBound);
@@ -334,7 +709,10 @@ ExternalCameraConfig::ExternalCameraConfig() :
         numVideoBuffers(kDefaultNumVideoBuffer),
         numStillBuffers(kDefaultNumStillBuffer),
         depthEnabled(false),
-        orientation(kDefaultOrientation) {
+        orientation(kDefaultOrientation),
+        uncompressedPassthrough(true),
+        resultBatchSize(kDefaultResultBatchSize),
+        resultBatchLatencyMs(kDefaultResultBatchLatencyMs) {
     fpsLimits.push_back({/*Size*/{ 640,  480}, /*FPS upper bound*/30.0});
     fpsLimits.push_back({/*Size*/{1280,  720}, /*FPS upper bound*/7.5});
     fpsLimits.push_back({/*Size*/{1920, 1080}, /*FPS upper bound*/5.0});
@@ -23,8 +23,11 @@
 #include <hidl/MQDescriptor.h>
 #include <hidl/Status.h>
 #include <include/convert.h>
+#include <array>
+#include <atomic>
 #include <chrono>
 #include <condition_variable>
+#include <deque>
 #include <list>
 #include <unordered_map>
 #include <unordered_set>
@@ -66,6 +69,7 @@ using ::android::hardware::camera::device::V3_4::HalStreamConfiguration;
 using ::android::hardware::camera::device::V3_4::ICameraDeviceSession;
 using ::android::hardware::camera::common::V1_0::Status;
 using ::android::hardware::camera::common::V1_0::helper::HandleImporter;
+using ::android::hardware::camera::common::V1_0::helper::ExifApp1Writer;
 using ::android::hardware::camera::common::V1_0::helper::ExifUtils;
 using ::android::hardware::camera::external::common::ExternalCameraConfig;
 using ::android::hardware::camera::external::common::Size;
@@ -164,10 +168,13 @@ protected:
 
     struct HalRequest {
         uint32_t frameNumber;
-        common::V1_0::helper::CameraMetadata setting;
+        // Request settings with the static result entries filled in, see fillStaticCaptureResult.
+        // Shared by all requests until the app sends new settings.
+        std::shared_ptr<const common::V1_0::helper::CameraMetadata> setting;
         sp<V4L2Frame> frameIn;
         nsecs_t shutterTs;
         std::vector<HalStreamBuffer> buffers;
+        bool jpegPending = false; // BLOB buffer is returned separately once it's encoded
     };
 
     static const uint64_t BUFFER_ID_NO_BUFFER = 0;
@@ -183,6 +190,10 @@ protected:
 
     Status initStatus() const;
     status_t initDefaultRequests();
+    // Fills the result entries that don't change from frame to frame into request settings md,
+    // along with placeholders for the ones that do, so that fillCaptureResult only has to update
+    // existing entries of a copy of md.
+    status_t fillStaticCaptureResult(common::V1_0::helper::CameraMetadata& md);
     status_t fillCaptureResult(common::V1_0::helper::CameraMetadata& md, nsecs_t timestamp);
     Status configureStreams(const V3_2::StreamConfiguration&,
             V3_3::HalStreamConfiguration* out,
@@ -190,7 +201,13 @@ protected:
             uint32_t blobBufferSize = 0);
     // fps = 0.0 means default, which is
     // slowest fps that is at least 30, or fastest fps if 30 is not supported
-    int configureV4l2StreamLocked(const SupportedV4L2Format& fmt, double fps = 0.0);
+    // bufferCount = 0 means the count from ExternalCameraConfig for the fps
+    int configureV4l2StreamLocked(const SupportedV4L2Format& fmt, double fps = 0.0,
+            uint32_t bufferCount = 0);
+    // Looks for an uncompressed V4L2 format of the same size as MJPEG format fmt which supports
+    // all of its frame rates. OutputThread writes YUV outputs straight from such V4L2 frames.
+    bool findPassthroughFormatLocked(const SupportedV4L2Format& fmt,
+            /*out*/SupportedV4L2Format* passthroughFmt);
     int v4l2StreamOffLocked();
     int setV4l2FpsLocked(double fps);
     static Status isStreamCombinationSupported(const V3_2::StreamConfiguration& config,
@@ -237,11 +254,11 @@ protected:
     Status processOneCaptureRequest(const CaptureRequest& request);
 
     Status processCaptureResult(std::shared_ptr<HalRequest>&);
+    // Returns a buffer of a request whose metadata has already been sent by processCaptureResult
+    Status processCaptureResultBuffer(uint32_t frameNumber, HalStreamBuffer&);
     Status processCaptureRequestError(const std::shared_ptr<HalRequest>&);
     void notifyShutter(uint32_t frameNumber, nsecs_t shutterTs);
     void notifyError(uint32_t frameNumber, int32_t streamId, ErrorCode ec);
-    void invokeProcessCaptureResultCallback(
-            hidl_vec<CaptureResult> &results, bool tryWriteFmq);
     static void freeReleaseFences(hidl_vec<CaptureResult>&);
 
     Size getMaxJpegResolution() const;
@@ -250,6 +267,10 @@ protected:
     ssize_t getJpegBufferSize(uint32_t width, uint32_t height) const;
 
     int waitForV4L2BufferReturnLocked(std::unique_lock<std::mutex>& lk);
+    // Waits until all V4L2 buffers are returned, e.g. before the stream can be reconfigured
+    int waitForV4L2IdleLocked();
+    // Resizes the V4L2 buffer queue if mV4l2BufferScheduler asks for it. Called with mLock held
+    Status updateV4L2BufferCountLocked();
 
     class OutputThread : public android::Thread {
     public:
@@ -263,10 +284,14 @@ protected:
         Status submitRequest(const std::shared_ptr<HalRequest>&);
         void flush();
         void dump(int fd);
+        virtual status_t readyToRun() override;
         virtual bool threadLoop() override;
 
         void setExifMakeModel(const std::string& make, const std::string& model);
 
+        // JPEG captures being encoded, each holding its BLOB buffer until encoding finishes
+        static const size_t kMaxPendingJpegJobs = 2;
+
     protected:
         // Methods to request output buffer in parallel
         // No-op for device@3.4. Implemented in device@3.5
@@ -274,11 +299,6 @@ protected:
         virtual int waitForBufferRequestDone(
                 /*out*/std::vector<HalStreamBuffer>*) { return 0; }
 
-        static const uint32_t FLEX_YUV_GENERIC = static_cast<uint32_t>('F') |
-                static_cast<uint32_t>('L') << 8 | static_cast<uint32_t>('E') << 16 |
-                static_cast<uint32_t>('X') << 24;
-        // returns FLEX_YUV_GENERIC for formats other than YV12/YU12/NV12/NV21
-        static uint32_t getFourCcFromLayout(const YCbCrLayout&);
         static int getCropRect(
                 CroppingType ct, const Size& inSize, const Size& outSize, IMapper::Rect* out);
 
@@ -286,8 +306,73 @@ protected:
         static const int kReqWaitTimeoutMs = 33;   // 33ms
         static const int kReqWaitTimesMax = 90;    // 33ms * 90 ~= 3 sec
 
+        // Number of YU12 frames MJPEG frames are decoded into. DecodeThread decodes the next
+        // frame into one while OutputThread scales/converts the current one from another.
+        static const size_t kNumDecodeBuffers = 2;
+
+        // Decode stage of the pipeline: takes requests off mRequestList, decodes their V4L2
+        // frames and hands them to OutputThread through mDecodedList.
+        class DecodeThread : public android::Thread {
+        public:
+            DecodeThread(OutputThread* parent) : mParent(parent) {}
+            virtual bool threadLoop() override;
+        private:
+            OutputThread* const mParent; // OutputThread owns and joins this thread
+        };
+
+        struct Yu12Buffer {
+            sp<AllocatedFrame> frame;
+            YCbCrLayout layout;
+        };
+
+        struct DecodedRequest {
+            std::shared_ptr<HalRequest> req;
+            Yu12Buffer yu12;    // frame == nullptr if the input didn't need decoding
+            int decodeRes;      // non-zero if the MJPEG frame is malformed
+            nsecs_t startTs;    // when DecodeThread picked up the request
+            nsecs_t decodedTs;  // when the request was handed to OutputThread
+        };
+
+        enum Stage {
+            STAGE_DECODE = 0,     // MJPEG decode or uncompressed V4L2 frame to YU12 conversion
+            STAGE_QUEUE,          // decoded request waiting for OutputThread
+            STAGE_CROP_SCALE_CONVERT, // YUV outputs, done in one pass by YuvCropScaler
+            STAGE_PASSTHROUGH,    // YUV outputs written straight from uncompressed V4L2 frame
+            STAGE_JPEG,
+            STAGE_TOTAL,          // decode start to capture result sent
+            STAGE_COUNT
+        };
+
+        struct StageLatency {
+            uint64_t count = 0;
+            nsecs_t total = 0;
+            nsecs_t max = 0;
+            nsecs_t last = 0;
+        };
+
+        // How YUV output buffers of a stream are filled, counted per stream for dumpState
+        enum OutputPath {
+            PATH_YU12 = 0,            // cropped/scaled/converted from the intermediate YU12 frame
+            PATH_PASSTHROUGH_COPY,    // copied from the V4L2 frame, layouts match
+            PATH_PASSTHROUGH_CONVERT, // converted from the V4L2 frame
+            PATH_COUNT
+        };
+
+        bool decodeNextRequest();
         void waitForNextRequest(std::shared_ptr<HalRequest>* out);
+        void waitForNextDecodedRequest(std::shared_ptr<DecodedRequest>* out);
         void signalRequestDone();
+        void recordLatency(Stage stage, nsecs_t latency);
+        void dumpLatency(int fd);
+        void recordOutputPath(int streamId, OutputPath path);
+        void dumpOutputPaths(int fd);
+
+        // Converts an uncompressed V4L2 frame into mYu12Frame
+        int convertToYu12Locked(const uint8_t* inData, uint32_t fourcc);
+        // Writes an output of the V4L2 frame size straight from an uncompressed V4L2 frame.
+        // Returns -EINVAL without touching the output if its layout isn't supported.
+        int passthroughLocked(const uint8_t* inData, uint32_t fourcc, const Size& sz,
+                const YCbCrLayout& out, /*out*/OutputPath* path);
 
         int cropAndScaleLocked(
                 sp<AllocatedFrame>& in, const Size& outSize,
@@ -297,36 +382,118 @@ protected:
                 sp<AllocatedFrame>& in, const Size& outSize,
                 YCbCrLayout* out);
 
-        int formatConvertLocked(const YCbCrLayout& in, const YCbCrLayout& out,
-                Size sz, uint32_t format);
-
         static int encodeJpegYU12(const Size &inSz,
+                const YCbCrLayout& inLayout, int jpegQuality,
+                const void *app1Buffer, size_t app1Size,
+                void *out, size_t maxOutSize,
+                size_t &actualCodeSize,
+                uint32_t restartInterval = 0);
+
+        // Same as encodeJpegYU12, but encodes horizontal strips of the image on mJpegWorkers and
+        // joins them into one scan with restart markers. Only called from JpegThread.
+        int encodeJpegYU12Parallel(const Size &inSz,
                 const YCbCrLayout& inLayout, int jpegQuality,
                 const void *app1Buffer, size_t app1Size,
                 void *out, size_t maxOutSize,
                 size_t &actualCodeSize);
 
-        int createJpegLocked(HalStreamBuffer &halBuf, const std::shared_ptr<HalRequest>& req);
+        // JPEG encode stage: encodes main images of still captures and returns their BLOB
+        // buffers, so OutputThread can move on to the following (preview) requests meanwhile.
+        class JpegThread : public android::Thread {
+        public:
+            JpegThread(OutputThread* parent) : mParent(parent) {}
+            virtual bool threadLoop() override;
+        private:
+            OutputThread* const mParent; // OutputThread owns and joins this thread
+        };
+
+        struct JpegJob {
+            uint32_t frameNumber;
+            HalStreamBuffer buffer;
+            sp<AllocatedFrame> yu12;   // cropped and scaled main image
+            std::vector<uint8_t> app1; // EXIF data, including the thumbnail
+            int quality;
+            size_t maxCodeSize;
+            nsecs_t submitTs;
+        };
+
+        struct JpegCaptureStats {
+            uint32_t frameNumber;
+            Size size;
+            size_t codeSize;
+            nsecs_t queueTime;  // waiting for JpegThread
+            nsecs_t encodeTime;
+        };
+
+        static const size_t kMaxJpegWorkers = 4;
+        static const size_t kNumJpegCaptureStats = 8;
+
+        // Crops/scales the main image, generates EXIF and queues the encoding to JpegThread
+        int createJpegLocked(HalStreamBuffer &halBuf, const std::shared_ptr<HalRequest>& req,
+                /*out*/std::shared_ptr<JpegJob>* job);
+        // Waits until another JPEG job can be queued, returns false on timeout
+        bool waitForJpegJobSlot();
+        void submitJpegJob(const std::shared_ptr<JpegJob>& job);
+        bool encodeNextJpeg();
+        void encodeJpegJob(const std::shared_ptr<JpegJob>& job);
+        void flushJpegJobs(const sp<ExternalCameraDeviceSession>& parent);
+        // Returns the BLOB buffers of the jobs with error status
+        void failJpegJobs(const sp<ExternalCameraDeviceSession>& parent,
+                std::list<std::shared_ptr<JpegJob>>& jobs);
+        void waitForJpegJobsDone(const sp<ExternalCameraDeviceSession>& parent);
+        void dumpJpegStats(int fd);
 
         const wp<ExternalCameraDeviceSession> mParent;
         const CroppingType mCroppingType;
 
         mutable std::mutex mRequestListLock;      // Protect acccess to mRequestList,
-                                                  // mProcessingRequest and mProcessingFrameNumer
+                                                  // mDecodedList, mFreeYu12Buffers,
+                                                  // mProcessingRequest and mProcessingFrameNumer,
+                                                  // mDecodingRequest and mDecodingFrameNumber
         std::condition_variable mRequestCond;     // signaled when a new request is submitted
+        std::condition_variable mDecodedCond;     // signaled when a request is decoded
+        std::condition_variable mYu12FreeCond;    // signaled when a YU12 buffer is released
         std::condition_variable mRequestDoneCond; // signaled when a request is done processing
         std::list<std::shared_ptr<HalRequest>> mRequestList;
+        std::list<std::shared_ptr<DecodedRequest>> mDecodedList;
+        std::vector<Yu12Buffer> mFreeYu12Buffers;
         bool mProcessingRequest = false;
         uint32_t mProcessingFrameNumer = 0;
+        bool mDecodingRequest = false;
+        uint32_t mDecodingFrameNumber = 0;
+
+        sp<DecodeThread> mDecodeThread;
+        MjpegDecoder mMjpegDecoder; // Only used by DecodeThread
+
+        mutable std::mutex mJpegLock;          // Protect mJpegJobs, mEncodingJpeg,
+                                               // mEncodingJpegFrameNumber, mFreeJpegFrames
+                                               // and mJpegStats
+        std::condition_variable mJpegCond;     // signaled when a JPEG job is queued
+        std::condition_variable mJpegDoneCond; // signaled when a JPEG job is done
+        std::list<std::shared_ptr<JpegJob>> mJpegJobs;
+        bool mEncodingJpeg = false;
+        uint32_t mEncodingJpegFrameNumber = 0;
+        std::vector<sp<AllocatedFrame>> mFreeJpegFrames;
+        std::list<JpegCaptureStats> mJpegStats;
+
+        sp<JpegThread> mJpegThread;
+        WorkerPool mJpegWorkers;
+        std::vector<std::vector<uint8_t>> mJpegStripCode; // Only used by JpegThread
+
+        mutable std::mutex mLatencyLock; // Protect mLatency and mOutputPaths
+        StageLatency mLatency[STAGE_COUNT];
+        std::unordered_map<int, std::array<uint64_t, PATH_COUNT>> mOutputPaths; // by stream id
 
         // V4L2 frameIn
-        // (MJPG decode)-> mYu12Frame
-        // (Scale)-> mScaledYu12Frames
-        // (Format convert) -> output gralloc frames
+        // (MJPG decode, DecodeThread)-> one of mFreeYu12Buffers
+        // (swapped in by OutputThread)-> mYu12Frame
+        // (Crop, scale and format convert, mCropScalers) -> YUV output gralloc frames
+        // (Scale)-> mScaledYu12Frames (Encode) -> JPEG output gralloc frames
         mutable std::mutex mBufferLock; // Protect access to intermediate buffers
         sp<AllocatedFrame> mYu12Frame;
         sp<AllocatedFrame> mYu12ThumbFrame;
-        std::unordered_map<Size, sp<AllocatedFrame>, SizeHasher> mIntermediateBuffers;
+        std::unordered_map<Size, sp<AllocatedFrame>, SizeHasher> mIntermediateBuffers; // BLOB only
+        std::unordered_map<Size, YuvCropScaler, SizeHasher> mCropScalers;
         std::unordered_map<Size, sp<AllocatedFrame>, SizeHasher> mScaledYu12Frames;
         YCbCrLayout mYu12FrameLayout;
         YCbCrLayout mYu12ThumbFrameLayout;
@@ -334,6 +501,7 @@ protected:
 
         std::string mExifMake;
         std::string mExifModel;
+        std::unique_ptr<ExifApp1Writer> mExifWriter; // created on first JPEG capture
     };
 
     // Protect (most of) HIDL interface methods from synchronized-entering
@@ -359,17 +527,22 @@ protected:
     bool mInitialized = false;
     bool mInitFail = false;
     bool mFirstRequest = false;
-    common::V1_0::helper::CameraMetadata mLatestReqSetting;
+    std::shared_ptr<const common::V1_0::helper::CameraMetadata> mLatestReqSetting;
 
     bool mV4l2Streaming = false;
     SupportedV4L2Format mV4l2StreamingFmt;
     double mV4l2StreamingFps = 0.0;
     size_t mV4L2BufferCount = 0;
 
+    // Bounds of the V4L2 buffer count chosen by mV4l2BufferScheduler
+    static const uint32_t kMinV4L2BufferCount = 2;
+    static const uint32_t kMaxExtraV4L2Buffers = 2; // on top of the count from config
+
     static const int kBufferWaitTimeoutSec = 3; // TODO: handle long exposure (or not allowing)
-    std::mutex mV4l2BufferLock; // protect the buffer count and condition below
+    std::mutex mV4l2BufferLock; // protect the buffer count, scheduler and condition below
     std::condition_variable mV4L2BufferReturned;
     size_t mNumDequeuedV4l2Buffers = 0;
+    V4L2BufferScheduler mV4l2BufferScheduler;
     uint32_t mMaxV4L2BufferSize = 0;
 
     // Not protected by mLock (but might be used when mLock is locked)
@@ -395,6 +568,9 @@ protected:
     std::mutex mAfTriggerLock; // protect mAfTrigger
     bool mAfTrigger = false;
 
+    // Buffers of capture result metadata, which is built from HalRequest::setting
+    common::V1_0::helper::CameraMetadataPool mResultMetadataPool;
+
     static HandleImporter sHandleImporter;
 
     /* Beginning of members not changed after initialize() */
@@ -403,8 +579,68 @@ protected:
     using ResultMetadataQueue = MessageQueue<uint8_t, kSynchronizedReadWrite>;
     std::shared_ptr<ResultMetadataQueue> mResultMetadataQueue;
 
-    // Protect against invokeProcessCaptureResultCallback()
-    Mutex mProcessCaptureResultLock;
+    // Delivers shutter/error notifications and capture results to the framework. Those of
+    // consecutive frames are aggregated when ExternalCameraConfig::resultBatchSize > 1, so that
+    // a batch takes one notify and one processCaptureResult call instead of two or more calls per
+    // frame. The thread sends batches whose oldest frame has waited for the latency budget.
+    // Order is preserved, and notifications of a batch are sent before its results.
+    class ResultBatcher : public android::Thread {
+    public:
+        ResultBatcher(const sp<ICameraDeviceCallback>& callback,
+                const std::shared_ptr<ResultMetadataQueue>& resultMetadataQueue,
+                common::V1_0::helper::CameraMetadataPool* metadataPool,
+                uint32_t batchSize, nsecs_t latencyBudget);
+
+        bool isBatching() const { return mBatchSize > 1; }
+
+        void notify(const NotifyMsg& msg);
+        // If result.result isn't empty it must point into md. The buffer of md is returned to
+        // the metadata pool once the result is sent.
+        void processCaptureResult(CaptureResult&& result,
+                common::V1_0::helper::CameraMetadata* md = nullptr);
+        // Sends everything that is pending right away
+        void flush();
+        void dump(int fd);
+
+        virtual bool threadLoop() override;
+
+    private:
+        struct Batch {
+            std::vector<NotifyMsg> msgs;
+            std::vector<CaptureResult> results;
+            // Metadata buffers results point into
+            std::deque<common::V1_0::helper::CameraMetadata> mds;
+            nsecs_t startTs = 0; // when the first message or result was queued
+
+            bool empty() const { return msgs.empty() && results.empty(); }
+        };
+
+        void sendLocked(Batch& batch); // called with mSendLock held
+
+        static const int kIdleWaitTimeoutMs = 33;
+
+        const sp<ICameraDeviceCallback> mCallback;
+        const std::shared_ptr<ResultMetadataQueue> mResultMetadataQueue;
+        common::V1_0::helper::CameraMetadataPool* const mMetadataPool;
+        const uint32_t mBatchSize;
+        const nsecs_t mLatencyBudget;
+
+        std::mutex mLock;
+        std::condition_variable mBatchCond;
+        Batch mPending; // guarded by mLock
+
+        // Serializes sending of batches, so that they reach the framework in order
+        Mutex mSendLock;
+
+        // Binder calls made, for dump
+        std::atomic<uint64_t> mNotifyCalls{0};
+        std::atomic<uint64_t> mResultCalls{0};
+        std::atomic<uint64_t> mResultsSent{0};
+        // Values at the previous dump, to report call rate since then. Guarded by mLock
+        nsecs_t mLastDumpTs = 0;
+        uint64_t mLastDumpCalls = 0;
+    };
+    sp<ResultBatcher> mResultBatcher;
 
     std::unordered_map<RequestTemplate, CameraMetadata> mDefaultRequests;
 
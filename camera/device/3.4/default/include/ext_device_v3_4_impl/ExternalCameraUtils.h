@@ -19,11 +19,20 @@
 
 #include <android/hardware/graphics/mapper/2.0/IMapper.h>
 #include <inttypes.h>
+#include <condition_variable>
+#include <functional>
+#include <memory>
 #include <mutex>
+#include <thread>
 #include <unordered_set>
 #include <vector>
 #include "tinyxml2.h"  // XML parsing
 #include "utils/LightRefBase.h"
+#include "utils/Timers.h"
+
+namespace libyuv {
+class MJpegDecoder;
+}
 
 using android::hardware::graphics::mapper::V2_0::IMapper;
 using android::hardware::graphics::mapper::V2_0::YCbCrLayout;
@@ -88,6 +97,16 @@ struct ExternalCameraConfig {
     // The value of android.sensor.orientation
     int32_t orientation;
 
+    // Stream uncompressed YUYV/NV12 instead of MJPEG when the device can do so at the same size
+    // and frame rates, so YUV outputs don't need MJPEG decoding
+    bool uncompressedPassthrough;
+
+    // Shutter notifications and capture results of up to resultBatchSize consecutive frames are
+    // sent to the framework with one notify and one processCaptureResult call. A frame waits at
+    // most resultBatchLatencyMs for its batch to fill up. Batch size 1 sends every frame right away
+    uint32_t resultBatchSize;
+    uint32_t resultBatchLatencyMs;
+
 private:
     ExternalCameraConfig();
     static bool updateFpsList(tinyxml2::XMLElement* fpsList, std::vector<FpsLimitation>& fpsLimits);
@@ -152,6 +171,106 @@ private:
     std::vector<uint8_t> mData;
 };
 
+// Decodes MJPEG frames into YU12. Unlike libyuv::MJPGToI420, which sets up a new libjpeg
+// decompressor for every frame, the decompressor and its scanline buffers are kept alive and
+// reused as long as the frame geometry doesn't change. Not thread safe.
+class MjpegDecoder {
+public:
+    MjpegDecoder();
+    ~MjpegDecoder();
+    // Returns 0 on success, non-zero if the frame is malformed, of a different size than
+    // width x height, or uses a chroma subsampling that cannot be converted to YU12.
+    int decode(const uint8_t* data, size_t dataSize,
+               uint32_t width, uint32_t height, const YCbCrLayout& out);
+private:
+    std::unique_ptr<libyuv::MJpegDecoder> mDecoder;
+};
+
+// Crops, scales and converts YU12 frames into a YUV420 buffer of any layout (planar, semi-planar
+// or other chroma step). Unscaled outputs are cropped and converted in a single pass. Scaled
+// outputs use libyuv I420Scale with kFilterNone, like JPEG captures, directly into planar buffers
+// and through a cached intermediate frame for other layouts. Not thread safe.
+class YuvCropScaler {
+public:
+    // crop must be within the input frame, crop and output dimensions must be even
+    int convert(const YCbCrLayout& in, const IMapper::Rect& crop,
+                const YCbCrLayout& out, uint32_t outWidth, uint32_t outHeight);
+private:
+    std::vector<uint8_t> mScaledFrame; // YU12, for scaled outputs that are not planar
+};
+
+// Fixed size pool of threads used to spread CPU heavy work of a single frame, e.g. encoding
+// strips of a JPEG image, over multiple cores.
+class WorkerPool {
+public:
+    // numThreads includes the thread calling runAll, which works on the tasks too
+    explicit WorkerPool(size_t numThreads);
+    ~WorkerPool();
+    size_t size() const { return mWorkers.size() + 1; }
+    // Runs all tasks and returns once every one of them is done. Not reentrant.
+    void runAll(const std::vector<std::function<void()>>& tasks);
+private:
+    void workerLoop();
+    bool runNextTaskLocked(std::unique_lock<std::mutex>& lk);
+
+    std::mutex mLock;
+    std::condition_variable mTaskCond; // signaled when tasks are submitted or pool is destroyed
+    std::condition_variable mDoneCond; // signaled when the last task is done
+    const std::vector<std::function<void()>>* mTasks = nullptr;
+    size_t mNextTask = 0;
+    size_t mTasksDone = 0;
+    bool mExiting = false;
+    std::vector<std::thread> mWorkers;
+};
+
+// Sizes the V4L2 buffer queue from how long the HAL holds dequeued buffers and keeps statistics
+// of the queue for dumpState. To always leave the driver a buffer to fill, about
+// hold time * fps + 1 buffers are needed. The queue grows soon after that's not the case, and
+// shrinks only once it has been oversized for a while, since every resize restarts the stream.
+// Not thread safe.
+class V4L2BufferScheduler {
+public:
+    // Starts over with a stream of count buffers, which may be resized within
+    // [minCount, maxCount]. Statistics are kept.
+    void reset(uint32_t count, uint32_t minCount, uint32_t maxCount, double fps, nsecs_t now);
+    // Buffer index was dequeued while numHeld other buffers were held by the HAL, after
+    // numDropped stale frames were put back to the queue
+    void onDequeue(uint32_t index, size_t numHeld, size_t numDropped, nsecs_t now);
+    // A frame was needed while the HAL held every buffer
+    void onStarved();
+    void onReturn(uint32_t index, nsecs_t now);
+    // Returns the count the queue should be resized to, 0 to keep the current one
+    uint32_t getResizeCount(nsecs_t now) const;
+    uint32_t getMaxCount() const { return mMaxCount; }
+    void dump(int fd) const;
+
+private:
+    static const uint32_t kGrowAfterFrames = 8;     // consecutive frames held for too long
+    static const uint32_t kShrinkAfterFrames = 300; // ~10s at 30fps
+    static const nsecs_t kMinResizeInterval = 2000000000LL; // 2s
+    static const size_t kNumDropBuckets = 4;        // 0, 1, 2, 3+ frames dropped
+
+    uint32_t getNeededCount() const;
+
+    uint32_t mCount = 0;
+    uint32_t mMinCount = 0;
+    uint32_t mMaxCount = 0;
+    nsecs_t mFramePeriod = 0;
+    nsecs_t mResetTs = 0;
+    std::vector<nsecs_t> mDequeueTs; // by buffer index, 0 if the buffer is queued
+    nsecs_t mAvgHoldTime = 0;        // moving average, kept across resets
+    nsecs_t mMaxHoldTime = 0;
+    bool mStarved = false;
+    uint32_t mFramesUndersized = 0;
+    uint32_t mFramesOversized = 0;
+
+    std::vector<uint64_t> mOccupancy; // dequeues by number of buffers already held
+    uint64_t mDropHistogram[kNumDropBuckets] = {}; // dequeues by number of frames dropped
+    uint64_t mNumDropped = 0;
+    uint64_t mNumStarved = 0;
+    uint64_t mNumResets = 0;
+};
+
 enum CroppingType {
     HORIZONTAL = 0,
     VERTICAL = 1
@@ -0,0 +1,189 @@
+/*
+ * Copyright (C) 2018 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <cstring>
+#include <vector>
+
+#include <benchmark/benchmark.h>
+#include <libyuv.h>
+
+#include "ExternalCameraUtils.h"
+
+namespace android {
+namespace hardware {
+namespace camera {
+namespace device {
+namespace V3_4 {
+namespace implementation {
+
+namespace {
+
+enum OutputFormat {
+    FORMAT_YV12 = 0,
+    FORMAT_NV21,
+};
+
+// Common USB webcam capture sizes and the stream sizes apps configure for them. Output aspect
+// ratio differs from the input in some cases, which exercises cropping.
+const int kSizes[][4] = {
+    {640, 480, 320, 240},
+    {640, 480, 640, 480},
+    {1280, 720, 640, 480},
+    {1280, 720, 1280, 720},
+    {1920, 1080, 1280, 720},
+    {1920, 1080, 640, 480},
+    {2592, 1944, 1920, 1080},
+    {1280, 960, 960, 720},
+    {2560, 1920, 960, 720},
+};
+
+struct YuvBuffer {
+    YuvBuffer(uint32_t width, uint32_t height, OutputFormat format)
+            : data(width * height * 3 / 2) {
+        // Not uniform, so that sampling a different pixel changes the output
+        for (size_t i = 0; i < data.size(); i++) {
+            data[i] = static_cast<uint8_t>(i * 7 + i / width);
+        }
+        uint8_t* chroma = data.data() + width * height;
+        layout.y = data.data();
+        layout.yStride = width;
+        if (format == FORMAT_NV21) {
+            layout.cr = chroma;
+            layout.cb = chroma + 1;
+            layout.cStride = width;
+            layout.chromaStep = 2;
+        } else {
+            layout.cr = chroma;
+            layout.cb = chroma + width * height / 4;
+            layout.cStride = width / 2;
+            layout.chromaStep = 1;
+        }
+    }
+
+    std::vector<uint8_t> data;
+    YCbCrLayout layout;
+};
+
+// Centered crop, like OutputThread::getCropRect
+IMapper::Rect centerCrop(uint32_t inW, uint32_t inH, uint32_t outW, uint32_t outH) {
+    uint32_t cropW = inW;
+    uint32_t cropH = (static_cast<uint64_t>(outH) * inW / outW) & ~0x1;
+    if (cropH > inH) {
+        cropW = (static_cast<uint64_t>(outW) * inH / outH) & ~0x1;
+        cropH = inH;
+    }
+    return {static_cast<int32_t>((inW - cropW) / 2 & ~0x1),
+            static_cast<int32_t>((inH - cropH) / 2 & ~0x1),
+            static_cast<int32_t>(cropW), static_cast<int32_t>(cropH)};
+}
+
+// Previous implementation: I420Scale into an intermediate YU12 frame followed by a format
+// conversion pass into the output buffer.
+void twoPass(const YuvBuffer& in, const IMapper::Rect& crop, YuvBuffer& scaled, YuvBuffer& out,
+        const int* sz, OutputFormat format) {
+    const size_t cOffset = crop.top / 2 * in.layout.cStride + crop.left / 2;
+    libyuv::I420Scale(
+            static_cast<uint8_t*>(in.layout.y) + crop.top * in.layout.yStride + crop.left,
+            in.layout.yStride,
+            static_cast<uint8_t*>(in.layout.cb) + cOffset, in.layout.cStride,
+            static_cast<uint8_t*>(in.layout.cr) + cOffset, in.layout.cStride,
+            crop.width, crop.height,
+            static_cast<uint8_t*>(scaled.layout.y), scaled.layout.yStride,
+            static_cast<uint8_t*>(scaled.layout.cb), scaled.layout.cStride,
+            static_cast<uint8_t*>(scaled.layout.cr), scaled.layout.cStride,
+            sz[2], sz[3], libyuv::FilterMode::kFilterNone);
+    if (format == FORMAT_NV21) {
+        libyuv::I420ToNV21(
+                static_cast<uint8_t*>(scaled.layout.y), scaled.layout.yStride,
+                static_cast<uint8_t*>(scaled.layout.cb), scaled.layout.cStride,
+                static_cast<uint8_t*>(scaled.layout.cr), scaled.layout.cStride,
+                static_cast<uint8_t*>(out.layout.y), out.layout.yStride,
+                static_cast<uint8_t*>(out.layout.cr), out.layout.cStride,
+                sz[2], sz[3]);
+    } else {
+        libyuv::I420Copy(
+                static_cast<uint8_t*>(scaled.layout.y), scaled.layout.yStride,
+                static_cast<uint8_t*>(scaled.layout.cb), scaled.layout.cStride,
+                static_cast<uint8_t*>(scaled.layout.cr), scaled.layout.cStride,
+                static_cast<uint8_t*>(out.layout.y), out.layout.yStride,
+                static_cast<uint8_t*>(out.layout.cb), out.layout.cStride,
+                static_cast<uint8_t*>(out.layout.cr), out.layout.cStride,
+                sz[2], sz[3]);
+    }
+}
+
+void BM_TwoPass(benchmark::State& state) {
+    const int* sz = kSizes[state.range(0)];
+    const OutputFormat format = static_cast<OutputFormat>(state.range(1));
+    YuvBuffer in(sz[0], sz[1], FORMAT_YV12);
+    YuvBuffer scaled(sz[2], sz[3], FORMAT_YV12);
+    YuvBuffer out(sz[2], sz[3], format);
+    const IMapper::Rect crop = centerCrop(sz[0], sz[1], sz[2], sz[3]);
+
+    for (auto _ : state) {
+        twoPass(in, crop, scaled, out, sz, format);
+        benchmark::ClobberMemory();
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+
+void BM_YuvCropScaler(benchmark::State& state) {
+    const int* sz = kSizes[state.range(0)];
+    const OutputFormat format = static_cast<OutputFormat>(state.range(1));
+    YuvBuffer in(sz[0], sz[1], FORMAT_YV12);
+    YuvBuffer out(sz[2], sz[3], format);
+    const IMapper::Rect crop = centerCrop(sz[0], sz[1], sz[2], sz[3]);
+
+    // JPEG captures still go through I420Scale, so YUV outputs must match it
+    YuvBuffer scaled(sz[2], sz[3], FORMAT_YV12);
+    YuvBuffer expected(sz[2], sz[3], format);
+    twoPass(in, crop, scaled, expected, sz, format);
+
+    YuvCropScaler scaler;
+    if (scaler.convert(in.layout, crop, out.layout, sz[2], sz[3]) != 0 ||
+            memcmp(out.data.data(), expected.data.data(), out.data.size()) != 0) {
+        state.SkipWithError("YuvCropScaler output differs from libyuv");
+        return;
+    }
+    for (auto _ : state) {
+        if (scaler.convert(in.layout, crop, out.layout, sz[2], sz[3]) != 0) {
+            state.SkipWithError("YuvCropScaler::convert failed");
+            break;
+        }
+        benchmark::ClobberMemory();
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+
+void sizeAndFormatArgs(benchmark::internal::Benchmark* b) {
+    for (size_t i = 0; i < sizeof(kSizes) / sizeof(kSizes[0]); i++) {
+        b->Args({static_cast<int>(i), FORMAT_YV12});
+        b->Args({static_cast<int>(i), FORMAT_NV21});
+    }
+}
+BENCHMARK(BM_TwoPass)->Apply(sizeAndFormatArgs);
+BENCHMARK(BM_YuvCropScaler)->Apply(sizeAndFormatArgs);
+
+}  // anonymous namespace
+
+}  // namespace implementation
+}  // namespace V3_4
+}  // namespace device
+}  // namespace camera
+}  // namespace hardware
+}  // namespace android
+
+BENCHMARK_MAIN();
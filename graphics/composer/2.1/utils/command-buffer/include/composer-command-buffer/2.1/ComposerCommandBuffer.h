@@ -52,18 +52,32 @@ using CommandQueueType = MessageQueue<uint32_t, kSynchronizedReadWrite>;
 
 // This class helps build a command queue.  Note that all sizes/lengths are in
 // units of uint32_t's.
+//
+// Once the message queue exists, commands are encoded directly into its
+// shared memory whenever the free space following the write pointer can hold
+// them, and writeQueue only has to commit them.  Otherwise they are encoded
+// into a local buffer and copied into the queue by writeQueue.
 class CommandWriterBase {
    public:
     CommandWriterBase(uint32_t initialMaxSize) : mDataMaxSize(initialMaxSize) {
-        mData = std::make_unique<uint32_t[]>(mDataMaxSize);
+        mDataStorage = std::make_unique<uint32_t[]>(mDataMaxSize);
         reset();
     }
 
     virtual ~CommandWriterBase() { reset(); }
 
+    // Lets surface damage and visible regions that don't fit in a command be
+    // split into continued commands, see writeRegionCommands.  A reader that
+    // doesn't know about continuations takes every command as the whole
+    // region, and IComposer 2.1 has no way to advertise support, so this must
+    // only be enabled for readers known to handle them.  Otherwise such
+    // regions are replaced by the entire layer.
+    void setRegionContinuationsEnabled(bool enabled) { mRegionContinuationsEnabled = enabled; }
+
     void reset() {
         mDataWritten = 0;
         mCommandEnd = 0;
+        useDataStorage();
 
         // handles in mDataHandles are owned by the caller
         mDataHandles.clear();
@@ -91,26 +105,24 @@ class CommandWriterBase {
             return true;
         }
 
-        // After data are written to the queue, it may not be read by the
-        // remote reader when
-        //
-        //  - the writer does not send them (because of other errors)
-        //  - the hwbinder transaction fails
-        //  - the reader does not read them (because of other errors)
-        //
-        // Discard the stale data here.
-        size_t staleDataSize = mQueue ? mQueue->availableToRead() : 0;
-        if (staleDataSize > 0) {
-            ALOGW("discarding stale data from message queue");
-            CommandQueueType::MemTransaction tx;
-            if (mQueue->beginRead(staleDataSize, &tx)) {
-                mQueue->commitRead(staleDataSize);
-            }
+        // the commands are written again without reset
+        if (mDataCommitted) {
+            moveDataToStorage(mDataWritten);
         }
 
-        // write data to queue, optionally resizing it
-        if (mQueue && (mDataMaxSize <= mQueue->getQuantumCount())) {
-            if (!mQueue->write(mData.get(), mDataWritten)) {
+        if (mDataInQueue) {
+            // commands were encoded in place, see mapQueue
+            if (!mQueue->commitWrite(mDataWritten)) {
+                ALOGE("failed to commit commands to message queue");
+                return false;
+            }
+
+            mDataCommitted = true;
+            *outQueueChanged = false;
+        } else if (mQueue && (mDataMaxSize <= mQueue->getQuantumCount())) {
+            // write data to queue, optionally resizing it
+            discardStaleData();
+            if (!mQueue->write(mData, mDataWritten)) {
                 ALOGE("failed to write commands to message queue");
                 return false;
             }
@@ -118,7 +130,7 @@ class CommandWriterBase {
             *outQueueChanged = false;
         } else {
             auto newQueue = std::make_unique<CommandQueueType>(mDataMaxSize);
-            if (!newQueue->isValid() || !newQueue->write(mData.get(), mDataWritten)) {
+            if (!newQueue->isValid() || !newQueue->write(mData, mDataWritten)) {
                 ALOGE("failed to prepare a new message queue ");
                 return false;
             }
@@ -238,9 +250,9 @@ class CommandWriterBase {
     static constexpr uint16_t kSetColorTransformLength = 17;
     void setColorTransform(const float* matrix, ColorTransform hint) {
         beginCommand(IComposerClient::Command::SET_COLOR_TRANSFORM, kSetColorTransformLength);
-        for (int i = 0; i < 16; i++) {
-            writeFloat(matrix[i]);
-        }
+        static_assert(sizeof(float) == sizeof(uint32_t), "unexpected float size");
+        memcpy(&mData[mDataWritten], matrix, 16 * sizeof(float));
+        mDataWritten += 16;
         writeSigned(static_cast<int32_t>(hint));
         endCommand();
     }
@@ -303,18 +315,16 @@ class CommandWriterBase {
         endCommand();
     }
 
-    void setLayerSurfaceDamage(const std::vector<IComposerClient::Rect>& damage) {
-        bool doWrite = (damage.size() <= kMaxLength / 4);
-        size_t length = (doWrite) ? damage.size() * 4 : 0;
+    // When region continuations are enabled, a region with more rectangles
+    // than fit in a command is split.  Every command but the last one holds
+    // kMaxRegionChunkRects rectangles followed by the number of rectangles
+    // still to come, so its length is kRegionContinuationLength, which is not
+    // a multiple of 4.  The last command is a plain region command.
+    static constexpr uint16_t kMaxRegionChunkRects = (std::numeric_limits<uint16_t>::max() - 1) / 4;
+    static constexpr uint16_t kRegionContinuationLength = kMaxRegionChunkRects * 4 + 1;
 
-        beginCommand(IComposerClient::Command::SET_LAYER_SURFACE_DAMAGE, length);
-        // When there are too many rectangles in the damage region and doWrite
-        // is false, we write no rectangle at all which means the entire
-        // layer is damaged.
-        if (doWrite) {
-            writeRegion(damage);
-        }
-        endCommand();
+    void setLayerSurfaceDamage(const std::vector<IComposerClient::Rect>& damage) {
+        writeRegionCommands(IComposerClient::Command::SET_LAYER_SURFACE_DAMAGE, damage);
     }
 
     static constexpr uint16_t kSetLayerBlendModeLength = 1;
@@ -382,17 +392,7 @@ class CommandWriterBase {
     }
 
     void setLayerVisibleRegion(const std::vector<IComposerClient::Rect>& visible) {
-        bool doWrite = (visible.size() <= kMaxLength / 4);
-        size_t length = (doWrite) ? visible.size() * 4 : 0;
-
-        beginCommand(IComposerClient::Command::SET_LAYER_VISIBLE_REGION, length);
-        // When there are too many rectangles in the visible region and
-        // doWrite is false, we write no rectangle at all which means the
-        // entire layer is visible.
-        if (doWrite) {
-            writeRegion(visible);
-        }
-        endCommand();
+        writeRegionCommands(IComposerClient::Command::SET_LAYER_VISIBLE_REGION, visible);
     }
 
     static constexpr uint16_t kSetLayerZOrderLength = 1;
@@ -423,6 +423,32 @@ class CommandWriterBase {
         endCommand();
     }
 
+    void writeRegionCommands(IComposerClient::Command command,
+                             const std::vector<IComposerClient::Rect>& region) {
+        if (region.size() > kMaxLength / 4 && !mRegionContinuationsEnabled) {
+            // When there are too many rectangles in the region, we write no
+            // rectangle at all which means the entire layer.
+            beginCommand(command, 0);
+            endCommand();
+            return;
+        }
+
+        size_t written = 0;
+        size_t remaining = region.size();
+        while (remaining > kMaxLength / 4) {
+            beginCommand(command, kRegionContinuationLength);
+            writeRegion(region.data() + written, kMaxRegionChunkRects);
+            written += kMaxRegionChunkRects;
+            remaining -= kMaxRegionChunkRects;
+            write(static_cast<uint32_t>(remaining));
+            endCommand();
+        }
+
+        beginCommand(command, remaining * 4);
+        writeRegion(region.data() + written, remaining);
+        endCommand();
+    }
+
     void setLayerDataspaceInternal(int32_t dataspace) {
         beginCommand(IComposerClient::Command::SET_LAYER_DATASPACE, kSetLayerDataspaceLength);
         writeSigned(dataspace);
@@ -477,8 +503,16 @@ class CommandWriterBase {
     }
 
     void writeRegion(const std::vector<IComposerClient::Rect>& region) {
-        for (const auto& rect : region) {
-            writeRect(rect);
+        writeRegion(region.data(), region.size());
+    }
+
+    // IComposerClient::Rect is laid out exactly like its encoding
+    void writeRegion(const IComposerClient::Rect* rects, size_t count) {
+        static_assert(sizeof(IComposerClient::Rect) == 4 * sizeof(uint32_t),
+                      "unexpected IComposerClient::Rect layout");
+        if (count > 0) {
+            memcpy(&mData[mDataWritten], rects, count * sizeof(IComposerClient::Rect));
+            mDataWritten += count * 4;
         }
     }
 
@@ -534,33 +568,103 @@ class CommandWriterBase {
 
     static constexpr uint16_t kMaxLength = std::numeric_limits<uint16_t>::max();
 
-    std::unique_ptr<uint32_t[]> mData;
+    // points either into mQueue or at mDataStorage
+    uint32_t* mData;
     uint32_t mDataWritten;
 
    private:
     void growData(uint32_t grow) {
+        if (mDataWritten == 0 && !mDataInQueue) {
+            mapQueue();
+        } else if (mDataCommitted) {
+            moveDataToStorage(mDataWritten);
+        }
+
         uint32_t newWritten = mDataWritten + grow;
         if (newWritten < mDataWritten) {
             LOG_ALWAYS_FATAL("buffer overflowed; data written %" PRIu32 ", growing by %" PRIu32,
                              mDataWritten, grow);
         }
 
-        if (newWritten <= mDataMaxSize) {
+        if (newWritten > mDataCapacity) {
+            moveDataToStorage(newWritten);
+        }
+    }
+
+    // Starts a batch of commands in the free space of the queue.  Only the
+    // contiguous part is used; should the batch outgrow it, it is moved to
+    // mDataStorage.
+    void mapQueue() {
+        if (!mQueue) {
+            return;
+        }
+
+        discardStaleData();
+
+        CommandQueueType::MemTransaction tx;
+        size_t available = mQueue->availableToWrite();
+        if (available == 0 || !mQueue->beginWrite(available, &tx)) {
             return;
         }
 
-        uint32_t newMaxSize = mDataMaxSize << 1;
-        if (newMaxSize < newWritten) {
-            newMaxSize = newWritten;
+        const auto& region = tx.getFirstRegion();
+        mData = region.getAddress();
+        mDataCapacity = static_cast<uint32_t>(region.getLength());
+        mDataInQueue = true;
+    }
+
+    void moveDataToStorage(uint32_t minSize) {
+        if (mDataMaxSize < minSize) {
+            uint32_t newMaxSize = mDataMaxSize << 1;
+            if (newMaxSize < minSize) {
+                newMaxSize = minSize;
+            }
+
+            auto newData = std::make_unique<uint32_t[]>(newMaxSize);
+            std::copy_n(mData, mDataWritten, newData.get());
+            mDataMaxSize = newMaxSize;
+            mDataStorage = std::move(newData);
+        } else if (mData != mDataStorage.get()) {
+            std::copy_n(mData, mDataWritten, mDataStorage.get());
         }
 
-        auto newData = std::make_unique<uint32_t[]>(newMaxSize);
-        std::copy_n(mData.get(), mDataWritten, newData.get());
-        mDataMaxSize = newMaxSize;
-        mData = std::move(newData);
+        useDataStorage();
+    }
+
+    void useDataStorage() {
+        mData = mDataStorage.get();
+        mDataCapacity = mDataMaxSize;
+        mDataInQueue = false;
+        mDataCommitted = false;
     }
 
+    // After data are written to the queue, it may not be read by the
+    // remote reader when
+    //
+    //  - the writer does not send them (because of other errors)
+    //  - the hwbinder transaction fails
+    //  - the reader does not read them (because of other errors)
+    //
+    // Discard the stale data here.
+    void discardStaleData() {
+        size_t staleDataSize = mQueue ? mQueue->availableToRead() : 0;
+        if (staleDataSize > 0) {
+            ALOGW("discarding stale data from message queue");
+            CommandQueueType::MemTransaction tx;
+            if (mQueue->beginRead(staleDataSize, &tx)) {
+                mQueue->commitRead(staleDataSize);
+            }
+        }
+    }
+
+    std::unique_ptr<uint32_t[]> mDataStorage;
     uint32_t mDataMaxSize;
+    // size of the buffer mData points at
+    uint32_t mDataCapacity;
+    // whether mData points into mQueue, and whether it has been committed
+    bool mDataInQueue = false;
+    bool mDataCommitted = false;
+    bool mRegionContinuationsEnabled = false;
     // end offset of the current command
     uint32_t mCommandEnd;
 
@@ -623,6 +727,9 @@ class CommandReaderBase {
    protected:
     bool isEmpty() const { return (mDataRead >= mDataSize); }
 
+    // Number of words left to read in the command buffer
+    uint32_t getUnreadSize() const { return mDataRead < mDataSize ? mDataSize - mDataRead : 0; }
+
     bool beginCommand(IComposerClient::Command* outCommand, uint16_t* outLength) {
         if (mCommandEnd) {
             LOG_FATAL("endCommand was not called for last command");
@@ -664,6 +771,29 @@ class CommandReaderBase {
         mCommandEnd = 0;
     }
 
+    // Moves on to the next command when the current one has been read
+    // completely and the next one has the same opcode.  Used after a region
+    // command that announces rectangles to come, see
+    // CommandWriterBase::writeRegionCommands.
+    bool beginContinuation(IComposerClient::Command command, uint16_t* outLength) {
+        if (mDataRead != mCommandEnd || isEmpty()) {
+            return false;
+        }
+
+        constexpr uint32_t opcode_mask =
+            static_cast<uint32_t>(IComposerClient::Command::OPCODE_MASK);
+        constexpr uint32_t length_mask =
+            static_cast<uint32_t>(IComposerClient::Command::LENGTH_MASK);
+        uint32_t val = mData[mDataRead];
+        if ((val & opcode_mask) != static_cast<uint32_t>(command) ||
+            mDataRead + 1 + (val & length_mask) > mDataSize) {
+            return false;
+        }
+
+        endCommand();
+        return beginCommand(&command, outLength);
+    }
+
     uint32_t getCommandLoc() const { return mCommandBegin; }
 
     uint32_t read() { return mData[mDataRead++]; }
@@ -0,0 +1,130 @@
+/*
+ * Copyright 2018 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "ComposerCommandBufferBenchmark"
+
+#include <vector>
+
+#include <benchmark/benchmark.h>
+#include <composer-command-buffer/2.1/ComposerCommandBuffer.h>
+
+namespace android {
+namespace hardware {
+namespace graphics {
+namespace composer {
+namespace V2_1 {
+
+namespace {
+
+// Drains the queue like the composer service does before executing commands.
+class QueueDrain : public CommandReaderBase {
+   public:
+    bool drain(const CommandWriterBase& writer, bool queueChanged, uint32_t length,
+               const hidl_vec<hidl_handle>& handles) {
+        if (queueChanged && !setMQDescriptor(*writer.getMQDescriptor())) {
+            return false;
+        }
+        bool ok = readQueue(length, handles);
+        reset();
+        return ok;
+    }
+};
+
+std::vector<IComposerClient::Rect> makeRegion(int rectCount) {
+    std::vector<IComposerClient::Rect> region;
+    region.reserve(rectCount);
+    for (int i = 0; i < rectCount; i++) {
+        region.push_back({0, i, 1080, i + 1});
+    }
+    return region;
+}
+
+// Encodes the geometry SurfaceFlinger sends for a layer stack, transfers it
+// through the message queue and reports encoded bytes per second.
+void BM_EncodeFrame(benchmark::State& state) {
+    const int layerCount = state.range(0);
+    const std::vector<IComposerClient::Rect> visible = makeRegion(4);
+
+    CommandWriterBase writer(1024);
+    QueueDrain reader;
+    bool queueChanged;
+    uint32_t length;
+    hidl_vec<hidl_handle> handles;
+    uint64_t bytes = 0;
+    for (auto _ : state) {
+        writer.selectDisplay(1);
+        for (int i = 0; i < layerCount; i++) {
+            writer.selectLayer(i + 1);
+            writer.setLayerCompositionType(IComposerClient::Composition::DEVICE);
+            writer.setLayerDisplayFrame({0, 100 * i, 1080, 100 * i + 400});
+            writer.setLayerSourceCrop({0.0f, 0.0f, 1080.0f, 400.0f});
+            writer.setLayerZOrder(i);
+            writer.setLayerBlendMode(IComposerClient::BlendMode::PREMULTIPLIED);
+            writer.setLayerPlaneAlpha(1.0f);
+            writer.setLayerDataspace(Dataspace::V0_SRGB);
+            writer.setLayerVisibleRegion(visible);
+            writer.setLayerSurfaceDamage(visible);
+        }
+        writer.validateDisplay();
+
+        if (!writer.writeQueue(&queueChanged, &length, &handles) ||
+            !reader.drain(writer, queueChanged, length, handles)) {
+            state.SkipWithError("failed to transfer commands");
+            break;
+        }
+        writer.reset();
+        bytes += length * sizeof(uint32_t);
+    }
+    state.SetBytesProcessed(bytes);
+}
+BENCHMARK(BM_EncodeFrame)->Arg(4)->Arg(16)->Arg(64);
+
+// Large regions exceed a single command and are split into continuations.
+void BM_EncodeRegion(benchmark::State& state) {
+    const std::vector<IComposerClient::Rect> region = makeRegion(state.range(0));
+
+    CommandWriterBase writer(1024);
+    writer.setRegionContinuationsEnabled(true);
+    QueueDrain reader;
+    bool queueChanged;
+    uint32_t length;
+    hidl_vec<hidl_handle> handles;
+    uint64_t bytes = 0;
+    for (auto _ : state) {
+        writer.selectLayer(1);
+        writer.setLayerVisibleRegion(region);
+
+        if (!writer.writeQueue(&queueChanged, &length, &handles) ||
+            !reader.drain(writer, queueChanged, length, handles)) {
+            state.SkipWithError("failed to transfer commands");
+            break;
+        }
+        writer.reset();
+        bytes += length * sizeof(uint32_t);
+    }
+    state.SetBytesProcessed(bytes);
+}
+BENCHMARK(BM_EncodeRegion)->Arg(16)->Arg(1024)->Arg(40000);
+
+}  // anonymous namespace
+
+}  // namespace V2_1
+}  // namespace composer
+}  // namespace graphics
+}  // namespace hardware
+}  // namespace android
+
+BENCHMARK_MAIN();
@@ -86,6 +86,10 @@ class ComposerCommandEngine : protected CommandReaderBase {
         mWriter.reset();
     }
 
+    // number of layer state commands that were not passed down to ComposerHal
+    // because they did not change the layer state
+    uint64_t getElidedCommandCount() const { return mElidedCommandCount; }
+
    protected:
     virtual bool executeCommand(IComposerClient::Command command, uint16_t length) {
         switch (command) {
@@ -286,6 +290,7 @@ class ComposerCommandEngine : protected CommandReaderBase {
                 mWriter.setPresentOrValidateResult(1);
                 mWriter.setPresentFence(presentFence);
                 mWriter.setReleaseFences(layers, fences);
+                onFramePresented();
                 return true;
             }
         }
@@ -336,6 +341,7 @@ class ComposerCommandEngine : protected CommandReaderBase {
         if (err == Error::NONE) {
             mWriter.setPresentFence(presentFence);
             mWriter.setReleaseFences(layers, fences);
+            onFramePresented();
         } else {
             mWriter.setError(getCommandLoc(), err);
         }
@@ -389,12 +395,17 @@ class ComposerCommandEngine : protected CommandReaderBase {
     }
 
     bool executeSetLayerSurfaceDamage(uint16_t length) {
-        // N rectangles
-        if (length % 4 != 0) {
+        // N rectangles, optionally continued
+        if (length % 4 != 0 && length != CommandWriterBase::kRegionContinuationLength) {
+            return false;
+        }
+
+        std::vector<hwc_rect_t> damage;
+        if (!readRegionCommands(IComposerClient::Command::SET_LAYER_SURFACE_DAMAGE, length,
+                                &damage)) {
             return false;
         }
 
-        auto damage = readRegion(length / 4);
         auto err = mHal->setLayerSurfaceDamage(mCurrentDisplay, mCurrentLayer, damage);
         if (err != Error::NONE) {
             mWriter.setError(getCommandLoc(), err);
@@ -408,8 +419,14 @@ class ComposerCommandEngine : protected CommandReaderBase {
             return false;
         }
 
+        if (skipUnchangedLayerState(IComposerClient::Command::SET_LAYER_BLEND_MODE, length)) {
+            return true;
+        }
+
         auto err = mHal->setLayerBlendMode(mCurrentDisplay, mCurrentLayer, readSigned());
         if (err != Error::NONE) {
+            mResources->invalidateLayerState(mCurrentDisplay, mCurrentLayer,
+                                             IComposerClient::Command::SET_LAYER_BLEND_MODE);
             mWriter.setError(getCommandLoc(), err);
         }
 
@@ -447,8 +464,14 @@ class ComposerCommandEngine : protected CommandReaderBase {
             return false;
         }
 
+        if (skipUnchangedLayerState(IComposerClient::Command::SET_LAYER_DATASPACE, length)) {
+            return true;
+        }
+
         auto err = mHal->setLayerDataspace(mCurrentDisplay, mCurrentLayer, readSigned());
         if (err != Error::NONE) {
+            mResources->invalidateLayerState(mCurrentDisplay, mCurrentLayer,
+                                             IComposerClient::Command::SET_LAYER_DATASPACE);
             mWriter.setError(getCommandLoc(), err);
         }
 
@@ -460,8 +483,14 @@ class ComposerCommandEngine : protected CommandReaderBase {
             return false;
         }
 
+        if (skipUnchangedLayerState(IComposerClient::Command::SET_LAYER_DISPLAY_FRAME, length)) {
+            return true;
+        }
+
         auto err = mHal->setLayerDisplayFrame(mCurrentDisplay, mCurrentLayer, readRect());
         if (err != Error::NONE) {
+            mResources->invalidateLayerState(mCurrentDisplay, mCurrentLayer,
+                                             IComposerClient::Command::SET_LAYER_DISPLAY_FRAME);
             mWriter.setError(getCommandLoc(), err);
         }
 
@@ -473,8 +502,14 @@ class ComposerCommandEngine : protected CommandReaderBase {
             return false;
         }
 
+        if (skipUnchangedLayerState(IComposerClient::Command::SET_LAYER_PLANE_ALPHA, length)) {
+            return true;
+        }
+
         auto err = mHal->setLayerPlaneAlpha(mCurrentDisplay, mCurrentLayer, readFloat());
         if (err != Error::NONE) {
+            mResources->invalidateLayerState(mCurrentDisplay, mCurrentLayer,
+                                             IComposerClient::Command::SET_LAYER_PLANE_ALPHA);
             mWriter.setError(getCommandLoc(), err);
         }
 
@@ -507,8 +542,14 @@ class ComposerCommandEngine : protected CommandReaderBase {
             return false;
         }
 
+        if (skipUnchangedLayerState(IComposerClient::Command::SET_LAYER_SOURCE_CROP, length)) {
+            return true;
+        }
+
         auto err = mHal->setLayerSourceCrop(mCurrentDisplay, mCurrentLayer, readFRect());
         if (err != Error::NONE) {
+            mResources->invalidateLayerState(mCurrentDisplay, mCurrentLayer,
+                                             IComposerClient::Command::SET_LAYER_SOURCE_CROP);
             mWriter.setError(getCommandLoc(), err);
         }
 
@@ -520,8 +561,14 @@ class ComposerCommandEngine : protected CommandReaderBase {
             return false;
         }
 
+        if (skipUnchangedLayerState(IComposerClient::Command::SET_LAYER_TRANSFORM, length)) {
+            return true;
+        }
+
         auto err = mHal->setLayerTransform(mCurrentDisplay, mCurrentLayer, readSigned());
         if (err != Error::NONE) {
+            mResources->invalidateLayerState(mCurrentDisplay, mCurrentLayer,
+                                             IComposerClient::Command::SET_LAYER_TRANSFORM);
             mWriter.setError(getCommandLoc(), err);
         }
 
@@ -529,14 +576,30 @@ class ComposerCommandEngine : protected CommandReaderBase {
     }
 
     bool executeSetLayerVisibleRegion(uint16_t length) {
-        // N rectangles
-        if (length % 4 != 0) {
+        // N rectangles, optionally continued
+        if (length % 4 != 0 && length != CommandWriterBase::kRegionContinuationLength) {
+            return false;
+        }
+
+        // a region continued in the following commands is not shadowed
+        if (length == CommandWriterBase::kRegionContinuationLength) {
+            mResources->invalidateLayerState(mCurrentDisplay, mCurrentLayer,
+                                             IComposerClient::Command::SET_LAYER_VISIBLE_REGION);
+        } else if (skipUnchangedLayerState(IComposerClient::Command::SET_LAYER_VISIBLE_REGION,
+                                           length)) {
+            return true;
+        }
+
+        std::vector<hwc_rect_t> region;
+        if (!readRegionCommands(IComposerClient::Command::SET_LAYER_VISIBLE_REGION, length,
+                                &region)) {
             return false;
         }
 
-        auto region = readRegion(length / 4);
         auto err = mHal->setLayerVisibleRegion(mCurrentDisplay, mCurrentLayer, region);
         if (err != Error::NONE) {
+            mResources->invalidateLayerState(mCurrentDisplay, mCurrentLayer,
+                                             IComposerClient::Command::SET_LAYER_VISIBLE_REGION);
             mWriter.setError(getCommandLoc(), err);
         }
 
@@ -548,14 +611,43 @@ class ComposerCommandEngine : protected CommandReaderBase {
             return false;
         }
 
+        if (skipUnchangedLayerState(IComposerClient::Command::SET_LAYER_Z_ORDER, length)) {
+            return true;
+        }
+
         auto err = mHal->setLayerZOrder(mCurrentDisplay, mCurrentLayer, read());
         if (err != Error::NONE) {
+            mResources->invalidateLayerState(mCurrentDisplay, mCurrentLayer,
+                                             IComposerClient::Command::SET_LAYER_Z_ORDER);
             mWriter.setError(getCommandLoc(), err);
         }
 
         return true;
     }
 
+    // Layer state commands carrying the same payload as the one last applied
+    // to the layer are consumed without calling into ComposerHal.  Commands
+    // whose state ComposerHal may change on its own (composition type) or
+    // that are meaningful per frame (buffer, damage, cursor) are never
+    // skipped.
+    bool skipUnchangedLayerState(IComposerClient::Command command, uint16_t length) {
+        if (mResources->updateLayerState(mCurrentDisplay, mCurrentLayer, command,
+                                         &mData[mDataRead], length)) {
+            return false;
+        }
+
+        mDataRead += length;
+        mFrameElidedCommandCount++;
+        mElidedCommandCount++;
+        return true;
+    }
+
+    void onFramePresented() {
+        ALOGV("display %" PRIu64 ": %" PRIu32 " layer commands elided", mCurrentDisplay,
+              mFrameElidedCommandCount);
+        mFrameElidedCommandCount = 0;
+    }
+
     hwc_rect_t readRect() {
         return hwc_rect_t{
             readSigned(), readSigned(), readSigned(), readSigned(),
@@ -573,6 +665,36 @@ class ComposerCommandEngine : protected CommandReaderBase {
         return region;
     }
 
+    // reads a region along with the commands continuing it, if any
+    bool readRegionCommands(IComposerClient::Command command, uint16_t length,
+                            std::vector<hwc_rect_t>* outRegion) {
+        *outRegion = readRegion(length / 4);
+        while (length == CommandWriterBase::kRegionContinuationLength) {
+            // number of rectangles in the following commands
+            uint32_t remaining = read();
+            if (remaining == 0 || !beginContinuation(command, &length)) {
+                return false;
+            }
+
+            bool continued = (length == CommandWriterBase::kRegionContinuationLength);
+            if (continued ? remaining <= CommandWriterBase::kMaxRegionChunkRects
+                          : (length % 4 != 0 || length / 4 != remaining)) {
+                return false;
+            }
+
+            // every remaining rectangle takes 4 words of the command buffer
+            if (remaining > getUnreadSize() / 4) {
+                return false;
+            }
+
+            outRegion->reserve(outRegion->size() + remaining);
+            auto chunk = readRegion(length / 4);
+            outRegion->insert(outRegion->end(), chunk.begin(), chunk.end());
+        }
+
+        return true;
+    }
+
     hwc_frect_t readFRect() {
         return hwc_frect_t{
             readFloat(), readFloat(), readFloat(), readFloat(),
@@ -588,6 +710,9 @@ class ComposerCommandEngine : protected CommandReaderBase {
 
     Display mCurrentDisplay = 0;
     Layer mCurrentLayer = 0;
+
+    uint32_t mFrameElidedCommandCount = 0;
+    uint64_t mElidedCommandCount = 0;
 };
 
 }  // namespace hal
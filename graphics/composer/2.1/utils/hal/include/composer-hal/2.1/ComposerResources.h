@@ -20,11 +20,13 @@
 #warning "ComposerResources.h included without LOG_TAG"
 #endif
 
+#include <algorithm>
 #include <memory>
 #include <mutex>
 #include <unordered_map>
 #include <vector>
 
+#include <android/hardware/graphics/composer/2.1/IComposerClient.h>
 #include <android/hardware/graphics/mapper/2.0/IMapper.h>
 #include <android/hardware/graphics/mapper/3.0/IMapper.h>
 #include <log/log.h>
@@ -229,9 +231,43 @@ class ComposerLayerResource {
                                               outReplacedHandle);
     }
 
+    // Returns false when the command payload matches the one last applied to
+    // the layer; otherwise remembers the payload and returns true.
+    bool updateState(IComposerClient::Command command, const uint32_t* data, uint16_t length) {
+        for (auto& state : mStates) {
+            if (state.command == command) {
+                if (state.data.size() == length &&
+                    std::equal(data, data + length, state.data.begin())) {
+                    return false;
+                }
+                state.data.assign(data, data + length);
+                return true;
+            }
+        }
+
+        mStates.push_back({command, std::vector<uint32_t>(data, data + length)});
+        return true;
+    }
+
+    void invalidateState(IComposerClient::Command command) {
+        mStates.erase(std::remove_if(mStates.begin(), mStates.end(),
+                                     [command](const auto& state) {
+                                         return state.command == command;
+                                     }),
+                      mStates.end());
+    }
+
    protected:
+    struct LayerState {
+        IComposerClient::Command command;
+        std::vector<uint32_t> data;
+    };
+
     ComposerHandleCache mBufferCache;
     ComposerHandleCache mSidebandStreamCache;
+
+    // a handful of commands at most, a linear search beats hashing
+    std::vector<LayerState> mStates;
 };
 
 // display resource
@@ -445,6 +481,26 @@ class ComposerResources {
         return false;
     }
 
+    // Layer state shadowing.  Returns false when the layer state command
+    // carries the same payload as the one last applied to the layer, in which
+    // case it does not need to be passed down to ComposerHal again.  Unknown
+    // displays and layers are never considered up to date.
+    bool updateLayerState(Display display, Layer layer, IComposerClient::Command command,
+                          const uint32_t* data, uint16_t length) {
+        std::lock_guard<std::mutex> lock(mDisplayResourcesMutex);
+        ComposerLayerResource* layerResource = findLayerResourceLocked(display, layer);
+        return layerResource ? layerResource->updateState(command, data, length) : true;
+    }
+
+    // forget the shadowed state, e.g., when ComposerHal failed to apply it
+    void invalidateLayerState(Display display, Layer layer, IComposerClient::Command command) {
+        std::lock_guard<std::mutex> lock(mDisplayResourcesMutex);
+        ComposerLayerResource* layerResource = findLayerResourceLocked(display, layer);
+        if (layerResource) {
+            layerResource->invalidateState(command);
+        }
+    }
+
    protected:
     virtual std::unique_ptr<ComposerDisplayResource> createDisplayResource(
         ComposerDisplayResource::DisplayType type, uint32_t outputBufferCacheSize) {
@@ -463,6 +519,11 @@ class ComposerResources {
         return iter->second.get();
     }
 
+    ComposerLayerResource* findLayerResourceLocked(Display display, Layer layer) {
+        ComposerDisplayResource* displayResource = findDisplayResourceLocked(display);
+        return displayResource ? displayResource->findLayerResource(layer) : nullptr;
+    }
+
     ComposerHandleImporter mImporter;
 
     std::mutex mDisplayResourcesMutex;
@@ -0,0 +1,258 @@
+/*
+ * Copyright 2018 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "ComposerCommandEngineBenchmark"
+
+#include <algorithm>
+#include <vector>
+
+#include <benchmark/benchmark.h>
+#include <composer-hal/2.1/ComposerCommandEngine.h>
+
+namespace android {
+namespace hardware {
+namespace graphics {
+namespace composer {
+namespace V2_1 {
+namespace hal {
+
+namespace {
+
+constexpr Display kDisplay = 1;
+constexpr int kFramesPerStream = 60;
+
+// ComposerHal that accepts everything and only counts layer state calls
+class NullComposerHal : public ComposerHal {
+   public:
+    bool hasCapability(hwc2_capability_t) override { return false; }
+    std::string dumpDebugInfo() override { return std::string(); }
+    void registerEventCallback(EventCallback*) override {}
+    void unregisterEventCallback() override {}
+
+    uint32_t getMaxVirtualDisplayCount() override { return 0; }
+    Error createVirtualDisplay(uint32_t, uint32_t, PixelFormat*, Display*) override {
+        return Error::NO_RESOURCES;
+    }
+    Error destroyVirtualDisplay(Display) override { return Error::BAD_DISPLAY; }
+    Error createLayer(Display, Layer*) override { return Error::NO_RESOURCES; }
+    Error destroyLayer(Display, Layer) override { return Error::NONE; }
+
+    Error getActiveConfig(Display, Config*) override { return Error::UNSUPPORTED; }
+    Error getClientTargetSupport(Display, uint32_t, uint32_t, PixelFormat, Dataspace) override {
+        return Error::NONE;
+    }
+    Error getColorModes(Display, hidl_vec<ColorMode>*) override { return Error::UNSUPPORTED; }
+    Error getDisplayAttribute(Display, Config, IComposerClient::Attribute, int32_t*) override {
+        return Error::UNSUPPORTED;
+    }
+    Error getDisplayConfigs(Display, hidl_vec<Config>*) override { return Error::UNSUPPORTED; }
+    Error getDisplayName(Display, hidl_string*) override { return Error::UNSUPPORTED; }
+    Error getDisplayType(Display, IComposerClient::DisplayType*) override {
+        return Error::UNSUPPORTED;
+    }
+    Error getDozeSupport(Display, bool*) override { return Error::UNSUPPORTED; }
+    Error getHdrCapabilities(Display, hidl_vec<Hdr>*, float*, float*, float*) override {
+        return Error::UNSUPPORTED;
+    }
+
+    Error setActiveConfig(Display, Config) override { return Error::NONE; }
+    Error setColorMode(Display, ColorMode) override { return Error::NONE; }
+    Error setPowerMode(Display, IComposerClient::PowerMode) override { return Error::NONE; }
+    Error setVsyncEnabled(Display, IComposerClient::Vsync) override { return Error::NONE; }
+
+    Error setColorTransform(Display, const float*, int32_t) override { return Error::NONE; }
+    Error setClientTarget(Display, buffer_handle_t, int32_t, int32_t,
+                          const std::vector<hwc_rect_t>&) override {
+        return Error::NONE;
+    }
+    Error setOutputBuffer(Display, buffer_handle_t, int32_t) override { return Error::NONE; }
+    Error validateDisplay(Display, std::vector<Layer>*, std::vector<IComposerClient::Composition>*,
+                          uint32_t*, std::vector<Layer>*, std::vector<uint32_t>*) override {
+        return Error::NONE;
+    }
+    Error acceptDisplayChanges(Display) override { return Error::NONE; }
+    Error presentDisplay(Display, int32_t* outPresentFence, std::vector<Layer>*,
+                         std::vector<int32_t>*) override {
+        *outPresentFence = -1;
+        return Error::NONE;
+    }
+
+    Error setLayerCursorPosition(Display, Layer, int32_t, int32_t) override {
+        return onLayerCall();
+    }
+    Error setLayerBuffer(Display, Layer, buffer_handle_t, int32_t) override {
+        return onLayerCall();
+    }
+    Error setLayerSurfaceDamage(Display, Layer, const std::vector<hwc_rect_t>&) override {
+        return onLayerCall();
+    }
+    Error setLayerBlendMode(Display, Layer, int32_t) override { return onLayerCall(); }
+    Error setLayerColor(Display, Layer, IComposerClient::Color) override { return onLayerCall(); }
+    Error setLayerCompositionType(Display, Layer, int32_t) override { return onLayerCall(); }
+    Error setLayerDataspace(Display, Layer, int32_t) override { return onLayerCall(); }
+    Error setLayerDisplayFrame(Display, Layer, const hwc_rect_t&) override {
+        return onLayerCall();
+    }
+    Error setLayerPlaneAlpha(Display, Layer, float) override { return onLayerCall(); }
+    Error setLayerSidebandStream(Display, Layer, buffer_handle_t) override {
+        return onLayerCall();
+    }
+    Error setLayerSourceCrop(Display, Layer, const hwc_frect_t&) override {
+        return onLayerCall();
+    }
+    Error setLayerTransform(Display, Layer, int32_t) override { return onLayerCall(); }
+    Error setLayerVisibleRegion(Display, Layer, const std::vector<hwc_rect_t>&) override {
+        return onLayerCall();
+    }
+    Error setLayerZOrder(Display, Layer, uint32_t) override { return onLayerCall(); }
+
+    uint64_t layerCalls = 0;
+
+   private:
+    Error onLayerCall() {
+        layerCalls++;
+        return Error::NONE;
+    }
+};
+
+// CommandWriterBase giving access to the recorded commands
+class CommandRecorder : public CommandWriterBase {
+   public:
+    CommandRecorder() : CommandWriterBase(4096) {}
+
+    std::vector<uint32_t> takeCommands() {
+        std::vector<uint32_t> commands(mData, mData + mDataWritten);
+        reset();
+        return commands;
+    }
+};
+
+enum Scenario {
+    // geometry does not change, SurfaceFlinger resends it anyway
+    STATIC = 0,
+    // one layer moves and fades, e.g., a window animation
+    ANIMATION,
+    // every layer scrolls, nothing can be elided
+    SCROLL,
+};
+
+// Records the commands SurfaceFlinger sends for a frame of a full-screen
+// layer stack: per-layer geometry, a buffer update on the top layer
+// (damage only, no handles), validate and present.
+std::vector<uint32_t> recordFrame(CommandRecorder* recorder, Scenario scenario, int frame,
+                                  int layerCount) {
+    recorder->selectDisplay(kDisplay);
+    for (int i = 0; i < layerCount; i++) {
+        const bool moving =
+            (scenario == SCROLL) || (scenario == ANIMATION && i == layerCount - 1);
+        const int32_t offset = moving ? frame % 64 : 0;
+        const IComposerClient::Rect frameRect = {0, 100 * i + offset, 1080,
+                                                 100 * i + 400 + offset};
+
+        recorder->selectLayer(i + 1);
+        recorder->setLayerCompositionType(IComposerClient::Composition::DEVICE);
+        recorder->setLayerDisplayFrame(frameRect);
+        recorder->setLayerSourceCrop({0.0f, static_cast<float>(offset), 1080.0f,
+                                      static_cast<float>(400 + offset)});
+        recorder->setLayerZOrder(i);
+        recorder->setLayerBlendMode(i == 0 ? IComposerClient::BlendMode::NONE
+                                           : IComposerClient::BlendMode::PREMULTIPLIED);
+        recorder->setLayerPlaneAlpha(moving && scenario == ANIMATION ? (frame % 10) / 10.0f
+                                                                     : 1.0f);
+        recorder->setLayerTransform(static_cast<Transform>(0));
+        recorder->setLayerDataspace(Dataspace::V0_SRGB);
+        recorder->setLayerVisibleRegion({frameRect});
+        if (i == layerCount - 1) {
+            recorder->setLayerSurfaceDamage({frameRect});
+        }
+    }
+    recorder->validateDisplay();
+    recorder->presentDisplay();
+
+    return recorder->takeCommands();
+}
+
+void BM_ReplayFrames(benchmark::State& state) {
+    const Scenario scenario = static_cast<Scenario>(state.range(0));
+    const int layerCount = state.range(1);
+
+    CommandRecorder recorder;
+    std::vector<std::vector<uint32_t>> frames;
+    for (int frame = 0; frame < kFramesPerStream; frame++) {
+        frames.push_back(recordFrame(&recorder, scenario, frame, layerCount));
+    }
+
+    // no buffers are imported, so the mapper is not needed
+    ComposerResources resources;
+    resources.addPhysicalDisplay(kDisplay);
+    for (int i = 0; i < layerCount; i++) {
+        resources.addLayer(kDisplay, i + 1, 1);
+    }
+
+    size_t maxFrameSize = 0;
+    for (const auto& commands : frames) {
+        maxFrameSize = std::max(maxFrameSize, commands.size());
+    }
+    CommandQueueType queue(maxFrameSize);
+
+    NullComposerHal hal;
+    ComposerCommandEngine engine(&hal, &resources);
+    if (!queue.isValid() || !engine.setInputMQDescriptor(*queue.getDesc())) {
+        state.SkipWithError("failed to set up the command queue");
+        return;
+    }
+
+    size_t frame = 0;
+    bool outQueueChanged;
+    uint32_t outCommandLength;
+    hidl_vec<hidl_handle> outCommandHandles;
+    for (auto _ : state) {
+        const std::vector<uint32_t>& commands = frames[frame];
+        if (!queue.write(commands.data(), commands.size()) ||
+            engine.execute(commands.size(), hidl_vec<hidl_handle>(), &outQueueChanged,
+                           &outCommandLength, &outCommandHandles) != Error::NONE) {
+            state.SkipWithError("failed to execute commands");
+            break;
+        }
+        engine.reset();
+        frame = (frame + 1) % frames.size();
+    }
+
+    const double iterations = std::max<double>(state.iterations(), 1);
+    state.counters["layerCallsPerFrame"] = hal.layerCalls / iterations;
+    state.counters["elidedPerFrame"] = engine.getElidedCommandCount() / iterations;
+    state.SetItemsProcessed(state.iterations());
+}
+
+void scenarioArgs(benchmark::internal::Benchmark* b) {
+    for (int scenario : {STATIC, ANIMATION, SCROLL}) {
+        for (int layerCount : {4, 16}) {
+            b->Args({scenario, layerCount});
+        }
+    }
+}
+BENCHMARK(BM_ReplayFrames)->Apply(scenarioArgs);
+
+}  // anonymous namespace
+
+}  // namespace hal
+}  // namespace V2_1
+}  // namespace composer
+}  // namespace graphics
+}  // namespace hardware
+}  // namespace android
+
+BENCHMARK_MAIN();
@@ -39,8 +39,10 @@ endif
 # Allow implicit fallthroughs in wifi_legacy_hal.cpp until they are fixed.
 LOCAL_CFLAGS += -Wno-error=implicit-fallthrough
 LOCAL_SRC_FILES := \
+    cpio_archive_writer.cpp \
     hidl_struct_util.cpp \
     hidl_sync_util.cpp \
+    link_layer_stats_sampler.cpp \
     ringbuffer.cpp \
     wifi.cpp \
     wifi_ap_iface.cpp \
@@ -64,6 +66,7 @@ LOCAL_SHARED_LIBRARIES := \
     libutils \
     libwifi-hal \
     libwifi-system-iface \
+    libz \
     android.hardware.wifi@1.0 \
     android.hardware.wifi@1.1 \
     android.hardware.wifi@1.2 \
@@ -90,6 +93,7 @@ LOCAL_SHARED_LIBRARIES := \
     libutils \
     libwifi-hal \
     libwifi-system-iface \
+    libz \
     android.hardware.wifi@1.0 \
     android.hardware.wifi@1.1 \
     android.hardware.wifi@1.2 \
@@ -120,6 +124,7 @@ LOCAL_SHARED_LIBRARIES := \
     libutils \
     libwifi-hal \
     libwifi-system-iface \
+    libz \
     android.hardware.wifi@1.0 \
     android.hardware.wifi@1.1 \
     android.hardware.wifi@1.2 \
@@ -137,7 +142,10 @@ LOCAL_MODULE := android.hardware.wifi@1.0-service-tests
 LOCAL_PROPRIETARY_MODULE := true
 LOCAL_CPPFLAGS := -Wall -Werror -Wextra
 LOCAL_SRC_FILES := \
+    tests/cpio_archive_writer_unit_tests.cpp \
     tests/hidl_struct_util_unit_tests.cpp \
+    tests/hidl_sync_util_unit_tests.cpp \
+    tests/link_layer_stats_sampler_unit_tests.cpp \
     tests/main.cpp \
     tests/mock_interface_tool.cpp \
     tests/mock_wifi_feature_flags.cpp \
@@ -162,8 +170,36 @@ LOCAL_SHARED_LIBRARIES := \
     libutils \
     libwifi-hal \
     libwifi-system-iface \
+    libz \
     android.hardware.wifi@1.0 \
     android.hardware.wifi@1.1 \
     android.hardware.wifi@1.2 \
     android.hardware.wifi@1.3
 include $(BUILD_NATIVE_TEST)
+
+###
+### android.hardware.wifi benchmarks.
+###
+include $(CLEAR_VARS)
+LOCAL_MODULE := android.hardware.wifi@1.0-service-benchmarks
+LOCAL_PROPRIETARY_MODULE := true
+LOCAL_CPPFLAGS := -Wall -Werror -Wextra
+LOCAL_SRC_FILES := \
+    tests/hidl_struct_util_benchmark.cpp
+LOCAL_STATIC_LIBRARIES := \
+    android.hardware.wifi@1.0-service-lib
+LOCAL_SHARED_LIBRARIES := \
+    libbase \
+    libcutils \
+    libhidlbase \
+    liblog \
+    libnl \
+    libutils \
+    libwifi-hal \
+    libwifi-system-iface \
+    libz \
+    android.hardware.wifi@1.0 \
+    android.hardware.wifi@1.1 \
+    android.hardware.wifi@1.2 \
+    android.hardware.wifi@1.3
+include $(BUILD_NATIVE_BENCHMARK)
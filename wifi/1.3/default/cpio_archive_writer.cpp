@@ -0,0 +1,371 @@
+/*
+ * Copyright (C) 2019 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/sendfile.h>
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
+#include <unistd.h>
+#include <zlib.h>
+
+#include <algorithm>
+#include <array>
+#include <limits>
+#include <vector>
+
+#include <android-base/file.h>
+#include <android-base/logging.h>
+#include <android-base/stringprintf.h>
+
+#include "cpio_archive_writer.h"
+
+namespace {
+using android::base::StringPrintf;
+using android::base::WriteFully;
+using android::base::unique_fd;
+
+constexpr char kCpioMagic[] = "070701";
+constexpr size_t kCpioHeaderSize = 110;
+// Header and "TRAILER!!!" name, NUL padded to 4 bytes.
+constexpr size_t kCpioTrailerSize = 124;
+constexpr size_t kCopyBufferSize = 32 * 1024;
+// Window bits for deflateInit2(), 16 is added to select the gzip format.
+constexpr int kGzipWindowBits = 15 + 16;
+constexpr int kGzipMemLevel = 8;
+
+size_t alignTo4(size_t size) { return (size + 3) & ~static_cast<size_t>(3); }
+
+bool writeZeros(int fd, size_t size) {
+    static const std::array<char, kCopyBufferSize> zeros = {};
+    while (size > 0) {
+        const size_t chunk = std::min(size, zeros.size());
+        if (!WriteFully(fd, zeros.data(), chunk)) {
+            return false;
+        }
+        size -= chunk;
+    }
+    return true;
+}
+
+// Copies up to |size| bytes of |in_fd| at |*offset| to |out_fd| through a
+// user space buffer, for when the kernel cannot copy between the two.
+ssize_t copyWithBuffer(int in_fd, off64_t* offset, int out_fd, size_t size) {
+    std::array<char, kCopyBufferSize> buf;
+    const ssize_t bytes_read = TEMP_FAILURE_RETRY(
+        pread64(in_fd, buf.data(), std::min(size, buf.size()), *offset));
+    if (bytes_read <= 0) {
+        return bytes_read;
+    }
+    if (!WriteFully(out_fd, buf.data(), bytes_read)) {
+        return -1;
+    }
+    *offset += bytes_read;
+    return bytes_read;
+}
+
+// Compresses |size| bytes at |data| and writes the output to |out_fd|.
+bool deflateToFd(z_stream* stream, uint8_t* data, size_t size, int flush,
+                 int out_fd, std::vector<uint8_t>* out_buf) {
+    stream->next_in = data;
+    stream->avail_in = size;
+    do {
+        stream->next_out = out_buf->data();
+        stream->avail_out = out_buf->size();
+        if (deflate(stream, flush) == Z_STREAM_ERROR) {
+            LOG(ERROR) << "Error compressing archive";
+            return false;
+        }
+        if (!WriteFully(out_fd, out_buf->data(),
+                        out_buf->size() - stream->avail_out)) {
+            PLOG(ERROR) << "Error writing compressed archive";
+            return false;
+        }
+    } while (stream->avail_out == 0);
+    return true;
+}
+}  // namespace
+
+namespace android {
+namespace hardware {
+namespace wifi {
+namespace V1_3 {
+namespace implementation {
+
+CpioArchiveWriter::Options::Options()
+    : compress(false),
+      max_bytes(std::numeric_limits<size_t>::max()),
+      max_duration(std::chrono::milliseconds::max()) {}
+
+CpioArchiveWriter::CpioArchiveWriter(int out_fd, const Options& options)
+    : out_fd_(out_fd),
+      options_(options),
+      start_time_(std::chrono::steady_clock::now()),
+      archive_fd_(out_fd),
+      compression_failed_(false),
+      num_bytes_(0),
+      num_errors_(0),
+      num_skipped_entries_(0),
+      entry_size_(0),
+      in_entry_(false),
+      broken_(false),
+      finished_(false) {
+    if (options_.compress && !startCompression()) {
+        LOG(ERROR) << "Writing the archive uncompressed";
+    }
+}
+
+CpioArchiveWriter::~CpioArchiveWriter() { finish(); }
+
+bool CpioArchiveWriter::addFile(const std::string& path,
+                                const std::string& name) {
+    unique_fd fd(TEMP_FAILURE_RETRY(open(path.c_str(), O_RDONLY | O_CLOEXEC)));
+    if (fd == -1) {
+        PLOG(ERROR) << "Failed to open file " << path;
+        num_errors_++;
+        return false;
+    }
+    struct stat st;
+    if (fstat(fd, &st) == -1) {
+        PLOG(ERROR) << "Failed to get file stat for " << path;
+        num_errors_++;
+        return false;
+    }
+    if (!beginEntry(name, st)) {
+        return false;
+    }
+    return endEntry(copyFileContent(fd, st.st_size));
+}
+
+bool CpioArchiveWriter::addData(const std::string& name,
+                                const std::string& data) {
+    if (!beginEntry(name, data.size(), time(nullptr))) {
+        return false;
+    }
+    return endEntry(WriteFully(archive_fd_, data.data(), data.size()));
+}
+
+bool CpioArchiveWriter::beginEntry(const std::string& name, size_t size,
+                                   time_t mtime) {
+    struct stat st = {};
+    st.st_mode = S_IFREG | S_IRUSR | S_IWUSR;
+    st.st_uid = geteuid();
+    st.st_gid = getegid();
+    st.st_nlink = 1;
+    st.st_mtime = mtime;
+    st.st_size = size;
+    return beginEntry(name, st);
+}
+
+int CpioArchiveWriter::getContentFd() const { return archive_fd_; }
+
+bool CpioArchiveWriter::endEntry(bool success) {
+    CHECK(in_entry_);
+    in_entry_ = false;
+    num_bytes_ += entry_size_;
+    if (!success) {
+        onError();
+        return false;
+    }
+    const size_t padding = alignTo4(entry_size_) - entry_size_;
+    if (!writeZeros(archive_fd_, padding)) {
+        PLOG(ERROR) << "Error padding 0s to archive";
+        onError();
+        return false;
+    }
+    num_bytes_ += padding;
+    return true;
+}
+
+bool CpioArchiveWriter::finish() {
+    if (finished_) {
+        return num_errors_ == 0;
+    }
+    CHECK(!in_entry_);
+    finished_ = true;
+    if (!broken_) {
+        // Logic obtained from //external/toybox/toys/posix/cpio.c
+        std::array<char, kCpioTrailerSize + 1> trailer = {};
+        sprintf(trailer.data(), "%s%040X%056X%08XTRAILER!!!", kCpioMagic, 1,
+                0x0b, 0);
+        if (!WriteFully(archive_fd_, trailer.data(), kCpioTrailerSize)) {
+            PLOG(ERROR) << "Error writing trailing bytes";
+            num_errors_++;
+        }
+    }
+    if (compression_thread_.joinable()) {
+        // Closing the pipe lets the compression thread finish the stream.
+        pipe_write_fd_.reset();
+        archive_fd_ = out_fd_;
+        compression_thread_.join();
+        if (compression_failed_) {
+            num_errors_++;
+        }
+    }
+    return num_errors_ == 0;
+}
+
+size_t CpioArchiveWriter::getNumErrors() const { return num_errors_; }
+
+size_t CpioArchiveWriter::getNumSkippedEntries() const {
+    return num_skipped_entries_;
+}
+
+bool CpioArchiveWriter::startCompression() {
+    int pipe_fds[2];
+    if (pipe2(pipe_fds, O_CLOEXEC) == -1) {
+        PLOG(ERROR) << "Failed to create compression pipe";
+        return false;
+    }
+    unique_fd read_fd(pipe_fds[0]);
+    pipe_write_fd_.reset(pipe_fds[1]);
+    archive_fd_ = pipe_write_fd_.get();
+    compression_thread_ = std::thread(&CpioArchiveWriter::runCompression,
+                                      this, std::move(read_fd));
+    return true;
+}
+
+void CpioArchiveWriter::runCompression(unique_fd in_fd) {
+    z_stream stream = {};
+    const bool initialized =
+        deflateInit2(&stream, Z_DEFAULT_COMPRESSION, Z_DEFLATED,
+                     kGzipWindowBits, kGzipMemLevel,
+                     Z_DEFAULT_STRATEGY) == Z_OK;
+    bool failed = !initialized;
+    if (!initialized) {
+        LOG(ERROR) << "Failed to initialize compression";
+    }
+    std::vector<uint8_t> in_buf(kCopyBufferSize);
+    std::vector<uint8_t> out_buf(kCopyBufferSize);
+    while (true) {
+        const ssize_t bytes_read =
+            TEMP_FAILURE_RETRY(read(in_fd, in_buf.data(), in_buf.size()));
+        if (bytes_read == -1) {
+            PLOG(ERROR) << "Error reading from compression pipe";
+            failed = true;
+            break;
+        }
+        // Keep draining the pipe after a failure, so that the writer does not
+        // block.
+        if (!failed) {
+            failed = !deflateToFd(&stream, in_buf.data(), bytes_read,
+                                  bytes_read == 0 ? Z_FINISH : Z_NO_FLUSH,
+                                  out_fd_, &out_buf);
+        }
+        if (bytes_read == 0) {
+            break;
+        }
+    }
+    if (initialized) {
+        deflateEnd(&stream);
+    }
+    compression_failed_ = failed;
+}
+
+bool CpioArchiveWriter::beginEntry(const std::string& name,
+                                   const struct stat& st) {
+    CHECK(!in_entry_ && !finished_);
+    if (broken_) {
+        return false;
+    }
+    if (!checkBudget(name, st.st_size)) {
+        num_skipped_entries_++;
+        return false;
+    }
+    // The name size includes the NUL terminator.
+    std::string header = StringPrintf(
+        "%s%08X%08X%08X%08X%08X%08X%08X%08X%08X%08X%08X%08X%08X", kCpioMagic,
+        static_cast<int>(st.st_ino), st.st_mode, st.st_uid, st.st_gid,
+        static_cast<int>(st.st_nlink), static_cast<int>(st.st_mtime),
+        static_cast<int>(st.st_size), major(st.st_dev), minor(st.st_dev),
+        major(st.st_rdev), minor(st.st_rdev),
+        static_cast<uint32_t>(name.size() + 1), 0);
+    header.append(name.c_str(), name.size() + 1);
+    header.resize(alignTo4(header.size()), '\0');
+    if (!WriteFully(archive_fd_, header.data(), header.size())) {
+        PLOG(ERROR) << "Error writing cpio header for " << name;
+        onError();
+        return false;
+    }
+    num_bytes_ += header.size();
+    in_entry_ = true;
+    entry_size_ = st.st_size;
+    return true;
+}
+
+bool CpioArchiveWriter::checkBudget(const std::string& name, size_t size) {
+    const size_t entry_bytes =
+        alignTo4(kCpioHeaderSize + name.size() + 1) + alignTo4(size);
+    if (num_bytes_ + entry_bytes + kCpioTrailerSize > options_.max_bytes) {
+        LOG(WARNING) << "Skipping " << name << ", archive size budget reached";
+        return false;
+    }
+    const auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::steady_clock::now() - start_time_);
+    if (elapsed >= options_.max_duration) {
+        LOG(WARNING) << "Skipping " << name << ", archive time budget reached";
+        return false;
+    }
+    return true;
+}
+
+bool CpioArchiveWriter::copyFileContent(int in_fd, size_t size) {
+    off64_t offset = 0;
+    bool zero_copy = true;
+    while (static_cast<size_t>(offset) < size) {
+        const size_t remaining = size - offset;
+        ssize_t copied;
+        if (!zero_copy) {
+            copied = copyWithBuffer(in_fd, &offset, archive_fd_, remaining);
+        } else if (pipe_write_fd_ != -1) {
+            copied = TEMP_FAILURE_RETRY(splice(in_fd, &offset, archive_fd_,
+                                               nullptr, remaining,
+                                               SPLICE_F_MORE));
+        } else {
+            copied = TEMP_FAILURE_RETRY(
+                sendfile64(archive_fd_, in_fd, &offset, remaining));
+        }
+        if (copied == -1 && zero_copy && (errno == EINVAL || errno == ENOSYS)) {
+            // Not supported for this pair of files.
+            zero_copy = false;
+            continue;
+        }
+        if (copied == -1) {
+            PLOG(ERROR) << "Error copying file content to archive";
+            return false;
+        }
+        if (copied == 0) {
+            // The file was truncated after its header was written, so pad it
+            // to the size recorded there.
+            LOG(WARNING) << "File truncated while being archived";
+            return writeZeros(archive_fd_, size - offset);
+        }
+    }
+    return true;
+}
+
+void CpioArchiveWriter::onError() {
+    // The stream is no longer aligned to the entry headers, so nothing else
+    // can be added.
+    num_errors_++;
+    broken_ = true;
+}
+
+}  // namespace implementation
+}  // namespace V1_3
+}  // namespace wifi
+}  // namespace hardware
+}  // namespace android
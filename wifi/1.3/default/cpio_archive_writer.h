@@ -0,0 +1,121 @@
+/*
+ * Copyright (C) 2019 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef CPIO_ARCHIVE_WRITER_H_
+#define CPIO_ARCHIVE_WRITER_H_
+
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include <chrono>
+#include <string>
+#include <thread>
+
+#include <android-base/macros.h>
+#include <android-base/unique_fd.h>
+
+namespace android {
+namespace hardware {
+namespace wifi {
+namespace V1_3 {
+namespace implementation {
+
+/**
+ * Streams a cpio archive ("newc" format) to a file descriptor.
+ *
+ * File content is copied with sendfile()/splice() without passing through
+ * user space, and in-memory content is written by the caller straight to
+ * |getContentFd|. The archive can optionally be gzip compressed on a
+ * background thread, which is fed through a pipe.
+ *
+ * Entries which do not fit in the size or time budget are skipped, but the
+ * archive is always terminated so that it can be extracted.
+ */
+class CpioArchiveWriter {
+   public:
+    struct Options {
+        Options();
+
+        // Gzip compress the archive.
+        bool compress;
+        // Entries which would grow the uncompressed archive past |max_bytes|,
+        // or which are added once |max_duration| has elapsed, are skipped.
+        size_t max_bytes;
+        std::chrono::milliseconds max_duration;
+    };
+
+    CpioArchiveWriter(int out_fd, const Options& options);
+    // Finishes the archive, if |finish| was not called.
+    ~CpioArchiveWriter();
+
+    // Adds the regular file at |path| as |name|.
+    bool addFile(const std::string& path, const std::string& name);
+    // Adds |data| as |name|.
+    bool addData(const std::string& name, const std::string& data);
+
+    // Starts an entry of |size| bytes named |name|. Returns false if the
+    // entry is skipped. Otherwise its content must be written to
+    // |getContentFd| before calling |endEntry|, with |success| set to false
+    // if that failed.
+    bool beginEntry(const std::string& name, size_t size, time_t mtime);
+    int getContentFd() const;
+    bool endEntry(bool success);
+
+    // Writes the trailer and waits for the compression to complete. Returns
+    // false if any error occurred.
+    bool finish();
+
+    size_t getNumErrors() const;
+    size_t getNumSkippedEntries() const;
+
+   private:
+    bool startCompression();
+    void runCompression(android::base::unique_fd in_fd);
+    // Writes the entry header, unless the entry is skipped.
+    bool beginEntry(const std::string& name, const struct stat& st);
+    bool checkBudget(const std::string& name, size_t size);
+    bool copyFileContent(int in_fd, size_t size);
+    void onError();
+
+    const int out_fd_;
+    const Options options_;
+    const std::chrono::steady_clock::time_point start_time_;
+    // Write end of the pipe to the compression thread, or |out_fd_|.
+    int archive_fd_;
+    android::base::unique_fd pipe_write_fd_;
+    std::thread compression_thread_;
+    // Only accessed by the compression thread until it is joined.
+    bool compression_failed_;
+    size_t num_bytes_;
+    size_t num_errors_;
+    size_t num_skipped_entries_;
+    // Size of the entry being written, if any.
+    size_t entry_size_;
+    bool in_entry_;
+    // Set once the stream is no longer aligned to entries.
+    bool broken_;
+    bool finished_;
+
+    DISALLOW_COPY_AND_ASSIGN(CpioArchiveWriter);
+};
+
+}  // namespace implementation
+}  // namespace V1_3
+}  // namespace wifi
+}  // namespace hardware
+}  // namespace android
+
+#endif  // CPIO_ARCHIVE_WRITER_H_
@@ -31,7 +31,8 @@ using namespace android::hardware::wifi::V1_0;
 /**
  * These utility functions are used to invoke a method on the provided
  * HIDL interface object.
- * These functions checks if the provided HIDL interface object is valid.
+ * These functions acquire the lock domain of the provided HIDL interface
+ * object and check if the object is valid.
  * a) if valid, Invokes the corresponding internal implementation function of
  * the HIDL method. It then invokes the HIDL continuation callback with
  * the status and any returned values.
@@ -43,7 +44,7 @@ template <typename ObjT, typename WorkFuncT, typename... Args>
 Return<void> validateAndCall(
     ObjT* obj, WifiStatusCode status_code_if_invalid, WorkFuncT&& work,
     const std::function<void(const WifiStatus&)>& hidl_cb, Args&&... args) {
-    const auto lock = hidl_sync_util::acquireGlobalLock();
+    const auto lock = obj->getLockDomain().acquire();
     if (obj->isValid()) {
         hidl_cb((obj->*work)(std::forward<Args>(args)...));
     } else {
@@ -53,13 +54,13 @@ Return<void> validateAndCall(
 }
 
 // Use for HIDL methods which return only an instance of WifiStatus.
-// This version passes the global lock acquired to the body of the method.
+// This version passes the lock acquired to the body of the method.
 // Note: Only used by IWifi::stop() currently.
 template <typename ObjT, typename WorkFuncT, typename... Args>
 Return<void> validateAndCallWithLock(
     ObjT* obj, WifiStatusCode status_code_if_invalid, WorkFuncT&& work,
     const std::function<void(const WifiStatus&)>& hidl_cb, Args&&... args) {
-    auto lock = hidl_sync_util::acquireGlobalLock();
+    auto lock = obj->getLockDomain().acquire();
     if (obj->isValid()) {
         hidl_cb((obj->*work)(&lock, std::forward<Args>(args)...));
     } else {
@@ -75,7 +76,7 @@ Return<void> validateAndCall(
     ObjT* obj, WifiStatusCode status_code_if_invalid, WorkFuncT&& work,
     const std::function<void(const WifiStatus&, ReturnT)>& hidl_cb,
     Args&&... args) {
-    const auto lock = hidl_sync_util::acquireGlobalLock();
+    const auto lock = obj->getLockDomain().acquire();
     if (obj->isValid()) {
         const auto& ret_pair = (obj->*work)(std::forward<Args>(args)...);
         const WifiStatus& status = std::get<0>(ret_pair);
@@ -96,7 +97,7 @@ Return<void> validateAndCall(
     ObjT* obj, WifiStatusCode status_code_if_invalid, WorkFuncT&& work,
     const std::function<void(const WifiStatus&, ReturnT1, ReturnT2)>& hidl_cb,
     Args&&... args) {
-    const auto lock = hidl_sync_util::acquireGlobalLock();
+    const auto lock = obj->getLockDomain().acquire();
     if (obj->isValid()) {
         const auto& ret_tuple = (obj->*work)(std::forward<Args>(args)...);
         const WifiStatus& status = std::get<0>(ret_tuple);
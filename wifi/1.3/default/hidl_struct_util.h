@@ -89,7 +89,7 @@ bool convertLegacyGscanResultToHidl(
 bool convertLegacyVectorOfCachedGscanResultsToHidl(
     const std::vector<legacy_hal::wifi_cached_scan_results>&
         legacy_cached_scan_results,
-    std::vector<StaScanData>* hidl_scan_datas);
+    hidl_vec<StaScanData>* hidl_scan_datas);
 bool convertLegacyLinkLayerStatsToHidl(
     const legacy_hal::LinkLayerStats& legacy_stats,
     V1_3::StaLinkLayerStats* hidl_stats);
@@ -14,10 +14,125 @@
  * limitations under the License.
  */
 
+#include <inttypes.h>
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <thread>
+#include <vector>
+
+#include <android-base/logging.h>
+#include <android-base/stringprintf.h>
+
 #include "hidl_sync_util.h"
 
+using android::base::StringAppendF;
+using android::hardware::wifi::V1_3::implementation::hidl_sync_util::LockDomain;
+
 namespace {
-std::recursive_mutex g_mutex;
+using Clock = std::chrono::steady_clock;
+
+// Domains held by the current thread, in acquisition order. Recursive
+// acquisitions appear once per acquisition.
+thread_local std::vector<const LockDomain*> held_domains;
+
+std::atomic<uint64_t> num_ordering_violations(0);
+
+uint64_t nanosSince(Clock::time_point start) {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() -
+                                                                start)
+        .count();
+}
+
+void updateMax(std::atomic<uint64_t>* max, uint64_t value) {
+    uint64_t cur = max->load(std::memory_order_relaxed);
+    while (value > cur &&
+           !max->compare_exchange_weak(cur, value, std::memory_order_relaxed)) {
+    }
+}
+
+// Registry of the live domains, for the debug dump.
+std::mutex& getDomainsLock() {
+    static std::mutex* lock = new std::mutex();
+    return *lock;
+}
+
+std::vector<const LockDomain*>& getDomains() {
+    static std::vector<const LockDomain*>* domains =
+        new std::vector<const LockDomain*>();
+    return *domains;
+}
+
+// Runs the queued callbacks in order on a single thread, which is started on
+// the first callback and lives as long as the process.
+class CallbackDispatcher {
+   public:
+    CallbackDispatcher()
+        : thread_started_(false),
+          num_dispatched_(0),
+          max_queue_depth_(0),
+          total_latency_ns_(0),
+          max_latency_ns_(0) {}
+
+    void post(std::function<void()> callback) {
+        std::lock_guard<std::mutex> lock(lock_);
+        if (!thread_started_) {
+            std::thread(&CallbackDispatcher::run, this).detach();
+            thread_started_ = true;
+        }
+        queue_.push_back({std::move(callback), Clock::now()});
+        max_queue_depth_ = std::max(max_queue_depth_, queue_.size());
+        cv_.notify_one();
+    }
+
+    void dumpStats(std::string* out) {
+        std::lock_guard<std::mutex> lock(lock_);
+        StringAppendF(out,
+                      "callback dispatcher: dispatched=%" PRIu64
+                      " queued=%zu max_queued=%zu latency_total_us=%" PRIu64
+                      " latency_max_us=%" PRIu64 "\n",
+                      num_dispatched_, queue_.size(), max_queue_depth_,
+                      total_latency_ns_ / 1000, max_latency_ns_ / 1000);
+    }
+
+   private:
+    struct Entry {
+        std::function<void()> callback;
+        Clock::time_point queued_at;
+    };
+
+    void run() {
+        std::unique_lock<std::mutex> lock(lock_);
+        while (true) {
+            cv_.wait(lock, [this] { return !queue_.empty(); });
+            Entry entry = std::move(queue_.front());
+            queue_.pop_front();
+            const uint64_t latency_ns = nanosSince(entry.queued_at);
+            num_dispatched_++;
+            total_latency_ns_ += latency_ns;
+            max_latency_ns_ = std::max(max_latency_ns_, latency_ns);
+            lock.unlock();
+            entry.callback();
+            lock.lock();
+        }
+    }
+
+    std::mutex lock_;
+    std::condition_variable cv_;
+    std::deque<Entry> queue_;
+    bool thread_started_;
+    uint64_t num_dispatched_;
+    size_t max_queue_depth_;
+    uint64_t total_latency_ns_;
+    uint64_t max_latency_ns_;
+};
+
+CallbackDispatcher& getDispatcher() {
+    static CallbackDispatcher* dispatcher = new CallbackDispatcher();
+    return *dispatcher;
+}
 }  // namespace
 
 namespace android {
@@ -27,8 +142,113 @@ namespace V1_3 {
 namespace implementation {
 namespace hidl_sync_util {
 
-std::unique_lock<std::recursive_mutex> acquireGlobalLock() {
-    return std::unique_lock<std::recursive_mutex>{g_mutex};
+LockDomain::LockDomain(const std::string& name, Rank rank)
+    : name_(name),
+      rank_(rank),
+      num_acquisitions_(0),
+      num_contended_(0),
+      total_wait_ns_(0),
+      max_wait_ns_(0) {
+    std::lock_guard<std::mutex> lock(getDomainsLock());
+    getDomains().push_back(this);
+}
+
+LockDomain::~LockDomain() {
+    std::lock_guard<std::mutex> lock(getDomainsLock());
+    auto& domains = getDomains();
+    domains.erase(std::remove(domains.begin(), domains.end(), this),
+                  domains.end());
+}
+
+void LockDomain::lock() {
+    checkOrdering();
+    if (mutex_.try_lock()) {
+        onLocked(0);
+        return;
+    }
+    const auto start = Clock::now();
+    mutex_.lock();
+    onLocked(nanosSince(start));
+}
+
+bool LockDomain::try_lock() {
+    if (!mutex_.try_lock()) {
+        return false;
+    }
+    onLocked(0);
+    return true;
+}
+
+void LockDomain::unlock() {
+    const auto it = std::find(held_domains.rbegin(), held_domains.rend(), this);
+    if (it != held_domains.rend()) {
+        held_domains.erase(std::next(it).base());
+    }
+    mutex_.unlock();
+}
+
+std::unique_lock<LockDomain> LockDomain::acquire() {
+    return std::unique_lock<LockDomain>(*this);
+}
+
+const std::string& LockDomain::getName() const { return name_; }
+
+void LockDomain::dumpStats(std::string* out) const {
+    StringAppendF(out,
+                  "%s: acquired=%" PRIu64 " contended=%" PRIu64
+                  " wait_total_us=%" PRIu64 " wait_max_us=%" PRIu64 "\n",
+                  name_.c_str(), num_acquisitions_.load(),
+                  num_contended_.load(), total_wait_ns_.load() / 1000,
+                  max_wait_ns_.load() / 1000);
+}
+
+void LockDomain::checkOrdering() const {
+    const LockDomain* innermost = nullptr;
+    for (const LockDomain* domain : held_domains) {
+        if (domain == this) {
+            return;
+        }
+        if (!innermost || domain->rank_ > innermost->rank_) {
+            innermost = domain;
+        }
+    }
+    if (innermost && innermost->rank_ >= rank_) {
+        num_ordering_violations++;
+        LOG(ERROR) << "Lock ordering violation: acquiring " << name_
+                   << " while holding " << innermost->name_;
+    }
+}
+
+void LockDomain::onLocked(uint64_t wait_ns) {
+    held_domains.push_back(this);
+    num_acquisitions_.fetch_add(1, std::memory_order_relaxed);
+    if (wait_ns > 0) {
+        num_contended_.fetch_add(1, std::memory_order_relaxed);
+        total_wait_ns_.fetch_add(wait_ns, std::memory_order_relaxed);
+        updateMax(&max_wait_ns_, wait_ns);
+    }
+}
+
+LockDomain& getChipLockDomain() {
+    static LockDomain* domain =
+        new LockDomain("chip", LockDomain::Rank::kChip);
+    return *domain;
+}
+
+void dispatchCallback(std::function<void()> callback) {
+    getDispatcher().post(std::move(callback));
+}
+
+void dumpLockStats(std::string* out) {
+    {
+        std::lock_guard<std::mutex> lock(getDomainsLock());
+        for (const LockDomain* domain : getDomains()) {
+            domain->dumpStats(out);
+        }
+    }
+    getDispatcher().dumpStats(out);
+    StringAppendF(out, "lock ordering violations: %" PRIu64 "\n",
+                  num_ordering_violations.load());
 }
 
 }  // namespace hidl_sync_util
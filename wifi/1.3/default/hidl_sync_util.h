@@ -17,17 +17,93 @@
 #ifndef HIDL_SYNC_UTIL_H_
 #define HIDL_SYNC_UTIL_H_
 
+#include <atomic>
+#include <functional>
 #include <mutex>
+#include <string>
 
-// Utility that provides a global lock to synchronize access between
-// the HIDL thread and the legacy HAL's event loop.
+#include <android-base/macros.h>
+
+// Utility that provides the locks used to synchronize access between
+// the HIDL thread and the threads delivering legacy HAL callbacks.
+// See THREADING.README for the lock ordering.
 namespace android {
 namespace hardware {
 namespace wifi {
 namespace V1_3 {
 namespace implementation {
 namespace hidl_sync_util {
-std::unique_lock<std::recursive_mutex> acquireGlobalLock();
+
+/**
+ * Recursive lock guarding the state of one chip or iface object.
+ *
+ * Domains are ranked, and a thread may only acquire a domain ranked after
+ * all the domains it already holds, apart from re-acquiring one it holds.
+ * Violations are logged and counted rather than treated as fatal.
+ *
+ * This is a Lockable type, so it works with std::unique_lock and
+ * std::condition_variable_any.
+ */
+class LockDomain {
+   public:
+    enum class Rank {
+        // IWifi, IWifiChip and the legacy HAL life cycle.
+        kChip = 0,
+        // A single iface or RTT controller.
+        kIface,
+        // The legacy HAL's asynchronous callback registrations.
+        kLegacyHalCallbacks,
+    };
+
+    LockDomain(const std::string& name, Rank rank);
+    ~LockDomain();
+
+    void lock();
+    bool try_lock();
+    void unlock();
+    std::unique_lock<LockDomain> acquire();
+
+    const std::string& getName() const;
+    // Appends the contention counters of this domain to |out|.
+    void dumpStats(std::string* out) const;
+
+   private:
+    void checkOrdering() const;
+    void onLocked(uint64_t wait_ns);
+
+    const std::string name_;
+    const Rank rank_;
+    std::recursive_mutex mutex_;
+    std::atomic<uint64_t> num_acquisitions_;
+    std::atomic<uint64_t> num_contended_;
+    std::atomic<uint64_t> total_wait_ns_;
+    std::atomic<uint64_t> max_wait_ns_;
+
+    DISALLOW_COPY_AND_ASSIGN(LockDomain);
+};
+
+// Domain shared by IWifi and the (single) IWifiChip.
+LockDomain& getChipLockDomain();
+
+// Acquires the lock domain of |obj|, or returns an unlocked lock if |obj| is
+// null. Used by callbacks which hold a promoted weak pointer.
+template <typename PtrT>
+std::unique_lock<LockDomain> acquireObjectLock(const PtrT& obj) {
+    if (!obj) {
+        return std::unique_lock<LockDomain>();
+    }
+    return obj->getLockDomain().acquire();
+}
+
+// Queues |callback| to run on the callback dispatcher thread. The legacy HAL
+// event loop uses this to hand callbacks over without waiting for the lock
+// domain of their target object.
+void dispatchCallback(std::function<void()> callback);
+
+// Appends the contention counters of all live lock domains and the callback
+// dispatcher to |out|.
+void dumpLockStats(std::string* out);
+
 }  // namespace hidl_sync_util
 }  // namespace implementation
 }  // namespace V1_3
@@ -0,0 +1,194 @@
+/*
+ * Copyright (C) 2019 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <inttypes.h>
+
+#include <algorithm>
+#include <numeric>
+
+#include <android-base/logging.h>
+#include <android-base/stringprintf.h>
+#include <utils/SystemClock.h>
+
+#include "link_layer_stats_sampler.h"
+
+namespace {
+using android::base::StringAppendF;
+
+// The legacy HAL counters are 32 bits wide, so compute their deltas modulo
+// 2^32 to handle wrap arounds.
+uint64_t counterDelta(uint32_t older, uint32_t newer) {
+    return static_cast<uint32_t>(newer - older);
+}
+
+template <size_t N>
+uint64_t sum(const std::array<uint64_t, N>& values) {
+    return std::accumulate(values.begin(), values.end(), uint64_t(0));
+}
+}  // namespace
+
+namespace android {
+namespace hardware {
+namespace wifi {
+namespace V1_3 {
+namespace implementation {
+
+double LinkLayerStatsSampler::Delta::perSecond(uint64_t count) const {
+    if (duration_ms == 0) {
+        return 0;
+    }
+    return count * 1000.0 / duration_ms;
+}
+
+LinkLayerStatsSampler::LinkLayerStatsSampler(
+    size_t history_size, std::chrono::milliseconds interval,
+    const Fetcher& fetcher, const Clock& clock)
+    : interval_(interval),
+      fetcher_(fetcher),
+      clock_(clock ? clock : []() -> uint64_t { return uptimeMillis(); }),
+      history_(history_size),
+      next_(0),
+      num_samples_(0),
+      last_seq_(0),
+      num_fetches_(0),
+      num_fetch_failures_(0),
+      num_cached_(0) {
+    CHECK(history_size > 0);
+}
+
+std::pair<legacy_hal::wifi_error, const LinkLayerStatsSampler::Sample*>
+LinkLayerStatsSampler::getSample() {
+    if (num_samples_ > 0) {
+        const Sample& newest = getSampleAt(0);
+        const uint64_t age_ms = clock_() - newest.timestamp_ms;
+        if (age_ms < static_cast<uint64_t>(interval_.count())) {
+            num_cached_++;
+            return {legacy_hal::WIFI_SUCCESS, &newest};
+        }
+    }
+    legacy_hal::wifi_error legacy_status;
+    legacy_hal::LinkLayerStats legacy_stats;
+    std::tie(legacy_status, legacy_stats) = fetcher_();
+    num_fetches_++;
+    if (legacy_status != legacy_hal::WIFI_SUCCESS) {
+        num_fetch_failures_++;
+        return {legacy_status, nullptr};
+    }
+    Sample& sample = history_[next_];
+    sample.seq = ++last_seq_;
+    sample.timestamp_ms = clock_();
+    sample.stats = std::move(legacy_stats);
+    next_ = (next_ + 1) % history_.size();
+    num_samples_ = std::min(num_samples_ + 1, history_.size());
+    return {legacy_hal::WIFI_SUCCESS, &sample};
+}
+
+bool LinkLayerStatsSampler::getDelta(std::chrono::milliseconds window,
+                                     Delta* delta) const {
+    if (!delta || num_samples_ < 2) {
+        return false;
+    }
+    const Sample& newest = getSampleAt(0);
+    size_t age = 1;
+    while (age + 1 < num_samples_ &&
+           newest.timestamp_ms - getSampleAt(age).timestamp_ms <
+               static_cast<uint64_t>(window.count())) {
+        age++;
+    }
+    computeDelta(getSampleAt(age), newest, delta);
+    return true;
+}
+
+void LinkLayerStatsSampler::clear() {
+    // |last_seq_| keeps increasing, so that samples taken after this are
+    // never mistaken for earlier ones.
+    next_ = 0;
+    num_samples_ = 0;
+}
+
+void LinkLayerStatsSampler::dump(std::string* out) const {
+    StringAppendF(out,
+                  "samples=%zu fetches=%" PRIu64 " fetch_failures=%" PRIu64
+                  " served_from_cache=%" PRIu64 " interval_ms=%" PRId64 "\n",
+                  num_samples_, num_fetches_, num_fetch_failures_, num_cached_,
+                  static_cast<int64_t>(interval_.count()));
+    for (size_t age = num_samples_; age > 1; age--) {
+        const Sample& newer = getSampleAt(age - 2);
+        Delta delta;
+        computeDelta(getSampleAt(age - 1), newer, &delta);
+        const uint64_t tx_mpdu = sum(delta.tx_mpdu);
+        const uint64_t rx_mpdu = sum(delta.rx_mpdu);
+        const uint64_t lost_mpdu = sum(delta.lost_mpdu);
+        const uint64_t retries = sum(delta.retries);
+        StringAppendF(
+            out,
+            "%" PRIu64 ": duration_ms=%" PRIu64 " beacon_rx=%" PRIu64
+            " tx_mpdu=%" PRIu64 " (%.1f/s) rx_mpdu=%" PRIu64
+            " (%.1f/s) lost_mpdu=%" PRIu64 " (%.1f/s) retries=%" PRIu64
+            " (%.1f/s) on_time_ms=%" PRIu64 " tx_time_ms=%" PRIu64
+            " rx_time_ms=%" PRIu64 " on_time_scan_ms=%" PRIu64 "\n",
+            newer.timestamp_ms, delta.duration_ms, delta.beacon_rx, tx_mpdu,
+            delta.perSecond(tx_mpdu), rx_mpdu, delta.perSecond(rx_mpdu),
+            lost_mpdu, delta.perSecond(lost_mpdu), retries,
+            delta.perSecond(retries), delta.on_time_ms, delta.tx_time_ms,
+            delta.rx_time_ms, delta.on_time_scan_ms);
+    }
+}
+
+const LinkLayerStatsSampler::Sample& LinkLayerStatsSampler::getSampleAt(
+    size_t age) const {
+    return history_[(next_ + history_.size() - 1 - age) % history_.size()];
+}
+
+void LinkLayerStatsSampler::computeDelta(const Sample& older,
+                                         const Sample& newer, Delta* delta) {
+    *delta = {};
+    delta->duration_ms = newer.timestamp_ms - older.timestamp_ms;
+    const auto& older_iface = older.stats.iface;
+    const auto& newer_iface = newer.stats.iface;
+    delta->beacon_rx =
+        counterDelta(older_iface.beacon_rx, newer_iface.beacon_rx);
+    for (size_t ac = 0; ac < legacy_hal::WIFI_AC_MAX; ac++) {
+        delta->tx_mpdu[ac] = counterDelta(older_iface.ac[ac].tx_mpdu,
+                                          newer_iface.ac[ac].tx_mpdu);
+        delta->rx_mpdu[ac] = counterDelta(older_iface.ac[ac].rx_mpdu,
+                                          newer_iface.ac[ac].rx_mpdu);
+        delta->lost_mpdu[ac] = counterDelta(older_iface.ac[ac].mpdu_lost,
+                                            newer_iface.ac[ac].mpdu_lost);
+        delta->retries[ac] = counterDelta(older_iface.ac[ac].retries,
+                                          newer_iface.ac[ac].retries);
+    }
+    const size_t num_radios =
+        std::min(older.stats.radios.size(), newer.stats.radios.size());
+    for (size_t i = 0; i < num_radios; i++) {
+        const auto& older_radio = older.stats.radios[i].stats;
+        const auto& newer_radio = newer.stats.radios[i].stats;
+        delta->on_time_ms +=
+            counterDelta(older_radio.on_time, newer_radio.on_time);
+        delta->tx_time_ms +=
+            counterDelta(older_radio.tx_time, newer_radio.tx_time);
+        delta->rx_time_ms +=
+            counterDelta(older_radio.rx_time, newer_radio.rx_time);
+        delta->on_time_scan_ms +=
+            counterDelta(older_radio.on_time_scan, newer_radio.on_time_scan);
+    }
+}
+
+}  // namespace implementation
+}  // namespace V1_3
+}  // namespace wifi
+}  // namespace hardware
+}  // namespace android
@@ -0,0 +1,127 @@
+/*
+ * Copyright (C) 2019 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef LINK_LAYER_STATS_SAMPLER_H_
+#define LINK_LAYER_STATS_SAMPLER_H_
+
+#include <array>
+#include <chrono>
+#include <functional>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <android-base/macros.h>
+
+#include "wifi_legacy_hal.h"
+
+namespace android {
+namespace hardware {
+namespace wifi {
+namespace V1_3 {
+namespace implementation {
+
+/**
+ * Samples the link layer stats of an iface into a fixed size history.
+ *
+ * A new sample is fetched from the legacy HAL only once the newest one is
+ * older than the sampling interval, so repeated queries within an interval
+ * are served from the newest sample without a driver round trip. The history
+ * is used to compute deltas and rates between samples.
+ *
+ * Not thread safe, it is only used on the HIDL thread.
+ */
+class LinkLayerStatsSampler {
+   public:
+    using Fetcher = std::function<
+        std::pair<legacy_hal::wifi_error, legacy_hal::LinkLayerStats>()>;
+    // Returns the current time in milliseconds.
+    using Clock = std::function<uint64_t()>;
+
+    struct Sample {
+        // Increases with every sample taken, starting from 1.
+        uint64_t seq;
+        uint64_t timestamp_ms;
+        legacy_hal::LinkLayerStats stats;
+    };
+
+    // Change of the counters between two samples.
+    struct Delta {
+        // Returns the rate per second of |count| over this delta.
+        double perSecond(uint64_t count) const;
+
+        uint64_t duration_ms;
+        uint64_t beacon_rx;
+        // Indexed by |legacy_hal::wifi_traffic_ac|.
+        std::array<uint64_t, legacy_hal::WIFI_AC_MAX> tx_mpdu;
+        std::array<uint64_t, legacy_hal::WIFI_AC_MAX> rx_mpdu;
+        std::array<uint64_t, legacy_hal::WIFI_AC_MAX> lost_mpdu;
+        std::array<uint64_t, legacy_hal::WIFI_AC_MAX> retries;
+        // Summed over the radios present in both samples.
+        uint64_t on_time_ms;
+        uint64_t tx_time_ms;
+        uint64_t rx_time_ms;
+        uint64_t on_time_scan_ms;
+    };
+
+    // |clock| defaults to uptimeMillis(), which is also the time base of
+    // the HIDL stats.
+    LinkLayerStatsSampler(size_t history_size,
+                          std::chrono::milliseconds interval,
+                          const Fetcher& fetcher,
+                          const Clock& clock = nullptr);
+
+    // Returns the newest sample, after fetching a new one if it is older
+    // than the sampling interval. The sample stays valid until the next
+    // call to |getSample| or |clear|.
+    std::pair<legacy_hal::wifi_error, const Sample*> getSample();
+    // Computes the delta between the newest sample and the newest one at
+    // least |window| older, or the oldest one if there is none. Returns false
+    // if there are less than two samples.
+    bool getDelta(std::chrono::milliseconds window, Delta* delta) const;
+    // Drops the history, e.g. when the driver counters are reset.
+    void clear();
+    // Appends the sampling counters and the delta between each pair of
+    // consecutive samples to |out|.
+    void dump(std::string* out) const;
+
+   private:
+    const Sample& getSampleAt(size_t age) const;
+    static void computeDelta(const Sample& older, const Sample& newer,
+                             Delta* delta);
+
+    const std::chrono::milliseconds interval_;
+    const Fetcher fetcher_;
+    const Clock clock_;
+    // Fixed size ring of samples, |next_| is the slot overwritten next.
+    std::vector<Sample> history_;
+    size_t next_;
+    size_t num_samples_;
+    uint64_t last_seq_;
+    uint64_t num_fetches_;
+    uint64_t num_fetch_failures_;
+    uint64_t num_cached_;
+
+    DISALLOW_COPY_AND_ASSIGN(LinkLayerStatsSampler);
+};
+
+}  // namespace implementation
+}  // namespace V1_3
+}  // namespace wifi
+}  // namespace hardware
+}  // namespace android
+
+#endif  // LINK_LAYER_STATS_SAMPLER_H_
@@ -14,37 +14,194 @@
  * limitations under the License.
  */
 
+#include <limits.h>
+#include <string.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include <algorithm>
+
 #include <android-base/logging.h>
 
 #include "ringbuffer.h"
 
+namespace {
+// Payloads handed to a single writev() call. Each record needs up to two
+// iovecs when it wraps around the end of the buffer.
+constexpr int kMaxIovecs = std::min(IOV_MAX, 256);
+
+// Writes all the iovecs, retrying after partial writes.
+bool writevFully(int fd, struct iovec* iov, int iovcnt) {
+    while (iovcnt > 0) {
+        ssize_t written = TEMP_FAILURE_RETRY(writev(fd, iov, iovcnt));
+        if (written < 0) {
+            return false;
+        }
+        while (iovcnt > 0 && static_cast<size_t>(written) >= iov->iov_len) {
+            written -= iov->iov_len;
+            iov++;
+            iovcnt--;
+        }
+        if (iovcnt > 0) {
+            iov->iov_base = static_cast<uint8_t*>(iov->iov_base) + written;
+            iov->iov_len -= written;
+        }
+    }
+    return true;
+}
+}  // namespace
+
 namespace android {
 namespace hardware {
 namespace wifi {
 namespace V1_3 {
 namespace implementation {
 
-Ringbuffer::Ringbuffer(size_t maxSize) : size_(0), maxSize_(maxSize) {}
+Ringbuffer::Ringbuffer(size_t maxSize)
+    : maxSize_(maxSize),
+      head_(0),
+      tail_(0),
+      pin_(kNotPinned),
+      num_dropped_records_(0) {}
 
 void Ringbuffer::append(const std::vector<uint8_t>& input) {
-    if (input.size() == 0) {
+    append(input.data(), input.size());
+}
+
+void Ringbuffer::append(const uint8_t* data, size_t size) {
+    if (size == 0) {
         return;
     }
-    if (input.size() > maxSize_) {
-        LOG(INFO) << "Oversized message of " << input.size()
-                  << " bytes is dropped";
+    const size_t record_size = kRecordHeaderSize + size;
+    if (record_size > maxSize_) {
+        LOG(INFO) << "Oversized message of " << size << " bytes is dropped";
         return;
     }
-    data_.push_back(input);
-    size_ += input.size() * sizeof(input[0]);
-    while (size_ > maxSize_) {
-        size_ -= data_.front().size() * sizeof(data_.front()[0]);
-        data_.pop_front();
+    uint64_t start;
+    {
+        std::lock_guard<std::mutex> lock(lock_);
+        if (!data_) {
+            data_.reset(new uint8_t[maxSize_]);
+        }
+        uint64_t head = head_;
+        while (tail_ + record_size - head > maxSize_) {
+            if (head >= pin_) {
+                num_dropped_records_++;
+                return;
+            }
+            head += kRecordHeaderSize + readRecordSize(head);
+        }
+        head_ = head;
+        start = tail_;
+    }
+    // Space past |tail_| is invisible to readers until |tail_| is updated.
+    const uint32_t header = static_cast<uint32_t>(size);
+    copyIn(start, reinterpret_cast<const uint8_t*>(&header), kRecordHeaderSize);
+    copyIn(start + kRecordHeaderSize, data, size);
+    std::lock_guard<std::mutex> lock(lock_);
+    tail_ = start + record_size;
+}
+
+bool Ringbuffer::empty() {
+    std::lock_guard<std::mutex> lock(lock_);
+    return head_ == tail_;
+}
+
+std::vector<std::vector<uint8_t>> Ringbuffer::getData() {
+    std::lock_guard<std::mutex> read_lock(read_lock_);
+    uint64_t pos, end;
+    pin(&pos, &end);
+    std::vector<std::vector<uint8_t>> records;
+    while (pos < end) {
+        std::vector<uint8_t> record(readRecordSize(pos));
+        copyOut(pos + kRecordHeaderSize, record.data(), record.size());
+        pos += kRecordHeaderSize + record.size();
+        records.push_back(std::move(record));
+    }
+    updatePin(kNotPinned);
+    return records;
+}
+
+bool Ringbuffer::writeToFile(int fd) { return writeToFile(fd, nullptr); }
+
+bool Ringbuffer::writeToFile(int fd,
+                             const std::function<bool(size_t)>& before_write) {
+    std::lock_guard<std::mutex> read_lock(read_lock_);
+    uint64_t pos, end;
+    pin(&pos, &end);
+    if (before_write) {
+        size_t size = 0;
+        for (uint64_t cur = pos; cur < end;) {
+            const size_t record_size = readRecordSize(cur);
+            size += record_size;
+            cur += kRecordHeaderSize + record_size;
+        }
+        if (!before_write(size)) {
+            updatePin(kNotPinned);
+            return true;
+        }
+    }
+    struct iovec iov[kMaxIovecs];
+    bool success = true;
+    while (pos < end) {
+        int iovcnt = 0;
+        while (pos < end && iovcnt + 2 <= kMaxIovecs) {
+            const size_t size = readRecordSize(pos);
+            const size_t offset = (pos + kRecordHeaderSize) % maxSize_;
+            const size_t first = std::min(size, maxSize_ - offset);
+            iov[iovcnt++] = {data_.get() + offset, first};
+            if (first < size) {
+                iov[iovcnt++] = {data_.get(), size - first};
+            }
+            pos += kRecordHeaderSize + size;
+        }
+        if (!writevFully(fd, iov, iovcnt)) {
+            PLOG(ERROR) << "Error writing to file";
+            success = false;
+            break;
+        }
+        // Let the producer reuse the space written out.
+        updatePin(pos);
     }
+    updatePin(kNotPinned);
+    return success;
+}
+
+size_t Ringbuffer::getNumDroppedRecords() {
+    std::lock_guard<std::mutex> lock(lock_);
+    return num_dropped_records_;
+}
+
+void Ringbuffer::pin(uint64_t* begin, uint64_t* end) {
+    std::lock_guard<std::mutex> lock(lock_);
+    pin_ = head_;
+    *begin = head_;
+    *end = tail_;
+}
+
+void Ringbuffer::updatePin(uint64_t pos) {
+    std::lock_guard<std::mutex> lock(lock_);
+    pin_ = pos;
+}
+
+uint32_t Ringbuffer::readRecordSize(uint64_t pos) const {
+    uint32_t size;
+    copyOut(pos, reinterpret_cast<uint8_t*>(&size), kRecordHeaderSize);
+    return size;
+}
+
+void Ringbuffer::copyIn(uint64_t pos, const uint8_t* src, size_t size) {
+    const size_t offset = pos % maxSize_;
+    const size_t first = std::min(size, maxSize_ - offset);
+    memcpy(data_.get() + offset, src, first);
+    memcpy(data_.get(), src + first, size - first);
 }
 
-const std::list<std::vector<uint8_t>>& Ringbuffer::getData() const {
-    return data_;
+void Ringbuffer::copyOut(uint64_t pos, uint8_t* dst, size_t size) const {
+    const size_t offset = pos % maxSize_;
+    const size_t first = std::min(size, maxSize_ - offset);
+    memcpy(dst, data_.get() + offset, first);
+    memcpy(dst + first, data_.get(), size - first);
 }
 
 }  // namespace implementation
@@ -17,7 +17,10 @@
 #ifndef RINGBUFFER_H_
 #define RINGBUFFER_H_
 
-#include <list>
+#include <functional>
+#include <limits>
+#include <memory>
+#include <mutex>
 #include <vector>
 
 namespace android {
@@ -28,20 +31,62 @@ namespace implementation {
 
 /**
  * Ringbuffer object used to store debug data.
+ *
+ * Records are stored back to back in a fixed capacity circular byte buffer,
+ * each prefixed with its length. The buffer is allocated on the first append.
+ *
+ * Data is appended from the legacy HAL event loop thread and read from the
+ * HIDL thread. A reader pins the records it has not consumed yet, so the
+ * producer never overwrites them and never waits for the reader's I/O either:
+ * records which would need to evict pinned data are dropped instead.
  */
 class Ringbuffer {
    public:
+    static constexpr size_t kRecordHeaderSize = sizeof(uint32_t);
+
     explicit Ringbuffer(size_t maxSize);
 
     // Appends the data buffer and deletes from the front until buffer is
-    // within |maxSize_|.
+    // within |maxSize_|. Only one thread may append at a time.
     void append(const std::vector<uint8_t>& input);
-    const std::list<std::vector<uint8_t>>& getData() const;
+    void append(const uint8_t* data, size_t size);
+
+    bool empty();
+    // Returns a copy of the stored records, oldest first.
+    std::vector<std::vector<uint8_t>> getData();
+    // Writes the stored records back to back to |fd| straight from the
+    // buffer.
+    bool writeToFile(int fd);
+    // Same as above, but first calls |before_write| with the number of bytes
+    // about to be written, e.g. to emit an archive entry header. Nothing is
+    // written if it returns false.
+    bool writeToFile(int fd, const std::function<bool(size_t)>& before_write);
+    // Number of records dropped because a reader had them pinned.
+    size_t getNumDroppedRecords();
 
    private:
-    std::list<std::vector<uint8_t>> data_;
-    size_t size_;
-    size_t maxSize_;
+    static constexpr uint64_t kNotPinned = std::numeric_limits<uint64_t>::max();
+
+    // Pins the stored records for the calling reader and returns their
+    // range, readers are serialized by |read_lock_|.
+    void pin(uint64_t* begin, uint64_t* end);
+    void updatePin(uint64_t pos);
+    uint32_t readRecordSize(uint64_t pos) const;
+    void copyIn(uint64_t pos, const uint8_t* src, size_t size);
+    void copyOut(uint64_t pos, uint8_t* dst, size_t size) const;
+
+    const size_t maxSize_;
+    std::unique_ptr<uint8_t[]> data_;
+    // Guards the offsets below. It is never held while copying data, so
+    // neither side waits for more than an offset update.
+    std::mutex lock_;
+    // Offsets grow monotonically, the position in |data_| is the offset
+    // modulo |maxSize_|.
+    uint64_t head_;  // oldest record
+    uint64_t tail_;  // end of the newest record
+    uint64_t pin_;   // oldest offset a reader still needs
+    size_t num_dropped_records_;
+    std::mutex read_lock_;
 };
 
 }  // namespace implementation
@@ -0,0 +1,199 @@
+/*
+ * Copyright (C) 2019, The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <zlib.h>
+
+#include <utility>
+#include <vector>
+
+#include <gmock/gmock.h>
+
+#include "cpio_archive_writer.h"
+
+using testing::ElementsAre;
+using testing::Pair;
+using testing::Test;
+
+namespace {
+constexpr size_t kCpioHeaderSize = 110;
+
+size_t alignTo4(size_t size) { return (size + 3) & ~static_cast<size_t>(3); }
+
+std::string readAll(FILE* file) {
+    std::string data;
+    rewind(file);
+    char buf[4096];
+    size_t bytes_read;
+    while ((bytes_read = fread(buf, 1, sizeof(buf), file)) > 0) {
+        data.append(buf, bytes_read);
+    }
+    return data;
+}
+
+std::string gunzip(const std::string& data) {
+    z_stream stream = {};
+    EXPECT_EQ(Z_OK, inflateInit2(&stream, 15 + 16));
+    stream.next_in =
+        reinterpret_cast<Bytef*>(const_cast<char*>(data.data()));
+    stream.avail_in = data.size();
+    std::string out;
+    int ret;
+    do {
+        char buf[4096];
+        stream.next_out = reinterpret_cast<Bytef*>(buf);
+        stream.avail_out = sizeof(buf);
+        ret = inflate(&stream, Z_NO_FLUSH);
+        out.append(buf, sizeof(buf) - stream.avail_out);
+    } while (ret == Z_OK);
+    EXPECT_EQ(Z_STREAM_END, ret);
+    inflateEnd(&stream);
+    return out;
+}
+
+// Returns the name and content of each entry, and checks that the archive is
+// terminated.
+std::vector<std::pair<std::string, std::string>> parseArchive(
+    const std::string& archive) {
+    std::vector<std::pair<std::string, std::string>> entries;
+    size_t pos = 0;
+    while (pos + kCpioHeaderSize <= archive.size()) {
+        EXPECT_EQ("070701", archive.substr(pos, 6));
+        const size_t size =
+            strtoul(archive.substr(pos + 54, 8).c_str(), nullptr, 16);
+        const size_t name_size =
+            strtoul(archive.substr(pos + 94, 8).c_str(), nullptr, 16);
+        const std::string name =
+            archive.substr(pos + kCpioHeaderSize, name_size - 1);
+        pos = alignTo4(pos + kCpioHeaderSize + name_size);
+        if (name == "TRAILER!!!") {
+            EXPECT_EQ(archive.size(), pos);
+            return entries;
+        }
+        entries.emplace_back(name, archive.substr(pos, size));
+        pos = alignTo4(pos + size);
+    }
+    ADD_FAILURE() << "Archive is not terminated";
+    return entries;
+}
+}  // namespace
+
+namespace android {
+namespace hardware {
+namespace wifi {
+namespace V1_3 {
+namespace implementation {
+
+class CpioArchiveWriterTest : public Test {
+   public:
+    void SetUp() override {
+        out_file_ = tmpfile();
+        in_file_ = tmpfile();
+        ASSERT_NE(nullptr, out_file_);
+        ASSERT_NE(nullptr, in_file_);
+        fputs("file content", in_file_);
+        fflush(in_file_);
+        in_file_path_ = "/proc/self/fd/" + std::to_string(fileno(in_file_));
+    }
+
+    void TearDown() override {
+        fclose(out_file_);
+        fclose(in_file_);
+    }
+
+    FILE* out_file_;
+    FILE* in_file_;
+    std::string in_file_path_;
+};
+
+TEST_F(CpioArchiveWriterTest, WriteEmptyArchive) {
+    CpioArchiveWriter writer(fileno(out_file_), {});
+    EXPECT_TRUE(writer.finish());
+    EXPECT_TRUE(parseArchive(readAll(out_file_)).empty());
+}
+
+TEST_F(CpioArchiveWriterTest, WriteEntries) {
+    CpioArchiveWriter writer(fileno(out_file_), {});
+    EXPECT_TRUE(writer.addData("data", "abcde"));
+    EXPECT_TRUE(writer.addFile(in_file_path_, "file"));
+    ASSERT_TRUE(writer.beginEntry("streamed", 3, 0));
+    EXPECT_EQ(3, write(writer.getContentFd(), "xyz", 3));
+    EXPECT_TRUE(writer.endEntry(true));
+    EXPECT_TRUE(writer.finish());
+    EXPECT_EQ(0u, writer.getNumErrors());
+    EXPECT_THAT(parseArchive(readAll(out_file_)),
+                ElementsAre(Pair("data", "abcde"), Pair("file", "file content"),
+                            Pair("streamed", "xyz")));
+}
+
+TEST_F(CpioArchiveWriterTest, SkipEntriesOverSizeBudget) {
+    CpioArchiveWriter::Options options;
+    // Too small for the large entry.
+    options.max_bytes = 2 * 256;
+    CpioArchiveWriter writer(fileno(out_file_), options);
+    EXPECT_TRUE(writer.addData("small", "abc"));
+    EXPECT_FALSE(writer.addData("large", std::string(256, 'x')));
+    EXPECT_TRUE(writer.addData("small2", "def"));
+    EXPECT_TRUE(writer.finish());
+    EXPECT_EQ(1u, writer.getNumSkippedEntries());
+    const std::string archive = readAll(out_file_);
+    EXPECT_LE(archive.size(), options.max_bytes);
+    EXPECT_THAT(parseArchive(archive),
+                ElementsAre(Pair("small", "abc"), Pair("small2", "def")));
+}
+
+TEST_F(CpioArchiveWriterTest, SkipEntriesOverTimeBudget) {
+    CpioArchiveWriter::Options options;
+    options.max_duration = std::chrono::milliseconds(0);
+    CpioArchiveWriter writer(fileno(out_file_), options);
+    EXPECT_FALSE(writer.addData("data", "abcde"));
+    EXPECT_FALSE(writer.addFile(in_file_path_, "file"));
+    EXPECT_TRUE(writer.finish());
+    EXPECT_EQ(2u, writer.getNumSkippedEntries());
+    EXPECT_TRUE(parseArchive(readAll(out_file_)).empty());
+}
+
+TEST_F(CpioArchiveWriterTest, WriteCompressedArchive) {
+    CpioArchiveWriter::Options options;
+    options.compress = true;
+    CpioArchiveWriter writer(fileno(out_file_), options);
+    EXPECT_TRUE(writer.addData("data", std::string(100000, 'x')));
+    EXPECT_TRUE(writer.addFile(in_file_path_, "file"));
+    EXPECT_TRUE(writer.finish());
+    const std::string archive = readAll(out_file_);
+    EXPECT_LT(archive.size(), 100000u);
+    EXPECT_THAT(parseArchive(gunzip(archive)),
+                ElementsAre(Pair("data", std::string(100000, 'x')),
+                            Pair("file", "file content")));
+}
+
+TEST_F(CpioArchiveWriterTest, FailedEntryStopsArchive) {
+    CpioArchiveWriter writer(fileno(out_file_), {});
+    EXPECT_FALSE(writer.addFile("/does/not/exist", "missing"));
+    EXPECT_TRUE(writer.addData("data", "abcde"));
+    ASSERT_TRUE(writer.beginEntry("failed", 3, 0));
+    EXPECT_FALSE(writer.endEntry(false));
+    EXPECT_FALSE(writer.addData("data2", "abcde"));
+    EXPECT_FALSE(writer.finish());
+    EXPECT_EQ(2u, writer.getNumErrors());
+}
+}  // namespace implementation
+}  // namespace V1_3
+}  // namespace wifi
+}  // namespace hardware
+}  // namespace android
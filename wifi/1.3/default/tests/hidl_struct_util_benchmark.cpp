@@ -0,0 +1,140 @@
+/*
+ * Copyright (C) 2019, The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <algorithm>
+#include <memory>
+#include <vector>
+
+#include <benchmark/benchmark.h>
+
+#include "hidl_struct_util.h"
+
+namespace android {
+namespace hardware {
+namespace wifi {
+namespace V1_3 {
+namespace implementation {
+namespace hidl_struct_util {
+
+namespace {
+
+// Typical IE length in a beacon (vendor specific IEs, rates, HT/VHT caps).
+constexpr uint8_t kIeLen = 24;
+
+void fillLegacyScanResult(int idx, legacy_hal::wifi_scan_result* result) {
+    result->ts = 1000 + idx;
+    snprintf(result->ssid, sizeof(result->ssid), "ssid-%d", idx);
+    for (size_t i = 0; i < sizeof(result->bssid); i++) {
+        result->bssid[i] = static_cast<uint8_t>(idx >> (8 * (i % 4)));
+    }
+    result->channel = 2412 + 5 * (idx % 13);
+    result->rssi = -40 - idx % 50;
+    result->beacon_period = 100;
+    result->capability = 0x431;
+}
+
+// Cached scans holding |num_bssids| results in total, without IEs.
+std::vector<legacy_hal::wifi_cached_scan_results> makeCachedScanResults(
+    int num_bssids) {
+    std::vector<legacy_hal::wifi_cached_scan_results> scans;
+    for (int idx = 0; idx < num_bssids; idx++) {
+        if (idx % MAX_AP_CACHE_PER_SCAN == 0) {
+            scans.emplace_back();
+            memset(&scans.back(), 0, sizeof(scans.back()));
+            scans.back().scan_id = scans.size();
+        }
+        auto& scan = scans.back();
+        fillLegacyScanResult(idx, &scan.results[scan.num_results++]);
+    }
+    return scans;
+}
+
+// A full scan result carrying |num_ies| IEs, as delivered by the legacy HAL.
+std::unique_ptr<uint8_t[]> makeFullScanResult(int idx, int num_ies) {
+    using wifi_ie = legacy_hal::wifi_information_element;
+    const size_t ie_length = num_ies * (sizeof(wifi_ie) + kIeLen);
+    const size_t size =
+        offsetof(legacy_hal::wifi_scan_result, ie_data) + ie_length;
+    std::unique_ptr<uint8_t[]> buffer(
+        new uint8_t[std::max(size, sizeof(legacy_hal::wifi_scan_result))]());
+    auto* result =
+        reinterpret_cast<legacy_hal::wifi_scan_result*>(buffer.get());
+    fillLegacyScanResult(idx, result);
+    result->ie_length = ie_length;
+    uint8_t* next_ie = reinterpret_cast<uint8_t*>(result->ie_data);
+    for (int ie_idx = 0; ie_idx < num_ies; ie_idx++) {
+        auto* ie = reinterpret_cast<wifi_ie*>(next_ie);
+        ie->id = ie_idx;
+        ie->len = kIeLen;
+        memset(ie->data, ie_idx, kIeLen);
+        next_ie += sizeof(wifi_ie) + kIeLen;
+    }
+    return buffer;
+}
+}  // namespace
+
+// Background scan results delivered through |onBackgroundScanResults|,
+// argument is the number of BSSIDs.
+static void BM_ConvertCachedScanResults(benchmark::State& state) {
+    const auto legacy_scans = makeCachedScanResults(state.range(0));
+    for (auto _ : state) {
+        hidl_vec<StaScanData> hidl_scan_datas;
+        benchmark::DoNotOptimize(convertLegacyVectorOfCachedGscanResultsToHidl(
+            legacy_scans, &hidl_scan_datas));
+        benchmark::DoNotOptimize(hidl_scan_datas.data());
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_ConvertCachedScanResults)->Arg(16)->Arg(64)->Arg(256)->Arg(1024);
+
+// Full scan results delivered through |onBackgroundFullScanResult|, one per
+// BSSID. Arguments are the number of BSSIDs and of IEs per BSSID.
+static void BM_ConvertFullScanResults(benchmark::State& state) {
+    std::vector<std::unique_ptr<uint8_t[]>> legacy_results;
+    for (int idx = 0; idx < state.range(0); idx++) {
+        legacy_results.push_back(makeFullScanResult(idx, state.range(1)));
+    }
+    for (auto _ : state) {
+        for (const auto& legacy_result : legacy_results) {
+            StaScanResult hidl_scan_result;
+            benchmark::DoNotOptimize(convertLegacyGscanResultToHidl(
+                *reinterpret_cast<const legacy_hal::wifi_scan_result*>(
+                    legacy_result.get()),
+                true, &hidl_scan_result));
+            benchmark::DoNotOptimize(
+                hidl_scan_result.informationElements.data());
+        }
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_ConvertFullScanResults)
+    ->Args({16, 8})
+    ->Args({16, 32})
+    ->Args({256, 8})
+    ->Args({256, 32});
+
+}  // namespace hidl_struct_util
+}  // namespace implementation
+}  // namespace V1_3
+}  // namespace wifi
+}  // namespace hardware
+}  // namespace android
+
+BENCHMARK_MAIN();
@@ -0,0 +1,140 @@
+/*
+ * Copyright (C) 2019, The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <condition_variable>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <gmock/gmock.h>
+
+#include "hidl_sync_util.h"
+
+using testing::HasSubstr;
+using testing::Test;
+
+namespace android {
+namespace hardware {
+namespace wifi {
+namespace V1_3 {
+namespace implementation {
+namespace hidl_sync_util {
+
+class HidlSyncUtilTest : public Test {
+   public:
+    LockDomain chip_domain_{"test_chip", LockDomain::Rank::kChip};
+    LockDomain iface_domain_{"test_iface", LockDomain::Rank::kIface};
+
+    // Returns the ordering violation count reported by the debug dump.
+    static uint64_t getNumOrderingViolations() {
+        const std::string kPrefix = "lock ordering violations: ";
+        std::string stats;
+        dumpLockStats(&stats);
+        const size_t pos = stats.find(kPrefix);
+        EXPECT_NE(std::string::npos, pos);
+        return std::stoull(stats.substr(pos + kPrefix.size()));
+    }
+};
+
+TEST_F(HidlSyncUtilTest, DomainIsRecursive) {
+    const auto lock = chip_domain_.acquire();
+    const auto lock2 = chip_domain_.acquire();
+    EXPECT_TRUE(lock.owns_lock());
+    EXPECT_TRUE(lock2.owns_lock());
+}
+
+TEST_F(HidlSyncUtilTest, OrderedAcquisitionIsNotAViolation) {
+    const uint64_t num_violations = getNumOrderingViolations();
+    {
+        const auto lock = chip_domain_.acquire();
+        const auto lock2 = iface_domain_.acquire();
+        // Re-acquiring a held domain is allowed regardless of its rank.
+        const auto lock3 = chip_domain_.acquire();
+    }
+    EXPECT_EQ(num_violations, getNumOrderingViolations());
+}
+
+TEST_F(HidlSyncUtilTest, OutOfOrderAcquisitionIsCounted) {
+    const uint64_t num_violations = getNumOrderingViolations();
+    {
+        const auto lock = iface_domain_.acquire();
+        const auto lock2 = chip_domain_.acquire();
+        EXPECT_TRUE(lock2.owns_lock());
+    }
+    EXPECT_EQ(num_violations + 1, getNumOrderingViolations());
+
+    // Acquiring a domain of the same rank as a held one is also a violation.
+    LockDomain other_iface_domain("test_other_iface", LockDomain::Rank::kIface);
+    {
+        const auto lock = iface_domain_.acquire();
+        const auto lock2 = other_iface_domain.acquire();
+    }
+    EXPECT_EQ(num_violations + 2, getNumOrderingViolations());
+}
+
+TEST_F(HidlSyncUtilTest, DumpIncludesLiveDomains) {
+    {
+        const auto lock = chip_domain_.acquire();
+        const auto lock2 = iface_domain_.acquire();
+    }
+    std::string stats;
+    dumpLockStats(&stats);
+    EXPECT_THAT(stats, HasSubstr("test_chip: acquired=1 contended=0"));
+    EXPECT_THAT(stats, HasSubstr("test_iface: acquired=1 contended=0"));
+    EXPECT_THAT(stats, HasSubstr("lock ordering violations:"));
+}
+
+TEST_F(HidlSyncUtilTest, DumpExcludesDestroyedDomains) {
+    {
+        LockDomain domain("test_destroyed", LockDomain::Rank::kIface);
+    }
+    std::string stats;
+    dumpLockStats(&stats);
+    EXPECT_THAT(stats, testing::Not(HasSubstr("test_destroyed")));
+}
+
+TEST_F(HidlSyncUtilTest, AcquireObjectLock) {
+    struct Object {
+        LockDomain& getLockDomain() { return domain; }
+        LockDomain domain{"test_object", LockDomain::Rank::kIface};
+    };
+    std::shared_ptr<Object> obj;
+    EXPECT_FALSE(acquireObjectLock(obj).owns_lock());
+    obj = std::make_shared<Object>();
+    EXPECT_TRUE(acquireObjectLock(obj).owns_lock());
+}
+
+TEST_F(HidlSyncUtilTest, DispatchRunsCallbacksInOrder) {
+    std::condition_variable_any cv;
+    std::vector<int> order;
+    constexpr int kNumCallbacks = 5;
+    for (int i = 0; i < kNumCallbacks; i++) {
+        dispatchCallback([&, i]() {
+            const auto lock = chip_domain_.acquire();
+            order.push_back(i);
+            cv.notify_all();
+        });
+    }
+    auto lock = chip_domain_.acquire();
+    cv.wait(lock, [&]() { return order.size() == kNumCallbacks; });
+    EXPECT_EQ(std::vector<int>({0, 1, 2, 3, 4}), order);
+}
+}  // namespace hidl_sync_util
+}  // namespace implementation
+}  // namespace V1_3
+}  // namespace wifi
+}  // namespace hardware
+}  // namespace android
@@ -0,0 +1,184 @@
+/*
+ * Copyright (C) 2019, The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <string.h>
+
+#include <algorithm>
+
+#include <gmock/gmock.h>
+
+#include "link_layer_stats_sampler.h"
+
+using testing::Test;
+
+namespace {
+constexpr size_t kHistorySize = 4;
+constexpr std::chrono::milliseconds kInterval(1000);
+}  // namespace
+
+namespace android {
+namespace hardware {
+namespace wifi {
+namespace V1_3 {
+namespace implementation {
+
+class LinkLayerStatsSamplerTest : public Test {
+   public:
+    LinkLayerStatsSamplerTest()
+        : sampler_(kHistorySize, kInterval,
+                   [this]() {
+                       num_fetches_++;
+                       return std::make_pair(status_, stats_);
+                   },
+                   [this]() { return now_ms_; }) {
+        memset(&stats_.iface, 0, sizeof(stats_.iface));
+        stats_.radios.resize(1);
+        memset(&stats_.radios[0].stats, 0, sizeof(stats_.radios[0].stats));
+    }
+
+    // Advances the clock and the driver counters at a constant rate of
+    // |count| per second.
+    void advance(uint64_t duration_ms, uint32_t count) {
+        now_ms_ += duration_ms;
+        stats_.iface.beacon_rx += count;
+        stats_.iface.ac[legacy_hal::WIFI_AC_BE].tx_mpdu += count;
+        stats_.radios[0].stats.on_time += duration_ms;
+    }
+
+    legacy_hal::wifi_error status_ = legacy_hal::WIFI_SUCCESS;
+    legacy_hal::LinkLayerStats stats_;
+    uint64_t now_ms_ = 10000;
+    int num_fetches_ = 0;
+    LinkLayerStatsSampler sampler_;
+};
+
+TEST_F(LinkLayerStatsSamplerTest, ServesCachedSampleWithinInterval) {
+    const auto first = sampler_.getSample();
+    ASSERT_EQ(legacy_hal::WIFI_SUCCESS, first.first);
+    ASSERT_NE(nullptr, first.second);
+    EXPECT_EQ(1u, first.second->seq);
+    EXPECT_EQ(now_ms_, first.second->timestamp_ms);
+
+    advance(kInterval.count() - 1, 10);
+    const auto cached = sampler_.getSample();
+    EXPECT_EQ(first.second, cached.second);
+    EXPECT_EQ(1u, cached.second->seq);
+    EXPECT_EQ(0u, cached.second->stats.iface.beacon_rx);
+    EXPECT_EQ(1, num_fetches_);
+
+    advance(1, 0);
+    const auto fresh = sampler_.getSample();
+    ASSERT_NE(nullptr, fresh.second);
+    EXPECT_EQ(2u, fresh.second->seq);
+    EXPECT_EQ(10u, fresh.second->stats.iface.beacon_rx);
+    EXPECT_EQ(2, num_fetches_);
+}
+
+TEST_F(LinkLayerStatsSamplerTest, FetchFailure) {
+    status_ = legacy_hal::WIFI_ERROR_NOT_AVAILABLE;
+    const auto result = sampler_.getSample();
+    EXPECT_EQ(legacy_hal::WIFI_ERROR_NOT_AVAILABLE, result.first);
+    EXPECT_EQ(nullptr, result.second);
+
+    // Failures are not cached.
+    status_ = legacy_hal::WIFI_SUCCESS;
+    const auto retry = sampler_.getSample();
+    EXPECT_EQ(legacy_hal::WIFI_SUCCESS, retry.first);
+    ASSERT_NE(nullptr, retry.second);
+    EXPECT_EQ(1u, retry.second->seq);
+    EXPECT_EQ(2, num_fetches_);
+}
+
+TEST_F(LinkLayerStatsSamplerTest, ComputeDelta) {
+    LinkLayerStatsSampler::Delta delta;
+    sampler_.getSample();
+    EXPECT_FALSE(sampler_.getDelta(kInterval, &delta));
+
+    advance(2000, 100);
+    sampler_.getSample();
+    ASSERT_TRUE(sampler_.getDelta(kInterval, &delta));
+    EXPECT_EQ(2000u, delta.duration_ms);
+    EXPECT_EQ(100u, delta.beacon_rx);
+    EXPECT_EQ(100u, delta.tx_mpdu[legacy_hal::WIFI_AC_BE]);
+    EXPECT_EQ(0u, delta.tx_mpdu[legacy_hal::WIFI_AC_VO]);
+    EXPECT_EQ(2000u, delta.on_time_ms);
+    EXPECT_DOUBLE_EQ(
+        50.0, delta.perSecond(delta.tx_mpdu[legacy_hal::WIFI_AC_BE]));
+}
+
+TEST_F(LinkLayerStatsSamplerTest, ComputeDeltaOverWindow) {
+    for (int i = 0; i < 3; i++) {
+        sampler_.getSample();
+        advance(1000, 10);
+    }
+    sampler_.getSample();
+    LinkLayerStatsSampler::Delta delta;
+    ASSERT_TRUE(sampler_.getDelta(std::chrono::milliseconds(2000), &delta));
+    EXPECT_EQ(2000u, delta.duration_ms);
+    EXPECT_EQ(20u, delta.beacon_rx);
+    // Falls back to the oldest sample.
+    ASSERT_TRUE(sampler_.getDelta(std::chrono::milliseconds(60000), &delta));
+    EXPECT_EQ(3000u, delta.duration_ms);
+    EXPECT_EQ(30u, delta.beacon_rx);
+}
+
+TEST_F(LinkLayerStatsSamplerTest, ComputeDeltaAcrossCounterWrapAround) {
+    stats_.iface.beacon_rx = UINT32_MAX - 4;
+    sampler_.getSample();
+    advance(1000, 10);
+    sampler_.getSample();
+    LinkLayerStatsSampler::Delta delta;
+    ASSERT_TRUE(sampler_.getDelta(kInterval, &delta));
+    EXPECT_EQ(10u, delta.beacon_rx);
+}
+
+TEST_F(LinkLayerStatsSamplerTest, HistoryKeepsNewestSamples) {
+    for (size_t i = 0; i < 2 * kHistorySize; i++) {
+        sampler_.getSample();
+        advance(1000, 10);
+    }
+    sampler_.getSample();
+    LinkLayerStatsSampler::Delta delta;
+    ASSERT_TRUE(sampler_.getDelta(std::chrono::milliseconds(60000), &delta));
+    EXPECT_EQ((kHistorySize - 1) * 1000, delta.duration_ms);
+
+    std::string dump;
+    sampler_.dump(&dump);
+    EXPECT_EQ(kHistorySize, static_cast<size_t>(std::count(
+                                dump.begin(), dump.end(), '\n')));
+    EXPECT_NE(std::string::npos, dump.find("tx_mpdu=10 (10.0/s)"));
+}
+
+TEST_F(LinkLayerStatsSamplerTest, ClearDropsHistory) {
+    sampler_.getSample();
+    advance(1000, 10);
+    sampler_.getSample();
+    sampler_.clear();
+    LinkLayerStatsSampler::Delta delta;
+    EXPECT_FALSE(sampler_.getDelta(kInterval, &delta));
+
+    // The next query is not served from the cache, and sequence numbers keep
+    // increasing.
+    const auto result = sampler_.getSample();
+    ASSERT_NE(nullptr, result.second);
+    EXPECT_EQ(3u, result.second->seq);
+    EXPECT_EQ(3, num_fetches_);
+}
+}  // namespace implementation
+}  // namespace V1_3
+}  // namespace wifi
+}  // namespace hardware
+}  // namespace android
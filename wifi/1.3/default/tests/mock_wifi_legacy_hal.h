@@ -34,8 +34,9 @@ class MockWifiLegacyHal : public WifiLegacyHal {
         const std::weak_ptr<wifi_system::InterfaceTool> iface_tool);
     MOCK_METHOD0(initialize, wifi_error());
     MOCK_METHOD0(start, wifi_error());
-    MOCK_METHOD2(stop, wifi_error(std::unique_lock<std::recursive_mutex>*,
-                                  const std::function<void()>&));
+    MOCK_METHOD2(stop,
+                 wifi_error(std::unique_lock<hidl_sync_util::LockDomain>*,
+                            const std::function<void()>&));
     MOCK_METHOD2(setDfsFlag, wifi_error(const std::string&, bool));
     MOCK_METHOD2(registerRadioModeChangeCallbackHandler,
                  wifi_error(const std::string&,
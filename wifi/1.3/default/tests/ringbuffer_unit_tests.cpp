@@ -14,6 +14,9 @@
  * limitations under the License.
  */
 
+#include <stdio.h>
+#include <unistd.h>
+
 #include <gmock/gmock.h>
 
 #include "ringbuffer.h"
@@ -29,7 +32,13 @@ namespace implementation {
 
 class RingbufferTest : public Test {
    public:
-    const uint32_t maxBufferSize_ = 10;
+    // Fits exactly two records of |kPayloadSize_| bytes.
+    static constexpr uint32_t kPayloadSize_ = 5;
+    const uint32_t maxBufferSize_ =
+        2 * (kPayloadSize_ + Ringbuffer::kRecordHeaderSize);
+    // Largest payload which fits in the buffer on its own.
+    const uint32_t maxPayloadSize_ =
+        maxBufferSize_ - Ringbuffer::kRecordHeaderSize;
     Ringbuffer buffer_{maxBufferSize_};
 };
 
@@ -38,8 +47,8 @@ TEST_F(RingbufferTest, CreateEmptyBuffer) {
 }
 
 TEST_F(RingbufferTest, CanUseFullBufferCapacity) {
-    const std::vector<uint8_t> input(maxBufferSize_ / 2, '0');
-    const std::vector<uint8_t> input2(maxBufferSize_ / 2, '1');
+    const std::vector<uint8_t> input(kPayloadSize_, '0');
+    const std::vector<uint8_t> input2(kPayloadSize_, '1');
     buffer_.append(input);
     buffer_.append(input2);
     ASSERT_EQ(2u, buffer_.getData().size());
@@ -48,8 +57,8 @@ TEST_F(RingbufferTest, CanUseFullBufferCapacity) {
 }
 
 TEST_F(RingbufferTest, OldDataIsRemovedOnOverflow) {
-    const std::vector<uint8_t> input(maxBufferSize_ / 2, '0');
-    const std::vector<uint8_t> input2(maxBufferSize_ / 2, '1');
+    const std::vector<uint8_t> input(kPayloadSize_, '0');
+    const std::vector<uint8_t> input2(kPayloadSize_, '1');
     const std::vector<uint8_t> input3 = {'G'};
     buffer_.append(input);
     buffer_.append(input2);
@@ -60,9 +69,9 @@ TEST_F(RingbufferTest, OldDataIsRemovedOnOverflow) {
 }
 
 TEST_F(RingbufferTest, MultipleOldDataIsRemovedOnOverflow) {
-    const std::vector<uint8_t> input(maxBufferSize_ / 2, '0');
-    const std::vector<uint8_t> input2(maxBufferSize_ / 2, '1');
-    const std::vector<uint8_t> input3(maxBufferSize_, '2');
+    const std::vector<uint8_t> input(kPayloadSize_, '0');
+    const std::vector<uint8_t> input2(kPayloadSize_, '1');
+    const std::vector<uint8_t> input3(maxPayloadSize_, '2');
     buffer_.append(input);
     buffer_.append(input2);
     buffer_.append(input3);
@@ -77,19 +86,81 @@ TEST_F(RingbufferTest, AppendingEmptyBufferDoesNotAddGarbage) {
 }
 
 TEST_F(RingbufferTest, OversizedAppendIsDropped) {
-    const std::vector<uint8_t> input(maxBufferSize_ + 1, '0');
+    const std::vector<uint8_t> input(maxPayloadSize_ + 1, '0');
     buffer_.append(input);
     ASSERT_TRUE(buffer_.getData().empty());
 }
 
 TEST_F(RingbufferTest, OversizedAppendDoesNotDropExistingData) {
-    const std::vector<uint8_t> input(maxBufferSize_, '0');
-    const std::vector<uint8_t> input2(maxBufferSize_ + 1, '1');
+    const std::vector<uint8_t> input(maxPayloadSize_, '0');
+    const std::vector<uint8_t> input2(maxPayloadSize_ + 1, '1');
     buffer_.append(input);
     buffer_.append(input2);
     ASSERT_EQ(1u, buffer_.getData().size());
     EXPECT_EQ(input, buffer_.getData().front());
 }
+
+TEST_F(RingbufferTest, RecordsWrapAroundBufferEnd) {
+    const std::vector<uint8_t> input = {'0'};
+    const std::vector<uint8_t> input2 = {'1', '2', '3'};
+    const std::vector<uint8_t> input3(kPayloadSize_, '4');
+    buffer_.append(input);
+    buffer_.append(input2);
+    buffer_.append(input3);
+    ASSERT_EQ(2u, buffer_.getData().size());
+    EXPECT_EQ(input2, buffer_.getData().front());
+    EXPECT_EQ(input3, buffer_.getData().back());
+}
+
+TEST_F(RingbufferTest, WriteToFileWritesPayloadsBackToBack) {
+    const std::vector<uint8_t> input = {'0'};
+    const std::vector<uint8_t> input2 = {'1', '2', '3'};
+    const std::vector<uint8_t> input3(kPayloadSize_, '4');
+    buffer_.append(input);
+    buffer_.append(input2);
+    buffer_.append(input3);
+
+    FILE* file = tmpfile();
+    ASSERT_NE(nullptr, file);
+    ASSERT_TRUE(buffer_.writeToFile(fileno(file)));
+    std::vector<uint8_t> expected(input2);
+    expected.insert(expected.end(), input3.begin(), input3.end());
+    std::vector<uint8_t> contents(expected.size() + 1);
+    ASSERT_EQ(static_cast<ssize_t>(expected.size()),
+              pread(fileno(file), contents.data(), contents.size(), 0));
+    contents.resize(expected.size());
+    EXPECT_EQ(expected, contents);
+    fclose(file);
+
+    // Writing out the records does not consume them.
+    EXPECT_EQ(2u, buffer_.getData().size());
+    EXPECT_EQ(0u, buffer_.getNumDroppedRecords());
+}
+
+TEST_F(RingbufferTest, WriteToFileReportsSizeBeforeWriting) {
+    const std::vector<uint8_t> input = {'0'};
+    const std::vector<uint8_t> input2 = {'1', '2', '3'};
+    buffer_.append(input);
+    buffer_.append(input2);
+
+    FILE* file = tmpfile();
+    ASSERT_NE(nullptr, file);
+    size_t reported_size = 0;
+    ASSERT_TRUE(buffer_.writeToFile(fileno(file), [&](size_t size) {
+        reported_size = size;
+        return true;
+    }));
+    EXPECT_EQ(input.size() + input2.size(), reported_size);
+    EXPECT_EQ(static_cast<off_t>(reported_size),
+              lseek(fileno(file), 0, SEEK_END));
+
+    // Nothing is written when the callback declines.
+    ASSERT_TRUE(buffer_.writeToFile(fileno(file),
+                                    [](size_t /* size */) { return false; }));
+    EXPECT_EQ(static_cast<off_t>(reported_size),
+              lseek(fileno(file), 0, SEEK_END));
+    fclose(file);
+}
 }  // namespace implementation
 }  // namespace V1_3
 }  // namespace wifi
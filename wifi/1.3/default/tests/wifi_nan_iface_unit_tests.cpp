@@ -14,6 +14,9 @@
  * limitations under the License.
  */
 
+#include <future>
+#include <vector>
+
 #include <android-base/logging.h>
 #include <android-base/macros.h>
 #include <cutils/properties.h>
@@ -141,6 +144,55 @@ TEST_F(WifiNanIfaceTest, IfacEventHandlers_OnStateToggleOffOn) {
     // Trigger the iface state toggle callback.
     captured_iface_event_handlers.on_state_toggle_off_on(kIfaceName);
 }
+
+TEST_F(WifiNanIfaceTest, DataPathEndDeliversAllInstanceIds) {
+    legacy_hal::NanCallbackHandlers captured_callback_handlers;
+    EXPECT_CALL(*legacy_hal_,
+                nanRegisterCallbackHandlers(testing::_, testing::_))
+        .WillOnce(testing::DoAll(
+            testing::SaveArg<1>(&captured_callback_handlers),
+            testing::Return(legacy_hal::WIFI_SUCCESS)));
+    sp<WifiNanIface> nan_iface =
+        new WifiNanIface(kIfaceName, legacy_hal_, iface_util_);
+
+    sp<NiceMock<MockNanIfaceEventCallback>> mock_event_callback{
+        new NiceMock<MockNanIfaceEventCallback>};
+    nan_iface->registerEventCallback(
+        mock_event_callback, [](const WifiStatus& status) {
+            ASSERT_EQ(WifiStatusCode::SUCCESS, status.code);
+        });
+    const std::vector<legacy_hal::NanDataPathId> ndp_instance_ids = {1, 7,
+                                                                     42};
+    {
+        testing::InSequence sequence;
+        for (const auto ndp_instance_id : ndp_instance_ids) {
+            EXPECT_CALL(*mock_event_callback,
+                        eventDataPathTerminated(ndp_instance_id))
+                .Times(1);
+        }
+    }
+
+    // Copy the indication the way the legacy HAL callback does, and release
+    // the original before the copy is delivered.
+    std::shared_ptr<const legacy_hal::NanDataPathEndInd> ind_copy;
+    {
+        std::vector<uint8_t> buffer(
+            sizeof(legacy_hal::NanDataPathEndInd) +
+            ndp_instance_ids.size() * sizeof(legacy_hal::NanDataPathId));
+        auto* ind =
+            reinterpret_cast<legacy_hal::NanDataPathEndInd*>(buffer.data());
+        ind->num_ndp_instances = ndp_instance_ids.size();
+        std::copy(ndp_instance_ids.begin(), ndp_instance_ids.end(),
+                  ind->ndp_instance_id);
+        ind_copy = legacy_hal::copyNanDataPathEndInd(*ind);
+    }
+    std::promise<void> delivered;
+    hidl_sync_util::dispatchCallback([&]() {
+        captured_callback_handlers.on_event_data_path_end(*ind_copy);
+        delivered.set_value();
+    });
+    delivered.get_future().wait();
+}
 }  // namespace implementation
 }  // namespace V1_3
 }  // namespace wifi
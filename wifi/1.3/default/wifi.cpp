@@ -51,6 +51,10 @@ bool Wifi::isValid() {
     return true;
 }
 
+hidl_sync_util::LockDomain& Wifi::getLockDomain() {
+    return hidl_sync_util::getChipLockDomain();
+}
+
 Return<void> Wifi::registerEventCallback(
     const sp<IWifiEventCallback>& event_callback,
     registerEventCallback_cb hidl_status_cb) {
@@ -129,7 +133,7 @@ WifiStatus Wifi::startInternal() {
 }
 
 WifiStatus Wifi::stopInternal(
-    /* NONNULL */ std::unique_lock<std::recursive_mutex>* lock) {
+    /* NONNULL */ std::unique_lock<hidl_sync_util::LockDomain>* lock) {
     if (run_state_ == RunState::STOPPED) {
         return createWifiStatus(WifiStatusCode::SUCCESS);
     } else if (run_state_ == RunState::STOPPING) {
@@ -194,7 +198,7 @@ WifiStatus Wifi::initializeModeControllerAndLegacyHal() {
 }
 
 WifiStatus Wifi::stopLegacyHalAndDeinitializeModeController(
-    /* NONNULL */ std::unique_lock<std::recursive_mutex>* lock) {
+    /* NONNULL */ std::unique_lock<hidl_sync_util::LockDomain>* lock) {
     run_state_ = RunState::STOPPING;
     legacy_hal::wifi_error legacy_status =
         legacy_hal_->stop(lock, [&]() { run_state_ = RunState::STOPPED; });
@@ -24,6 +24,7 @@
 #include <utils/Looper.h>
 
 #include "hidl_callback_util.h"
+#include "hidl_sync_util.h"
 #include "wifi_chip.h"
 #include "wifi_feature_flags.h"
 #include "wifi_legacy_hal.h"
@@ -48,6 +49,7 @@ class Wifi : public V1_3::IWifi {
          const std::shared_ptr<feature_flags::WifiFeatureFlags> feature_flags);
 
     bool isValid();
+    hidl_sync_util::LockDomain& getLockDomain();
 
     // HIDL methods exposed.
     Return<void> registerEventCallback(
@@ -68,13 +70,14 @@ class Wifi : public V1_3::IWifi {
     WifiStatus registerEventCallbackInternal(
         const sp<IWifiEventCallback>& event_callback);
     WifiStatus startInternal();
-    WifiStatus stopInternal(std::unique_lock<std::recursive_mutex>* lock);
+    WifiStatus stopInternal(
+        std::unique_lock<hidl_sync_util::LockDomain>* lock);
     std::pair<WifiStatus, std::vector<ChipId>> getChipIdsInternal();
     std::pair<WifiStatus, sp<IWifiChip>> getChipInternal(ChipId chip_id);
 
     WifiStatus initializeModeControllerAndLegacyHal();
     WifiStatus stopLegacyHalAndDeinitializeModeController(
-        std::unique_lock<std::recursive_mutex>* lock);
+        std::unique_lock<hidl_sync_util::LockDomain>* lock);
 
     // Instance is created in this root level |IWifi| HIDL interface object
     // and shared with all the child HIDL interface objects.
@@ -37,7 +37,8 @@ WifiApIface::WifiApIface(
       legacy_hal_(legacy_hal),
       iface_util_(iface_util),
       feature_flags_(feature_flags),
-      is_valid_(true) {
+      is_valid_(true),
+      lock_domain_("ap:" + ifname, hidl_sync_util::LockDomain::Rank::kIface) {
     if (feature_flags_.lock()->isApMacRandomizationDisabled()) {
         LOG(INFO) << "AP MAC randomization disabled";
         return;
@@ -53,12 +54,17 @@ WifiApIface::WifiApIface(
 }
 
 void WifiApIface::invalidate() {
+    const auto lock = lock_domain_.acquire();
     legacy_hal_.reset();
     is_valid_ = false;
 }
 
 bool WifiApIface::isValid() { return is_valid_; }
 
+hidl_sync_util::LockDomain& WifiApIface::getLockDomain() {
+    return lock_domain_;
+}
+
 std::string WifiApIface::getName() { return ifname_; }
 
 Return<void> WifiApIface::getName(getName_cb hidl_status_cb) {
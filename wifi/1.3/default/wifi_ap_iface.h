@@ -20,6 +20,7 @@
 #include <android-base/macros.h>
 #include <android/hardware/wifi/1.0/IWifiApIface.h>
 
+#include "hidl_sync_util.h"
 #include "wifi_feature_flags.h"
 #include "wifi_iface_util.h"
 #include "wifi_legacy_hal.h"
@@ -44,6 +45,7 @@ class WifiApIface : public V1_0::IWifiApIface {
     // Refer to |WifiChip::invalidate()|.
     void invalidate();
     bool isValid();
+    hidl_sync_util::LockDomain& getLockDomain();
     std::string getName();
 
     // HIDL methods exposed.
@@ -67,6 +69,7 @@ class WifiApIface : public V1_0::IWifiApIface {
     std::weak_ptr<iface_util::WifiIfaceUtil> iface_util_;
     std::weak_ptr<feature_flags::WifiFeatureFlags> feature_flags_;
     bool is_valid_;
+    hidl_sync_util::LockDomain lock_domain_;
 
     DISALLOW_COPY_AND_ASSIGN(WifiApIface);
 };
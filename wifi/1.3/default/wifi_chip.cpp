@@ -17,10 +17,11 @@
 #include <fcntl.h>
 
 #include <android-base/logging.h>
+#include <android-base/parseint.h>
+#include <android-base/strings.h>
 #include <android-base/unique_fd.h>
 #include <cutils/properties.h>
 #include <sys/stat.h>
-#include <sys/sysmacros.h>
 
 #include "hidl_return_util.h"
 #include "hidl_struct_util.h"
@@ -35,12 +36,21 @@ using android::hardware::hidl_vec;
 using android::hardware::wifi::V1_0::ChipModeId;
 using android::hardware::wifi::V1_0::IfaceType;
 using android::hardware::wifi::V1_0::IWifiChip;
+using android::hardware::wifi::V1_3::implementation::CpioArchiveWriter;
 
-constexpr char kCpioMagic[] = "070701";
 constexpr size_t kMaxBufferSizeBytes = 1024 * 1024 * 3;
 constexpr uint32_t kMaxRingBufferFileAgeSeconds = 60 * 60 * 10;
 constexpr uint32_t kMaxRingBufferFileNum = 20;
 constexpr char kTombstoneFolderPath[] = "/data/vendor/tombstones/wifi/";
+constexpr char kLockStatsFileName[] = "hal_lock_stats";
+constexpr char kLinkLayerStatsFileNamePrefix[] = "link_layer_stats_";
+// Budget of the archive written by |IWifiChip::debug|, which can be overridden
+// with the options below.
+constexpr size_t kMaxDebugArchiveBytes = 128 * 1024 * 1024;
+constexpr std::chrono::milliseconds kMaxDebugArchiveDuration(10 * 1000);
+constexpr char kDebugOptionCompress[] = "--compress";
+constexpr char kDebugOptionMaxBytes[] = "--max-bytes=";
+constexpr char kDebugOptionMaxTimeMs[] = "--max-time-ms=";
 constexpr char kActiveWlanIfaceNameProperty[] = "wifi.active.interface";
 constexpr char kNoActiveWlanIfaceNamePropertyValue[] = "";
 constexpr unsigned kMaxWlanIfaces = 5;
@@ -163,135 +173,63 @@ bool removeOldFilesInternal() {
     return success;
 }
 
-// Helper function for |cpioArchiveFilesInDir|
-bool cpioWriteHeader(int out_fd, struct stat& st, const char* file_name,
-                     size_t file_name_len) {
-    std::array<char, 32 * 1024> read_buf;
-    ssize_t llen =
-        sprintf(read_buf.data(),
-                "%s%08X%08X%08X%08X%08X%08X%08X%08X%08X%08X%08X%08X%08X",
-                kCpioMagic, static_cast<int>(st.st_ino), st.st_mode, st.st_uid,
-                st.st_gid, static_cast<int>(st.st_nlink),
-                static_cast<int>(st.st_mtime), static_cast<int>(st.st_size),
-                major(st.st_dev), minor(st.st_dev), major(st.st_rdev),
-                minor(st.st_rdev), static_cast<uint32_t>(file_name_len), 0);
-    if (write(out_fd, read_buf.data(), llen) == -1) {
-        PLOG(ERROR) << "Error writing cpio header to file " << file_name;
-        return false;
-    }
-    if (write(out_fd, file_name, file_name_len) == -1) {
-        PLOG(ERROR) << "Error writing filename to file " << file_name;
-        return false;
-    }
-
-    // NUL Pad header up to 4 multiple bytes.
-    llen = (llen + file_name_len) % 4;
-    if (llen != 0) {
-        const uint32_t zero = 0;
-        if (write(out_fd, &zero, 4 - llen) == -1) {
-            PLOG(ERROR) << "Error padding 0s to file " << file_name;
-            return false;
-        }
-    }
-    return true;
-}
-
-// Helper function for |cpioArchiveFilesInDir|
-size_t cpioWriteFileContent(int fd_read, int out_fd, struct stat& st) {
-    // writing content of file
-    std::array<char, 32 * 1024> read_buf;
-    ssize_t llen = st.st_size;
-    size_t n_error = 0;
-    while (llen > 0) {
-        ssize_t bytes_read = read(fd_read, read_buf.data(), read_buf.size());
-        if (bytes_read == -1) {
-            PLOG(ERROR) << "Error reading file";
-            return ++n_error;
-        }
-        llen -= bytes_read;
-        if (write(out_fd, read_buf.data(), bytes_read) == -1) {
-            PLOG(ERROR) << "Error writing data to file";
-            return ++n_error;
-        }
-        if (bytes_read == 0) {  // this should never happen, but just in case
-                                // to unstuck from while loop
-            PLOG(ERROR) << "Unexpected read result";
-            n_error++;
-            break;
-        }
-    }
-    llen = st.st_size % 4;
-    if (llen != 0) {
-        const uint32_t zero = 0;
-        if (write(out_fd, &zero, 4 - llen) == -1) {
-            PLOG(ERROR) << "Error padding 0s to file";
-            return ++n_error;
-        }
-    }
-    return n_error;
-}
-
-// Helper function for |cpioArchiveFilesInDir|
-bool cpioWriteFileTrailer(int out_fd) {
-    std::array<char, 4096> read_buf;
-    read_buf.fill(0);
-    if (write(out_fd, read_buf.data(),
-              sprintf(read_buf.data(), "070701%040X%056X%08XTRAILER!!!", 1,
-                      0x0b, 0) +
-                  4) == -1) {
-        PLOG(ERROR) << "Error writing trailing bytes";
-        return false;
-    }
-    return true;
-}
-
-// Archives all files in |input_dir| and writes result into |out_fd|
-// Logic obtained from //external/toybox/toys/posix/cpio.c "Output cpio archive"
-// portion
-size_t cpioArchiveFilesInDir(int out_fd, const char* input_dir) {
-    struct dirent* dp;
-    size_t n_error = 0;
+// Archives all files in |input_dir|, newest first so that the oldest ones are
+// dropped if the archive runs out of budget.
+void archiveFilesInDir(CpioArchiveWriter* writer, const char* input_dir) {
     std::unique_ptr<DIR, decltype(&closedir)> dir_dump(opendir(input_dir),
                                                        closedir);
     if (!dir_dump) {
         PLOG(ERROR) << "Failed to open directory";
-        return ++n_error;
+        return;
     }
+    struct dirent* dp;
+    std::list<std::pair<time_t, std::string>> files;
     while ((dp = readdir(dir_dump.get()))) {
         if (dp->d_type != DT_REG) {
             continue;
         }
-        std::string cur_file_name(dp->d_name);
-        // string.size() does not include the null terminator. The cpio FreeBSD
-        // file header expects the null character to be included in the length.
-        const size_t file_name_len = cur_file_name.size() + 1;
+        const std::string cur_file_name(dp->d_name);
         struct stat st;
-        const std::string cur_file_path = kTombstoneFolderPath + cur_file_name;
+        const std::string cur_file_path = input_dir + cur_file_name;
         if (stat(cur_file_path.c_str(), &st) == -1) {
             PLOG(ERROR) << "Failed to get file stat for " << cur_file_path;
-            n_error++;
             continue;
         }
-        const int fd_read = open(cur_file_path.c_str(), O_RDONLY);
-        if (fd_read == -1) {
-            PLOG(ERROR) << "Failed to open file " << cur_file_path;
-            n_error++;
-            continue;
-        }
-        unique_fd file_auto_closer(fd_read);
-        if (!cpioWriteHeader(out_fd, st, cur_file_name.c_str(),
-                             file_name_len)) {
-            return ++n_error;
-        }
-        size_t write_error = cpioWriteFileContent(fd_read, out_fd, st);
-        if (write_error) {
-            return n_error + write_error;
+        files.emplace_back(st.st_mtime, cur_file_name);
+    }
+    files.sort(std::greater<std::pair<time_t, std::string>>());
+    for (const auto& file : files) {
+        writer->addFile(input_dir + file.second, file.second);
+    }
+}
+
+// Parses the options passed to |IWifiChip::debug|.
+void parseDebugOptions(const hidl_vec<hidl_string>& options,
+                       CpioArchiveWriter::Options* archive_options) {
+    for (const auto& option : options) {
+        const std::string value(option);
+        uint64_t max_time_ms;
+        if (value == kDebugOptionCompress) {
+            archive_options->compress = true;
+        } else if (android::base::StartsWith(value, kDebugOptionMaxBytes)) {
+            if (!android::base::ParseUint(
+                    value.substr(strlen(kDebugOptionMaxBytes)),
+                    &archive_options->max_bytes)) {
+                LOG(ERROR) << "Invalid debug option " << value;
+            }
+        } else if (android::base::StartsWith(value, kDebugOptionMaxTimeMs)) {
+            if (android::base::ParseUint(
+                    value.substr(strlen(kDebugOptionMaxTimeMs)),
+                    &max_time_ms)) {
+                archive_options->max_duration =
+                    std::chrono::milliseconds(max_time_ms);
+            } else {
+                LOG(ERROR) << "Invalid debug option " << value;
+            }
+        } else {
+            LOG(ERROR) << "Unknown debug option " << value;
         }
     }
-    if (!cpioWriteFileTrailer(out_fd)) {
-        return ++n_error;
-    }
-    return n_error;
 }
 
 // Helper function to create a non-const char*.
@@ -342,6 +280,11 @@ void WifiChip::invalidate() {
 
 bool WifiChip::isValid() { return is_valid_; }
 
+hidl_sync_util::LockDomain& WifiChip::getLockDomain() {
+    // There is a single chip, which shares its domain with |Wifi|.
+    return hidl_sync_util::getChipLockDomain();
+}
+
 std::set<sp<V1_2::IWifiChipEventCallback>> WifiChip::getEventCallbacks() {
     return event_cb_handler_.getCallbacks();
 }
@@ -604,15 +547,37 @@ Return<void> WifiChip::getCapabilities_1_3(getCapabilities_cb hidl_status_cb) {
 }
 
 Return<void> WifiChip::debug(const hidl_handle& handle,
-                             const hidl_vec<hidl_string>&) {
+                             const hidl_vec<hidl_string>& options) {
     if (handle != nullptr && handle->numFds >= 1) {
         int fd = handle->data[0];
-        if (!writeRingbufferFilesInternal()) {
-            LOG(ERROR) << "Error writing files to flash";
+        CpioArchiveWriter::Options archive_options;
+        archive_options.max_bytes = kMaxDebugArchiveBytes;
+        archive_options.max_duration = kMaxDebugArchiveDuration;
+        parseDebugOptions(options, &archive_options);
+        if (!removeOldFilesInternal()) {
+            LOG(ERROR) << "Error occurred while deleting old tombstone files";
+        }
+        // The ring buffers and HAL stats are streamed from memory, so only
+        // the files persisted earlier are read from flash.
+        CpioArchiveWriter writer(fd, archive_options);
+        writeRingbuffersToArchiveInternal(&writer);
+        std::string lock_stats;
+        hidl_sync_util::dumpLockStats(&lock_stats);
+        writer.addData(kLockStatsFileName, lock_stats);
+        for (const auto& iface : sta_ifaces_) {
+            std::string link_layer_stats;
+            iface->dumpLinkLayerStats(&link_layer_stats);
+            writer.addData(kLinkLayerStatsFileNamePrefix + iface->getName(),
+                           link_layer_stats);
+        }
+        archiveFilesInDir(&writer, kTombstoneFolderPath);
+        if (!writer.finish()) {
+            LOG(ERROR) << writer.getNumErrors()
+                       << " errors occured in cpio function";
         }
-        uint32_t n_error = cpioArchiveFilesInDir(fd, kTombstoneFolderPath);
-        if (n_error != 0) {
-            LOG(ERROR) << n_error << " errors occured in cpio function";
+        if (writer.getNumSkippedEntries() > 0) {
+            LOG(WARNING) << writer.getNumSkippedEntries()
+                         << " files skipped to stay within the debug budget";
         }
         fsync(fd);
     } else {
@@ -700,7 +665,7 @@ WifiChip::getAvailableModesInternal() {
 }
 
 WifiStatus WifiChip::configureChipInternal(
-    /* NONNULL */ std::unique_lock<std::recursive_mutex>* lock,
+    /* NONNULL */ std::unique_lock<hidl_sync_util::LockDomain>* lock,
     ChipModeId mode_id) {
     if (!isValidModeId(mode_id)) {
         return createWifiStatus(WifiStatusCode::ERROR_INVALID_ARGS);
@@ -1045,8 +1010,12 @@ WifiStatus WifiChip::startLoggingToDebugRingBufferInternal(
                 std::underlying_type<WifiDebugRingBufferVerboseLevel>::type>(
                 verbose_level),
             max_interval_in_sec, min_data_size_in_bytes);
-    ringbuffer_map_.insert(std::pair<std::string, Ringbuffer>(
-        ring_name, Ringbuffer(kMaxBufferSizeBytes)));
+    {
+        std::lock_guard<std::mutex> lock(ringbuffer_map_lock_);
+        ringbuffer_map_.emplace(std::piecewise_construct,
+                                std::forward_as_tuple(std::string(ring_name)),
+                                std::forward_as_tuple(kMaxBufferSizeBytes));
+    }
     return createWifiStatusFromLegacyError(legacy_status);
 }
 
@@ -1103,6 +1072,8 @@ WifiStatus WifiChip::enableDebugErrorAlertsInternal(bool enable) {
                                             int32_t error_code,
                                             std::vector<uint8_t> debug_data) {
             const auto shared_ptr_this = weak_ptr_this.promote();
+            const auto lock =
+                hidl_sync_util::acquireObjectLock(shared_ptr_this);
             if (!shared_ptr_this.get() || !shared_ptr_this->isValid()) {
                 LOG(ERROR) << "Callback invoked on an invalid object";
                 return;
@@ -1161,7 +1132,7 @@ WifiStatus WifiChip::selectTxPowerScenarioInternal_1_2(
 }
 
 WifiStatus WifiChip::handleChipConfiguration(
-    /* NONNULL */ std::unique_lock<std::recursive_mutex>* lock,
+    /* NONNULL */ std::unique_lock<hidl_sync_util::LockDomain>* lock,
     ChipModeId mode_id) {
     // If the chip is already configured in a different mode, stop
     // the legacy HAL and then start it after firmware mode change.
@@ -1219,9 +1190,10 @@ WifiStatus WifiChip::registerDebugRingBufferCallback() {
     }
 
     android::wp<WifiChip> weak_ptr_this(this);
+    // Runs on the legacy HAL event loop thread rather than the dispatcher, and
+    // only needs |ringbuffer_map_lock_|.
     const auto& on_ring_buffer_data_callback =
-        [weak_ptr_this](const std::string& name,
-                        const std::vector<uint8_t>& data,
+        [weak_ptr_this](const char* name, const uint8_t* data, size_t size,
                         const legacy_hal::wifi_ring_buffer_status& status) {
             const auto shared_ptr_this = weak_ptr_this.promote();
             if (!shared_ptr_this.get() || !shared_ptr_this->isValid()) {
@@ -1234,14 +1206,18 @@ WifiStatus WifiChip::registerDebugRingBufferCallback() {
                 LOG(ERROR) << "Error converting ring buffer status";
                 return;
             }
+            std::unique_lock<std::mutex> lock(
+                shared_ptr_this->ringbuffer_map_lock_);
             const auto& target = shared_ptr_this->ringbuffer_map_.find(name);
-            if (target != shared_ptr_this->ringbuffer_map_.end()) {
-                Ringbuffer& cur_buffer = target->second;
-                cur_buffer.append(data);
-            } else {
+            if (target == shared_ptr_this->ringbuffer_map_.end()) {
                 LOG(ERROR) << "Ringname " << name << " not found";
                 return;
             }
+            // Ringbuffers are never removed from the map, and appending
+            // doesn't need the map lock.
+            Ringbuffer& cur_buffer = target->second;
+            lock.unlock();
+            cur_buffer.append(data, size);
         };
     legacy_hal::wifi_error legacy_status =
         legacy_hal_.lock()->registerRingBufferCallbackHandler(
@@ -1258,6 +1234,8 @@ WifiStatus WifiChip::registerRadioModeChangeCallback() {
     const auto& on_radio_mode_change_callback =
         [weak_ptr_this](const std::vector<legacy_hal::WifiMacInfo>& mac_infos) {
             const auto shared_ptr_this = weak_ptr_this.promote();
+            const auto lock =
+                hidl_sync_util::acquireObjectLock(shared_ptr_this);
             if (!shared_ptr_this.get() || !shared_ptr_this->isValid()) {
                 LOG(ERROR) << "Callback invoked on an invalid object";
                 return;
@@ -1514,10 +1492,11 @@ bool WifiChip::writeRingbufferFilesInternal() {
         LOG(ERROR) << "Error occurred while deleting old tombstone files";
         return false;
     }
-    // write ringbuffers to file
-    for (const auto& item : ringbuffer_map_) {
-        const Ringbuffer& cur_buffer = item.second;
-        if (cur_buffer.getData().empty()) {
+    // write ringbuffers to file. The map is only modified by HIDL methods, so
+    // it can be walked here without |ringbuffer_map_lock_|.
+    for (auto& item : ringbuffer_map_) {
+        Ringbuffer& cur_buffer = item.second;
+        if (cur_buffer.empty()) {
             continue;
         }
         const std::string file_path_raw =
@@ -1528,16 +1507,35 @@ bool WifiChip::writeRingbufferFilesInternal() {
             return false;
         }
         unique_fd file_auto_closer(dump_fd);
-        for (const auto& cur_block : cur_buffer.getData()) {
-            if (write(dump_fd, cur_block.data(),
-                      sizeof(cur_block[0]) * cur_block.size()) == -1) {
-                PLOG(ERROR) << "Error writing to file";
-            }
+        cur_buffer.writeToFile(dump_fd);
+        const size_t num_dropped = cur_buffer.getNumDroppedRecords();
+        if (num_dropped > 0) {
+            LOG(INFO) << "Ring " << item.first << " dropped " << num_dropped
+                      << " records while being written out";
         }
     }
     return true;
 }
 
+void WifiChip::writeRingbuffersToArchiveInternal(CpioArchiveWriter* writer) {
+    const time_t now = time(nullptr);
+    for (auto& item : ringbuffer_map_) {
+        Ringbuffer& cur_buffer = item.second;
+        if (cur_buffer.empty()) {
+            continue;
+        }
+        bool in_entry = false;
+        const bool success = cur_buffer.writeToFile(
+            writer->getContentFd(), [&](size_t size) {
+                in_entry = writer->beginEntry(item.first, size, now);
+                return in_entry;
+            });
+        if (in_entry) {
+            writer->endEntry(success);
+        }
+    }
+}
+
 }  // namespace implementation
 }  // namespace V1_3
 }  // namespace wifi
@@ -17,13 +17,17 @@
 #ifndef WIFI_CHIP_H_
 #define WIFI_CHIP_H_
 
+#include <atomic>
 #include <list>
 #include <map>
+#include <mutex>
 
 #include <android-base/macros.h>
 #include <android/hardware/wifi/1.3/IWifiChip.h>
 
+#include "cpio_archive_writer.h"
 #include "hidl_callback_util.h"
+#include "hidl_sync_util.h"
 #include "ringbuffer.h"
 #include "wifi_ap_iface.h"
 #include "wifi_feature_flags.h"
@@ -70,6 +74,7 @@ class WifiChip : public V1_3::IWifiChip {
     // marked valid before processing them.
     void invalidate();
     bool isValid();
+    hidl_sync_util::LockDomain& getLockDomain();
     std::set<sp<V1_2::IWifiChipEventCallback>> getEventCallbacks();
 
     // HIDL methods exposed.
@@ -167,7 +172,8 @@ class WifiChip : public V1_3::IWifiChip {
     std::pair<WifiStatus, uint32_t> getCapabilitiesInternal();
     std::pair<WifiStatus, std::vector<ChipMode>> getAvailableModesInternal();
     WifiStatus configureChipInternal(
-        std::unique_lock<std::recursive_mutex>* lock, ChipModeId mode_id);
+        std::unique_lock<hidl_sync_util::LockDomain>* lock,
+        ChipModeId mode_id);
     std::pair<WifiStatus, uint32_t> getModeInternal();
     std::pair<WifiStatus, IWifiChip::ChipDebugInfo>
     requestChipDebugInfoInternal();
@@ -218,7 +224,8 @@ class WifiChip : public V1_3::IWifiChip {
     WifiStatus selectTxPowerScenarioInternal_1_2(TxPowerScenario scenario);
     std::pair<WifiStatus, uint32_t> getCapabilitiesInternal_1_3();
     WifiStatus handleChipConfiguration(
-        std::unique_lock<std::recursive_mutex>* lock, ChipModeId mode_id);
+        std::unique_lock<hidl_sync_util::LockDomain>* lock,
+        ChipModeId mode_id);
     WifiStatus registerDebugRingBufferCallback();
     WifiStatus registerRadioModeChangeCallback();
 
@@ -246,6 +253,7 @@ class WifiChip : public V1_3::IWifiChip {
     std::string allocateApIfaceName();
     std::string allocateStaIfaceName();
     bool writeRingbufferFilesInternal();
+    void writeRingbuffersToArchiveInternal(CpioArchiveWriter* writer);
 
     ChipId chip_id_;
     std::weak_ptr<legacy_hal::WifiLegacyHal> legacy_hal_;
@@ -257,8 +265,11 @@ class WifiChip : public V1_3::IWifiChip {
     std::vector<sp<WifiP2pIface>> p2p_ifaces_;
     std::vector<sp<WifiStaIface>> sta_ifaces_;
     std::vector<sp<WifiRttController>> rtt_controllers_;
-    std::map<std::string, Ringbuffer> ringbuffer_map_;
-    bool is_valid_;
+    // Guards |ringbuffer_map_| against the ring buffer data callback, which
+    // runs on the legacy HAL event loop thread without the global lock.
+    std::mutex ringbuffer_map_lock_;
+    std::map<std::string, Ringbuffer, std::less<>> ringbuffer_map_;
+    std::atomic<bool> is_valid_;
     // Members pertaining to chip configuration.
     uint32_t current_mode_id_;
     std::vector<IWifiChip::ChipMode> modes_;
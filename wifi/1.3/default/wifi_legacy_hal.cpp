@@ -14,8 +14,14 @@
  * limitations under the License.
  */
 
+#include <stddef.h>
+#include <string.h>
+
+#include <algorithm>
 #include <array>
 #include <chrono>
+#include <memory>
+#include <mutex>
 
 #include <android-base/logging.h>
 #include <cutils/properties.h>
@@ -56,11 +62,37 @@ namespace legacy_hal {
 // Legacy HAL functions accept "C" style function pointers, so use global
 // functions to pass to the legacy HAL function and store the corresponding
 // std::function methods to be invoked.
+//
+// Unless noted otherwise, the asynchronous callbacks are invoked on the legacy
+// HAL event loop thread with the callback lock domain held. They only convert
+// their arguments and hand the user callbacks over to the callback dispatcher,
+// so that the event loop never waits on the lock domain of a chip or iface
+// object.
+hidl_sync_util::LockDomain& getCallbackLockDomain() {
+    static hidl_sync_util::LockDomain* domain = new hidl_sync_util::LockDomain(
+        "legacy_hal_callbacks",
+        hidl_sync_util::LockDomain::Rank::kLegacyHalCallbacks);
+    return *domain;
+}
+
+std::unique_lock<hidl_sync_util::LockDomain> acquireCallbackLock() {
+    return getCallbackLockDomain().acquire();
+}
+
+// Queues a call to |callback| with copies of |args| on the callback
+// dispatcher.
+template <typename CallbackT, typename... Args>
+void dispatchUserCallback(const CallbackT& callback, Args... args) {
+    hidl_sync_util::dispatchCallback(
+        [callback, args...]() { callback(args...); });
+}
+
 //
 // Callback to be invoked once |stop| is complete
 std::function<void(wifi_handle handle)> on_stop_complete_internal_callback;
 void onAsyncStopComplete(wifi_handle handle) {
-    const auto lock = hidl_sync_util::acquireGlobalLock();
+    // |WifiLegacyHal::stop| waits for this with the chip lock domain released.
+    const auto lock = hidl_sync_util::getChipLockDomain().acquire();
     if (on_stop_complete_internal_callback) {
         on_stop_complete_internal_callback(handle);
         // Invalidate this callback since we don't want this firing again.
@@ -88,7 +120,7 @@ void onSyncFirmwareMemoryDump(char* buffer, int buffer_size) {
 std::function<void(wifi_request_id, wifi_scan_event)>
     on_gscan_event_internal_callback;
 void onAsyncGscanEvent(wifi_request_id id, wifi_scan_event event) {
-    const auto lock = hidl_sync_util::acquireGlobalLock();
+    const auto lock = acquireCallbackLock();
     if (on_gscan_event_internal_callback) {
         on_gscan_event_internal_callback(id, event);
     }
@@ -99,7 +131,7 @@ std::function<void(wifi_request_id, wifi_scan_result*, uint32_t)>
     on_gscan_full_result_internal_callback;
 void onAsyncGscanFullResult(wifi_request_id id, wifi_scan_result* result,
                             uint32_t buckets_scanned) {
-    const auto lock = hidl_sync_util::acquireGlobalLock();
+    const auto lock = acquireCallbackLock();
     if (on_gscan_full_result_internal_callback) {
         on_gscan_full_result_internal_callback(id, result, buckets_scanned);
     }
@@ -121,18 +153,21 @@ std::function<void((wifi_request_id, uint8_t*, int8_t))>
     on_rssi_threshold_breached_internal_callback;
 void onAsyncRssiThresholdBreached(wifi_request_id id, uint8_t* bssid,
                                   int8_t rssi) {
-    const auto lock = hidl_sync_util::acquireGlobalLock();
+    const auto lock = acquireCallbackLock();
     if (on_rssi_threshold_breached_internal_callback) {
         on_rssi_threshold_breached_internal_callback(id, bssid, rssi);
     }
 }
 
-// Callback to be invoked for ring buffer data indication.
+// Callback to be invoked for ring buffer data indication. Verbose firmware
+// logging makes this a frequent callback, so it is guarded by its own lock
+// rather than the global one.
+std::mutex on_ring_buffer_data_lock;
 std::function<void(char*, char*, int, wifi_ring_buffer_status*)>
     on_ring_buffer_data_internal_callback;
 void onAsyncRingBufferData(char* ring_name, char* buffer, int buffer_size,
                            wifi_ring_buffer_status* status) {
-    const auto lock = hidl_sync_util::acquireGlobalLock();
+    std::lock_guard<std::mutex> lock(on_ring_buffer_data_lock);
     if (on_ring_buffer_data_internal_callback) {
         on_ring_buffer_data_internal_callback(ring_name, buffer, buffer_size,
                                               status);
@@ -144,7 +179,7 @@ std::function<void(wifi_request_id, char*, int, int)>
     on_error_alert_internal_callback;
 void onAsyncErrorAlert(wifi_request_id id, char* buffer, int buffer_size,
                        int err_code) {
-    const auto lock = hidl_sync_util::acquireGlobalLock();
+    const auto lock = acquireCallbackLock();
     if (on_error_alert_internal_callback) {
         on_error_alert_internal_callback(id, buffer, buffer_size, err_code);
     }
@@ -155,7 +190,7 @@ std::function<void(wifi_request_id, uint32_t, wifi_mac_info*)>
     on_radio_mode_change_internal_callback;
 void onAsyncRadioModeChange(wifi_request_id id, uint32_t num_macs,
                             wifi_mac_info* mac_infos) {
-    const auto lock = hidl_sync_util::acquireGlobalLock();
+    const auto lock = acquireCallbackLock();
     if (on_radio_mode_change_internal_callback) {
         on_radio_mode_change_internal_callback(id, num_macs, mac_infos);
     }
@@ -167,13 +202,37 @@ std::function<void(wifi_request_id, unsigned num_results,
     on_rtt_results_internal_callback;
 void onAsyncRttResults(wifi_request_id id, unsigned num_results,
                        wifi_rtt_result* rtt_results[]) {
-    const auto lock = hidl_sync_util::acquireGlobalLock();
+    const auto lock = acquireCallbackLock();
     if (on_rtt_results_internal_callback) {
         on_rtt_results_internal_callback(id, num_results, rtt_results);
         on_rtt_results_internal_callback = nullptr;
     }
 }
 
+// Copies |ind| along with the |num_ndp_instances| entries of its trailing
+// |ndp_instance_id| array.
+template <typename IndT>
+std::shared_ptr<const IndT> copyNanNdpInstanceInd(const IndT& ind) {
+    const size_t size = offsetof(IndT, ndp_instance_id) +
+                        ind.num_ndp_instances * sizeof(NanDataPathId);
+    std::shared_ptr<uint8_t> ind_copy(
+        new uint8_t[std::max(size, sizeof(IndT))](),
+        std::default_delete<uint8_t[]>());
+    memcpy(ind_copy.get(), &ind, size);
+    return std::shared_ptr<const IndT>(
+        ind_copy, reinterpret_cast<const IndT*>(ind_copy.get()));
+}
+
+std::shared_ptr<const NanDataPathEndInd> copyNanDataPathEndInd(
+    const NanDataPathEndInd& ind) {
+    return copyNanNdpInstanceInd(ind);
+}
+
+std::shared_ptr<const NanDataPathScheduleUpdateInd>
+copyNanDataPathScheduleUpdateInd(const NanDataPathScheduleUpdateInd& ind) {
+    return copyNanNdpInstanceInd(ind);
+}
+
 // Callbacks for the various NAN operations.
 // NOTE: These have very little conversions to perform before invoking the user
 // callbacks.
@@ -181,9 +240,9 @@ void onAsyncRttResults(wifi_request_id id, unsigned num_results,
 std::function<void(transaction_id, const NanResponseMsg&)>
     on_nan_notify_response_user_callback;
 void onAysncNanNotifyResponse(transaction_id id, NanResponseMsg* msg) {
-    const auto lock = hidl_sync_util::acquireGlobalLock();
+    const auto lock = acquireCallbackLock();
     if (on_nan_notify_response_user_callback && msg) {
-        on_nan_notify_response_user_callback(id, *msg);
+        dispatchUserCallback(on_nan_notify_response_user_callback, id, *msg);
     }
 }
 
@@ -196,139 +255,151 @@ void onAysncNanEventPublishReplied(NanPublishRepliedInd* /* event */) {
 std::function<void(const NanPublishTerminatedInd&)>
     on_nan_event_publish_terminated_user_callback;
 void onAysncNanEventPublishTerminated(NanPublishTerminatedInd* event) {
-    const auto lock = hidl_sync_util::acquireGlobalLock();
+    const auto lock = acquireCallbackLock();
     if (on_nan_event_publish_terminated_user_callback && event) {
-        on_nan_event_publish_terminated_user_callback(*event);
+        dispatchUserCallback(on_nan_event_publish_terminated_user_callback,
+                             *event);
     }
 }
 
 std::function<void(const NanMatchInd&)> on_nan_event_match_user_callback;
 void onAysncNanEventMatch(NanMatchInd* event) {
-    const auto lock = hidl_sync_util::acquireGlobalLock();
+    const auto lock = acquireCallbackLock();
     if (on_nan_event_match_user_callback && event) {
-        on_nan_event_match_user_callback(*event);
+        dispatchUserCallback(on_nan_event_match_user_callback, *event);
     }
 }
 
 std::function<void(const NanMatchExpiredInd&)>
     on_nan_event_match_expired_user_callback;
 void onAysncNanEventMatchExpired(NanMatchExpiredInd* event) {
-    const auto lock = hidl_sync_util::acquireGlobalLock();
+    const auto lock = acquireCallbackLock();
     if (on_nan_event_match_expired_user_callback && event) {
-        on_nan_event_match_expired_user_callback(*event);
+        dispatchUserCallback(on_nan_event_match_expired_user_callback, *event);
     }
 }
 
 std::function<void(const NanSubscribeTerminatedInd&)>
     on_nan_event_subscribe_terminated_user_callback;
 void onAysncNanEventSubscribeTerminated(NanSubscribeTerminatedInd* event) {
-    const auto lock = hidl_sync_util::acquireGlobalLock();
+    const auto lock = acquireCallbackLock();
     if (on_nan_event_subscribe_terminated_user_callback && event) {
-        on_nan_event_subscribe_terminated_user_callback(*event);
+        dispatchUserCallback(on_nan_event_subscribe_terminated_user_callback,
+                             *event);
     }
 }
 
 std::function<void(const NanFollowupInd&)> on_nan_event_followup_user_callback;
 void onAysncNanEventFollowup(NanFollowupInd* event) {
-    const auto lock = hidl_sync_util::acquireGlobalLock();
+    const auto lock = acquireCallbackLock();
     if (on_nan_event_followup_user_callback && event) {
-        on_nan_event_followup_user_callback(*event);
+        dispatchUserCallback(on_nan_event_followup_user_callback, *event);
     }
 }
 
 std::function<void(const NanDiscEngEventInd&)>
     on_nan_event_disc_eng_event_user_callback;
 void onAysncNanEventDiscEngEvent(NanDiscEngEventInd* event) {
-    const auto lock = hidl_sync_util::acquireGlobalLock();
+    const auto lock = acquireCallbackLock();
     if (on_nan_event_disc_eng_event_user_callback && event) {
-        on_nan_event_disc_eng_event_user_callback(*event);
+        dispatchUserCallback(on_nan_event_disc_eng_event_user_callback, *event);
     }
 }
 
 std::function<void(const NanDisabledInd&)> on_nan_event_disabled_user_callback;
 void onAysncNanEventDisabled(NanDisabledInd* event) {
-    const auto lock = hidl_sync_util::acquireGlobalLock();
+    const auto lock = acquireCallbackLock();
     if (on_nan_event_disabled_user_callback && event) {
-        on_nan_event_disabled_user_callback(*event);
+        dispatchUserCallback(on_nan_event_disabled_user_callback, *event);
     }
 }
 
 std::function<void(const NanTCAInd&)> on_nan_event_tca_user_callback;
 void onAysncNanEventTca(NanTCAInd* event) {
-    const auto lock = hidl_sync_util::acquireGlobalLock();
+    const auto lock = acquireCallbackLock();
     if (on_nan_event_tca_user_callback && event) {
-        on_nan_event_tca_user_callback(*event);
+        dispatchUserCallback(on_nan_event_tca_user_callback, *event);
     }
 }
 
 std::function<void(const NanBeaconSdfPayloadInd&)>
     on_nan_event_beacon_sdf_payload_user_callback;
 void onAysncNanEventBeaconSdfPayload(NanBeaconSdfPayloadInd* event) {
-    const auto lock = hidl_sync_util::acquireGlobalLock();
+    const auto lock = acquireCallbackLock();
     if (on_nan_event_beacon_sdf_payload_user_callback && event) {
-        on_nan_event_beacon_sdf_payload_user_callback(*event);
+        dispatchUserCallback(on_nan_event_beacon_sdf_payload_user_callback,
+                             *event);
     }
 }
 
 std::function<void(const NanDataPathRequestInd&)>
     on_nan_event_data_path_request_user_callback;
 void onAysncNanEventDataPathRequest(NanDataPathRequestInd* event) {
-    const auto lock = hidl_sync_util::acquireGlobalLock();
+    const auto lock = acquireCallbackLock();
     if (on_nan_event_data_path_request_user_callback && event) {
-        on_nan_event_data_path_request_user_callback(*event);
+        dispatchUserCallback(on_nan_event_data_path_request_user_callback,
+                             *event);
     }
 }
 std::function<void(const NanDataPathConfirmInd&)>
     on_nan_event_data_path_confirm_user_callback;
 void onAysncNanEventDataPathConfirm(NanDataPathConfirmInd* event) {
-    const auto lock = hidl_sync_util::acquireGlobalLock();
+    const auto lock = acquireCallbackLock();
     if (on_nan_event_data_path_confirm_user_callback && event) {
-        on_nan_event_data_path_confirm_user_callback(*event);
+        dispatchUserCallback(on_nan_event_data_path_confirm_user_callback,
+                             *event);
     }
 }
 
 std::function<void(const NanDataPathEndInd&)>
     on_nan_event_data_path_end_user_callback;
 void onAysncNanEventDataPathEnd(NanDataPathEndInd* event) {
-    const auto lock = hidl_sync_util::acquireGlobalLock();
+    const auto lock = acquireCallbackLock();
     if (on_nan_event_data_path_end_user_callback && event) {
-        on_nan_event_data_path_end_user_callback(*event);
+        const auto& callback = on_nan_event_data_path_end_user_callback;
+        const auto event_copy = copyNanDataPathEndInd(*event);
+        hidl_sync_util::dispatchCallback(
+            [callback, event_copy]() { callback(*event_copy); });
     }
 }
 
 std::function<void(const NanTransmitFollowupInd&)>
     on_nan_event_transmit_follow_up_user_callback;
 void onAysncNanEventTransmitFollowUp(NanTransmitFollowupInd* event) {
-    const auto lock = hidl_sync_util::acquireGlobalLock();
+    const auto lock = acquireCallbackLock();
     if (on_nan_event_transmit_follow_up_user_callback && event) {
-        on_nan_event_transmit_follow_up_user_callback(*event);
+        dispatchUserCallback(on_nan_event_transmit_follow_up_user_callback,
+                             *event);
     }
 }
 
 std::function<void(const NanRangeRequestInd&)>
     on_nan_event_range_request_user_callback;
 void onAysncNanEventRangeRequest(NanRangeRequestInd* event) {
-    const auto lock = hidl_sync_util::acquireGlobalLock();
+    const auto lock = acquireCallbackLock();
     if (on_nan_event_range_request_user_callback && event) {
-        on_nan_event_range_request_user_callback(*event);
+        dispatchUserCallback(on_nan_event_range_request_user_callback, *event);
     }
 }
 
 std::function<void(const NanRangeReportInd&)>
     on_nan_event_range_report_user_callback;
 void onAysncNanEventRangeReport(NanRangeReportInd* event) {
-    const auto lock = hidl_sync_util::acquireGlobalLock();
+    const auto lock = acquireCallbackLock();
     if (on_nan_event_range_report_user_callback && event) {
-        on_nan_event_range_report_user_callback(*event);
+        dispatchUserCallback(on_nan_event_range_report_user_callback, *event);
     }
 }
 
 std::function<void(const NanDataPathScheduleUpdateInd&)>
     on_nan_event_schedule_update_user_callback;
 void onAsyncNanEventScheduleUpdate(NanDataPathScheduleUpdateInd* event) {
-    const auto lock = hidl_sync_util::acquireGlobalLock();
+    const auto lock = acquireCallbackLock();
     if (on_nan_event_schedule_update_user_callback && event) {
-        on_nan_event_schedule_update_user_callback(*event);
+        const auto& callback = on_nan_event_schedule_update_user_callback;
+        const auto event_copy = copyNanDataPathScheduleUpdateInd(*event);
+        hidl_sync_util::dispatchCallback(
+            [callback, event_copy]() { callback(*event_copy); });
     }
 }
 // End of the free-standing "C" style callbacks.
@@ -359,7 +430,11 @@ wifi_error WifiLegacyHal::initialize() {
 wifi_error WifiLegacyHal::start() {
     // Ensure that we're starting in a good state.
     CHECK(global_func_table_.wifi_initialize && !global_handle_ &&
-          iface_name_to_handle_.empty() && !awaiting_event_loop_termination_);
+          !awaiting_event_loop_termination_);
+    {
+        std::lock_guard<std::mutex> lock(iface_name_to_handle_lock_);
+        CHECK(iface_name_to_handle_.empty());
+    }
     if (is_started_) {
         LOG(DEBUG) << "Legacy HAL already started";
         return WIFI_SUCCESS;
@@ -384,7 +459,12 @@ wifi_error WifiLegacyHal::start() {
     }
     std::thread(&WifiLegacyHal::runEventLoop, this).detach();
     status = retrieveIfaceHandles();
-    if (status != WIFI_SUCCESS || iface_name_to_handle_.empty()) {
+    bool has_iface_handles;
+    {
+        std::lock_guard<std::mutex> lock(iface_name_to_handle_lock_);
+        has_iface_handles = !iface_name_to_handle_.empty();
+    }
+    if (status != WIFI_SUCCESS || !has_iface_handles) {
         LOG(ERROR) << "Failed to retrieve wlan interface handle";
         return status;
     }
@@ -394,7 +474,7 @@ wifi_error WifiLegacyHal::start() {
 }
 
 wifi_error WifiLegacyHal::stop(
-    /* NONNULL */ std::unique_lock<std::recursive_mutex>* lock,
+    /* NONNULL */ std::unique_lock<hidl_sync_util::LockDomain>* lock,
     const std::function<void()>& on_stop_complete_user_callback) {
     if (!is_started_) {
         LOG(DEBUG) << "Legacy HAL already stopped";
@@ -533,6 +613,7 @@ wifi_error WifiLegacyHal::startGscan(
     const on_gscan_results_callback& on_results_user_callback,
     const on_gscan_full_result_callback& on_full_result_user_callback) {
     // If there is already an ongoing background scan, reject new scan requests.
+    auto lock = acquireCallbackLock();
     if (on_gscan_event_internal_callback ||
         on_gscan_full_result_internal_callback) {
         return WIFI_ERROR_NOT_AVAILABLE;
@@ -552,7 +633,8 @@ wifi_error WifiLegacyHal::startGscan(
                     std::tie(status, cached_scan_results) =
                         getGscanCachedResults(iface_name);
                     if (status == WIFI_SUCCESS) {
-                        on_results_user_callback(id, cached_scan_results);
+                        dispatchUserCallback(on_results_user_callback, id,
+                                             cached_scan_results);
                         return;
                     }
                     FALLTHROUGH_INTENDED;
@@ -560,7 +642,7 @@ wifi_error WifiLegacyHal::startGscan(
                 // Fall through if failed. Failure to retrieve cached scan
                 // results should trigger a background scan failure.
                 case WIFI_SCAN_FAILED:
-                    on_failure_user_callback(id);
+                    dispatchUserCallback(on_failure_user_callback, id);
                     on_gscan_event_internal_callback = nullptr;
                     on_gscan_full_result_internal_callback = nullptr;
                     return;
@@ -572,16 +654,31 @@ wifi_error WifiLegacyHal::startGscan(
                                                  wifi_request_id id,
                                                  wifi_scan_result* result,
                                                  uint32_t buckets_scanned) {
-        if (result) {
-            on_full_result_user_callback(id, result, buckets_scanned);
+        if (!result) {
+            return;
         }
+        // Copy the result along with its IEs, which follow the struct.
+        const size_t size =
+            offsetof(wifi_scan_result, ie_data) + result->ie_length;
+        std::shared_ptr<uint8_t> result_copy(
+            new uint8_t[std::max(size, sizeof(*result))](),
+            std::default_delete<uint8_t[]>());
+        memcpy(result_copy.get(), result, size);
+        hidl_sync_util::dispatchCallback([on_full_result_user_callback, id,
+                                          result_copy, buckets_scanned]() {
+            on_full_result_user_callback(
+                id, reinterpret_cast<wifi_scan_result*>(result_copy.get()),
+                buckets_scanned);
+        });
     };
+    lock.unlock();
 
     wifi_scan_result_handler handler = {onAsyncGscanFullResult,
                                         onAsyncGscanEvent};
     wifi_error status = global_func_table_.wifi_start_gscan(
         id, getIfaceHandle(iface_name), params, handler);
     if (status != WIFI_SUCCESS) {
+        lock.lock();
         on_gscan_event_internal_callback = nullptr;
         on_gscan_full_result_internal_callback = nullptr;
     }
@@ -593,15 +690,18 @@ wifi_error WifiLegacyHal::stopGscan(const std::string& iface_name,
     // If there is no an ongoing background scan, reject stop requests.
     // TODO(b/32337212): This needs to be handled by the HIDL object because we
     // need to return the NOT_STARTED error code.
+    auto lock = acquireCallbackLock();
     if (!on_gscan_event_internal_callback &&
         !on_gscan_full_result_internal_callback) {
         return WIFI_ERROR_NOT_AVAILABLE;
     }
+    lock.unlock();
     wifi_error status =
         global_func_table_.wifi_stop_gscan(id, getIfaceHandle(iface_name));
     // If the request Id is wrong, don't stop the ongoing background scan. Any
     // other error should be treated as the end of background scan.
     if (status != WIFI_ERROR_INVALID_REQUEST_ID) {
+        lock.lock();
         on_gscan_event_internal_callback = nullptr;
         on_gscan_full_result_internal_callback = nullptr;
     }
@@ -712,6 +812,7 @@ wifi_error WifiLegacyHal::startRssiMonitoring(
     int8_t min_rssi,
     const on_rssi_threshold_breached_callback&
         on_threshold_breached_user_callback) {
+    auto lock = acquireCallbackLock();
     if (on_rssi_threshold_breached_internal_callback) {
         return WIFI_ERROR_NOT_AVAILABLE;
     }
@@ -725,12 +826,15 @@ wifi_error WifiLegacyHal::startRssiMonitoring(
             // |bssid_ptr| pointer is assumed to have 6 bytes for the mac
             // address.
             std::copy(bssid_ptr, bssid_ptr + 6, std::begin(bssid_arr));
-            on_threshold_breached_user_callback(id, bssid_arr, rssi);
+            dispatchUserCallback(on_threshold_breached_user_callback, id,
+                                 bssid_arr, rssi);
         };
+    lock.unlock();
     wifi_error status = global_func_table_.wifi_start_rssi_monitoring(
         id, getIfaceHandle(iface_name), max_rssi, min_rssi,
         {onAsyncRssiThresholdBreached});
     if (status != WIFI_SUCCESS) {
+        lock.lock();
         on_rssi_threshold_breached_internal_callback = nullptr;
     }
     return status;
@@ -738,14 +842,17 @@ wifi_error WifiLegacyHal::startRssiMonitoring(
 
 wifi_error WifiLegacyHal::stopRssiMonitoring(const std::string& iface_name,
                                              wifi_request_id id) {
+    auto lock = acquireCallbackLock();
     if (!on_rssi_threshold_breached_internal_callback) {
         return WIFI_ERROR_NOT_AVAILABLE;
     }
+    lock.unlock();
     wifi_error status = global_func_table_.wifi_stop_rssi_monitoring(
         id, getIfaceHandle(iface_name));
     // If the request Id is wrong, don't stop the ongoing rssi monitoring. Any
     // other error should be treated as the end of background scan.
     if (status != WIFI_ERROR_INVALID_REQUEST_ID) {
+        lock.lock();
         on_rssi_threshold_breached_internal_callback = nullptr;
     }
     return status;
@@ -909,22 +1016,24 @@ std::pair<wifi_error, WakeReasonStats> WifiLegacyHal::getWakeReasonStats(
 wifi_error WifiLegacyHal::registerRingBufferCallbackHandler(
     const std::string& iface_name,
     const on_ring_buffer_data_callback& on_user_data_callback) {
+    std::unique_lock<std::mutex> lock(on_ring_buffer_data_lock);
     if (on_ring_buffer_data_internal_callback) {
         return WIFI_ERROR_NOT_AVAILABLE;
     }
     on_ring_buffer_data_internal_callback =
         [on_user_data_callback](char* ring_name, char* buffer, int buffer_size,
                                 wifi_ring_buffer_status* status) {
-            if (status && buffer) {
-                std::vector<uint8_t> buffer_vector(
-                    reinterpret_cast<uint8_t*>(buffer),
-                    reinterpret_cast<uint8_t*>(buffer) + buffer_size);
-                on_user_data_callback(ring_name, buffer_vector, *status);
+            if (status && buffer && buffer_size >= 0) {
+                on_user_data_callback(ring_name,
+                                      reinterpret_cast<uint8_t*>(buffer),
+                                      buffer_size, *status);
             }
         };
+    lock.unlock();
     wifi_error status = global_func_table_.wifi_set_log_handler(
         0, getIfaceHandle(iface_name), {onAsyncRingBufferData});
     if (status != WIFI_SUCCESS) {
+        lock.lock();
         on_ring_buffer_data_internal_callback = nullptr;
     }
     return status;
@@ -932,10 +1041,13 @@ wifi_error WifiLegacyHal::registerRingBufferCallbackHandler(
 
 wifi_error WifiLegacyHal::deregisterRingBufferCallbackHandler(
     const std::string& iface_name) {
-    if (!on_ring_buffer_data_internal_callback) {
-        return WIFI_ERROR_NOT_AVAILABLE;
+    {
+        std::lock_guard<std::mutex> lock(on_ring_buffer_data_lock);
+        if (!on_ring_buffer_data_internal_callback) {
+            return WIFI_ERROR_NOT_AVAILABLE;
+        }
+        on_ring_buffer_data_internal_callback = nullptr;
     }
-    on_ring_buffer_data_internal_callback = nullptr;
     return global_func_table_.wifi_reset_log_handler(
         0, getIfaceHandle(iface_name));
 }
@@ -971,6 +1083,7 @@ wifi_error WifiLegacyHal::getRingBufferData(const std::string& iface_name,
 wifi_error WifiLegacyHal::registerErrorAlertCallbackHandler(
     const std::string& iface_name,
     const on_error_alert_callback& on_user_alert_callback) {
+    auto lock = acquireCallbackLock();
     if (on_error_alert_internal_callback) {
         return WIFI_ERROR_NOT_AVAILABLE;
     }
@@ -979,16 +1092,18 @@ wifi_error WifiLegacyHal::registerErrorAlertCallbackHandler(
                                            int buffer_size, int err_code) {
         if (buffer) {
             CHECK(id == 0);
-            on_user_alert_callback(
-                err_code,
+            dispatchUserCallback(
+                on_user_alert_callback, err_code,
                 std::vector<uint8_t>(
                     reinterpret_cast<uint8_t*>(buffer),
                     reinterpret_cast<uint8_t*>(buffer) + buffer_size));
         }
     };
+    lock.unlock();
     wifi_error status = global_func_table_.wifi_set_alert_handler(
         0, getIfaceHandle(iface_name), {onAsyncErrorAlert});
     if (status != WIFI_SUCCESS) {
+        lock.lock();
         on_error_alert_internal_callback = nullptr;
     }
     return status;
@@ -996,10 +1111,13 @@ wifi_error WifiLegacyHal::registerErrorAlertCallbackHandler(
 
 wifi_error WifiLegacyHal::deregisterErrorAlertCallbackHandler(
     const std::string& iface_name) {
-    if (!on_error_alert_internal_callback) {
-        return WIFI_ERROR_NOT_AVAILABLE;
+    {
+        const auto lock = acquireCallbackLock();
+        if (!on_error_alert_internal_callback) {
+            return WIFI_ERROR_NOT_AVAILABLE;
+        }
+        on_error_alert_internal_callback = nullptr;
     }
-    on_error_alert_internal_callback = nullptr;
     return global_func_table_.wifi_reset_alert_handler(
         0, getIfaceHandle(iface_name));
 }
@@ -1007,6 +1125,7 @@ wifi_error WifiLegacyHal::deregisterErrorAlertCallbackHandler(
 wifi_error WifiLegacyHal::registerRadioModeChangeCallbackHandler(
     const std::string& iface_name,
     const on_radio_mode_change_callback& on_user_change_callback) {
+    auto lock = acquireCallbackLock();
     if (on_radio_mode_change_internal_callback) {
         return WIFI_ERROR_NOT_AVAILABLE;
     }
@@ -1028,21 +1147,49 @@ wifi_error WifiLegacyHal::registerRadioModeChangeCallbackHandler(
                 }
                 mac_infos_vec.push_back(mac_info);
             }
-            on_user_change_callback(mac_infos_vec);
+            dispatchUserCallback(on_user_change_callback, mac_infos_vec);
         }
     };
+    lock.unlock();
     wifi_error status = global_func_table_.wifi_set_radio_mode_change_handler(
         0, getIfaceHandle(iface_name), {onAsyncRadioModeChange});
     if (status != WIFI_SUCCESS) {
+        lock.lock();
         on_radio_mode_change_internal_callback = nullptr;
     }
     return status;
 }
 
+// Copy of a |wifi_rtt_result| and the information elements it points to,
+// which outlives the legacy HAL callback.
+struct RttResultCopy {
+    wifi_rtt_result result;
+    std::vector<uint8_t> lci;
+    std::vector<uint8_t> lcr;
+};
+
+std::vector<uint8_t> copyInformationElement(
+    const wifi_information_element* ie) {
+    if (!ie) {
+        return {};
+    }
+    const uint8_t* ie_ptr = reinterpret_cast<const uint8_t*>(ie);
+    return std::vector<uint8_t>(
+        ie_ptr, ie_ptr + offsetof(wifi_information_element, data) + ie->len);
+}
+
+wifi_information_element* asInformationElement(std::vector<uint8_t>* ie) {
+    if (ie->empty()) {
+        return nullptr;
+    }
+    return reinterpret_cast<wifi_information_element*>(ie->data());
+}
+
 wifi_error WifiLegacyHal::startRttRangeRequest(
     const std::string& iface_name, wifi_request_id id,
     const std::vector<wifi_rtt_config>& rtt_configs,
     const on_rtt_results_callback& on_results_user_callback) {
+    auto lock = acquireCallbackLock();
     if (on_rtt_results_internal_callback) {
         return WIFI_ERROR_NOT_AVAILABLE;
     }
@@ -1054,20 +1201,37 @@ wifi_error WifiLegacyHal::startRttRangeRequest(
                 LOG(ERROR) << "Unexpected nullptr in RTT results";
                 return;
             }
-            std::vector<const wifi_rtt_result*> rtt_results_vec;
-            std::copy_if(rtt_results, rtt_results + num_results,
-                         back_inserter(rtt_results_vec),
-                         [](wifi_rtt_result* rtt_result) {
-                             return rtt_result != nullptr;
-                         });
-            on_results_user_callback(id, rtt_results_vec);
+            auto rtt_results_copy =
+                std::make_shared<std::vector<RttResultCopy>>();
+            for (unsigned i = 0; i < num_results; i++) {
+                if (rtt_results[i] != nullptr) {
+                    rtt_results_copy->push_back(
+                        {*rtt_results[i],
+                         copyInformationElement(rtt_results[i]->LCI),
+                         copyInformationElement(rtt_results[i]->LCR)});
+                }
+            }
+            hidl_sync_util::dispatchCallback([on_results_user_callback, id,
+                                              rtt_results_copy]() {
+                std::vector<const wifi_rtt_result*> rtt_results_vec;
+                for (auto& rtt_result : *rtt_results_copy) {
+                    rtt_result.result.LCI =
+                        asInformationElement(&rtt_result.lci);
+                    rtt_result.result.LCR =
+                        asInformationElement(&rtt_result.lcr);
+                    rtt_results_vec.push_back(&rtt_result.result);
+                }
+                on_results_user_callback(id, rtt_results_vec);
+            });
         };
+    lock.unlock();
 
     std::vector<wifi_rtt_config> rtt_configs_internal(rtt_configs);
     wifi_error status = global_func_table_.wifi_rtt_range_request(
         id, getIfaceHandle(iface_name), rtt_configs.size(),
         rtt_configs_internal.data(), {onAsyncRttResults});
     if (status != WIFI_SUCCESS) {
+        lock.lock();
         on_rtt_results_internal_callback = nullptr;
     }
     return status;
@@ -1076,9 +1240,11 @@ wifi_error WifiLegacyHal::startRttRangeRequest(
 wifi_error WifiLegacyHal::cancelRttRangeRequest(
     const std::string& iface_name, wifi_request_id id,
     const std::vector<std::array<uint8_t, 6>>& mac_addrs) {
+    auto lock = acquireCallbackLock();
     if (!on_rtt_results_internal_callback) {
         return WIFI_ERROR_NOT_AVAILABLE;
     }
+    lock.unlock();
     static_assert(sizeof(mac_addr) == sizeof(std::array<uint8_t, 6>),
                   "MAC address size mismatch");
     // TODO: How do we handle partial cancels (i.e only a subset of enabled mac
@@ -1090,6 +1256,7 @@ wifi_error WifiLegacyHal::cancelRttRangeRequest(
     // If the request Id is wrong, don't stop the ongoing range request. Any
     // other error should be treated as the end of rtt ranging.
     if (status != WIFI_ERROR_INVALID_REQUEST_ID) {
+        lock.lock();
         on_rtt_results_internal_callback = nullptr;
     }
     return status;
@@ -1145,6 +1312,7 @@ wifi_error WifiLegacyHal::setRttLcr(const std::string& iface_name,
 
 wifi_error WifiLegacyHal::nanRegisterCallbackHandlers(
     const std::string& iface_name, const NanCallbackHandlers& user_callbacks) {
+    auto lock = acquireCallbackLock();
     on_nan_notify_response_user_callback = user_callbacks.on_notify_response;
     on_nan_event_publish_terminated_user_callback =
         user_callbacks.on_event_publish_terminated;
@@ -1174,6 +1342,7 @@ wifi_error WifiLegacyHal::nanRegisterCallbackHandlers(
         user_callbacks.on_event_range_report;
     on_nan_event_schedule_update_user_callback =
         user_callbacks.on_event_schedule_update;
+    lock.unlock();
 
     return global_func_table_.wifi_nan_register_handler(
         getIfaceHandle(iface_name),
@@ -1361,6 +1530,7 @@ wifi_error WifiLegacyHal::retrieveIfaceHandles() {
         // API does not return a size.
         std::string iface_name(iface_name_arr.data());
         LOG(INFO) << "Adding interface handle for " << iface_name;
+        std::lock_guard<std::mutex> lock(iface_name_to_handle_lock_);
         iface_name_to_handle_[iface_name] = iface_handles[i];
     }
     return WIFI_SUCCESS;
@@ -1368,6 +1538,7 @@ wifi_error WifiLegacyHal::retrieveIfaceHandles() {
 
 wifi_interface_handle WifiLegacyHal::getIfaceHandle(
     const std::string& iface_name) {
+    std::lock_guard<std::mutex> lock(iface_name_to_handle_lock_);
     const auto iface_handle_iter = iface_name_to_handle_.find(iface_name);
     if (iface_handle_iter == iface_name_to_handle_.end()) {
         LOG(ERROR) << "Unknown iface name: " << iface_name;
@@ -1379,7 +1550,7 @@ wifi_interface_handle WifiLegacyHal::getIfaceHandle(
 void WifiLegacyHal::runEventLoop() {
     LOG(DEBUG) << "Starting legacy HAL event loop";
     global_func_table_.wifi_event_loop(global_handle_);
-    const auto lock = hidl_sync_util::acquireGlobalLock();
+    const auto lock = hidl_sync_util::getChipLockDomain().acquire();
     if (!awaiting_event_loop_termination_) {
         LOG(FATAL)
             << "Legacy HAL event loop terminated, but HAL was not stopping";
@@ -1417,14 +1588,21 @@ WifiLegacyHal::getGscanCachedResults(const std::string& iface_name) {
 
 void WifiLegacyHal::invalidate() {
     global_handle_ = nullptr;
-    iface_name_to_handle_.clear();
+    {
+        std::lock_guard<std::mutex> lock(iface_name_to_handle_lock_);
+        iface_name_to_handle_.clear();
+    }
     on_driver_memory_dump_internal_callback = nullptr;
     on_firmware_memory_dump_internal_callback = nullptr;
+    on_link_layer_stats_result_internal_callback = nullptr;
+    {
+        std::lock_guard<std::mutex> lock(on_ring_buffer_data_lock);
+        on_ring_buffer_data_internal_callback = nullptr;
+    }
+    const auto lock = acquireCallbackLock();
     on_gscan_event_internal_callback = nullptr;
     on_gscan_full_result_internal_callback = nullptr;
-    on_link_layer_stats_result_internal_callback = nullptr;
     on_rssi_threshold_breached_internal_callback = nullptr;
-    on_ring_buffer_data_internal_callback = nullptr;
     on_error_alert_internal_callback = nullptr;
     on_radio_mode_change_internal_callback = nullptr;
     on_rtt_results_internal_callback = nullptr;
@@ -20,11 +20,15 @@
 #include <condition_variable>
 #include <functional>
 #include <map>
+#include <memory>
+#include <mutex>
 #include <thread>
 #include <vector>
 
 #include <wifi_system/interface_tool.h>
 
+#include "hidl_sync_util.h"
+
 // HACK: The include inside the namespace below also transitively includes a
 // bunch of libc headers into the namespace, which leads to functions like
 // socketpair being defined in
@@ -112,6 +116,15 @@ struct NanCallbackHandlers {
         on_event_schedule_update;
 };
 
+// The NAN data path end and schedule update indications end in the flexible
+// array |ndp_instance_id|, which a plain struct copy drops. These copy an
+// indication along with its instance ids, so that it outlives the legacy HAL
+// callback.
+std::shared_ptr<const NanDataPathEndInd> copyNanDataPathEndInd(
+    const NanDataPathEndInd& ind);
+std::shared_ptr<const NanDataPathScheduleUpdateInd>
+copyNanDataPathScheduleUpdateInd(const NanDataPathScheduleUpdateInd& ind);
+
 // Full scan results contain IE info and are hence passed by reference, to
 // preserve the variable length array member |ie_data|. Callee must not retain
 // the pointer.
@@ -133,9 +146,11 @@ using on_rssi_threshold_breached_callback =
 using on_rtt_results_callback = std::function<void(
     wifi_request_id, const std::vector<const wifi_rtt_result*>&)>;
 
-// Callback for ring buffer data.
+// Callback for ring buffer data. Data is only valid for the duration of the
+// callback. Unlike other asynchronous callbacks, it is not invoked under the
+// global lock.
 using on_ring_buffer_data_callback =
-    std::function<void(const std::string&, const std::vector<uint8_t>&,
+    std::function<void(const char*, const uint8_t*, size_t,
                        const wifi_ring_buffer_status&)>;
 
 // Callback for alerts.
@@ -179,8 +194,9 @@ class WifiLegacyHal {
     virtual wifi_error start();
     // Deinitialize the legacy HAL and wait for the event loop thread to exit
     // using a predefined timeout.
-    virtual wifi_error stop(std::unique_lock<std::recursive_mutex>* lock,
-                            const std::function<void()>& on_complete_callback);
+    virtual wifi_error stop(
+        std::unique_lock<hidl_sync_util::LockDomain>* lock,
+        const std::function<void()>& on_complete_callback);
     // Checks if legacy HAL has successfully started
     bool isStarted();
     // Wrappers for all the functions in the legacy HAL function table.
@@ -384,7 +400,9 @@ class WifiLegacyHal {
     // Opaque handle to be used for all global operations.
     wifi_handle global_handle_;
     // Map of interface name to handle that is to be used for all interface
-    // specific operations.
+    // specific operations. The gscan event callback looks up handles on the
+    // legacy HAL event loop thread, so the map has its own lock.
+    std::mutex iface_name_to_handle_lock_;
     std::map<std::string, wifi_interface_handle> iface_name_to_handle_;
     // Flag to indicate if we have initiated the cleanup of legacy HAL.
     std::atomic<bool> awaiting_event_loop_termination_;
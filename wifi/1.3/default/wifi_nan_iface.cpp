@@ -35,7 +35,8 @@ WifiNanIface::WifiNanIface(
     : ifname_(ifname),
       legacy_hal_(legacy_hal),
       iface_util_(iface_util),
-      is_valid_(true) {
+      is_valid_(true),
+      lock_domain_("nan:" + ifname, hidl_sync_util::LockDomain::Rank::kIface) {
     // Register all the callbacks here. these should be valid for the lifetime
     // of the object. Whenever the mode changes legacy HAL will remove
     // all of these callbacks.
@@ -48,6 +49,7 @@ WifiNanIface::WifiNanIface(
                                   legacy_hal::transaction_id id,
                                   const legacy_hal::NanResponseMsg& msg) {
         const auto shared_ptr_this = weak_ptr_this.promote();
+        const auto lock = hidl_sync_util::acquireObjectLock(shared_ptr_this);
         if (!shared_ptr_this.get() || !shared_ptr_this->isValid()) {
             LOG(ERROR) << "Callback invoked on an invalid object";
             return;
@@ -246,6 +248,8 @@ WifiNanIface::WifiNanIface(
     callback_handlers.on_event_disc_eng_event =
         [weak_ptr_this](const legacy_hal::NanDiscEngEventInd& msg) {
             const auto shared_ptr_this = weak_ptr_this.promote();
+            const auto lock =
+                hidl_sync_util::acquireObjectLock(shared_ptr_this);
             if (!shared_ptr_this.get() || !shared_ptr_this->isValid()) {
                 LOG(ERROR) << "Callback invoked on an invalid object";
                 return;
@@ -265,6 +269,8 @@ WifiNanIface::WifiNanIface(
     callback_handlers.on_event_disabled =
         [weak_ptr_this](const legacy_hal::NanDisabledInd& msg) {
             const auto shared_ptr_this = weak_ptr_this.promote();
+            const auto lock =
+                hidl_sync_util::acquireObjectLock(shared_ptr_this);
             if (!shared_ptr_this.get() || !shared_ptr_this->isValid()) {
                 LOG(ERROR) << "Callback invoked on an invalid object";
                 return;
@@ -283,6 +289,8 @@ WifiNanIface::WifiNanIface(
     callback_handlers.on_event_publish_terminated =
         [weak_ptr_this](const legacy_hal::NanPublishTerminatedInd& msg) {
             const auto shared_ptr_this = weak_ptr_this.promote();
+            const auto lock =
+                hidl_sync_util::acquireObjectLock(shared_ptr_this);
             if (!shared_ptr_this.get() || !shared_ptr_this->isValid()) {
                 LOG(ERROR) << "Callback invoked on an invalid object";
                 return;
@@ -302,6 +310,8 @@ WifiNanIface::WifiNanIface(
     callback_handlers.on_event_subscribe_terminated =
         [weak_ptr_this](const legacy_hal::NanSubscribeTerminatedInd& msg) {
             const auto shared_ptr_this = weak_ptr_this.promote();
+            const auto lock =
+                hidl_sync_util::acquireObjectLock(shared_ptr_this);
             if (!shared_ptr_this.get() || !shared_ptr_this->isValid()) {
                 LOG(ERROR) << "Callback invoked on an invalid object";
                 return;
@@ -322,6 +332,8 @@ WifiNanIface::WifiNanIface(
     callback_handlers.on_event_match =
         [weak_ptr_this](const legacy_hal::NanMatchInd& msg) {
             const auto shared_ptr_this = weak_ptr_this.promote();
+            const auto lock =
+                hidl_sync_util::acquireObjectLock(shared_ptr_this);
             if (!shared_ptr_this.get() || !shared_ptr_this->isValid()) {
                 LOG(ERROR) << "Callback invoked on an invalid object";
                 return;
@@ -343,6 +355,8 @@ WifiNanIface::WifiNanIface(
     callback_handlers.on_event_match_expired =
         [weak_ptr_this](const legacy_hal::NanMatchExpiredInd& msg) {
             const auto shared_ptr_this = weak_ptr_this.promote();
+            const auto lock =
+                hidl_sync_util::acquireObjectLock(shared_ptr_this);
             if (!shared_ptr_this.get() || !shared_ptr_this->isValid()) {
                 LOG(ERROR) << "Callback invoked on an invalid object";
                 return;
@@ -360,6 +374,8 @@ WifiNanIface::WifiNanIface(
     callback_handlers.on_event_followup =
         [weak_ptr_this](const legacy_hal::NanFollowupInd& msg) {
             const auto shared_ptr_this = weak_ptr_this.promote();
+            const auto lock =
+                hidl_sync_util::acquireObjectLock(shared_ptr_this);
             if (!shared_ptr_this.get() || !shared_ptr_this->isValid()) {
                 LOG(ERROR) << "Callback invoked on an invalid object";
                 return;
@@ -381,6 +397,8 @@ WifiNanIface::WifiNanIface(
     callback_handlers.on_event_transmit_follow_up =
         [weak_ptr_this](const legacy_hal::NanTransmitFollowupInd& msg) {
             const auto shared_ptr_this = weak_ptr_this.promote();
+            const auto lock =
+                hidl_sync_util::acquireObjectLock(shared_ptr_this);
             if (!shared_ptr_this.get() || !shared_ptr_this->isValid()) {
                 LOG(ERROR) << "Callback invoked on an invalid object";
                 return;
@@ -399,6 +417,8 @@ WifiNanIface::WifiNanIface(
     callback_handlers.on_event_data_path_request =
         [weak_ptr_this](const legacy_hal::NanDataPathRequestInd& msg) {
             const auto shared_ptr_this = weak_ptr_this.promote();
+            const auto lock =
+                hidl_sync_util::acquireObjectLock(shared_ptr_this);
             if (!shared_ptr_this.get() || !shared_ptr_this->isValid()) {
                 LOG(ERROR) << "Callback invoked on an invalid object";
                 return;
@@ -420,6 +440,8 @@ WifiNanIface::WifiNanIface(
     callback_handlers.on_event_data_path_confirm =
         [weak_ptr_this](const legacy_hal::NanDataPathConfirmInd& msg) {
             const auto shared_ptr_this = weak_ptr_this.promote();
+            const auto lock =
+                hidl_sync_util::acquireObjectLock(shared_ptr_this);
             if (!shared_ptr_this.get() || !shared_ptr_this->isValid()) {
                 LOG(ERROR) << "Callback invoked on an invalid object";
                 return;
@@ -442,6 +464,8 @@ WifiNanIface::WifiNanIface(
     callback_handlers.on_event_data_path_end =
         [weak_ptr_this](const legacy_hal::NanDataPathEndInd& msg) {
             const auto shared_ptr_this = weak_ptr_this.promote();
+            const auto lock =
+                hidl_sync_util::acquireObjectLock(shared_ptr_this);
             if (!shared_ptr_this.get() || !shared_ptr_this->isValid()) {
                 LOG(ERROR) << "Callback invoked on an invalid object";
                 return;
@@ -477,6 +501,7 @@ WifiNanIface::WifiNanIface(
                                         const legacy_hal::
                                             NanDataPathScheduleUpdateInd& msg) {
         const auto shared_ptr_this = weak_ptr_this.promote();
+        const auto lock = hidl_sync_util::acquireObjectLock(shared_ptr_this);
         if (!shared_ptr_this.get() || !shared_ptr_this->isValid()) {
             LOG(ERROR) << "Callback invoked on an invalid object";
             return;
@@ -505,6 +530,10 @@ WifiNanIface::WifiNanIface(
 
     // Register for iface state toggle events.
     iface_util::IfaceEventHandlers event_handlers = {};
+    // Invoked synchronously on the HIDL thread when another iface object
+    // changes the MAC address of |ifname_|, with that object's lock domain
+    // held. It only reads the callback registrations, which are never modified
+    // off the HIDL thread, so it doesn't take the lock domain of this iface.
     event_handlers.on_state_toggle_off_on =
         [weak_ptr_this](const std::string& /* iface_name */) {
             const auto shared_ptr_this = weak_ptr_this.promote();
@@ -525,6 +554,7 @@ WifiNanIface::WifiNanIface(
 }
 
 void WifiNanIface::invalidate() {
+    const auto lock = lock_domain_.acquire();
     // send commands to HAL to actually disable and destroy interfaces
     legacy_hal_.lock()->nanDisableRequest(ifname_, 0xFFFF);
     legacy_hal_.lock()->nanDataInterfaceDelete(ifname_, 0xFFFE, "aware_data0");
@@ -538,6 +568,10 @@ void WifiNanIface::invalidate() {
 
 bool WifiNanIface::isValid() { return is_valid_; }
 
+hidl_sync_util::LockDomain& WifiNanIface::getLockDomain() {
+    return lock_domain_;
+}
+
 std::string WifiNanIface::getName() { return ifname_; }
 
 std::set<sp<V1_0::IWifiNanIfaceEventCallback>>
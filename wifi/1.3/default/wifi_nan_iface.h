@@ -22,6 +22,7 @@
 #include <android/hardware/wifi/1.2/IWifiNanIface.h>
 
 #include "hidl_callback_util.h"
+#include "hidl_sync_util.h"
 #include "wifi_iface_util.h"
 #include "wifi_legacy_hal.h"
 
@@ -43,6 +44,7 @@ class WifiNanIface : public V1_2::IWifiNanIface {
     // Refer to |WifiChip::invalidate()|.
     void invalidate();
     bool isValid();
+    hidl_sync_util::LockDomain& getLockDomain();
     std::string getName();
 
     // HIDL methods exposed.
@@ -151,6 +153,7 @@ class WifiNanIface : public V1_2::IWifiNanIface {
     std::weak_ptr<legacy_hal::WifiLegacyHal> legacy_hal_;
     std::weak_ptr<iface_util::WifiIfaceUtil> iface_util_;
     bool is_valid_;
+    hidl_sync_util::LockDomain lock_domain_;
     hidl_callback_util::HidlCallbackHandler<V1_0::IWifiNanIfaceEventCallback>
         event_cb_handler_;
     hidl_callback_util::HidlCallbackHandler<V1_2::IWifiNanIfaceEventCallback>
@@ -30,15 +30,23 @@ using hidl_return_util::validateAndCall;
 WifiP2pIface::WifiP2pIface(
     const std::string& ifname,
     const std::weak_ptr<legacy_hal::WifiLegacyHal> legacy_hal)
-    : ifname_(ifname), legacy_hal_(legacy_hal), is_valid_(true) {}
+    : ifname_(ifname),
+      legacy_hal_(legacy_hal),
+      is_valid_(true),
+      lock_domain_("p2p:" + ifname, hidl_sync_util::LockDomain::Rank::kIface) {}
 
 void WifiP2pIface::invalidate() {
+    const auto lock = lock_domain_.acquire();
     legacy_hal_.reset();
     is_valid_ = false;
 }
 
 bool WifiP2pIface::isValid() { return is_valid_; }
 
+hidl_sync_util::LockDomain& WifiP2pIface::getLockDomain() {
+    return lock_domain_;
+}
+
 std::string WifiP2pIface::getName() { return ifname_; }
 
 Return<void> WifiP2pIface::getName(getName_cb hidl_status_cb) {
@@ -20,6 +20,7 @@
 #include <android-base/macros.h>
 #include <android/hardware/wifi/1.0/IWifiP2pIface.h>
 
+#include "hidl_sync_util.h"
 #include "wifi_legacy_hal.h"
 
 namespace android {
@@ -39,6 +40,7 @@ class WifiP2pIface : public V1_0::IWifiP2pIface {
     // Refer to |WifiChip::invalidate()|.
     void invalidate();
     bool isValid();
+    hidl_sync_util::LockDomain& getLockDomain();
     std::string getName();
 
     // HIDL methods exposed.
@@ -53,6 +55,7 @@ class WifiP2pIface : public V1_0::IWifiP2pIface {
     std::string ifname_;
     std::weak_ptr<legacy_hal::WifiLegacyHal> legacy_hal_;
     bool is_valid_;
+    hidl_sync_util::LockDomain lock_domain_;
 
     DISALLOW_COPY_AND_ASSIGN(WifiP2pIface);
 };
@@ -34,9 +34,12 @@ WifiRttController::WifiRttController(
     : ifname_(iface_name),
       bound_iface_(bound_iface),
       legacy_hal_(legacy_hal),
-      is_valid_(true) {}
+      is_valid_(true),
+      lock_domain_("rtt:" + iface_name,
+                   hidl_sync_util::LockDomain::Rank::kIface) {}
 
 void WifiRttController::invalidate() {
+    const auto lock = lock_domain_.acquire();
     legacy_hal_.reset();
     event_callbacks_.clear();
     is_valid_ = false;
@@ -44,6 +47,10 @@ void WifiRttController::invalidate() {
 
 bool WifiRttController::isValid() { return is_valid_; }
 
+hidl_sync_util::LockDomain& WifiRttController::getLockDomain() {
+    return lock_domain_;
+}
+
 std::vector<sp<IWifiRttControllerEventCallback>>
 WifiRttController::getEventCallbacks() {
     return event_callbacks_;
@@ -155,6 +162,8 @@ WifiStatus WifiRttController::rangeRequestInternal(
             legacy_hal::wifi_request_id id,
             const std::vector<const legacy_hal::wifi_rtt_result*>& results) {
             const auto shared_ptr_this = weak_ptr_this.promote();
+            const auto lock =
+                hidl_sync_util::acquireObjectLock(shared_ptr_this);
             if (!shared_ptr_this.get() || !shared_ptr_this->isValid()) {
                 LOG(ERROR) << "Callback invoked on an invalid object";
                 return;
@@ -22,6 +22,7 @@
 #include <android/hardware/wifi/1.0/IWifiRttController.h>
 #include <android/hardware/wifi/1.0/IWifiRttControllerEventCallback.h>
 
+#include "hidl_sync_util.h"
 #include "wifi_legacy_hal.h"
 
 namespace android {
@@ -41,6 +42,7 @@ class WifiRttController : public V1_0::IWifiRttController {
     // Refer to |WifiChip::invalidate()|.
     void invalidate();
     bool isValid();
+    hidl_sync_util::LockDomain& getLockDomain();
     std::vector<sp<IWifiRttControllerEventCallback>> getEventCallbacks();
     std::string getIfaceName();
 
@@ -93,6 +95,7 @@ class WifiRttController : public V1_0::IWifiRttController {
     std::weak_ptr<legacy_hal::WifiLegacyHal> legacy_hal_;
     std::vector<sp<IWifiRttControllerEventCallback>> event_callbacks_;
     bool is_valid_;
+    hidl_sync_util::LockDomain lock_domain_;
 
     DISALLOW_COPY_AND_ASSIGN(WifiRttController);
 };
@@ -14,7 +14,14 @@
  * limitations under the License.
  */
 
+#include <inttypes.h>
+
+#include <algorithm>
+#include <numeric>
+
 #include <android-base/logging.h>
+#include <android-base/stringprintf.h>
+#include <cutils/properties.h>
 
 #include "hidl_return_util.h"
 #include "hidl_struct_util.h"
@@ -26,8 +33,32 @@ namespace hardware {
 namespace wifi {
 namespace V1_3 {
 namespace implementation {
+using android::base::StringAppendF;
 using hidl_return_util::validateAndCall;
 
+namespace {
+// Number of link layer stats samples kept for the debug dump.
+constexpr size_t kLinkLayerStatsHistorySize = 32;
+// Link layer stats queries closer than this are served from the previous
+// sample instead of querying the driver again.
+constexpr char kLinkLayerStatsIntervalProperty[] =
+    "vendor.wifi.hal.link_layer_stats_interval_ms";
+constexpr int32_t kDefaultLinkLayerStatsIntervalMs = 1000;
+// Window of the link layer stats rates summarized in the debug dump.
+constexpr std::chrono::milliseconds kLinkLayerStatsSummaryWindow(60000);
+
+std::chrono::milliseconds getLinkLayerStatsInterval() {
+    return std::chrono::milliseconds(std::max(
+        0, property_get_int32(kLinkLayerStatsIntervalProperty,
+                              kDefaultLinkLayerStatsIntervalMs)));
+}
+
+uint64_t sumOverAcs(
+    const std::array<uint64_t, legacy_hal::WIFI_AC_MAX>& values) {
+    return std::accumulate(values.begin(), values.end(), uint64_t(0));
+}
+}  // namespace
+
 WifiStaIface::WifiStaIface(
     const std::string& ifname,
     const std::weak_ptr<legacy_hal::WifiLegacyHal> legacy_hal,
@@ -35,7 +66,13 @@ WifiStaIface::WifiStaIface(
     : ifname_(ifname),
       legacy_hal_(legacy_hal),
       iface_util_(iface_util),
-      is_valid_(true) {
+      is_valid_(true),
+      lock_domain_("sta:" + ifname, hidl_sync_util::LockDomain::Rank::kIface),
+      link_layer_stats_sampler_(
+          kLinkLayerStatsHistorySize, getLinkLayerStatsInterval(),
+          [this]() { return legacy_hal_.lock()->getLinkLayerStats(ifname_); }),
+      hidl_link_layer_stats_seq_(0),
+      hidl_link_layer_stats_() {
     // Turn on DFS channel usage for STA iface.
     legacy_hal::wifi_error legacy_status =
         legacy_hal_.lock()->setDfsFlag(ifname_, true);
@@ -46,6 +83,7 @@ WifiStaIface::WifiStaIface(
 }
 
 void WifiStaIface::invalidate() {
+    const auto lock = lock_domain_.acquire();
     legacy_hal_.reset();
     event_cb_handler_.invalidate();
     is_valid_ = false;
@@ -53,8 +91,31 @@ void WifiStaIface::invalidate() {
 
 bool WifiStaIface::isValid() { return is_valid_; }
 
+hidl_sync_util::LockDomain& WifiStaIface::getLockDomain() {
+    return lock_domain_;
+}
+
 std::string WifiStaIface::getName() { return ifname_; }
 
+void WifiStaIface::dumpLinkLayerStats(std::string* out) {
+    const auto lock = lock_domain_.acquire();
+    link_layer_stats_sampler_.dump(out);
+    LinkLayerStatsSampler::Delta delta;
+    if (!link_layer_stats_sampler_.getDelta(kLinkLayerStatsSummaryWindow,
+                                            &delta)) {
+        return;
+    }
+    StringAppendF(out,
+                  "summary: duration_ms=%" PRIu64
+                  " beacon_rx=%.1f/s tx_mpdu=%.1f/s rx_mpdu=%.1f/s"
+                  " lost_mpdu=%.1f/s retries=%.1f/s\n",
+                  delta.duration_ms, delta.perSecond(delta.beacon_rx),
+                  delta.perSecond(sumOverAcs(delta.tx_mpdu)),
+                  delta.perSecond(sumOverAcs(delta.rx_mpdu)),
+                  delta.perSecond(sumOverAcs(delta.lost_mpdu)),
+                  delta.perSecond(sumOverAcs(delta.retries)));
+}
+
 std::set<sp<IWifiStaIfaceEventCallback>> WifiStaIface::getEventCallbacks() {
     return event_cb_handler_.getCallbacks();
 }
@@ -378,6 +439,8 @@ WifiStatus WifiStaIface::startBackgroundScanInternal(
     const auto& on_failure_callback =
         [weak_ptr_this](legacy_hal::wifi_request_id id) {
             const auto shared_ptr_this = weak_ptr_this.promote();
+            const auto lock =
+                hidl_sync_util::acquireObjectLock(shared_ptr_this);
             if (!shared_ptr_this.get() || !shared_ptr_this->isValid()) {
                 LOG(ERROR) << "Callback invoked on an invalid object";
                 return;
@@ -394,11 +457,13 @@ WifiStatus WifiStaIface::startBackgroundScanInternal(
             legacy_hal::wifi_request_id id,
             const std::vector<legacy_hal::wifi_cached_scan_results>& results) {
             const auto shared_ptr_this = weak_ptr_this.promote();
+            const auto lock =
+                hidl_sync_util::acquireObjectLock(shared_ptr_this);
             if (!shared_ptr_this.get() || !shared_ptr_this->isValid()) {
                 LOG(ERROR) << "Callback invoked on an invalid object";
                 return;
             }
-            std::vector<StaScanData> hidl_scan_datas;
+            hidl_vec<StaScanData> hidl_scan_datas;
             if (!hidl_struct_util::
                     convertLegacyVectorOfCachedGscanResultsToHidl(
                         results, &hidl_scan_datas)) {
@@ -419,6 +484,7 @@ WifiStatus WifiStaIface::startBackgroundScanInternal(
                                                   wifi_scan_result* result,
                                               uint32_t buckets_scanned) {
         const auto shared_ptr_this = weak_ptr_this.promote();
+        const auto lock = hidl_sync_util::acquireObjectLock(shared_ptr_this);
         if (!shared_ptr_this.get() || !shared_ptr_this->isValid()) {
             LOG(ERROR) << "Callback invoked on an invalid object";
             return;
@@ -454,12 +520,20 @@ WifiStatus WifiStaIface::stopBackgroundScanInternal(uint32_t cmd_id) {
 WifiStatus WifiStaIface::enableLinkLayerStatsCollectionInternal(bool debug) {
     legacy_hal::wifi_error legacy_status =
         legacy_hal_.lock()->enableLinkLayerStats(ifname_, debug);
+    if (legacy_status == legacy_hal::WIFI_SUCCESS) {
+        // The driver counters start over, deltas against older samples would
+        // be meaningless.
+        link_layer_stats_sampler_.clear();
+    }
     return createWifiStatusFromLegacyError(legacy_status);
 }
 
 WifiStatus WifiStaIface::disableLinkLayerStatsCollectionInternal() {
     legacy_hal::wifi_error legacy_status =
         legacy_hal_.lock()->disableLinkLayerStats(ifname_);
+    if (legacy_status == legacy_hal::WIFI_SUCCESS) {
+        link_layer_stats_sampler_.clear();
+    }
     return createWifiStatusFromLegacyError(legacy_status);
 }
 
@@ -471,18 +545,22 @@ WifiStaIface::getLinkLayerStatsInternal() {
 std::pair<WifiStatus, V1_3::StaLinkLayerStats>
 WifiStaIface::getLinkLayerStatsInternal_1_3() {
     legacy_hal::wifi_error legacy_status;
-    legacy_hal::LinkLayerStats legacy_stats;
-    std::tie(legacy_status, legacy_stats) =
-        legacy_hal_.lock()->getLinkLayerStats(ifname_);
+    const LinkLayerStatsSampler::Sample* sample;
+    std::tie(legacy_status, sample) = link_layer_stats_sampler_.getSample();
     if (legacy_status != legacy_hal::WIFI_SUCCESS) {
         return {createWifiStatusFromLegacyError(legacy_status), {}};
     }
-    V1_3::StaLinkLayerStats hidl_stats;
-    if (!hidl_struct_util::convertLegacyLinkLayerStatsToHidl(legacy_stats,
-                                                             &hidl_stats)) {
-        return {createWifiStatus(WifiStatusCode::ERROR_UNKNOWN), {}};
+    if (sample->seq != hidl_link_layer_stats_seq_) {
+        if (!hidl_struct_util::convertLegacyLinkLayerStatsToHidl(
+                sample->stats, &hidl_link_layer_stats_)) {
+            hidl_link_layer_stats_seq_ = 0;
+            return {createWifiStatus(WifiStatusCode::ERROR_UNKNOWN), {}};
+        }
+        // Report when the sample was taken rather than when it was converted.
+        hidl_link_layer_stats_.timeStampInMs = sample->timestamp_ms;
+        hidl_link_layer_stats_seq_ = sample->seq;
     }
-    return {createWifiStatus(WifiStatusCode::SUCCESS), hidl_stats};
+    return {createWifiStatus(WifiStatusCode::SUCCESS), hidl_link_layer_stats_};
 }
 
 WifiStatus WifiStaIface::startRssiMonitoringInternal(uint32_t cmd_id,
@@ -493,6 +571,8 @@ WifiStatus WifiStaIface::startRssiMonitoringInternal(uint32_t cmd_id,
         [weak_ptr_this](legacy_hal::wifi_request_id id,
                         std::array<uint8_t, 6> bssid, int8_t rssi) {
             const auto shared_ptr_this = weak_ptr_this.promote();
+            const auto lock =
+                hidl_sync_util::acquireObjectLock(shared_ptr_this);
             if (!shared_ptr_this.get() || !shared_ptr_this->isValid()) {
                 LOG(ERROR) << "Callback invoked on an invalid object";
                 return;
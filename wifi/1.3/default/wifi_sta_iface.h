@@ -22,6 +22,8 @@
 #include <android/hardware/wifi/1.3/IWifiStaIface.h>
 
 #include "hidl_callback_util.h"
+#include "hidl_sync_util.h"
+#include "link_layer_stats_sampler.h"
 #include "wifi_iface_util.h"
 #include "wifi_legacy_hal.h"
 
@@ -43,8 +45,12 @@ class WifiStaIface : public V1_3::IWifiStaIface {
     // Refer to |WifiChip::invalidate()|.
     void invalidate();
     bool isValid();
+    hidl_sync_util::LockDomain& getLockDomain();
     std::set<sp<IWifiStaIfaceEventCallback>> getEventCallbacks();
     std::string getName();
+    // Appends the link layer stats history of this iface, and a summary of
+    // its rates over the last minute, to |out|.
+    void dumpLinkLayerStats(std::string* out);
 
     // HIDL methods exposed.
     Return<void> getName(getName_cb hidl_status_cb) override;
@@ -164,8 +170,14 @@ class WifiStaIface : public V1_3::IWifiStaIface {
     std::weak_ptr<legacy_hal::WifiLegacyHal> legacy_hal_;
     std::weak_ptr<iface_util::WifiIfaceUtil> iface_util_;
     bool is_valid_;
+    hidl_sync_util::LockDomain lock_domain_;
     hidl_callback_util::HidlCallbackHandler<IWifiStaIfaceEventCallback>
         event_cb_handler_;
+    LinkLayerStatsSampler link_layer_stats_sampler_;
+    // HIDL conversion of the newest link layer stats sample, reused while
+    // the sampler serves the same sample.
+    uint64_t hidl_link_layer_stats_seq_;
+    V1_3::StaLinkLayerStats hidl_link_layer_stats_;
 
     DISALLOW_COPY_AND_ASSIGN(WifiStaIface);
 };